@@ -25,13 +25,13 @@
 #include "monitor.h"
 #include <stdarg.h>
 
-unsigned X, Y, S, U, PC;
-unsigned A, B, DP;
-unsigned H, N, Z, OV, C;
-unsigned EFI;
+INSTANCE unsigned X, Y, S, U, PC;
+INSTANCE unsigned A, B, DP;
+INSTANCE unsigned H, N, Z, OV, C;
+INSTANCE unsigned EFI;
 
 #ifdef H6309
-unsigned E, F, V, MD;
+INSTANCE unsigned E, F, V, MD;
 
 #define MD_NATIVE 0x1		/* if 1, execute in 6309 mode */
 #define MD_FIRQ_LIKE_IRQ 0x2	/* if 1, FIRQ acts like IRQ */
@@ -39,22 +39,29 @@ unsigned E, F, V, MD;
 #define MD_DBZ 0x80		/* divide by zero */
 #endif /* H6309 */
 
-unsigned iPC;
+INSTANCE unsigned iPC;
 
-unsigned long irq_start_time;
-unsigned ea = 0;
-long cpu_clk = 0;
-long cpu_period = 0;
-int cpu_quit = 1;
-unsigned int irqs_pending = 0;
-unsigned int firqs_pending = 0;
-unsigned int cc_changed = 0;
+INSTANCE unsigned long irq_start_time;
+INSTANCE unsigned ea = 0;
+INSTANCE long cpu_clk = 0;
+INSTANCE long cpu_period = 0;
+INSTANCE int cpu_quit = 1;
+INSTANCE unsigned int irqs_pending = 0;
+INSTANCE unsigned int firqs_pending = 0;
+INSTANCE unsigned int cc_changed = 0;
 
-unsigned *index_regs[4] = { &X, &Y, &U, &S };
+/* Bumped whenever cpu_clk is moved by something other than the
+instruction being executed, so that a cycle count measured across
+the change can be thrown away */
+INSTANCE unsigned int cpu_clk_adjusts = 0;
 
-extern int dump_cycles_on_success;
+/* Nonzero while the CPU is stopped in SYNC or CWAI, waiting for an
+interrupt */
+INSTANCE unsigned int cpu_waiting = 0;
 
-extern int trace_enabled;
+extern INSTANCE int dump_cycles_on_success;
+
+extern INSTANCE int trace_enabled;
 
 extern void irq (void);
 extern void firq (void);
@@ -66,7 +73,11 @@ void request_irq (unsigned int source)
 	 * IRQ immediately.  Else, mark it pending and
 	 * we'll check it later when the flags change.
 	 */
+	if (irqstat_enabled)
+		irqstat_request (IRQSTAT_IRQ, source, irqs_pending);
 	irqs_pending |= (1 << source);
+	if (cpu_waiting == WAIT_SYNC)
+		cpu_waiting = 0;
 	if (!(EFI & I_FLAG))
 		irq ();
 }
@@ -83,7 +94,11 @@ void request_firq (unsigned int source)
 	 * IRQ immediately.  Else, mark it pending and
 	 * we'll check it later when the flags change.
 	 */
+	if (irqstat_enabled)
+		irqstat_request (IRQSTAT_FIRQ, source, firqs_pending);
 	firqs_pending |= (1 << source);
+	if (cpu_waiting == WAIT_SYNC)
+		cpu_waiting = 0;
 	if (!(EFI & F_FLAG))
 		firq ();
 }
@@ -120,9 +135,13 @@ sim_error (const char *format, ...)
 	va_end (ap);
 
 	if (debug_enabled)
+	{
+		/* Enter the monitor right after this instruction */
 		monitor_on = 1;
+		cpu_end_slice ();
+	}
 	else
-		exit (2);
+		sim_stop (2);
 }
 
 
@@ -138,8 +157,12 @@ sim_exit (uint8_t exit_code)
 {
 	char *s;
 
-	/* On a nonzero exit, always print an error message. */
-	if (exit_code != 0)
+	if (state_save_file)
+		state_save (state_save_file);
+
+	/* On a nonzero exit, always print an error message.  A test run
+	by --batch is described in the report instead. */
+	if (exit_code != 0 && !batch_mode)
 	{
 		printf ("m6809-run: program exited with %d\n", exit_code);
 		if (exit_code)
@@ -147,7 +170,7 @@ sim_exit (uint8_t exit_code)
 	}
 
 	/* If a cycle count should be printed, do that last. */
-	if (dump_cycles_on_success)
+	if (dump_cycles_on_success && !batch_mode)
 	{
 		printf ("%s : %ld cycles, %ld ms\n", prog_name, get_cycles (),
 			get_elapsed_realtime ());
@@ -164,7 +187,7 @@ sim_exit (uint8_t exit_code)
 		}
 	}
 
-	exit (exit_code);
+	sim_stop (exit_code);
 }
 
 
@@ -190,10 +213,18 @@ change_pc (unsigned newPC)
 }
 
 
+/* When nonzero, instruction bytes are fetched from the predecode
+cache rather than the bus. */
+INSTANCE const U8 *fetch_ptr;
+
 static inline unsigned
 imm_byte (void)
 {
-  unsigned val = read8 (PC);
+  unsigned val;
+  if (fetch_ptr)
+    val = *fetch_ptr++;
+  else
+    val = fast_fetch8 (PC);
   PC++;
   return val;
 }
@@ -201,7 +232,14 @@ imm_byte (void)
 static inline unsigned
 imm_word (void)
 {
-  unsigned val = read16 (PC);
+  unsigned val;
+  if (fetch_ptr)
+    {
+      val = (fetch_ptr[0] << 8) | fetch_ptr[1];
+      fetch_ptr += 2;
+    }
+  else
+    val = fast_fetch16 (PC);
   PC += 2;
   return val;
 }
@@ -246,8 +284,7 @@ read_stack16 (unsigned addr)
 static void
 direct (void)
 {
-  unsigned val = read8 (PC) | DP;
-  PC++;
+  unsigned val = imm_byte () | DP;
   ea = val;
 }
 
@@ -255,7 +292,23 @@ static void
 indexed (void)			/* note take 1 extra cycle */
 {
   unsigned post = imm_byte ();
-  unsigned *R = index_regs[(post >> 5) & 0x3];
+  unsigned *R;
+
+  if (insnmix_enabled)
+    {
+      insnmix_mode = &insnmix_modes[post & 0x80 ? post & 0x1f : INSNMIX_OFFSET5];
+      insnmix_mode->insns++;
+    }
+
+  /* Not a table of pointers: the registers are thread-local, so
+     their addresses are not constants. */
+  switch ((post >> 5) & 0x3)
+    {
+    case 0: R = &X; break;
+    case 1: R = &Y; break;
+    case 2: R = &U; break;
+    default: R = &S; break;
+    }
 
   if (post & 0x80)
     {
@@ -406,8 +459,7 @@ indexed (void)			/* note take 1 extra cycle */
 static void
 extended (void)
 {
-  unsigned val = read16 (PC);
-  PC += 2;
+  unsigned val = imm_word ();
   ea = val;
 }
 
@@ -621,11 +673,71 @@ set_md (unsigned val)
 
 /* handle condition code register */
 
+/* The arithmetic helpers evaluate C and OV lazily: they record the
+kind of operation, its operands and its unmasked result, and the
+flags are computed from those only when something reads them.
+lazy_flags holds the kind of operation and which of the two flags
+are still pending, so that recording one takes a single store for
+both.  N and Z just hold the result, and H only needs bit 4 of
+arg ^ val ^ res, so those are always kept up to date. */
+INSTANCE unsigned lazy_flags = 0;
+static INSTANCE unsigned lazy_arg, lazy_val, lazy_res;
+
+void
+flags_sync (void)
+{
+  unsigned c = 0, ov = 0, res = 0;
+
+  switch (lazy_flags & LAZY_OP)
+    {
+    case LAZY_ADD8:
+      res = lazy_res & 0xff;
+      c = (lazy_res >> 1) & 0x80;
+      ov = lazy_arg ^ lazy_val ^ res ^ c;
+      break;
+    case LAZY_SUB8:
+      res = lazy_res & 0xff;
+      c = lazy_res & 0x100;
+      ov = (lazy_arg ^ lazy_val) & (lazy_arg ^ res);
+      break;
+    case LAZY_ADD16:
+      res = lazy_res & 0xffff;
+      c = lazy_res & 0x10000;
+      ov = ((lazy_arg ^ res) & (lazy_val ^ res)) >> 8;
+      break;
+    case LAZY_SUB16:
+      res = lazy_res & 0xffff;
+      c = lazy_res & 0x10000;
+      ov = ((lazy_arg ^ lazy_val) & (lazy_arg ^ res)) >> 8;
+      break;
+    }
+
+  if (lazy_flags & LAZY_C)
+    C = c;
+  if (lazy_flags & LAZY_V)
+    OV = ov;
+  lazy_flags = 0;
+}
+
+/* Record an operation whose C and OV are to be computed later.
+Every such operation sets both, so nothing pending from an earlier
+one needs to be kept. */
+static inline void
+lazy_set (unsigned op, unsigned arg, unsigned val, unsigned res)
+{
+  lazy_arg = arg;
+  lazy_val = val;
+  lazy_res = res;
+  lazy_flags = op | LAZY_C | LAZY_V;
+}
+
 unsigned
 get_cc (void)
 {
   unsigned res = EFI & (E_FLAG | F_FLAG | I_FLAG);
 
+  flags_valid ();
+
   if (H & 0x10)
     res |= H_FLAG;
   if (N & 0x80)
@@ -649,6 +761,7 @@ set_cc (unsigned arg)
   Z = (~arg) & Z_FLAG;
   OV = (arg & V_FLAG ? 0x80 : 0);
   C = arg & C_FLAG;
+  lazy_flags = 0;
   cc_changed = 1;
 }
 
@@ -784,11 +897,13 @@ set_reg (unsigned nro, unsigned val)
 static unsigned
 adc (unsigned arg, unsigned val)
 {
-  unsigned res = arg + val + (C != 0);
+  unsigned res;
 
-  C = (res >> 1) & 0x80;
+  flags_valid ();
+  res = arg + val + (C != 0);
+  lazy_set (LAZY_ADD8, arg, val, res);
   N = Z = res &= 0xff;
-  OV = H = arg ^ val ^ res ^ C;
+  H = arg ^ val ^ res;
 
   return res;
 }
@@ -798,9 +913,9 @@ add (unsigned arg, unsigned val)
 {
   unsigned res = arg + val;
 
-  C = (res >> 1) & 0x80;
+  lazy_set (LAZY_ADD8, arg, val, res);
   N = Z = res &= 0xff;
-  OV = H = arg ^ val ^ res ^ C;
+  H = arg ^ val ^ res;
 
   return res;
 }
@@ -812,6 +927,7 @@ and (unsigned arg, unsigned val)
 
   N = Z = res;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
 
   return res;
 }
@@ -824,6 +940,7 @@ asl (unsigned arg)		/* same as lsl */
   C = res & 0x100;
   N = Z = res &= 0xff;
   OV = arg ^ res;
+  lazy_flags &= ~(LAZY_C | LAZY_V);
   cpu_clk -= 2;
 
   return res;
@@ -836,6 +953,7 @@ asr (unsigned arg)
 
   C = res & 1;
   N = Z = res = (res >> 1) & 0xff;
+  lazy_flags &= ~LAZY_C;
   cpu_clk -= 2;
 
   return res;
@@ -848,12 +966,14 @@ bit (unsigned arg, unsigned val)
 
   N = Z = res;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
 }
 
 static unsigned
 clr (unsigned arg)
 {
   C = N = Z = OV = arg = 0;
+  lazy_flags &= ~(LAZY_C | LAZY_V);
   cpu_clk -= 2;
 
   return arg;
@@ -864,9 +984,8 @@ cmp (unsigned arg, unsigned val)
 {
   unsigned res = arg - val;
 
-  C = res & 0x100;
-  N = Z = res &= 0xff;
-  OV = (arg ^ val) & (arg ^ res);
+  lazy_set (LAZY_SUB8, arg, val, res);
+  N = Z = res & 0xff;
 }
 
 static unsigned
@@ -877,6 +996,7 @@ com (unsigned arg)
   N = Z = res;
   OV = 0;
   C = 1;
+  lazy_flags &= ~(LAZY_C | LAZY_V);
   cpu_clk -= 2;
 
   return res;
@@ -889,6 +1009,8 @@ daa (void)
   unsigned msn = res & 0xf0;
   unsigned lsn = res & 0x0f;
 
+  flags_valid ();
+
   if (lsn > 0x09 || (H & 0x10))
     res += 0x06;
   if (msn > 0x80 && lsn > 0x09)
@@ -910,6 +1032,7 @@ dec (unsigned arg)
 
   N = Z = res;
   OV = arg & ~res;
+  lazy_flags &= ~LAZY_V;
   cpu_clk -= 2;
 
   return res;
@@ -922,6 +1045,7 @@ eor (unsigned arg, unsigned val)
 
   N = Z = res;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
 
   return res;
 }
@@ -952,6 +1076,7 @@ inc (unsigned arg)
 
   N = Z = res;
   OV = ~arg & res;
+  lazy_flags &= ~LAZY_V;
   cpu_clk -= 2;
 
   return res;
@@ -964,6 +1089,7 @@ ld (unsigned arg)
 
   N = Z = res;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
 
   return res;
 }
@@ -976,6 +1102,7 @@ lsr (unsigned arg)
   N = 0;
   Z = res;
   C = arg & 1;
+  lazy_flags &= ~LAZY_C;
   cpu_clk -= 2;
 
   return res;
@@ -988,6 +1115,7 @@ mul (void)
 
   Z = res;
   C = res & 0x80;
+  lazy_flags &= ~LAZY_C;
   A = res >> 8;
   B = res & 0xff;
   cpu_clk -= 11;
@@ -1000,6 +1128,7 @@ neg (int arg)
 
   C = N = Z = res;
   OV = res & arg;
+  lazy_flags &= ~(LAZY_C | LAZY_V);
   cpu_clk -= 2;
 
   return res;
@@ -1012,6 +1141,7 @@ or (unsigned arg, unsigned val)
 
   N = Z = res;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
 
   return res;
 }
@@ -1019,7 +1149,10 @@ or (unsigned arg, unsigned val)
 static unsigned
 rol (unsigned arg)
 {
-  unsigned res = (arg << 1) + (C != 0);
+  unsigned res;
+
+  flags_valid ();
+  res = (arg << 1) + (C != 0);
 
   C = res & 0x100;
   N = Z = res &= 0xff;
@@ -1034,6 +1167,7 @@ ror (unsigned arg)
 {
   unsigned res = arg;
 
+  flags_valid ();
   if (C != 0)
     res |= 0x100;
   C = res & 1;
@@ -1046,11 +1180,12 @@ ror (unsigned arg)
 static unsigned
 sbc (unsigned arg, unsigned val)
 {
-  unsigned res = arg - val - (C != 0);
+  unsigned res;
 
-  C = res & 0x100;
+  flags_valid ();
+  res = arg - val - (C != 0);
+  lazy_set (LAZY_SUB8, arg, val, res);
   N = Z = res &= 0xff;
-  OV = (arg ^ val) & (arg ^ res);
 
   return res;
 }
@@ -1062,6 +1197,7 @@ st (unsigned arg)
 
   N = Z = res;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
 
   WRMEM (ea, res);
 }
@@ -1071,9 +1207,8 @@ sub (unsigned arg, unsigned val)
 {
   unsigned res = arg - val;
 
-  C = res & 0x100;
+  lazy_set (LAZY_SUB8, arg, val, res);
   N = Z = res &= 0xff;
-  OV = (arg ^ val) & (arg ^ res);
 
   return res;
 }
@@ -1085,6 +1220,7 @@ tst (unsigned arg)
 
   N = Z = res;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
   cpu_clk -= 2;
 }
 
@@ -1118,9 +1254,8 @@ addd (unsigned val)
   unsigned arg = (A << 8) | B;
   unsigned res = arg + val;
 
-  C = res & 0x10000;
+  lazy_set (LAZY_ADD16, arg, val, res);
   Z = res &= 0xffff;
-  OV = ((arg ^ res) & (val ^ res)) >> 8;
   A = N = res >> 8;
   B = res & 0xff;
 }
@@ -1130,10 +1265,9 @@ cmp16 (unsigned arg, unsigned val)
 {
   unsigned res = arg - val;
 
-  C = res & 0x10000;
+  lazy_set (LAZY_SUB16, arg, val, res);
   Z = res &= 0xffff;
   N = res >> 8;
-  OV = ((arg ^ val) & (arg ^ res)) >> 8;
 }
 
 static void
@@ -1145,6 +1279,7 @@ ldd (unsigned arg)
   A = N = res >> 8;
   B = res & 0xff;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
 }
 
 static unsigned
@@ -1155,6 +1290,7 @@ ld16 (unsigned arg)
   Z = res;
   N = res >> 8;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
 
   return res;
 }
@@ -1180,6 +1316,7 @@ std (void)
   Z = res;
   N = A;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
   WRMEM16 (ea, res);
 }
 
@@ -1191,6 +1328,7 @@ st16 (unsigned arg)
   Z = res;
   N = res >> 8;
   OV = 0;
+  lazy_flags &= ~LAZY_V;
   WRMEM16 (ea, res);
 }
 
@@ -1200,9 +1338,8 @@ subd (unsigned val)
   unsigned arg = (A << 8) | B;
   unsigned res = arg - val;
 
-  C = res & 0x10000;
+  lazy_set (LAZY_SUB16, arg, val, res);
   Z = res &= 0xffff;
-  OV = ((arg ^ val) & (arg ^ res)) >> 8;
   A = N = res >> 8;
   B = res & 0xff;
 }
@@ -1374,8 +1511,8 @@ puls (void)
     }
   if (post & 0x80)
     {
-      monitor_return ();
       cpu_clk -= 2;
+      monitor_return ();
       PC = read_stack16 (S);
 		check_pc ();
       S = (S + 2) & 0xffff;
@@ -1433,8 +1570,8 @@ pulu (void)
     }
   if (post & 0x80)
     {
-      monitor_return ();
       cpu_clk -= 2;
+      monitor_return ();
       PC = read_stack16 (U);
 		check_pc ();
       U = (U + 2) & 0xffff;
@@ -1461,9 +1598,10 @@ jsr (void)
 static void
 rti (void)
 {
-  monitor_return ();
   cpu_clk -= 6;
   command_exit_irq_hook (get_cycles () - irq_start_time);
+  if (irqstat_enabled)
+    irqstat_return ();
   set_cc (read_stack (S));
   S = (S + 1) & 0xffff;
 
@@ -1483,6 +1621,7 @@ rti (void)
       U = read_stack16 (S);
       S = (S + 2) & 0xffff;
     }
+  monitor_return ();
   PC = read_stack16 (S);
   check_pc ();
   S = (S + 2) & 0xffff;
@@ -1491,8 +1630,8 @@ rti (void)
 static void
 rts (void)
 {
-  monitor_return ();
   cpu_clk -= 5;
+  monitor_return ();
   PC = read_stack16 (S);
   check_pc ();
   S = (S + 2) & 0xffff;
@@ -1501,27 +1640,36 @@ rts (void)
 void
 irq (void)
 {
-  EFI |= E_FLAG;
-  S = (S - 2) & 0xffff;
-  write_stack16 (S, PC & 0xffff);
-  S = (S - 2) & 0xffff;
-  write_stack16 (S, U);
-  S = (S - 2) & 0xffff;
-  write_stack16 (S, Y);
-  S = (S - 2) & 0xffff;
-  write_stack16 (S, X);
-  S = (S - 1) & 0xffff;
-  write_stack (S, DP >> 8);
-  S = (S - 1) & 0xffff;
-  write_stack (S, B);
-  S = (S - 1) & 0xffff;
-  write_stack (S, A);
-  S = (S - 1) & 0xffff;
-  write_stack (S, get_cc ());
+  /* After CWAI, the entire state has already been stacked */
+  if (cpu_waiting != WAIT_CWAI)
+    {
+      EFI |= E_FLAG;
+      S = (S - 2) & 0xffff;
+      write_stack16 (S, PC & 0xffff);
+      S = (S - 2) & 0xffff;
+      write_stack16 (S, U);
+      S = (S - 2) & 0xffff;
+      write_stack16 (S, Y);
+      S = (S - 2) & 0xffff;
+      write_stack16 (S, X);
+      S = (S - 1) & 0xffff;
+      write_stack (S, DP >> 8);
+      S = (S - 1) & 0xffff;
+      write_stack (S, B);
+      S = (S - 1) & 0xffff;
+      write_stack (S, A);
+      S = (S - 1) & 0xffff;
+      write_stack (S, get_cc ());
+    }
+  cpu_waiting = 0;
+  cpu_clk_adjusts++;
   EFI |= I_FLAG;
 
   irq_start_time = get_cycles ();
   change_pc (read16 (0xfff8));
+  monitor_call (FC_INTERRUPT);
+  if (irqstat_enabled)
+    irqstat_enter (IRQSTAT_IRQ, irqs_pending);
 #if 1
   irqs_pending = 0;
 #endif
@@ -1531,14 +1679,22 @@ irq (void)
 void
 firq (void)
 {
-  EFI &= ~E_FLAG;
-  S = (S - 2) & 0xffff;
-  write_stack16 (S, PC & 0xffff);
-  S = (S - 1) & 0xffff;
-  write_stack (S, get_cc ());
+  if (cpu_waiting != WAIT_CWAI)
+    {
+      EFI &= ~E_FLAG;
+      S = (S - 2) & 0xffff;
+      write_stack16 (S, PC & 0xffff);
+      S = (S - 1) & 0xffff;
+      write_stack (S, get_cc ());
+    }
+  cpu_waiting = 0;
+  cpu_clk_adjusts++;
   EFI |= (I_FLAG | F_FLAG);
 
   change_pc (read16 (0xfff6));
+  monitor_call (FC_INTERRUPT);
+  if (irqstat_enabled)
+    irqstat_enter (IRQSTAT_FIRQ, firqs_pending);
 #if 1
   firqs_pending = 0;
 #endif
@@ -1569,6 +1725,9 @@ swi (void)
   EFI |= (I_FLAG | F_FLAG);
 
   change_pc (read16 (0xfffa));
+  monitor_call (FC_SWI);
+  if (irqstat_enabled)
+    irqstat_enter (IRQSTAT_SWI, 0);
 }
 
 void
@@ -1594,6 +1753,9 @@ swi2 (void)
   write_stack (S, get_cc ());
 
   change_pc (read16 (0xfff4));
+  monitor_call (FC_SWI);
+  if (irqstat_enabled)
+    irqstat_enter (IRQSTAT_SWI, 0);
 }
 
 void
@@ -1619,6 +1781,9 @@ swi3 (void)
   write_stack (S, get_cc ());
 
   change_pc (read16 (0xfff2));
+  monitor_call (FC_SWI);
+  if (irqstat_enabled)
+    irqstat_enter (IRQSTAT_SWI, 0);
 }
 
 #ifdef H6309
@@ -1645,20 +1810,51 @@ trap (void)
   write_stack (S, get_cc ());
 
   change_pc (read16 (0xfff0));
+  monitor_call (FC_SWI);
+  if (irqstat_enabled)
+    irqstat_enter (IRQSTAT_SWI, 0);
 }
 #endif
 
 void
 cwai (void)
 {
-  sim_error ("CWAI - not supported yet!");
+  unsigned tmp = imm_byte ();
+
+  cpu_clk -= 20;
+  set_cc (get_cc () & tmp);
+  EFI |= E_FLAG;
+  S = (S - 2) & 0xffff;
+  write_stack16 (S, PC & 0xffff);
+  S = (S - 2) & 0xffff;
+  write_stack16 (S, U);
+  S = (S - 2) & 0xffff;
+  write_stack16 (S, Y);
+  S = (S - 2) & 0xffff;
+  write_stack16 (S, X);
+  S = (S - 1) & 0xffff;
+  write_stack (S, DP >> 8);
+  S = (S - 1) & 0xffff;
+  write_stack (S, B);
+  S = (S - 1) & 0xffff;
+  write_stack (S, A);
+  S = (S - 1) & 0xffff;
+  write_stack (S, get_cc ());
+
+  /* Wait for an unmasked interrupt.  One that is already pending is
+  taken when the CC change is noticed at the end of this instruction. */
+  cpu_waiting = WAIT_CWAI;
 }
 
 void
 sync (void)
 {
   cpu_clk -= 4;
-  sim_error ("SYNC - not supported yet!");
+
+  /* Wait for any interrupt, masked or not.  If one is already being
+  requested, execution just continues. */
+  if (!irqs_pending && !firqs_pending)
+    cpu_waiting = WAIT_SYNC;
 }
 
 static void
@@ -1681,20 +1877,21 @@ andcc (void)
 
 /* Branch Instructions */
 
-#define cond_HI() ((Z != 0) && (C == 0))
-#define cond_LS() ((Z == 0) || (C != 0))
-#define cond_HS() (C == 0)
-#define cond_LO() (C != 0)
+/* Only the conditions that test C or OV need the lazy flags */
+#define cond_HI() (flags_valid (), (Z != 0) && (C == 0))
+#define cond_LS() (flags_valid (), (Z == 0) || (C != 0))
+#define cond_HS() (flags_valid (), C == 0)
+#define cond_LO() (flags_valid (), C != 0)
 #define cond_NE() (Z != 0)
 #define cond_EQ() (Z == 0)
-#define cond_VC() ((OV & 0x80) == 0)
-#define cond_VS() ((OV & 0x80) != 0)
+#define cond_VC() (flags_valid (), (OV & 0x80) == 0)
+#define cond_VS() (flags_valid (), (OV & 0x80) != 0)
 #define cond_PL() ((N & 0x80) == 0)
 #define cond_MI() ((N & 0x80) != 0)
-#define cond_GE() (((N^OV) & 0x80) == 0)
-#define cond_LT() (((N^OV) & 0x80) != 0)
-#define cond_GT() ((((N^OV) & 0x80) == 0) && (Z != 0))
-#define cond_LE() ((((N^OV) & 0x80) != 0) || (Z == 0))
+#define cond_GE() (flags_valid (), ((N^OV) & 0x80) == 0)
+#define cond_LT() (flags_valid (), ((N^OV) & 0x80) != 0)
+#define cond_GT() (flags_valid (), (((N^OV) & 0x80) == 0) && (Z != 0))
+#define cond_LE() (flags_valid (), (((N^OV) & 0x80) != 0) || (Z == 0))
 
 static void
 bra (void)
@@ -1706,6 +1903,8 @@ bra (void)
 static void
 branch (unsigned cond)
 {
+  if (coverage_enabled)
+    *coverage_last |= cond ? COV_TAKEN : COV_NOT_TAKEN;
   if (cond)
     bra ();
   else
@@ -1724,6 +1923,8 @@ long_bra (void)
 static void
 long_branch (unsigned cond)
 {
+  if (coverage_enabled)
+    *coverage_last |= cond ? COV_TAKEN : COV_NOT_TAKEN;
   if (cond)
     {
       long_bra ();
@@ -1761,1385 +1962,206 @@ bsr (void)
 }
 
 
-/* Execute 6809 code for a certain number of cycles. */
-int
-cpu_execute (int cycles)
-{
-  unsigned opcode;
+/* Nonzero if instructions should be decoded with the portable switch
+statement instead of threaded code. */
+INSTANCE int switch_dispatch = 0;
 
-  cpu_period = cpu_clk = cycles;
+/* Computed goto relies on the GCC labels-as-values extension.  Define
+NO_THREADED_DISPATCH to build only the switch engine. */
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define HAVE_THREADED_DISPATCH
+#endif
 
-  do
-    {
-	 	command_insn_hook ();
-		if (check_break () != 0)
-			monitor_on = 1;
+#define CPU_EXECUTE cpu_execute_switch
+#define THREADED_DISPATCH 0
+#define DEBUG_HOOKS 1
+#define PROFILE_HOOKS 0
+#include "6809exec.h"
+#undef CPU_EXECUTE
+#undef DEBUG_HOOKS
+
+#define CPU_EXECUTE cpu_execute_switch_nohooks
+#define DEBUG_HOOKS 0
+#include "6809exec.h"
+#undef CPU_EXECUTE
+#undef PROFILE_HOOKS
+
+#define CPU_EXECUTE cpu_execute_switch_profile
+#define PROFILE_HOOKS 1
+#include "6809exec.h"
+#undef CPU_EXECUTE
+#undef DEBUG_HOOKS
+#undef PROFILE_HOOKS
+#undef THREADED_DISPATCH
+
+#ifdef HAVE_THREADED_DISPATCH
+#define CPU_EXECUTE cpu_execute_threaded
+#define THREADED_DISPATCH 1
+#define DEBUG_HOOKS 1
+#define PROFILE_HOOKS 0
+#include "6809exec.h"
+#undef CPU_EXECUTE
+#undef DEBUG_HOOKS
+
+#define CPU_EXECUTE cpu_execute_threaded_nohooks
+#define DEBUG_HOOKS 0
+#include "6809exec.h"
+#undef CPU_EXECUTE
+#undef PROFILE_HOOKS
+
+#define CPU_EXECUTE cpu_execute_threaded_profile
+#define PROFILE_HOOKS 1
+#include "6809exec.h"
+#undef CPU_EXECUTE
+#undef DEBUG_HOOKS
+#undef PROFILE_HOOKS
+#undef THREADED_DISPATCH
+#endif
 
-		if (monitor_on != 0)
-			if (monitor6809 () != 0)
-				goto cpu_exit;
 
-      iPC = PC;
-      opcode = imm_byte ();
+/* Nonzero if anything needs the debugger to look at every
+instruction: the monitor is active, breakpoints are set, dumpi or
+single-stepping is in effect, or the trace buffer is being kept (-T).
+Watchpoints are checked by the bus instead (see command_read_hook).
+A -d session runs without the hooks once it is continued; faults and
+Ctrl-C turn the monitor on, and the next slice has them again. */
+static inline int
+cpu_hooks_needed (void)
+{
+  extern INSTANCE int dump_every_insn;
+  extern INSTANCE int auto_break_insn_count;
 
-      switch (opcode)
-	{
-	case 0x00:
-	  direct ();
-	  cpu_clk -= 4;
-	  WRMEM (ea, neg (RDMEM (ea)));
-	  break;		/* NEG direct */
-#ifdef H6309
-	case 0x01:		/* OIM */
-	  break;
-	case 0x02:		/* AIM */
-	  break;
-#endif
-	case 0x03:
-	  direct ();
-	  cpu_clk -= 4;
-	  WRMEM (ea, com (RDMEM (ea)));
-	  break;		/* COM direct */
-	case 0x04:
-	  direct ();
-	  cpu_clk -= 4;
-	  WRMEM (ea, lsr (RDMEM (ea)));
-	  break;		/* LSR direct */
-#ifdef H6309
-	case 0x05:		/* EIM */
-	  break;
-#endif
-	case 0x06:
-	  direct ();
-	  cpu_clk -= 4;
-	  WRMEM (ea, ror (RDMEM (ea)));
-	  break;		/* ROR direct */
-	case 0x07:
-	  direct ();
-	  cpu_clk -= 4;
-	  WRMEM (ea, asr (RDMEM (ea)));
-	  break;		/* ASR direct */
-	case 0x08:
-	  direct ();
-	  cpu_clk -= 4;
-	  WRMEM (ea, asl (RDMEM (ea)));
-	  break;		/* ASL direct */
-	case 0x09:
-	  direct ();
-	  cpu_clk -= 4;
-	  WRMEM (ea, rol (RDMEM (ea)));
-	  break;		/* ROL direct */
-	case 0x0a:
-	  direct ();
-	  cpu_clk -= 4;
-	  WRMEM (ea, dec (RDMEM (ea)));
-	  break;		/* DEC direct */
-#ifdef H6309
-	case 0x0B:		/* TIM */
-	  break;
-#endif
-	case 0x0c:
-	  direct ();
-	  cpu_clk -= 4;
-	  WRMEM (ea, inc (RDMEM (ea)));
-	  break;		/* INC direct */
-	case 0x0d:
-	  direct ();
-	  cpu_clk -= 4;
-	  tst (RDMEM (ea));
-	  break;		/* TST direct */
-	case 0x0e:
-	  direct ();
-	  cpu_clk -= 3;
-	  PC = ea;
-     check_pc ();
-	  monitor_call (FC_TAIL_CALL);
-	  break;		/* JMP direct */
-	case 0x0f:
-	  direct ();
-	  cpu_clk -= 4;
-	  WRMEM (ea, clr (RDMEM (ea)));
-	  break;		/* CLR direct */
-	case 0x10:
-	  {
-	    opcode = imm_byte ();
-
-	    switch (opcode)
-	      {
-	      case 0x21:
-		cpu_clk -= 5;
-		PC += 2;
-		break;
-	      case 0x22:
-		long_branch (cond_HI ());
-		break;
-	      case 0x23:
-		long_branch (cond_LS ());
-		break;
-	      case 0x24:
-		long_branch (cond_HS ());
-		break;
-	      case 0x25:
-		long_branch (cond_LO ());
-		break;
-	      case 0x26:
-		long_branch (cond_NE ());
-		break;
-	      case 0x27:
-		long_branch (cond_EQ ());
-		break;
-	      case 0x28:
-		long_branch (cond_VC ());
-		break;
-	      case 0x29:
-		long_branch (cond_VS ());
-		break;
-	      case 0x2a:
-		long_branch (cond_PL ());
-		break;
-	      case 0x2b:
-		long_branch (cond_MI ());
-		break;
-	      case 0x2c:
-		long_branch (cond_GE ());
-		break;
-	      case 0x2d:
-		long_branch (cond_LT ());
-		break;
-	      case 0x2e:
-		long_branch (cond_GT ());
-		break;
-	      case 0x2f:
-		long_branch (cond_LE ());
-		break;
-#ifdef H6309
-	      case 0x30:	/* ADDR */
-		break;
-	      case 0x31:	/* ADCR */
-		break;
-	      case 0x32:	/* SUBR */
-		break;
-	      case 0x33:	/* SBCR */
-		break;
-	      case 0x34:	/* ANDR */
-		break;
-	      case 0x35:	/* ORR */
-		break;
-	      case 0x36:	/* EORR */
-		break;
-	      case 0x37:	/* CMPR */
-		break;
-	      case 0x38:	/* PSHSW */
-		break;
-	      case 0x39:	/* PULSW */
-		break;
-	      case 0x3a:	/* PSHUW */
-		break;
-	      case 0x3b:	/* PULUW */
-		break;
-#endif
-	      case 0x3f:
-		swi2 ();
-		break;
-#ifdef H6309
-	      case 0x40:	/* NEGD */
-		break;
-	      case 0x43:	/* COMD */
-		break;
-	      case 0x44:	/* LSRD */
-		break;
-	      case 0x46:	/* RORD */
-		break;
-	      case 0x47:	/* ASRD */
-		break;
-	      case 0x48:	/* ASLD/LSLD */
-		break;
-	      case 0x49:	/* ROLD */
-		break;
-	      case 0x4a:	/* DECD */
-		break;
-	      case 0x4c:	/* INCD */
-		break;
-	      case 0x4d:	/* TSTD */
-		break;
-	      case 0x4f:	/* CLRD */
-		break;
-	      case 0x53:	/* COMW */
-		break;
-	      case 0x54:	/* LSRW */
-		break;
-	      case 0x56:	/* ??RORW */
-		break;
-	      case 0x59:	/* ROLW */
-		break;
-	      case 0x5a:	/* DECW */
-		break;
-	      case 0x5c:	/* INCW */
-		break;
-	      case 0x5d:	/* TSTW */
-		break;
-	      case 0x5f:	/* CLRW */
-		break;
-	      case 0x80:	/* SUBW */
-		break;
-	      case 0x81:	/* CMPW */
-		break;
-	      case 0x82:	/* SBCD */
-		break;
-#endif
-	      case 0x83:
-		cpu_clk -= 5;
-		cmp16 (get_d (), imm_word ());
-		break;
-#ifdef H6309
-	      case 0x84:	/* ANDD */
-		break;
-	      case 0x85:	/* BITD */
-		break;
-	      case 0x86:	/* LDW */
-		break;
-	      case 0x88:	/* EORD */
-		break;
-	      case 0x89:	/* ADCD */
-		break;
-	      case 0x8a:	/* ORD */
-		break;
-	      case 0x8b:	/* ADDW */
-		break;
-#endif
-	      case 0x8c:
-		cpu_clk -= 5;
-		cmp16 (Y, imm_word ());
-		break;
-	      case 0x8e:
-		cpu_clk -= 4;
-		Y = ld16 (imm_word ());
-		break;
-#ifdef H6309
-	      case 0x90:	/* SUBW */
-		break;
-	      case 0x91:	/* CMPW */
-		break;
-	      case 0x92:	/* SBCD */
-		break;
-#endif
-	      case 0x93:
-		direct ();
-		cpu_clk -= 5;
-		cmp16 (get_d (), RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0x9c:
-		direct ();
-		cpu_clk -= 5;
-		cmp16 (Y, RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0x9e:
-		direct ();
-		cpu_clk -= 5;
-		Y = ld16 (RDMEM16 (ea));
-		break;
-	      case 0x9f:
-		direct ();
-		cpu_clk -= 5;
-		st16 (Y);
-		break;
-	      case 0xa3:
-		cpu_clk--;
-		indexed ();
-		cmp16 (get_d (), RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0xac:
-		cpu_clk--;
-		indexed ();
-		cmp16 (Y, RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0xae:
-		cpu_clk--;
-		indexed ();
-		Y = ld16 (RDMEM16 (ea));
-		break;
-	      case 0xaf:
-		cpu_clk--;
-		indexed ();
-		st16 (Y);
-		break;
-	      case 0xb3:
-		extended ();
-		cpu_clk -= 6;
-		cmp16 (get_d (), RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0xbc:
-		extended ();
-		cpu_clk -= 6;
-		cmp16 (Y, RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0xbe:
-		extended ();
-		cpu_clk -= 6;
-		Y = ld16 (RDMEM16 (ea));
-		break;
-	      case 0xbf:
-		extended ();
-		cpu_clk -= 6;
-		st16 (Y);
-		break;
-	      case 0xce:
-		cpu_clk -= 4;
-		S = ld16 (imm_word ());
-		break;
-	      case 0xde:
-		direct ();
-		cpu_clk -= 5;
-		S = ld16 (RDMEM16 (ea));
-		break;
-	      case 0xdf:
-		direct ();
-		cpu_clk -= 5;
-		st16 (S);
-		break;
-	      case 0xee:
-		cpu_clk--;
-		indexed ();
-		S = ld16 (RDMEM16 (ea));
-		break;
-	      case 0xef:
-		cpu_clk--;
-		indexed ();
-		st16 (S);
-		break;
-	      case 0xfe:
-		extended ();
-		cpu_clk -= 6;
-		S = ld16 (RDMEM16 (ea));
-		break;
-	      case 0xff:
-		extended ();
-		cpu_clk -= 6;
-		st16 (S);
-		break;
-	      default:
-	        sim_error ("invalid opcode (1) at %s\n", monitor_addr_name (iPC));
-		break;
-	      }
-	  }
-	  break;
+  return monitor_on || trace_enabled
+    || active_break_count || dump_every_insn || auto_break_insn_count;
+}
 
-	case 0x11:
-	  {
-	    opcode = imm_byte ();
-
-	    switch (opcode)
-	      {
-	      case 0x3f:
-		swi3 ();
-		break;
-#ifdef H6309
-			case 0x80: /* SUBE */
-			case 0x81: /* CMPE */
-#endif
-	      case 0x83:
-		cpu_clk -= 5;
-		cmp16 (U, imm_word ());
-		break;
-#ifdef H6309
-			case 0x86: /* LDE */
-			case 0x8B: /* ADDE */
-#endif
-	      case 0x8c:
-		cpu_clk -= 5;
-		cmp16 (S, imm_word ());
-		break;
-#ifdef H6309
-			case 0x8D: /* DIVD */
-			case 0x8E: /* DIVQ */
-			case 0x8F: /* MULD */
-			case 0x90: /* SUBE */
-			case 0x91: /* CMPE */
-#endif
-	      case 0x93:
-		direct ();
-		cpu_clk -= 5;
-		cmp16 (U, RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0x9c:
-		direct ();
-		cpu_clk -= 5;
-		cmp16 (S, RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0xa3:
-		cpu_clk--;
-		indexed ();
-		cmp16 (U, RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0xac:
-		cpu_clk--;
-		indexed ();
-		cmp16 (S, RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0xb3:
-		extended ();
-		cpu_clk -= 6;
-		cmp16 (U, RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      case 0xbc:
-		extended ();
-		cpu_clk -= 6;
-		cmp16 (S, RDMEM16 (ea));
-		cpu_clk--;
-		break;
-	      default:
-	        sim_error ("invalid opcode (2) at %s\n", monitor_addr_name (iPC));
-		break;
-	      }
-	  }
-	  break;
 
-	case 0x12:
-	  nop ();
-	  break;
-	case 0x13:
-	  sync ();
-	  break;
-#ifdef H6309
-	case 0x14:		/* SEXW */
-	  break;
+/**
+ * End the time slice after the instruction being run, so that a
+ * watchpoint hit in a copy of the engine without the debugger hooks
+ * stops the CPU as soon as it would with them.  The cycle count is
+ * unchanged.
+ */
+void
+cpu_end_slice (void)
+{
+  if (profile_hooks_needed ())
+    profile_clk -= cpu_clk;
+  cpu_period -= cpu_clk;
+  cpu_clk = 0;
+  cpu_clk_adjusts++;
+}
+
+
+/* Execute 6809 code for a certain number of cycles, using whichever
+dispatch engine was selected.  When no debugger features are in use,
+a copy of the engine without the debugger hooks is run instead, or
+the one that profiles, if that is enabled.  The choice is made again
+on every call, so turning a feature on takes effect within one time
+slice. */
+#ifdef HAVE_THREADED_DISPATCH
+/* The copy of the threaded engine that filled in the handlers of the
+predecoded instructions */
+static INSTANCE int (*threaded_engine) (int);
+
+/* Run ENGINE, a copy of the threaded engine, first clearing the
+handlers left by any other copy: they are addresses of its labels,
+and jumping to them from here would run its code on our frame. */
+static int
+cpu_execute_threaded_copy (int (*engine) (int), int cycles)
+{
+  if (engine != threaded_engine)
+    {
+      predecode_clear_handlers ();
+      threaded_engine = engine;
+    }
+  return engine (cycles);
+}
 #endif
-	case 0x16:
-	  long_bra ();
-	  cpu_clk -= 5;
-	  break;
-	case 0x17:
-	  long_bsr ();
-	  break;
-	case 0x19:
-	  daa ();
-	  break;
-	case 0x1a:
-	  orcc ();
-	  break;
-	case 0x1c:
-	  andcc ();
-	  break;
-	case 0x1d:
-	  sex ();
-	  break;
-	case 0x1e:
-	  exg ();
-	  break;
-	case 0x1f:
-	  tfr ();
-	  break;
 
-	case 0x20:
-	  bra ();
-	  cpu_clk -= 3;
-	  break;
-	case 0x21:
-	  PC++;
-	  cpu_clk -= 3;
-	  break;
-	case 0x22:
-	  branch (cond_HI ());
-	  break;
-	case 0x23:
-	  branch (cond_LS ());
-	  break;
-	case 0x24:
-	  branch (cond_HS ());
-	  break;
-	case 0x25:
-	  branch (cond_LO ());
-	  break;
-	case 0x26:
-	  branch (cond_NE ());
-	  break;
-	case 0x27:
-	  branch (cond_EQ ());
-	  break;
-	case 0x28:
-	  branch (cond_VC ());
-	  break;
-	case 0x29:
-	  branch (cond_VS ());
-	  break;
-	case 0x2a:
-	  branch (cond_PL ());
-	  break;
-	case 0x2b:
-	  branch (cond_MI ());
-	  break;
-	case 0x2c:
-	  branch (cond_GE ());
-	  break;
-	case 0x2d:
-	  branch (cond_LT ());
-	  break;
-	case 0x2e:
-	  branch (cond_GT ());
-	  break;
-	case 0x2f:
-	  branch (cond_LE ());
-	  break;
 
-	case 0x30:
-	  indexed ();
-	  Z = X = ea;
-	  break;		/* LEAX indexed */
-	case 0x31:
-	  indexed ();
-	  Z = Y = ea;
-	  break;		/* LEAY indexed */
-	case 0x32:
-	  indexed ();
-	  S = ea;
-	  break;		/* LEAS indexed */
-	case 0x33:
-	  indexed ();
-	  U = ea;
-	  break;		/* LEAU indexed */
-	case 0x34:
-	  pshs ();
-	  break;		/* PSHS implied */
-	case 0x35:
-	  puls ();
-	  break;		/* PULS implied */
-	case 0x36:
-	  pshu ();
-	  break;		/* PSHU implied */
-	case 0x37:
-	  pulu ();
-	  break;		/* PULU implied */
-	case 0x39:
-	  rts ();
-	  break;		/* RTS implied  */
-	case 0x3a:
-	  abx ();
-	  break;		/* ABX implied  */
-	case 0x3b:
-	  rti ();
-	  break;		/* RTI implied  */
-	case 0x3c:
-	  cwai ();
-	  break;		/* CWAI implied */
-	case 0x3d:
-	  mul ();
-	  break;		/* MUL implied  */
-	case 0x3f:
-	  swi ();
-	  break;		/* SWI implied  */
-
-	case 0x40:
-	  A = neg (A);
-	  break;		/* NEGA implied */
-	case 0x43:
-	  A = com (A);
-	  break;		/* COMA implied */
-	case 0x44:
-	  A = lsr (A);
-	  break;		/* LSRA implied */
-	case 0x46:
-	  A = ror (A);
-	  break;		/* RORA implied */
-	case 0x47:
-	  A = asr (A);
-	  break;		/* ASRA implied */
-	case 0x48:
-	  A = asl (A);
-	  break;		/* ASLA implied */
-	case 0x49:
-	  A = rol (A);
-	  break;		/* ROLA implied */
-	case 0x4a:
-	  A = dec (A);
-	  break;		/* DECA implied */
-	case 0x4c:
-	  A = inc (A);
-	  break;		/* INCA implied */
-	case 0x4d:
-	  tst (A);
-	  break;		/* TSTA implied */
-	case 0x4f:
-	  A = clr (A);
-	  break;		/* CLRA implied */
-
-	case 0x50:
-	  B = neg (B);
-	  break;		/* NEGB implied */
-	case 0x53:
-	  B = com (B);
-	  break;		/* COMB implied */
-	case 0x54:
-	  B = lsr (B);
-	  break;		/* LSRB implied */
-	case 0x56:
-	  B = ror (B);
-	  break;		/* RORB implied */
-	case 0x57:
-	  B = asr (B);
-	  break;		/* ASRB implied */
-	case 0x58:
-	  B = asl (B);
-	  break;		/* ASLB implied */
-	case 0x59:
-	  B = rol (B);
-	  break;		/* ROLB implied */
-	case 0x5a:
-	  B = dec (B);
-	  break;		/* DECB implied */
-	case 0x5c:
-	  B = inc (B);
-	  break;		/* INCB implied */
-	case 0x5d:
-	  tst (B);
-	  break;		/* TSTB implied */
-	case 0x5f:
-	  B = clr (B);
-	  break;		/* CLRB implied */
-	case 0x60:
-	  indexed ();
-	  WRMEM (ea, neg (RDMEM (ea)));
-	  break;		/* NEG indexed */
-#ifdef H6309
-	case 0x61:		/* OIM indexed */
-	  break;
-	case 0x62:		/* AIM indexed */
-	  break;
-#endif
-	case 0x63:
-	  indexed ();
-	  WRMEM (ea, com (RDMEM (ea)));
-	  break;		/* COM indexed */
-	case 0x64:
-	  indexed ();
-	  WRMEM (ea, lsr (RDMEM (ea)));
-	  break;		/* LSR indexed */
-#ifdef H6309
-	case 0x65:		/* EIM indexed */
-	  break;
-#endif
-	case 0x66:
-	  indexed ();
-	  WRMEM (ea, ror (RDMEM (ea)));
-	  break;		/* ROR indexed */
-	case 0x67:
-	  indexed ();
-	  WRMEM (ea, asr (RDMEM (ea)));
-	  break;		/* ASR indexed */
-	case 0x68:
-	  indexed ();
-	  WRMEM (ea, asl (RDMEM (ea)));
-	  break;		/* ASL indexed */
-	case 0x69:
-	  indexed ();
-	  WRMEM (ea, rol (RDMEM (ea)));
-	  break;		/* ROL indexed */
-	case 0x6a:
-	  indexed ();
-	  WRMEM (ea, dec (RDMEM (ea)));
-	  break;		/* DEC indexed */
-#ifdef H6309
-	case 0x6b:		/* TIM indexed */
-	  break;
-#endif
-	case 0x6c:
-	  indexed ();
-	  WRMEM (ea, inc (RDMEM (ea)));
-	  break;		/* INC indexed */
-	case 0x6d:
-	  indexed ();
-	  tst (RDMEM (ea));
-	  break;		/* TST indexed */
-	case 0x6e:
-	  indexed ();
-	  cpu_clk += 1;
-	  PC = ea;
-     check_pc ();
-	  monitor_call (FC_TAIL_CALL);
-	  break;		/* JMP indexed */
-	case 0x6f:
-	  indexed ();
-	  WRMEM (ea, clr (RDMEM (ea)));
-	  break;		/* CLR indexed */
-	case 0x70:
-	  extended ();
-	  cpu_clk -= 5;
-	  WRMEM (ea, neg (RDMEM (ea)));
-	  break;		/* NEG extended */
-#ifdef H6309
-	case 0x71:		/* OIM extended */
-	  break;
-	case 0x72:		/* AIM extended */
-	  break;
-#endif
-	case 0x73:
-	  extended ();
-	  cpu_clk -= 5;
-	  WRMEM (ea, com (RDMEM (ea)));
-	  break;		/* COM extended */
-	case 0x74:
-	  extended ();
-	  cpu_clk -= 5;
-	  WRMEM (ea, lsr (RDMEM (ea)));
-	  break;		/* LSR extended */
-#ifdef H6309
-	case 0x75:		/* EIM extended */
-	  break;
+int
+cpu_execute (int cycles)
+{
+  if (!cpu_hooks_needed ())
+    {
+      if (profile_hooks_needed ())
+	{
+#ifdef HAVE_THREADED_DISPATCH
+	  if (!switch_dispatch)
+	    return cpu_execute_threaded_copy (cpu_execute_threaded_profile,
+					      cycles);
 #endif
-	case 0x76:
-	  extended ();
-	  cpu_clk -= 5;
-	  WRMEM (ea, ror (RDMEM (ea)));
-	  break;		/* ROR extended */
-	case 0x77:
-	  extended ();
-	  cpu_clk -= 5;
-	  WRMEM (ea, asr (RDMEM (ea)));
-	  break;		/* ASR extended */
-	case 0x78:
-	  extended ();
-	  cpu_clk -= 5;
-	  WRMEM (ea, asl (RDMEM (ea)));
-	  break;		/* ASL extended */
-	case 0x79:
-	  extended ();
-	  cpu_clk -= 5;
-	  WRMEM (ea, rol (RDMEM (ea)));
-	  break;		/* ROL extended */
-	case 0x7a:
-	  extended ();
-	  cpu_clk -= 5;
-	  WRMEM (ea, dec (RDMEM (ea)));
-	  break;		/* DEC extended */
-#ifdef H6309
-	case 0x7b:		/* TIM indexed */
-	  break;
+	  return cpu_execute_switch_profile (cycles);
+	}
+#ifdef HAVE_THREADED_DISPATCH
+      if (!switch_dispatch)
+	return cpu_execute_threaded_copy (cpu_execute_threaded_nohooks,
+					  cycles);
 #endif
-	case 0x7c:
-	  extended ();
-	  cpu_clk -= 5;
-	  WRMEM (ea, inc (RDMEM (ea)));
-	  break;		/* INC extended */
-	case 0x7d:
-	  extended ();
-	  cpu_clk -= 5;
-	  tst (RDMEM (ea));
-	  break;		/* TST extended */
-	case 0x7e:
-	  extended ();
-	  cpu_clk -= 4;
-	  PC = ea;
-     check_pc ();
-	  monitor_call (FC_TAIL_CALL);
-	  break;		/* JMP extended */
-	case 0x7f:
-	  extended ();
-	  cpu_clk -= 5;
-	  WRMEM (ea, clr (RDMEM (ea)));
-	  break;		/* CLR extended */
-	case 0x80:
-	  cpu_clk -= 2;
-	  A = sub (A, imm_byte ());
-	  break;
-	case 0x81:
-	  cpu_clk -= 2;
-	  cmp (A, imm_byte ());
-	  break;
-	case 0x82:
-	  cpu_clk -= 2;
-	  A = sbc (A, imm_byte ());
-	  break;
-	case 0x83:
-	  cpu_clk -= 4;
-	  subd (imm_word ());
-	  break;
-	case 0x84:
-	  cpu_clk -= 2;
-	  A = and (A, imm_byte ());
-	  break;
-	case 0x85:
-	  cpu_clk -= 2;
-	  bit (A, imm_byte ());
-	  break;
-	case 0x86:
-	  cpu_clk -= 2;
-	  A = ld (imm_byte ());
-	  break;
-	case 0x88:
-	  cpu_clk -= 2;
-	  A = eor (A, imm_byte ());
-	  break;
-	case 0x89:
-	  cpu_clk -= 2;
-	  A = adc (A, imm_byte ());
-	  break;
-	case 0x8a:
-	  cpu_clk -= 2;
-	  A = or (A, imm_byte ());
-	  break;
-	case 0x8b:
-	  cpu_clk -= 2;
-	  A = add (A, imm_byte ());
-	  break;
-	case 0x8c:
-	  cpu_clk -= 4;
-	  cmp16 (X, imm_word ());
-	  break;
-	case 0x8d:
-	  bsr ();
-	  break;
-	case 0x8e:
-	  cpu_clk -= 3;
-	  X = ld16 (imm_word ());
-	  break;
-
-	case 0x90:
-	  direct ();
-	  cpu_clk -= 4;
-	  A = sub (A, RDMEM (ea));
-	  break;
-	case 0x91:
-	  direct ();
-	  cpu_clk -= 4;
-	  cmp (A, RDMEM (ea));
-	  break;
-	case 0x92:
-	  direct ();
-	  cpu_clk -= 4;
-	  A = sbc (A, RDMEM (ea));
-	  break;
-	case 0x93:
-	  direct ();
-	  cpu_clk -= 4;
-	  subd (RDMEM16 (ea));
-	  cpu_clk--;
-	  break;
-	case 0x94:
-	  direct ();
-	  cpu_clk -= 4;
-	  A = and (A, RDMEM (ea));
-	  break;
-	case 0x95:
-	  direct ();
-	  cpu_clk -= 4;
-	  bit (A, RDMEM (ea));
-	  break;
-	case 0x96:
-	  direct ();
-	  cpu_clk -= 4;
-	  A = ld (RDMEM (ea));
-	  break;
-	case 0x97:
-	  direct ();
-	  cpu_clk -= 4;
-	  st (A);
-	  break;
-	case 0x98:
-	  direct ();
-	  cpu_clk -= 4;
-	  A = eor (A, RDMEM (ea));
-	  break;
-	case 0x99:
-	  direct ();
-	  cpu_clk -= 4;
-	  A = adc (A, RDMEM (ea));
-	  break;
-	case 0x9a:
-	  direct ();
-	  cpu_clk -= 4;
-	  A = or (A, RDMEM (ea));
-	  break;
-	case 0x9b:
-	  direct ();
-	  cpu_clk -= 4;
-	  A = add (A, RDMEM (ea));
-	  break;
-	case 0x9c:
-	  direct ();
-	  cpu_clk -= 4;
-	  cmp16 (X, RDMEM16 (ea));
-	  cpu_clk--;
-	  break;
-	case 0x9d:
-	  direct ();
-	  cpu_clk -= 7;
-	  jsr ();
-	  break;
-	case 0x9e:
-	  direct ();
-	  cpu_clk -= 4;
-	  X = ld16 (RDMEM16 (ea));
-	  break;
-	case 0x9f:
-	  direct ();
-	  cpu_clk -= 4;
-	  st16 (X);
-	  break;
-
-	case 0xa0:
-	  indexed ();
-	  A = sub (A, RDMEM (ea));
-	  break;
-	case 0xa1:
-	  indexed ();
-	  cmp (A, RDMEM (ea));
-	  break;
-	case 0xa2:
-	  indexed ();
-	  A = sbc (A, RDMEM (ea));
-	  break;
-	case 0xa3:
-	  indexed ();
-	  subd (RDMEM16 (ea));
-	  cpu_clk--;
-	  break;
-	case 0xa4:
-	  indexed ();
-	  A = and (A, RDMEM (ea));
-	  break;
-	case 0xa5:
-	  indexed ();
-	  bit (A, RDMEM (ea));
-	  break;
-	case 0xa6:
-	  indexed ();
-	  A = ld (RDMEM (ea));
-	  break;
-	case 0xa7:
-	  indexed ();
-	  st (A);
-	  break;
-	case 0xa8:
-	  indexed ();
-	  A = eor (A, RDMEM (ea));
-	  break;
-	case 0xa9:
-	  indexed ();
-	  A = adc (A, RDMEM (ea));
-	  break;
-	case 0xaa:
-	  indexed ();
-	  A = or (A, RDMEM (ea));
-	  break;
-	case 0xab:
-	  indexed ();
-	  A = add (A, RDMEM (ea));
-	  break;
-	case 0xac:
-	  indexed ();
-	  cmp16 (X, RDMEM16 (ea));
-	  cpu_clk--;
-	  break;
-	case 0xad:
-	  indexed ();
-	  cpu_clk -= 3;
-	  jsr ();
-	  break;
-	case 0xae:
-	  indexed ();
-	  X = ld16 (RDMEM16 (ea));
-	  break;
-	case 0xaf:
-	  indexed ();
-	  st16 (X);
-	  break;
-
-	case 0xb0:
-	  extended ();
-	  cpu_clk -= 5;
-	  A = sub (A, RDMEM (ea));
-	  break;
-	case 0xb1:
-	  extended ();
-	  cpu_clk -= 5;
-	  cmp (A, RDMEM (ea));
-	  break;
-	case 0xb2:
-	  extended ();
-	  cpu_clk -= 5;
-	  A = sbc (A, RDMEM (ea));
-	  break;
-	case 0xb3:
-	  extended ();
-	  cpu_clk -= 5;
-	  subd (RDMEM16 (ea));
-	  cpu_clk--;
-	  break;
-	case 0xb4:
-	  extended ();
-	  cpu_clk -= 5;
-	  A = and (A, RDMEM (ea));
-	  break;
-	case 0xb5:
-	  extended ();
-	  cpu_clk -= 5;
-	  bit (A, RDMEM (ea));
-	  break;
-	case 0xb6:
-	  extended ();
-	  cpu_clk -= 5;
-	  A = ld (RDMEM (ea));
-	  break;
-	case 0xb7:
-	  extended ();
-	  cpu_clk -= 5;
-	  st (A);
-	  break;
-	case 0xb8:
-	  extended ();
-	  cpu_clk -= 5;
-	  A = eor (A, RDMEM (ea));
-	  break;
-	case 0xb9:
-	  extended ();
-	  cpu_clk -= 5;
-	  A = adc (A, RDMEM (ea));
-	  break;
-	case 0xba:
-	  extended ();
-	  cpu_clk -= 5;
-	  A = or (A, RDMEM (ea));
-	  break;
-	case 0xbb:
-	  extended ();
-	  cpu_clk -= 5;
-	  A = add (A, RDMEM (ea));
-	  break;
-	case 0xbc:
-	  extended ();
-	  cpu_clk -= 5;
-	  cmp16 (X, RDMEM16 (ea));
-	  cpu_clk--;
-	  break;
-	case 0xbd:
-	  extended ();
-	  cpu_clk -= 8;
-	  jsr ();
-	  break;
-	case 0xbe:
-	  extended ();
-	  cpu_clk -= 5;
-	  X = ld16 (RDMEM16 (ea));
-	  break;
-	case 0xbf:
-	  extended ();
-	  cpu_clk -= 5;
-	  st16 (X);
-	  break;
+      return cpu_execute_switch_nohooks (cycles);
+    }
 
-	case 0xc0:
-	  cpu_clk -= 2;
-	  B = sub (B, imm_byte ());
-	  break;
-	case 0xc1:
-	  cpu_clk -= 2;
-	  cmp (B, imm_byte ());
-	  break;
-	case 0xc2:
-	  cpu_clk -= 2;
-	  B = sbc (B, imm_byte ());
-	  break;
-	case 0xc3:
-	  cpu_clk -= 4;
-	  addd (imm_word ());
-	  break;
-	case 0xc4:
-	  cpu_clk -= 2;
-	  B = and (B, imm_byte ());
-	  break;
-	case 0xc5:
-	  cpu_clk -= 2;
-	  bit (B, imm_byte ());
-	  break;
-	case 0xc6:
-	  cpu_clk -= 2;
-	  B = ld (imm_byte ());
-	  break;
-	case 0xc8:
-	  cpu_clk -= 2;
-	  B = eor (B, imm_byte ());
-	  break;
-	case 0xc9:
-	  cpu_clk -= 2;
-	  B = adc (B, imm_byte ());
-	  break;
-	case 0xca:
-	  cpu_clk -= 2;
-	  B = or (B, imm_byte ());
-	  break;
-	case 0xcb:
-	  cpu_clk -= 2;
-	  B = add (B, imm_byte ());
-	  break;
-	case 0xcc:
-	  cpu_clk -= 3;
-	  ldd (imm_word ());
-	  break;
-#ifdef H6309
-	case 0xcd:		/* LDQ immed */
-	  break;
+#ifdef HAVE_THREADED_DISPATCH
+  if (!switch_dispatch)
+    return cpu_execute_threaded_copy (cpu_execute_threaded, cycles);
 #endif
-	case 0xce:
-	  cpu_clk -= 3;
-	  U = ld16 (imm_word ());
-	  break;
+  return cpu_execute_switch (cycles);
+}
 
-	case 0xd0:
-	  direct ();
-	  cpu_clk -= 4;
-	  B = sub (B, RDMEM (ea));
-	  break;
-	case 0xd1:
-	  direct ();
-	  cpu_clk -= 4;
-	  cmp (B, RDMEM (ea));
-	  break;
-	case 0xd2:
-	  direct ();
-	  cpu_clk -= 4;
-	  B = sbc (B, RDMEM (ea));
-	  break;
-	case 0xd3:
-	  direct ();
-	  cpu_clk -= 4;
-	  addd (RDMEM16 (ea));
-	  cpu_clk--;
-	  break;
-	case 0xd4:
-	  direct ();
-	  cpu_clk -= 4;
-	  B = and (B, RDMEM (ea));
-	  break;
-	case 0xd5:
-	  direct ();
-	  cpu_clk -= 4;
-	  bit (B, RDMEM (ea));
-	  break;
-	case 0xd6:
-	  direct ();
-	  cpu_clk -= 4;
-	  B = ld (RDMEM (ea));
-	  break;
-	case 0xd7:
-	  direct ();
-	  cpu_clk -= 4;
-	  st (B);
-	  break;
-	case 0xd8:
-	  direct ();
-	  cpu_clk -= 4;
-	  B = eor (B, RDMEM (ea));
-	  break;
-	case 0xd9:
-	  direct ();
-	  cpu_clk -= 4;
-	  B = adc (B, RDMEM (ea));
-	  break;
-	case 0xda:
-	  direct ();
-	  cpu_clk -= 4;
-	  B = or (B, RDMEM (ea));
-	  break;
-	case 0xdb:
-	  direct ();
-	  cpu_clk -= 4;
-	  B = add (B, RDMEM (ea));
-	  break;
-	case 0xdc:
-	  direct ();
-	  cpu_clk -= 4;
-	  ldd (RDMEM16 (ea));
-	  break;
-	case 0xdd:
-	  direct ();
-	  cpu_clk -= 4;
-	  std ();
-	  break;
-	case 0xde:
-	  direct ();
-	  cpu_clk -= 4;
-	  U = ld16 (RDMEM16 (ea));
-	  break;
-	case 0xdf:
-	  direct ();
-	  cpu_clk -= 4;
-	  st16 (U);
-	  break;
+/* Execute exactly one instruction with the switch engine, charging
+its cycles to the current time slice.  Used by the JIT to check its
+results against the interpreter. */
+void
+cpu_interpret_one (void)
+{
+  long saved_clk = cpu_clk;
+  long saved_period = cpu_period;
+  int used;
 
-	case 0xe0:
-	  indexed ();
-	  B = sub (B, RDMEM (ea));
-	  break;
-	case 0xe1:
-	  indexed ();
-	  cmp (B, RDMEM (ea));
-	  break;
-	case 0xe2:
-	  indexed ();
-	  B = sbc (B, RDMEM (ea));
-	  break;
-	case 0xe3:
-	  indexed ();
-	  addd (RDMEM16 (ea));
-	  cpu_clk--;
-	  break;
-	case 0xe4:
-	  indexed ();
-	  B = and (B, RDMEM (ea));
-	  break;
-	case 0xe5:
-	  indexed ();
-	  bit (B, RDMEM (ea));
-	  break;
-	case 0xe6:
-	  indexed ();
-	  B = ld (RDMEM (ea));
-	  break;
-	case 0xe7:
-	  indexed ();
-	  st (B);
-	  break;
-	case 0xe8:
-	  indexed ();
-	  B = eor (B, RDMEM (ea));
-	  break;
-	case 0xe9:
-	  indexed ();
-	  B = adc (B, RDMEM (ea));
-	  break;
-	case 0xea:
-	  indexed ();
-	  B = or (B, RDMEM (ea));
-	  break;
-	case 0xeb:
-	  indexed ();
-	  B = add (B, RDMEM (ea));
-	  break;
-	case 0xec:
-	  indexed ();
-	  ldd (RDMEM16 (ea));
-	  break;
-	case 0xed:
-	  indexed ();
-	  std ();
-	  break;
-	case 0xee:
-	  indexed ();
-	  U = ld16 (RDMEM16 (ea));
-	  break;
-	case 0xef:
-	  indexed ();
-	  st16 (U);
-	  break;
+  /* Keep get_cycles () consistent while the inner slice runs */
+  total += saved_period - saved_clk;
+  used = cpu_execute_switch_nohooks (1);
+  total -= saved_period - saved_clk;
 
-	case 0xf0:
-	  extended ();
-	  cpu_clk -= 5;
-	  B = sub (B, RDMEM (ea));
-	  break;
-	case 0xf1:
-	  extended ();
-	  cpu_clk -= 5;
-	  cmp (B, RDMEM (ea));
-	  break;
-	case 0xf2:
-	  extended ();
-	  cpu_clk -= 5;
-	  B = sbc (B, RDMEM (ea));
-	  break;
-	case 0xf3:
-	  extended ();
-	  cpu_clk -= 5;
-	  addd (RDMEM16 (ea));
-	  cpu_clk--;
-	  break;
-	case 0xf4:
-	  extended ();
-	  cpu_clk -= 5;
-	  B = and (B, RDMEM (ea));
-	  break;
-	case 0xf5:
-	  extended ();
-	  cpu_clk -= 5;
-	  bit (B, RDMEM (ea));
-	  break;
-	case 0xf6:
-	  extended ();
-	  cpu_clk -= 5;
-	  B = ld (RDMEM (ea));
-	  break;
-	case 0xf7:
-	  extended ();
-	  cpu_clk -= 5;
-	  st (B);
-	  break;
-	case 0xf8:
-	  extended ();
-	  cpu_clk -= 5;
-	  B = eor (B, RDMEM (ea));
-	  break;
-	case 0xf9:
-	  extended ();
-	  cpu_clk -= 5;
-	  B = adc (B, RDMEM (ea));
-	  break;
-	case 0xfa:
-	  extended ();
-	  cpu_clk -= 5;
-	  B = or (B, RDMEM (ea));
-	  break;
-	case 0xfb:
-	  extended ();
-	  cpu_clk -= 5;
-	  B = add (B, RDMEM (ea));
-	  break;
-	case 0xfc:
-	  extended ();
-	  cpu_clk -= 5;
-	  ldd (RDMEM16 (ea));
-	  break;
-	case 0xfd:
-	  extended ();
-	  cpu_clk -= 5;
-	  std ();
-	  break;
-	case 0xfe:
-	  extended ();
-	  cpu_clk -= 5;
-	  U = ld16 (RDMEM16 (ea));
-	  break;
-	case 0xff:
-	  extended ();
-	  cpu_clk -= 5;
-	  st16 (U);
-	  break;
+  cpu_period = saved_period;
+  cpu_clk = saved_clk - used;
+}
 
-	default:
-	  cpu_clk -= 2;
-     sim_error ("invalid opcode '%02X'\n", opcode);
-     PC = iPC;
-	  break;
-	}
+/* Execute one instruction with the switch engine as a time slice of
+its own, or if the CPU is waiting for an interrupt, let CYCLES pass.
+Returns the cycles used.  Used to repeat execution exactly for reverse
+debugging. */
+int
+cpu_step (int cycles)
+{
+  return cpu_execute_switch_nohooks (cpu_waiting ? cycles : 1);
+}
 
-	if (cc_changed)
-		cc_modified ();
-    }
-  while (cpu_clk > 0);
+void
+cpu_get_regs (struct cpu_regs *regs)
+{
+  flags_valid ();
+  regs->X = X; regs->Y = Y; regs->S = S; regs->U = U; regs->PC = PC;
+  regs->A = A; regs->B = B; regs->DP = DP;
+  regs->H = H; regs->N = N; regs->Z = Z; regs->OV = OV; regs->C = C;
+  regs->EFI = EFI;
+#ifdef H6309
+  regs->E = E; regs->F = F; regs->V = V; regs->MD = MD;
+#endif
+}
 
-cpu_exit:
-   cpu_period -= cpu_clk;
-   cpu_clk = cpu_period;
-   return cpu_period;
+void
+cpu_set_regs (const struct cpu_regs *regs)
+{
+  X = regs->X; Y = regs->Y; S = regs->S; U = regs->U; PC = regs->PC;
+  A = regs->A; B = regs->B; DP = regs->DP;
+  H = regs->H; N = regs->N; Z = regs->Z; OV = regs->OV; C = regs->C;
+  EFI = regs->EFI;
+  lazy_flags = 0;
+#ifdef H6309
+  E = regs->E; F = regs->F; V = regs->V; MD = regs->MD;
+#endif
 }
 
 void
@@ -3148,7 +2170,9 @@ cpu_reset (void)
   X = Y = S = U = A = B = DP = 0;
   H = N = OV = C = 0;
   Z = 1;
+  lazy_flags = 0;
   EFI = F_FLAG | I_FLAG;
+  cpu_waiting = 0;
 #ifdef H6309
   MD = E = F = V = 0;
 #endif
@@ -3156,3 +2180,37 @@ cpu_reset (void)
   change_pc (read16 (0xfffe));
   cpu_is_running ();
 }
+
+/* Save or restore the CPU in a snapshot (see state.c) */
+void
+cpu_state (void)
+{
+  unsigned cc = get_cc ();
+  unsigned changed = cc_changed;
+
+  state_uint (&X);
+  state_uint (&Y);
+  state_uint (&S);
+  state_uint (&U);
+  state_uint (&PC);
+  state_uint (&A);
+  state_uint (&B);
+  state_uint (&DP);
+  state_uint (&cc);
+#ifdef H6309
+  state_uint (&E);
+  state_uint (&F);
+  state_uint (&V);
+  state_uint (&MD);
+#endif
+  state_uint (&irqs_pending);
+  state_uint (&firqs_pending);
+  state_uint (&cpu_waiting);
+  state_uint (&changed);
+
+  if (state_restoring ())
+    {
+      set_cc (cc);
+      cc_changed = changed;
+    }
+}
@@ -63,33 +63,333 @@ typedef uint16_t target_addr_t;
 #define V_FLAG 0x02
 #define C_FLAG 0x01
 
-extern int debug_enabled;
+extern INSTANCE int debug_enabled;
 extern int need_flush;
-extern unsigned long total;
-extern int dump_cycles_on_success;
-extern const char *prog_name;
+extern INSTANCE unsigned long total;
+extern INSTANCE int dump_cycles_on_success;
+extern INSTANCE const char *prog_name;
 
 long get_elapsed_realtime (void);
 
+/* main.c */
+extern int sim_main (int argc, char *argv[]);
+extern void sim_stop (int status) __attribute__((noreturn));
+extern void sim_events_state (void);
+
+/* state.c */
+extern INSTANCE const char *state_save_file;
+extern INSTANCE const char *state_load_file;
+extern int state_save (const char *filename);
+extern int state_load (const char *filename);
+extern int state_save_mem (char **bufp, size_t *lenp);
+extern int state_load_mem (char *buf, size_t len);
+
+/* replay.c */
+extern INSTANCE const char *record_file;
+extern INSTANCE const char *replay_file;
+extern int replay_init (void);
+extern void replay_close (void);
+extern INSTANCE int input_logging;
+
+/* A point in the input, to go back to with input_rewind */
+struct input_mark
+{
+	unsigned long pos;
+	int pending;
+	int eof;
+};
+
+extern void input_mark (struct input_mark *mark);
+extern void input_rewind (const struct input_mark *mark);
+extern void input_log_trim (const struct input_mark *mark);
+
+/* reverse.c */
+extern INSTANCE unsigned long checkpoint_cycles;
+extern INSTANCE int checkpoint_count;
+extern INSTANCE int reverse_watch_hit;
+extern void reverse_init (void);
+extern void reverse_free (void);
+extern void reverse_step (void);
+extern void reverse_next (void);
+extern void reverse_continue (void);
+
+/* forkserver.c */
+extern INSTANCE const char *fork_server_socket;
+extern INSTANCE unsigned long fork_cycles;
+extern INSTANCE unsigned long fork_start_cycles;
+extern INSTANCE const char *fork_at;
+extern void fork_server (void);
+extern void fork_server_exit (int status);
+
+/* batch.c */
+extern INSTANCE int batch_mode;
+extern INSTANCE const char *batch_manifest;
+extern INSTANCE const char *batch_report;
+extern INSTANCE int batch_jobs;
+extern int batch_run (int argc, char *argv[]);
+
+/* profile.c */
+
+/* The cost of the code at one address */
+struct profile_count
+{
+	unsigned long cycles;
+	unsigned long insns;
+};
+
+extern INSTANCE const char *profile_file;
+extern INSTANCE int profile_enabled;
+extern INSTANCE struct profile_count *profile_counts[];
+extern INSTANCE unsigned long profile_limit[];
+extern INSTANCE struct profile_count *profile_last;
+extern INSTANCE long profile_clk;
+extern INSTANCE struct bus_map busmaps[];
+extern struct profile_count *profile_lookup (unsigned int pc);
+extern void profile_init (void);
+extern void profile_report (void);
+extern void profile_free (void);
+
+/* Return the counts for the code at CPU address PC */
+static inline struct profile_count *
+profile_at (unsigned int pc)
+{
+	struct bus_map *map = &busmaps[pc / BUS_MAP_SIZE];
+	unsigned long phy = map->offset + pc % BUS_MAP_SIZE;
+
+	if (phy < profile_limit[map->devid])
+		return &profile_counts[map->devid][phy];
+	return profile_lookup (pc);
+}
+
+/* insnmix.c */
+
+/* The counts for indexed postbytes: 0-31 for those with bit 7 set,
+by their low 5 bits, and one for all of the 5-bit offsets */
+#define INSNMIX_OFFSET5 32
+#define INSNMIX_MODES   33
+
+extern INSTANCE const char *insnmix_file;
+extern INSTANCE int insnmix_enabled;
+extern INSTANCE struct profile_count insnmix_ops[3][256];
+extern INSTANCE struct profile_count insnmix_modes[];
+extern INSTANCE struct profile_count *insnmix_last;
+extern INSTANCE struct profile_count *insnmix_mode;
+extern void insnmix_init (void);
+extern void insnmix_report (void);
+extern void insnmix_free (void);
+
+/* Charge CYCLES to the instruction that has just ended */
+static inline void
+insnmix_charge (long cycles)
+{
+	insnmix_last->cycles += cycles;
+	if (insnmix_mode)
+	{
+		insnmix_mode->cycles += cycles;
+		insnmix_mode = NULL;
+	}
+}
+
+/* coverage.c */
+
+/* The flags kept for each byte */
+#define COV_EXECUTED  0x1
+#define COV_TAKEN     0x2
+#define COV_NOT_TAKEN 0x4
+
+extern INSTANCE const char *coverage_file;
+extern INSTANCE const char *coverage_lcov_file;
+extern INSTANCE const char *coverage_json_file;
+extern INSTANCE int coverage_enabled;
+extern INSTANCE U8 *coverage_flags[];
+extern INSTANCE unsigned long coverage_limit[];
+extern INSTANCE U8 *coverage_last;
+extern U8 *coverage_lookup (unsigned int pc);
+extern void coverage_init (void);
+extern void coverage_report (void);
+extern void coverage_free (void);
+
+/* Return the flags for the code at CPU address PC */
+static inline U8 *
+coverage_at (unsigned int pc)
+{
+	struct bus_map *map = &busmaps[pc / BUS_MAP_SIZE];
+	unsigned long phy = map->offset + pc % BUS_MAP_SIZE;
+
+	if (phy < coverage_limit[map->devid])
+		return &coverage_flags[map->devid][phy];
+	return coverage_lookup (pc);
+}
+
+/* Nonzero if the engine built with PROFILE_HOOKS has to be run */
+#define profile_hooks_needed() \
+	(profile_enabled || insnmix_enabled || coverage_enabled || tracefile_enabled)
+
+/* callgraph.c */
+extern INSTANCE const char *callgraph_file;
+extern INSTANCE int callgraph_enabled;
+extern void callgraph_init (void);
+extern void callgraph_report (void);
+extern void callgraph_free (void);
+
+/* irqstat.c */
+
+/* What a handler was entered by */
+#define IRQSTAT_IRQ   0
+#define IRQSTAT_FIRQ  1
+#define IRQSTAT_SWI   2
+
+extern INSTANCE int irqstat_enabled;
+extern void irqstat_request (int kind, unsigned int source, unsigned int pending);
+extern void irqstat_enter (int kind, unsigned int pending);
+extern void irqstat_return (void);
+extern void irqstat_reset (void);
+extern void irqstat_print (FILE *fp);
+extern void irqstat_report (void);
+
+/* heatmap.c */
+
+/* What kind of access is counted */
+#define HEAT_READ   0
+#define HEAT_WRITE  1
+#define HEAT_FETCH  2
+
+extern INSTANCE const char *heatmap_file;
+extern INSTANCE int heatmap_enabled;
+extern int heatmap_add_range (const char *arg);
+extern void heatmap_init (void);
+extern void heatmap_access (unsigned int addr, unsigned int devid, int kind);
+extern void heatmap_report (void);
+extern void heatmap_free (void);
+
+/* tracefile.c */
+extern INSTANCE const char *tracefile_name;
+extern INSTANCE const char *tracefile_decode_name;
+extern INSTANCE int tracefile_regs;
+extern INSTANCE int tracefile_writes;
+extern INSTANCE int tracefile_enabled;
+extern INSTANCE long tracefile_pending;
+extern void tracefile_init (void);
+extern void tracefile_insn (unsigned int pc, long cycles);
+extern void tracefile_write (absolute_address_t addr, U8 val);
+extern void tracefile_close (void);
+extern int tracefile_decode (const char *filename);
+
+/* machine.c */
+extern U8 cpu_read8 (unsigned int addr);
+extern U16 cpu_read16 (unsigned int addr);
+extern void cpu_write8 (unsigned int addr, U8 val);
+extern U8 cpu_fetch8 (unsigned int addr);
+extern U16 cpu_fetch16 (unsigned int addr);
+extern INSTANCE FILE *console_output;
+
+/* Host pointers to plain RAM/ROM, one per bus map, or NULL where the
+access has to go through the device (see bus_fast_update). */
+extern INSTANCE U8 *bus_read_ptr[];
+extern INSTANCE U8 *bus_write_ptr[];
+extern void bus_fast_update (unsigned int start, unsigned int count);
+extern void bus_fast_update_page (unsigned int devid, unsigned long page);
+
+static inline U8
+fast_read8 (unsigned int addr)
+{
+	U8 *ptr = bus_read_ptr[(addr & 0xFFFF) / BUS_MAP_SIZE];
+	if (ptr)
+		return ptr[addr % BUS_MAP_SIZE];
+	return cpu_read8 (addr);
+}
+
+static inline U16
+fast_read16 (unsigned int addr)
+{
+	U8 *ptr = bus_read_ptr[(addr & 0xFFFF) / BUS_MAP_SIZE];
+	if (ptr && (addr % BUS_MAP_SIZE) != BUS_MAP_SIZE - 1)
+		return (ptr[addr % BUS_MAP_SIZE] << 8) | ptr[addr % BUS_MAP_SIZE + 1];
+	return cpu_read16 (addr);
+}
+
+/* The same, for instruction bytes, which the bus counts apart from
+data reads (see heatmap.c) */
+static inline U8
+fast_fetch8 (unsigned int addr)
+{
+	U8 *ptr = bus_read_ptr[(addr & 0xFFFF) / BUS_MAP_SIZE];
+	if (ptr)
+		return ptr[addr % BUS_MAP_SIZE];
+	return cpu_fetch8 (addr);
+}
+
+static inline U16
+fast_fetch16 (unsigned int addr)
+{
+	U8 *ptr = bus_read_ptr[(addr & 0xFFFF) / BUS_MAP_SIZE];
+	if (ptr && (addr % BUS_MAP_SIZE) != BUS_MAP_SIZE - 1)
+		return (ptr[addr % BUS_MAP_SIZE] << 8) | ptr[addr % BUS_MAP_SIZE + 1];
+	return cpu_fetch16 (addr);
+}
+
+static inline void
+fast_write8 (unsigned int addr, U8 val)
+{
+	U8 *ptr = bus_write_ptr[(addr & 0xFFFF) / BUS_MAP_SIZE];
+	if (ptr)
+		ptr[addr % BUS_MAP_SIZE] = val;
+	else
+		cpu_write8 (addr, val);
+}
+
 /* Primitive read/write macros */
-#define read8(addr)        cpu_read8 (addr)
-#define write8(addr,val)   do { cpu_write8 (addr, val); } while (0)
+#define read8(addr)        fast_read8 (addr)
+#define write8(addr,val)   do { fast_write8 (addr, val); } while (0)
 
 /* 16-bit versions */
-#define read16(addr)       cpu_read16(addr)
+#define read16(addr)       fast_read16 (addr)
 #define write16(addr,val)  do { write8(addr+1, val & 0xFF); write8(addr, (val >> 8) & 0xFF); } while (0)
 
 /* Fetch macros */
 
 #define abs_read16(addr)   ((abs_read8(addr) << 8) | abs_read8(addr+1))
 
-#define fetch8()           abs_read8 (pc++)
-#define fetch16()          (pc += 2, abs_read16(pc-2))
+/* For the disassembler, which has the address of the instruction in
+OPC and of the next byte in PC */
+extern INSTANCE const U8 *dasm_bytes;
+extern U8 dasm_read8 (absolute_address_t opc, absolute_address_t addr);
+#define fetch8()           dasm_read8 (opc, pc++)
+#define fetch16()          (pc += 2, (dasm_read8 (opc, pc-2) << 8) | dasm_read8 (opc, pc-1))
 
 /* 6809.c */
-extern int cpu_quit;
+extern INSTANCE int cpu_quit;
+extern void sim_error (const char *format, ...);
+extern void sim_exit (uint8_t exit_code);
+extern INSTANCE int switch_dispatch;
+extern INSTANCE const U8 *fetch_ptr;
 extern int cpu_execute (int);
 extern void cpu_reset (void);
+extern void cpu_state (void);
+extern void cpu_interpret_one (void);
+extern int cpu_step (int cycles);
+
+/* Why the CPU is stopped waiting for an interrupt */
+#define WAIT_SYNC 1
+#define WAIT_CWAI 2
+
+extern INSTANCE unsigned int cpu_waiting;
+
+/* Lazy condition codes: which of C and OV still have to be
+computed from the last arithmetic operation, and what kind of
+operation that was */
+#define LAZY_C     0x1
+#define LAZY_V     0x2
+#define LAZY_ADD8  0x0
+#define LAZY_SUB8  0x4
+#define LAZY_ADD16 0x8
+#define LAZY_SUB16 0xC
+#define LAZY_OP    0xC
+
+extern INSTANCE unsigned lazy_flags;
+extern void flags_sync (void);
+#define flags_valid() \
+	((lazy_flags & (LAZY_C | LAZY_V)) ? flags_sync () : (void)0)
 
 extern unsigned get_a  (void);
 extern unsigned get_b  (void);
@@ -113,6 +413,72 @@ extern void set_u  (unsigned);
 extern void set_pc (unsigned);
 extern void set_d  (unsigned);
 
+/* predecode.c */
+
+#define PD_MAX_INSNS 16
+#define PD_MAX_BLOCKS 4096
+#define PD_HASH_SIZE 4096
+
+/* A decoded instruction.  The handler is the address of its body
+in the threaded engine; it is filled in the first time it runs, and
+cleared when another copy of the engine takes over.  The cycle count
+is also measured then, for the JIT. */
+struct pd_insn
+{
+	void *handler;
+	U8 len;
+	U8 bytes[5];
+	U8 cycles;
+};
+
+/* A basic block: instructions that are always executed in sequence,
+up to and including a jump, or the end of a bus map page. */
+struct pd_block
+{
+	absolute_address_t addr;
+	struct pd_block *hash_next;
+	struct pd_block *page_next;
+	struct pd_block *link;        /* The block that ran next last time */
+	unsigned int link_pc;         /* ... and the CPU address it began at */
+	unsigned long link_gen;       /* ... valid only in this generation */
+	unsigned int count;
+	int (*jit) (void);            /* The translated code, if any */
+	unsigned int hits;            /* Times entered before translation */
+	unsigned int idle;            /* Cycles per pass, if an idle loop */
+	struct pd_insn insn[PD_MAX_INSNS];
+};
+
+extern INSTANCE int predecode_enabled;
+extern INSTANCE unsigned long predecode_generation;
+extern INSTANCE struct pd_block **predecode_pages[];
+extern struct pd_block *predecode_lookup (unsigned int pc);
+extern void predecode_invalidate (unsigned int devid, unsigned long page);
+extern void predecode_invalidate_range (unsigned int devid,
+	unsigned long offset, unsigned long len);
+extern void predecode_flush (void);
+extern void predecode_clear_handlers (void);
+extern void predecode_free (void);
+
+/* Called after a write to a device, to discard any code cached
+from the page that was modified. */
+#define predecode_write(devid, phy_addr) \
+	do { \
+		if (predecode_pages[devid] \
+			&& predecode_pages[devid][(phy_addr) / BUS_MAP_SIZE]) \
+			predecode_invalidate (devid, (phy_addr) / BUS_MAP_SIZE); \
+	} while (0)
+
+/* jit.c */
+
+#define JIT_ON      1
+#define JIT_COMPARE 2
+
+extern INSTANCE int jit_enabled;
+extern INSTANCE unsigned long jit_blocks_translated;
+extern INSTANCE unsigned long jit_compare_failures;
+extern int jit_execute (struct pd_block *blk, unsigned int pc);
+extern void jit_free (void);
+
 /* fileio.c */
 
 struct pathlist
@@ -129,7 +495,7 @@ FILE * file_require_open (struct pathlist *path, const char *filename, const cha
 void file_close (FILE *fp);
 
 /* monitor.c */
-extern int monitor_on;
+extern INSTANCE int monitor_on;
 extern int check_break (void);
 extern void monitor_init (void); 
 extern int monitor6809 (void);
@@ -158,6 +524,7 @@ struct stringspace
 {
 	char space[32000];
 	unsigned int used;
+	struct stringspace *prev;   /* The one that filled up before it */
 };
 
 
@@ -177,16 +544,26 @@ struct symtab
    struct symbol *syms_by_name[MAX_SYMBOL_HASH];
    struct symbol *syms_by_value[MAX_SYMBOL_HASH];
    struct symtab *parent;
+   struct symbol **by_addr;      /* Sorted by value, see sym_index */
+   unsigned int by_addr_count;
+   int by_addr_valid;
 };
 
-extern struct symtab program_symtab;
-extern struct symtab internal_symtab;
-extern struct symtab auto_symtab;
+extern INSTANCE struct symtab program_symtab;
+extern INSTANCE struct symtab internal_symtab;
+extern INSTANCE struct symtab auto_symtab;
 
 struct symbol *sym_add (struct symtab *symtab, const char *name, unsigned long value, unsigned int type);
 void sym_set (struct symtab *symtab, const char *name, unsigned long value, unsigned int type);
 int sym_find (struct symtab *symtab, const char *name, unsigned long *value, unsigned int type);
 const char *sym_lookup (struct symtab *symtab, unsigned long value);
+void sym_index (struct symtab *symtab);
+struct symbol **sym_sorted (struct symtab *symtab, unsigned int *countp);
+int sym_nearest (struct symtab *symtab, unsigned long value);
+const char *sym_lookup_offset (struct symtab *symtab, unsigned long value,
+	unsigned long *offsetp);
+void symtab_reset (struct symtab *symtab);
+void sym_free (void);
 
 typedef void (*command_handler_t) (void);
 
@@ -194,9 +571,12 @@ typedef void (*virtual_handler_t) (unsigned long *val, int writep);
 
 typedef unsigned int thread_id_t;
 
+/* An expression compiled by the debugger (see command.c) */
+struct expr_node;
+
 typedef struct
 {
-   unsigned int id : 8;
+   unsigned int id;
    unsigned int used : 1;
    unsigned int enabled : 1;
    unsigned int conditional : 1;
@@ -207,13 +587,18 @@ typedef struct
    unsigned int size : 4;
    unsigned int keep_running : 1;
 	unsigned int temp : 1;
+	unsigned int match_value : 1;
 	unsigned int last_write : 16;
 	unsigned int write_mask : 16;
+	unsigned int value : 8;
    absolute_address_t addr;
+   absolute_address_t end;     /* The last address watched */
    char condition[128];
+   struct expr_node *cond;
    thread_id_t tid;
    unsigned int pass_count;
    unsigned int ignore_count;
+   unsigned int hash_next;     /* The next one in its chain, plus 1 */
 } breakpoint_t;
 
 
@@ -223,6 +608,7 @@ typedef struct
    int used : 1;
    datatype_t type;
    char expr[128];
+   struct expr_node *code;
 } display_t;
 
 
@@ -233,11 +619,19 @@ typedef struct
 } thread_t;
 
 
-#define MAX_BREAKS 32
 #define MAX_DISPLAYS 32
 #define MAX_HISTORY 10
 #define MAX_THREADS 64
 
+extern INSTANCE unsigned int active_break_count;
+extern INSTANCE unsigned int active_watch_count;
+extern INSTANCE unsigned int read_watch_count;
+extern int command_page_watched (unsigned int devid, unsigned long offset);
+extern void cpu_end_slice (void);
+extern void command_free (void);
+
 void command_irq_hook (unsigned long cycles);
+int command_break_at (unsigned int pc);
+void print_current_insn (void);
 
 #endif /* M6809_H */
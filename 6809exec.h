@@ -0,0 +1,1783 @@
+/*
+ * Copyright 2001 by Arto Salmi and Joze Fabcic
+ * Copyright 2006, 2007 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The instruction execution loop.  This file is not compiled on its
+own; 6809.c includes it once for each dispatch engine, after defining:
+
+CPU_EXECUTE - the name of the function to generate.
+
+THREADED_DISPATCH - zero to decode opcodes with a switch statement,
+or nonzero to jump straight to each handler through a table of label
+addresses (GCC computed goto).  There is one table per opcode page.
+
+DEBUG_HOOKS - nonzero to call the debugger before every instruction
+(trace buffer, breakpoints, dumpi, single-stepping, and entry to the
+monitor).  The copies without them are used for plain runs.
+
+PROFILE_HOOKS - nonzero to charge the cycles of every instruction to
+its address, for the flat profile (see profile.c), and to its opcode,
+for the instruction mix (see insnmix.c), and to mark it as run, for
+coverage (see coverage.c).  The copies with DEBUG_HOOKS do the same
+whenever any of them is enabled.
+
+The instruction bodies are shared by both engines, so they stay
+bit-identical in register state and cycle counting. */
+
+#if PROFILE_HOOKS
+#define PROFILING           1
+#elif DEBUG_HOOKS
+#define PROFILING           profile_hooks_needed ()
+#else
+#define PROFILING           0
+#endif
+
+/* Note the opcode being dispatched, for the instruction mix.  After a
+$10 or $11 prefix, the opcode on the next page replaces it. */
+#define MIX(page, op) \
+  do { \
+    if (PROFILING && insnmix_enabled) \
+      { \
+	insnmix_last = &insnmix_ops[page][op]; \
+	insnmix_last->insns++; \
+      } \
+  } while (0)
+
+#if THREADED_DISPATCH
+#define DISPATCH(page, op)  MIX (page, op); goto *dispatch_##page[op];
+#define OP(page, n)         op_##page##_##n
+#define OP_INVALID(page)    op_##page##_invalid
+#define T(page, n)          [n] = &&op_##page##_##n
+#else
+#define DISPATCH(page, op)  MIX (page, op); switch (op)
+#define OP(page, n)         case n
+#define OP_INVALID(page)    default
+#endif
+#define NEXT                goto insn_done
+
+/* Execute 6809 code for a certain number of cycles. */
+static int
+CPU_EXECUTE (int cycles)
+{
+  unsigned opcode;
+  struct pd_block *pd_blk = NULL;
+  struct pd_insn *pd = NULL, *pd_end = NULL;
+  unsigned pd_pc = 0;
+  unsigned long pd_gen = 0;
+  struct pd_insn *pd_timed = NULL;
+  long pd_clk = 0;
+  unsigned int pd_adjusts = 0;
+
+#if THREADED_DISPATCH
+  static void *const dispatch_0[256] = {
+      [0 ... 255] = &&op_0_invalid,
+      T (0, 0x00),
+#ifdef H6309
+      T (0, 0x01), T (0, 0x02),
+#endif
+      T (0, 0x03), T (0, 0x04),
+#ifdef H6309
+      T (0, 0x05),
+#endif
+      T (0, 0x06), T (0, 0x07), T (0, 0x08), T (0, 0x09),
+      T (0, 0x0a),
+#ifdef H6309
+      T (0, 0x0b),
+#endif
+      T (0, 0x0c), T (0, 0x0d), T (0, 0x0e), T (0, 0x0f),
+      T (0, 0x10),
+      T (0, 0x11),
+      T (0, 0x12), T (0, 0x13),
+#ifdef H6309
+      T (0, 0x14),
+#endif
+      T (0, 0x16), T (0, 0x17), T (0, 0x19), T (0, 0x1a),
+      T (0, 0x1c), T (0, 0x1d), T (0, 0x1e), T (0, 0x1f),
+      T (0, 0x20), T (0, 0x21), T (0, 0x22), T (0, 0x23),
+      T (0, 0x24), T (0, 0x25), T (0, 0x26), T (0, 0x27),
+      T (0, 0x28), T (0, 0x29), T (0, 0x2a), T (0, 0x2b),
+      T (0, 0x2c), T (0, 0x2d), T (0, 0x2e), T (0, 0x2f),
+      T (0, 0x30), T (0, 0x31), T (0, 0x32), T (0, 0x33),
+      T (0, 0x34), T (0, 0x35), T (0, 0x36), T (0, 0x37),
+      T (0, 0x39), T (0, 0x3a), T (0, 0x3b), T (0, 0x3c),
+      T (0, 0x3d), T (0, 0x3f), T (0, 0x40), T (0, 0x43),
+      T (0, 0x44), T (0, 0x46), T (0, 0x47), T (0, 0x48),
+      T (0, 0x49), T (0, 0x4a), T (0, 0x4c), T (0, 0x4d),
+      T (0, 0x4f), T (0, 0x50), T (0, 0x53), T (0, 0x54),
+      T (0, 0x56), T (0, 0x57), T (0, 0x58), T (0, 0x59),
+      T (0, 0x5a), T (0, 0x5c), T (0, 0x5d), T (0, 0x5f),
+      T (0, 0x60),
+#ifdef H6309
+      T (0, 0x61), T (0, 0x62),
+#endif
+      T (0, 0x63), T (0, 0x64),
+#ifdef H6309
+      T (0, 0x65),
+#endif
+      T (0, 0x66), T (0, 0x67), T (0, 0x68), T (0, 0x69),
+      T (0, 0x6a),
+#ifdef H6309
+      T (0, 0x6b),
+#endif
+      T (0, 0x6c), T (0, 0x6d), T (0, 0x6e), T (0, 0x6f),
+      T (0, 0x70),
+#ifdef H6309
+      T (0, 0x71), T (0, 0x72),
+#endif
+      T (0, 0x73), T (0, 0x74),
+#ifdef H6309
+      T (0, 0x75),
+#endif
+      T (0, 0x76), T (0, 0x77), T (0, 0x78), T (0, 0x79),
+      T (0, 0x7a),
+#ifdef H6309
+      T (0, 0x7b),
+#endif
+      T (0, 0x7c), T (0, 0x7d), T (0, 0x7e), T (0, 0x7f),
+      T (0, 0x80), T (0, 0x81), T (0, 0x82), T (0, 0x83),
+      T (0, 0x84), T (0, 0x85), T (0, 0x86), T (0, 0x88),
+      T (0, 0x89), T (0, 0x8a), T (0, 0x8b), T (0, 0x8c),
+      T (0, 0x8d), T (0, 0x8e), T (0, 0x90), T (0, 0x91),
+      T (0, 0x92), T (0, 0x93), T (0, 0x94), T (0, 0x95),
+      T (0, 0x96), T (0, 0x97), T (0, 0x98), T (0, 0x99),
+      T (0, 0x9a), T (0, 0x9b), T (0, 0x9c), T (0, 0x9d),
+      T (0, 0x9e), T (0, 0x9f), T (0, 0xa0), T (0, 0xa1),
+      T (0, 0xa2), T (0, 0xa3), T (0, 0xa4), T (0, 0xa5),
+      T (0, 0xa6), T (0, 0xa7), T (0, 0xa8), T (0, 0xa9),
+      T (0, 0xaa), T (0, 0xab), T (0, 0xac), T (0, 0xad),
+      T (0, 0xae), T (0, 0xaf), T (0, 0xb0), T (0, 0xb1),
+      T (0, 0xb2), T (0, 0xb3), T (0, 0xb4), T (0, 0xb5),
+      T (0, 0xb6), T (0, 0xb7), T (0, 0xb8), T (0, 0xb9),
+      T (0, 0xba), T (0, 0xbb), T (0, 0xbc), T (0, 0xbd),
+      T (0, 0xbe), T (0, 0xbf), T (0, 0xc0), T (0, 0xc1),
+      T (0, 0xc2), T (0, 0xc3), T (0, 0xc4), T (0, 0xc5),
+      T (0, 0xc6), T (0, 0xc8), T (0, 0xc9), T (0, 0xca),
+      T (0, 0xcb), T (0, 0xcc),
+#ifdef H6309
+      T (0, 0xcd),
+#endif
+      T (0, 0xce), T (0, 0xd0), T (0, 0xd1), T (0, 0xd2),
+      T (0, 0xd3), T (0, 0xd4), T (0, 0xd5), T (0, 0xd6),
+      T (0, 0xd7), T (0, 0xd8), T (0, 0xd9), T (0, 0xda),
+      T (0, 0xdb), T (0, 0xdc), T (0, 0xdd), T (0, 0xde),
+      T (0, 0xdf), T (0, 0xe0), T (0, 0xe1), T (0, 0xe2),
+      T (0, 0xe3), T (0, 0xe4), T (0, 0xe5), T (0, 0xe6),
+      T (0, 0xe7), T (0, 0xe8), T (0, 0xe9), T (0, 0xea),
+      T (0, 0xeb), T (0, 0xec), T (0, 0xed), T (0, 0xee),
+      T (0, 0xef), T (0, 0xf0), T (0, 0xf1), T (0, 0xf2),
+      T (0, 0xf3), T (0, 0xf4), T (0, 0xf5), T (0, 0xf6),
+      T (0, 0xf7), T (0, 0xf8), T (0, 0xf9), T (0, 0xfa),
+      T (0, 0xfb), T (0, 0xfc), T (0, 0xfd), T (0, 0xfe),
+      T (0, 0xff),
+  };
+  static void *const dispatch_1[256] = {
+      [0 ... 255] = &&op_1_invalid,
+      T (1, 0x21), T (1, 0x22), T (1, 0x23), T (1, 0x24),
+      T (1, 0x25), T (1, 0x26), T (1, 0x27), T (1, 0x28),
+      T (1, 0x29), T (1, 0x2a), T (1, 0x2b), T (1, 0x2c),
+      T (1, 0x2d), T (1, 0x2e), T (1, 0x2f),
+#ifdef H6309
+      T (1, 0x30), T (1, 0x31), T (1, 0x32), T (1, 0x33),
+      T (1, 0x34), T (1, 0x35), T (1, 0x36), T (1, 0x37),
+      T (1, 0x38), T (1, 0x39), T (1, 0x3a), T (1, 0x3b),
+#endif
+      T (1, 0x3f),
+#ifdef H6309
+      T (1, 0x40), T (1, 0x43), T (1, 0x44), T (1, 0x46),
+      T (1, 0x47), T (1, 0x48), T (1, 0x49), T (1, 0x4a),
+      T (1, 0x4c), T (1, 0x4d), T (1, 0x4f), T (1, 0x53),
+      T (1, 0x54), T (1, 0x56), T (1, 0x59), T (1, 0x5a),
+      T (1, 0x5c), T (1, 0x5d), T (1, 0x5f), T (1, 0x80),
+      T (1, 0x81), T (1, 0x82),
+#endif
+      T (1, 0x83),
+#ifdef H6309
+      T (1, 0x84), T (1, 0x85), T (1, 0x86), T (1, 0x88),
+      T (1, 0x89), T (1, 0x8a), T (1, 0x8b),
+#endif
+      T (1, 0x8c), T (1, 0x8e),
+#ifdef H6309
+      T (1, 0x90), T (1, 0x91), T (1, 0x92),
+#endif
+      T (1, 0x93), T (1, 0x9c), T (1, 0x9e), T (1, 0x9f),
+      T (1, 0xa3), T (1, 0xac), T (1, 0xae), T (1, 0xaf),
+      T (1, 0xb3), T (1, 0xbc), T (1, 0xbe), T (1, 0xbf),
+      T (1, 0xce), T (1, 0xde), T (1, 0xdf), T (1, 0xee),
+      T (1, 0xef), T (1, 0xfe), T (1, 0xff),
+  };
+  static void *const dispatch_2[256] = {
+      [0 ... 255] = &&op_2_invalid,
+      T (2, 0x3f),
+#ifdef H6309
+      T (2, 0x80), T (2, 0x81),
+#endif
+      T (2, 0x83),
+#ifdef H6309
+      T (2, 0x86), T (2, 0x8b),
+#endif
+      T (2, 0x8c),
+#ifdef H6309
+      T (2, 0x8d), T (2, 0x8e), T (2, 0x8f), T (2, 0x90),
+      T (2, 0x91),
+#endif
+      T (2, 0x93), T (2, 0x9c), T (2, 0xa3), T (2, 0xac),
+      T (2, 0xb3), T (2, 0xbc),
+  };
+#endif
+
+  cpu_period = cpu_clk = cycles;
+  if (PROFILING)
+    profile_clk = cpu_clk;
+
+  do
+    {
+#if DEBUG_HOOKS
+	 	command_insn_hook ();
+		if (check_break () != 0)
+			monitor_on = 1;
+
+		if (monitor_on != 0)
+			if (monitor6809 () != 0)
+				goto cpu_exit;
+#endif
+
+      /* SYNC and CWAI stop the CPU until an interrupt is requested,
+      which only happens between time slices, so the rest of this one
+      can pass at once. */
+      if (cpu_waiting)
+	{
+	  cpu_clk = 0;
+	  goto insn_done;
+	}
+
+      iPC = PC;
+
+      /* The previous instruction ends here, and this one begins */
+      if (PROFILING)
+	{
+	  if (profile_enabled)
+	    {
+	      profile_last->cycles += profile_clk - cpu_clk;
+	      profile_last = profile_at (PC);
+	      profile_last->insns++;
+	    }
+	  if (insnmix_enabled)
+	    insnmix_charge (profile_clk - cpu_clk);
+	  if (coverage_enabled)
+	    {
+	      coverage_last = coverage_at (PC);
+	      *coverage_last |= COV_EXECUTED;
+	    }
+	  if (tracefile_enabled)
+	    tracefile_insn (PC, profile_clk - cpu_clk);
+	  profile_clk = cpu_clk;
+	}
+
+      /* Fetch from the predecode cache when possible.  Read watchpoints
+      need to see every fetch, so the cache is bypassed while any
+      are set. */
+      fetch_ptr = NULL;
+      if (predecode_enabled && !read_watch_count)
+	{
+	  if (pd == pd_end || PC != pd_pc || pd_gen != predecode_generation)
+	    {
+	      /* Follow the link from the previous block if it still
+	      leads here; otherwise do a full lookup and remember it. */
+	      struct pd_block *blk;
+	      if (pd_blk && pd_gen == predecode_generation
+		  && pd_blk->link_gen == pd_gen && pd_blk->link_pc == PC)
+		blk = pd_blk->link;
+	      else
+		{
+		  blk = predecode_lookup (PC);
+		  if (pd_blk && pd_gen == predecode_generation)
+		    {
+		      pd_blk->link = blk;
+		      pd_blk->link_pc = PC;
+		      pd_blk->link_gen = pd_gen;
+		    }
+		}
+	      pd_gen = predecode_generation;
+	      pd_blk = blk;
+	      pd = pd_end = NULL;
+	      if (blk)
+		{
+		  pd = blk->insn;
+		  pd_end = pd + blk->count;
+		  pd_pc = PC;
+
+#if !DEBUG_HOOKS && !PROFILE_HOOKS
+		  /* A loop that does nothing but come back here can only be
+		  left by an interrupt, which will not be requested before the
+		  end of this time slice.  Skip all but the last pass. */
+		  if (blk->idle && cpu_clk > blk->idle)
+		    cpu_clk -= (cpu_clk - 1) / blk->idle * blk->idle;
+#endif
+
+		  /* Run the block as native code if it has been translated.
+		  Translated code skips the debugger hooks between its
+		  instructions, so it is never run by the copy that has
+		  them. */
+		  if (!DEBUG_HOOKS && jit_enabled && !PROFILING && !active_watch_count
+		      && jit_execute (blk, PC))
+		    {
+		      pd = pd_end = NULL;
+		      goto insn_done;
+		    }
+		}
+	    }
+	  if (pd != pd_end)
+	    {
+	      fetch_ptr = pd->bytes;
+	      pd_pc += pd->len;
+	      if (pd->cycles == 0)
+		{
+		  /* Measure the instruction the first time it runs */
+		  pd_timed = pd;
+		  pd_clk = cpu_clk;
+		  pd_adjusts = cpu_clk_adjusts;
+		}
+#if THREADED_DISPATCH
+	      if (pd->handler == NULL)
+		{
+		  if (pd->bytes[0] == 0x10)
+		    pd->handler = dispatch_1[pd->bytes[1]];
+		  else if (pd->bytes[0] == 0x11)
+		    pd->handler = dispatch_2[pd->bytes[1]];
+		  else
+		    pd->handler = dispatch_0[pd->bytes[0]];
+		}
+	      if (pd->bytes[0] == 0x10 || pd->bytes[0] == 0x11)
+		{
+		  opcode = pd->bytes[1];
+		  MIX (pd->bytes[0] == 0x10 ? 1 : 2, opcode);
+		  fetch_ptr += 2;
+		  PC += 2;
+		}
+	      else
+		{
+		  opcode = pd->bytes[0];
+		  MIX (0, opcode);
+		  fetch_ptr++;
+		  PC++;
+		}
+	      goto *(pd++)->handler;
+#else
+	      pd++;
+#endif
+	    }
+	}
+
+      opcode = imm_byte ();
+
+      DISPATCH (0, opcode)
+	{
+	OP (0, 0x00):
+	  direct ();
+	  cpu_clk -= 4;
+	  WRMEM (ea, neg (RDMEM (ea)));
+	  NEXT;		/* NEG direct */
+#ifdef H6309
+	OP (0, 0x01):		/* OIM */
+	  NEXT;
+	OP (0, 0x02):		/* AIM */
+	  NEXT;
+#endif
+	OP (0, 0x03):
+	  direct ();
+	  cpu_clk -= 4;
+	  WRMEM (ea, com (RDMEM (ea)));
+	  NEXT;		/* COM direct */
+	OP (0, 0x04):
+	  direct ();
+	  cpu_clk -= 4;
+	  WRMEM (ea, lsr (RDMEM (ea)));
+	  NEXT;		/* LSR direct */
+#ifdef H6309
+	OP (0, 0x05):		/* EIM */
+	  NEXT;
+#endif
+	OP (0, 0x06):
+	  direct ();
+	  cpu_clk -= 4;
+	  WRMEM (ea, ror (RDMEM (ea)));
+	  NEXT;		/* ROR direct */
+	OP (0, 0x07):
+	  direct ();
+	  cpu_clk -= 4;
+	  WRMEM (ea, asr (RDMEM (ea)));
+	  NEXT;		/* ASR direct */
+	OP (0, 0x08):
+	  direct ();
+	  cpu_clk -= 4;
+	  WRMEM (ea, asl (RDMEM (ea)));
+	  NEXT;		/* ASL direct */
+	OP (0, 0x09):
+	  direct ();
+	  cpu_clk -= 4;
+	  WRMEM (ea, rol (RDMEM (ea)));
+	  NEXT;		/* ROL direct */
+	OP (0, 0x0a):
+	  direct ();
+	  cpu_clk -= 4;
+	  WRMEM (ea, dec (RDMEM (ea)));
+	  NEXT;		/* DEC direct */
+#ifdef H6309
+	OP (0, 0x0b):		/* TIM */
+	  NEXT;
+#endif
+	OP (0, 0x0c):
+	  direct ();
+	  cpu_clk -= 4;
+	  WRMEM (ea, inc (RDMEM (ea)));
+	  NEXT;		/* INC direct */
+	OP (0, 0x0d):
+	  direct ();
+	  cpu_clk -= 4;
+	  tst (RDMEM (ea));
+	  NEXT;		/* TST direct */
+	OP (0, 0x0e):
+	  direct ();
+	  cpu_clk -= 3;
+	  PC = ea;
+     check_pc ();
+	  monitor_call (FC_TAIL_CALL);
+	  NEXT;		/* JMP direct */
+	OP (0, 0x0f):
+	  direct ();
+	  cpu_clk -= 4;
+	  WRMEM (ea, clr (RDMEM (ea)));
+	  NEXT;		/* CLR direct */
+	OP (0, 0x10):
+	  {
+	    opcode = imm_byte ();
+
+	    DISPATCH (1, opcode)
+	      {
+	      OP (1, 0x21):
+		cpu_clk -= 5;
+		PC += 2;
+		NEXT;
+	      OP (1, 0x22):
+		long_branch (cond_HI ());
+		NEXT;
+	      OP (1, 0x23):
+		long_branch (cond_LS ());
+		NEXT;
+	      OP (1, 0x24):
+		long_branch (cond_HS ());
+		NEXT;
+	      OP (1, 0x25):
+		long_branch (cond_LO ());
+		NEXT;
+	      OP (1, 0x26):
+		long_branch (cond_NE ());
+		NEXT;
+	      OP (1, 0x27):
+		long_branch (cond_EQ ());
+		NEXT;
+	      OP (1, 0x28):
+		long_branch (cond_VC ());
+		NEXT;
+	      OP (1, 0x29):
+		long_branch (cond_VS ());
+		NEXT;
+	      OP (1, 0x2a):
+		long_branch (cond_PL ());
+		NEXT;
+	      OP (1, 0x2b):
+		long_branch (cond_MI ());
+		NEXT;
+	      OP (1, 0x2c):
+		long_branch (cond_GE ());
+		NEXT;
+	      OP (1, 0x2d):
+		long_branch (cond_LT ());
+		NEXT;
+	      OP (1, 0x2e):
+		long_branch (cond_GT ());
+		NEXT;
+	      OP (1, 0x2f):
+		long_branch (cond_LE ());
+		NEXT;
+#ifdef H6309
+	      OP (1, 0x30):	/* ADDR */
+		NEXT;
+	      OP (1, 0x31):	/* ADCR */
+		NEXT;
+	      OP (1, 0x32):	/* SUBR */
+		NEXT;
+	      OP (1, 0x33):	/* SBCR */
+		NEXT;
+	      OP (1, 0x34):	/* ANDR */
+		NEXT;
+	      OP (1, 0x35):	/* ORR */
+		NEXT;
+	      OP (1, 0x36):	/* EORR */
+		NEXT;
+	      OP (1, 0x37):	/* CMPR */
+		NEXT;
+	      OP (1, 0x38):	/* PSHSW */
+		NEXT;
+	      OP (1, 0x39):	/* PULSW */
+		NEXT;
+	      OP (1, 0x3a):	/* PSHUW */
+		NEXT;
+	      OP (1, 0x3b):	/* PULUW */
+		NEXT;
+#endif
+	      OP (1, 0x3f):
+		swi2 ();
+		NEXT;
+#ifdef H6309
+	      OP (1, 0x40):	/* NEGD */
+		NEXT;
+	      OP (1, 0x43):	/* COMD */
+		NEXT;
+	      OP (1, 0x44):	/* LSRD */
+		NEXT;
+	      OP (1, 0x46):	/* RORD */
+		NEXT;
+	      OP (1, 0x47):	/* ASRD */
+		NEXT;
+	      OP (1, 0x48):	/* ASLD/LSLD */
+		NEXT;
+	      OP (1, 0x49):	/* ROLD */
+		NEXT;
+	      OP (1, 0x4a):	/* DECD */
+		NEXT;
+	      OP (1, 0x4c):	/* INCD */
+		NEXT;
+	      OP (1, 0x4d):	/* TSTD */
+		NEXT;
+	      OP (1, 0x4f):	/* CLRD */
+		NEXT;
+	      OP (1, 0x53):	/* COMW */
+		NEXT;
+	      OP (1, 0x54):	/* LSRW */
+		NEXT;
+	      OP (1, 0x56):	/* ??RORW */
+		NEXT;
+	      OP (1, 0x59):	/* ROLW */
+		NEXT;
+	      OP (1, 0x5a):	/* DECW */
+		NEXT;
+	      OP (1, 0x5c):	/* INCW */
+		NEXT;
+	      OP (1, 0x5d):	/* TSTW */
+		NEXT;
+	      OP (1, 0x5f):	/* CLRW */
+		NEXT;
+	      OP (1, 0x80):	/* SUBW */
+		NEXT;
+	      OP (1, 0x81):	/* CMPW */
+		NEXT;
+	      OP (1, 0x82):	/* SBCD */
+		NEXT;
+#endif
+	      OP (1, 0x83):
+		cpu_clk -= 5;
+		cmp16 (get_d (), imm_word ());
+		NEXT;
+#ifdef H6309
+	      OP (1, 0x84):	/* ANDD */
+		NEXT;
+	      OP (1, 0x85):	/* BITD */
+		NEXT;
+	      OP (1, 0x86):	/* LDW */
+		NEXT;
+	      OP (1, 0x88):	/* EORD */
+		NEXT;
+	      OP (1, 0x89):	/* ADCD */
+		NEXT;
+	      OP (1, 0x8a):	/* ORD */
+		NEXT;
+	      OP (1, 0x8b):	/* ADDW */
+		NEXT;
+#endif
+	      OP (1, 0x8c):
+		cpu_clk -= 5;
+		cmp16 (Y, imm_word ());
+		NEXT;
+	      OP (1, 0x8e):
+		cpu_clk -= 4;
+		Y = ld16 (imm_word ());
+		NEXT;
+#ifdef H6309
+	      OP (1, 0x90):	/* SUBW */
+		NEXT;
+	      OP (1, 0x91):	/* CMPW */
+		NEXT;
+	      OP (1, 0x92):	/* SBCD */
+		NEXT;
+#endif
+	      OP (1, 0x93):
+		direct ();
+		cpu_clk -= 5;
+		cmp16 (get_d (), RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (1, 0x9c):
+		direct ();
+		cpu_clk -= 5;
+		cmp16 (Y, RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (1, 0x9e):
+		direct ();
+		cpu_clk -= 5;
+		Y = ld16 (RDMEM16 (ea));
+		NEXT;
+	      OP (1, 0x9f):
+		direct ();
+		cpu_clk -= 5;
+		st16 (Y);
+		NEXT;
+	      OP (1, 0xa3):
+		cpu_clk--;
+		indexed ();
+		cmp16 (get_d (), RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (1, 0xac):
+		cpu_clk--;
+		indexed ();
+		cmp16 (Y, RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (1, 0xae):
+		cpu_clk--;
+		indexed ();
+		Y = ld16 (RDMEM16 (ea));
+		NEXT;
+	      OP (1, 0xaf):
+		cpu_clk--;
+		indexed ();
+		st16 (Y);
+		NEXT;
+	      OP (1, 0xb3):
+		extended ();
+		cpu_clk -= 6;
+		cmp16 (get_d (), RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (1, 0xbc):
+		extended ();
+		cpu_clk -= 6;
+		cmp16 (Y, RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (1, 0xbe):
+		extended ();
+		cpu_clk -= 6;
+		Y = ld16 (RDMEM16 (ea));
+		NEXT;
+	      OP (1, 0xbf):
+		extended ();
+		cpu_clk -= 6;
+		st16 (Y);
+		NEXT;
+	      OP (1, 0xce):
+		cpu_clk -= 4;
+		S = ld16 (imm_word ());
+		NEXT;
+	      OP (1, 0xde):
+		direct ();
+		cpu_clk -= 5;
+		S = ld16 (RDMEM16 (ea));
+		NEXT;
+	      OP (1, 0xdf):
+		direct ();
+		cpu_clk -= 5;
+		st16 (S);
+		NEXT;
+	      OP (1, 0xee):
+		cpu_clk--;
+		indexed ();
+		S = ld16 (RDMEM16 (ea));
+		NEXT;
+	      OP (1, 0xef):
+		cpu_clk--;
+		indexed ();
+		st16 (S);
+		NEXT;
+	      OP (1, 0xfe):
+		extended ();
+		cpu_clk -= 6;
+		S = ld16 (RDMEM16 (ea));
+		NEXT;
+	      OP (1, 0xff):
+		extended ();
+		cpu_clk -= 6;
+		st16 (S);
+		NEXT;
+	      OP_INVALID (1):
+	        sim_error ("invalid opcode (1) at %s\n", monitor_addr_name (iPC));
+		NEXT;
+	      }
+	  }
+	  NEXT;
+
+	OP (0, 0x11):
+	  {
+	    opcode = imm_byte ();
+
+	    DISPATCH (2, opcode)
+	      {
+	      OP (2, 0x3f):
+		swi3 ();
+		NEXT;
+#ifdef H6309
+			OP (2, 0x80): /* SUBE */
+			OP (2, 0x81): /* CMPE */
+#endif
+	      OP (2, 0x83):
+		cpu_clk -= 5;
+		cmp16 (U, imm_word ());
+		NEXT;
+#ifdef H6309
+			OP (2, 0x86): /* LDE */
+			OP (2, 0x8b): /* ADDE */
+#endif
+	      OP (2, 0x8c):
+		cpu_clk -= 5;
+		cmp16 (S, imm_word ());
+		NEXT;
+#ifdef H6309
+			OP (2, 0x8d): /* DIVD */
+			OP (2, 0x8e): /* DIVQ */
+			OP (2, 0x8f): /* MULD */
+			OP (2, 0x90): /* SUBE */
+			OP (2, 0x91): /* CMPE */
+#endif
+	      OP (2, 0x93):
+		direct ();
+		cpu_clk -= 5;
+		cmp16 (U, RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (2, 0x9c):
+		direct ();
+		cpu_clk -= 5;
+		cmp16 (S, RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (2, 0xa3):
+		cpu_clk--;
+		indexed ();
+		cmp16 (U, RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (2, 0xac):
+		cpu_clk--;
+		indexed ();
+		cmp16 (S, RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (2, 0xb3):
+		extended ();
+		cpu_clk -= 6;
+		cmp16 (U, RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP (2, 0xbc):
+		extended ();
+		cpu_clk -= 6;
+		cmp16 (S, RDMEM16 (ea));
+		cpu_clk--;
+		NEXT;
+	      OP_INVALID (2):
+	        sim_error ("invalid opcode (2) at %s\n", monitor_addr_name (iPC));
+		NEXT;
+	      }
+	  }
+	  NEXT;
+
+	OP (0, 0x12):
+	  nop ();
+	  NEXT;
+	OP (0, 0x13):
+	  sync ();
+	  NEXT;
+#ifdef H6309
+	OP (0, 0x14):		/* SEXW */
+	  NEXT;
+#endif
+	OP (0, 0x16):
+	  long_bra ();
+	  cpu_clk -= 5;
+	  NEXT;
+	OP (0, 0x17):
+	  long_bsr ();
+	  NEXT;
+	OP (0, 0x19):
+	  daa ();
+	  NEXT;
+	OP (0, 0x1a):
+	  orcc ();
+	  NEXT;
+	OP (0, 0x1c):
+	  andcc ();
+	  NEXT;
+	OP (0, 0x1d):
+	  sex ();
+	  NEXT;
+	OP (0, 0x1e):
+	  exg ();
+	  NEXT;
+	OP (0, 0x1f):
+	  tfr ();
+	  NEXT;
+
+	OP (0, 0x20):
+	  bra ();
+	  cpu_clk -= 3;
+#if !DEBUG_HOOKS && !PROFILE_HOOKS
+	  /* BRA * can only be left by an interrupt; see above */
+	  if (PC == iPC && cpu_clk > 3)
+	    cpu_clk -= (cpu_clk - 1) / 3 * 3;
+#endif
+	  NEXT;
+	OP (0, 0x21):
+	  PC++;
+	  cpu_clk -= 3;
+	  NEXT;
+	OP (0, 0x22):
+	  branch (cond_HI ());
+	  NEXT;
+	OP (0, 0x23):
+	  branch (cond_LS ());
+	  NEXT;
+	OP (0, 0x24):
+	  branch (cond_HS ());
+	  NEXT;
+	OP (0, 0x25):
+	  branch (cond_LO ());
+	  NEXT;
+	OP (0, 0x26):
+	  branch (cond_NE ());
+	  NEXT;
+	OP (0, 0x27):
+	  branch (cond_EQ ());
+	  NEXT;
+	OP (0, 0x28):
+	  branch (cond_VC ());
+	  NEXT;
+	OP (0, 0x29):
+	  branch (cond_VS ());
+	  NEXT;
+	OP (0, 0x2a):
+	  branch (cond_PL ());
+	  NEXT;
+	OP (0, 0x2b):
+	  branch (cond_MI ());
+	  NEXT;
+	OP (0, 0x2c):
+	  branch (cond_GE ());
+	  NEXT;
+	OP (0, 0x2d):
+	  branch (cond_LT ());
+	  NEXT;
+	OP (0, 0x2e):
+	  branch (cond_GT ());
+	  NEXT;
+	OP (0, 0x2f):
+	  branch (cond_LE ());
+	  NEXT;
+
+	OP (0, 0x30):
+	  indexed ();
+	  Z = X = ea;
+	  NEXT;		/* LEAX indexed */
+	OP (0, 0x31):
+	  indexed ();
+	  Z = Y = ea;
+	  NEXT;		/* LEAY indexed */
+	OP (0, 0x32):
+	  indexed ();
+	  S = ea;
+	  NEXT;		/* LEAS indexed */
+	OP (0, 0x33):
+	  indexed ();
+	  U = ea;
+	  NEXT;		/* LEAU indexed */
+	OP (0, 0x34):
+	  pshs ();
+	  NEXT;		/* PSHS implied */
+	OP (0, 0x35):
+	  puls ();
+	  NEXT;		/* PULS implied */
+	OP (0, 0x36):
+	  pshu ();
+	  NEXT;		/* PSHU implied */
+	OP (0, 0x37):
+	  pulu ();
+	  NEXT;		/* PULU implied */
+	OP (0, 0x39):
+	  rts ();
+	  NEXT;		/* RTS implied  */
+	OP (0, 0x3a):
+	  abx ();
+	  NEXT;		/* ABX implied  */
+	OP (0, 0x3b):
+	  rti ();
+	  NEXT;		/* RTI implied  */
+	OP (0, 0x3c):
+	  cwai ();
+	  NEXT;		/* CWAI implied */
+	OP (0, 0x3d):
+	  mul ();
+	  NEXT;		/* MUL implied  */
+	OP (0, 0x3f):
+	  swi ();
+	  NEXT;		/* SWI implied  */
+
+	OP (0, 0x40):
+	  A = neg (A);
+	  NEXT;		/* NEGA implied */
+	OP (0, 0x43):
+	  A = com (A);
+	  NEXT;		/* COMA implied */
+	OP (0, 0x44):
+	  A = lsr (A);
+	  NEXT;		/* LSRA implied */
+	OP (0, 0x46):
+	  A = ror (A);
+	  NEXT;		/* RORA implied */
+	OP (0, 0x47):
+	  A = asr (A);
+	  NEXT;		/* ASRA implied */
+	OP (0, 0x48):
+	  A = asl (A);
+	  NEXT;		/* ASLA implied */
+	OP (0, 0x49):
+	  A = rol (A);
+	  NEXT;		/* ROLA implied */
+	OP (0, 0x4a):
+	  A = dec (A);
+	  NEXT;		/* DECA implied */
+	OP (0, 0x4c):
+	  A = inc (A);
+	  NEXT;		/* INCA implied */
+	OP (0, 0x4d):
+	  tst (A);
+	  NEXT;		/* TSTA implied */
+	OP (0, 0x4f):
+	  A = clr (A);
+	  NEXT;		/* CLRA implied */
+
+	OP (0, 0x50):
+	  B = neg (B);
+	  NEXT;		/* NEGB implied */
+	OP (0, 0x53):
+	  B = com (B);
+	  NEXT;		/* COMB implied */
+	OP (0, 0x54):
+	  B = lsr (B);
+	  NEXT;		/* LSRB implied */
+	OP (0, 0x56):
+	  B = ror (B);
+	  NEXT;		/* RORB implied */
+	OP (0, 0x57):
+	  B = asr (B);
+	  NEXT;		/* ASRB implied */
+	OP (0, 0x58):
+	  B = asl (B);
+	  NEXT;		/* ASLB implied */
+	OP (0, 0x59):
+	  B = rol (B);
+	  NEXT;		/* ROLB implied */
+	OP (0, 0x5a):
+	  B = dec (B);
+	  NEXT;		/* DECB implied */
+	OP (0, 0x5c):
+	  B = inc (B);
+	  NEXT;		/* INCB implied */
+	OP (0, 0x5d):
+	  tst (B);
+	  NEXT;		/* TSTB implied */
+	OP (0, 0x5f):
+	  B = clr (B);
+	  NEXT;		/* CLRB implied */
+	OP (0, 0x60):
+	  indexed ();
+	  WRMEM (ea, neg (RDMEM (ea)));
+	  NEXT;		/* NEG indexed */
+#ifdef H6309
+	OP (0, 0x61):		/* OIM indexed */
+	  NEXT;
+	OP (0, 0x62):		/* AIM indexed */
+	  NEXT;
+#endif
+	OP (0, 0x63):
+	  indexed ();
+	  WRMEM (ea, com (RDMEM (ea)));
+	  NEXT;		/* COM indexed */
+	OP (0, 0x64):
+	  indexed ();
+	  WRMEM (ea, lsr (RDMEM (ea)));
+	  NEXT;		/* LSR indexed */
+#ifdef H6309
+	OP (0, 0x65):		/* EIM indexed */
+	  NEXT;
+#endif
+	OP (0, 0x66):
+	  indexed ();
+	  WRMEM (ea, ror (RDMEM (ea)));
+	  NEXT;		/* ROR indexed */
+	OP (0, 0x67):
+	  indexed ();
+	  WRMEM (ea, asr (RDMEM (ea)));
+	  NEXT;		/* ASR indexed */
+	OP (0, 0x68):
+	  indexed ();
+	  WRMEM (ea, asl (RDMEM (ea)));
+	  NEXT;		/* ASL indexed */
+	OP (0, 0x69):
+	  indexed ();
+	  WRMEM (ea, rol (RDMEM (ea)));
+	  NEXT;		/* ROL indexed */
+	OP (0, 0x6a):
+	  indexed ();
+	  WRMEM (ea, dec (RDMEM (ea)));
+	  NEXT;		/* DEC indexed */
+#ifdef H6309
+	OP (0, 0x6b):		/* TIM indexed */
+	  NEXT;
+#endif
+	OP (0, 0x6c):
+	  indexed ();
+	  WRMEM (ea, inc (RDMEM (ea)));
+	  NEXT;		/* INC indexed */
+	OP (0, 0x6d):
+	  indexed ();
+	  tst (RDMEM (ea));
+	  NEXT;		/* TST indexed */
+	OP (0, 0x6e):
+	  indexed ();
+	  cpu_clk += 1;
+	  PC = ea;
+     check_pc ();
+	  monitor_call (FC_TAIL_CALL);
+	  NEXT;		/* JMP indexed */
+	OP (0, 0x6f):
+	  indexed ();
+	  WRMEM (ea, clr (RDMEM (ea)));
+	  NEXT;		/* CLR indexed */
+	OP (0, 0x70):
+	  extended ();
+	  cpu_clk -= 5;
+	  WRMEM (ea, neg (RDMEM (ea)));
+	  NEXT;		/* NEG extended */
+#ifdef H6309
+	OP (0, 0x71):		/* OIM extended */
+	  NEXT;
+	OP (0, 0x72):		/* AIM extended */
+	  NEXT;
+#endif
+	OP (0, 0x73):
+	  extended ();
+	  cpu_clk -= 5;
+	  WRMEM (ea, com (RDMEM (ea)));
+	  NEXT;		/* COM extended */
+	OP (0, 0x74):
+	  extended ();
+	  cpu_clk -= 5;
+	  WRMEM (ea, lsr (RDMEM (ea)));
+	  NEXT;		/* LSR extended */
+#ifdef H6309
+	OP (0, 0x75):		/* EIM extended */
+	  NEXT;
+#endif
+	OP (0, 0x76):
+	  extended ();
+	  cpu_clk -= 5;
+	  WRMEM (ea, ror (RDMEM (ea)));
+	  NEXT;		/* ROR extended */
+	OP (0, 0x77):
+	  extended ();
+	  cpu_clk -= 5;
+	  WRMEM (ea, asr (RDMEM (ea)));
+	  NEXT;		/* ASR extended */
+	OP (0, 0x78):
+	  extended ();
+	  cpu_clk -= 5;
+	  WRMEM (ea, asl (RDMEM (ea)));
+	  NEXT;		/* ASL extended */
+	OP (0, 0x79):
+	  extended ();
+	  cpu_clk -= 5;
+	  WRMEM (ea, rol (RDMEM (ea)));
+	  NEXT;		/* ROL extended */
+	OP (0, 0x7a):
+	  extended ();
+	  cpu_clk -= 5;
+	  WRMEM (ea, dec (RDMEM (ea)));
+	  NEXT;		/* DEC extended */
+#ifdef H6309
+	OP (0, 0x7b):		/* TIM indexed */
+	  NEXT;
+#endif
+	OP (0, 0x7c):
+	  extended ();
+	  cpu_clk -= 5;
+	  WRMEM (ea, inc (RDMEM (ea)));
+	  NEXT;		/* INC extended */
+	OP (0, 0x7d):
+	  extended ();
+	  cpu_clk -= 5;
+	  tst (RDMEM (ea));
+	  NEXT;		/* TST extended */
+	OP (0, 0x7e):
+	  extended ();
+	  cpu_clk -= 4;
+	  PC = ea;
+     check_pc ();
+	  monitor_call (FC_TAIL_CALL);
+	  NEXT;		/* JMP extended */
+	OP (0, 0x7f):
+	  extended ();
+	  cpu_clk -= 5;
+	  WRMEM (ea, clr (RDMEM (ea)));
+	  NEXT;		/* CLR extended */
+	OP (0, 0x80):
+	  cpu_clk -= 2;
+	  A = sub (A, imm_byte ());
+	  NEXT;
+	OP (0, 0x81):
+	  cpu_clk -= 2;
+	  cmp (A, imm_byte ());
+	  NEXT;
+	OP (0, 0x82):
+	  cpu_clk -= 2;
+	  A = sbc (A, imm_byte ());
+	  NEXT;
+	OP (0, 0x83):
+	  cpu_clk -= 4;
+	  subd (imm_word ());
+	  NEXT;
+	OP (0, 0x84):
+	  cpu_clk -= 2;
+	  A = and (A, imm_byte ());
+	  NEXT;
+	OP (0, 0x85):
+	  cpu_clk -= 2;
+	  bit (A, imm_byte ());
+	  NEXT;
+	OP (0, 0x86):
+	  cpu_clk -= 2;
+	  A = ld (imm_byte ());
+	  NEXT;
+	OP (0, 0x88):
+	  cpu_clk -= 2;
+	  A = eor (A, imm_byte ());
+	  NEXT;
+	OP (0, 0x89):
+	  cpu_clk -= 2;
+	  A = adc (A, imm_byte ());
+	  NEXT;
+	OP (0, 0x8a):
+	  cpu_clk -= 2;
+	  A = or (A, imm_byte ());
+	  NEXT;
+	OP (0, 0x8b):
+	  cpu_clk -= 2;
+	  A = add (A, imm_byte ());
+	  NEXT;
+	OP (0, 0x8c):
+	  cpu_clk -= 4;
+	  cmp16 (X, imm_word ());
+	  NEXT;
+	OP (0, 0x8d):
+	  bsr ();
+	  NEXT;
+	OP (0, 0x8e):
+	  cpu_clk -= 3;
+	  X = ld16 (imm_word ());
+	  NEXT;
+
+	OP (0, 0x90):
+	  direct ();
+	  cpu_clk -= 4;
+	  A = sub (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0x91):
+	  direct ();
+	  cpu_clk -= 4;
+	  cmp (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0x92):
+	  direct ();
+	  cpu_clk -= 4;
+	  A = sbc (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0x93):
+	  direct ();
+	  cpu_clk -= 4;
+	  subd (RDMEM16 (ea));
+	  cpu_clk--;
+	  NEXT;
+	OP (0, 0x94):
+	  direct ();
+	  cpu_clk -= 4;
+	  A = and (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0x95):
+	  direct ();
+	  cpu_clk -= 4;
+	  bit (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0x96):
+	  direct ();
+	  cpu_clk -= 4;
+	  A = ld (RDMEM (ea));
+	  NEXT;
+	OP (0, 0x97):
+	  direct ();
+	  cpu_clk -= 4;
+	  st (A);
+	  NEXT;
+	OP (0, 0x98):
+	  direct ();
+	  cpu_clk -= 4;
+	  A = eor (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0x99):
+	  direct ();
+	  cpu_clk -= 4;
+	  A = adc (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0x9a):
+	  direct ();
+	  cpu_clk -= 4;
+	  A = or (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0x9b):
+	  direct ();
+	  cpu_clk -= 4;
+	  A = add (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0x9c):
+	  direct ();
+	  cpu_clk -= 4;
+	  cmp16 (X, RDMEM16 (ea));
+	  cpu_clk--;
+	  NEXT;
+	OP (0, 0x9d):
+	  direct ();
+	  cpu_clk -= 7;
+	  jsr ();
+	  NEXT;
+	OP (0, 0x9e):
+	  direct ();
+	  cpu_clk -= 4;
+	  X = ld16 (RDMEM16 (ea));
+	  NEXT;
+	OP (0, 0x9f):
+	  direct ();
+	  cpu_clk -= 4;
+	  st16 (X);
+	  NEXT;
+
+	OP (0, 0xa0):
+	  indexed ();
+	  A = sub (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xa1):
+	  indexed ();
+	  cmp (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xa2):
+	  indexed ();
+	  A = sbc (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xa3):
+	  indexed ();
+	  subd (RDMEM16 (ea));
+	  cpu_clk--;
+	  NEXT;
+	OP (0, 0xa4):
+	  indexed ();
+	  A = and (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xa5):
+	  indexed ();
+	  bit (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xa6):
+	  indexed ();
+	  A = ld (RDMEM (ea));
+	  NEXT;
+	OP (0, 0xa7):
+	  indexed ();
+	  st (A);
+	  NEXT;
+	OP (0, 0xa8):
+	  indexed ();
+	  A = eor (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xa9):
+	  indexed ();
+	  A = adc (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xaa):
+	  indexed ();
+	  A = or (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xab):
+	  indexed ();
+	  A = add (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xac):
+	  indexed ();
+	  cmp16 (X, RDMEM16 (ea));
+	  cpu_clk--;
+	  NEXT;
+	OP (0, 0xad):
+	  indexed ();
+	  cpu_clk -= 3;
+	  jsr ();
+	  NEXT;
+	OP (0, 0xae):
+	  indexed ();
+	  X = ld16 (RDMEM16 (ea));
+	  NEXT;
+	OP (0, 0xaf):
+	  indexed ();
+	  st16 (X);
+	  NEXT;
+
+	OP (0, 0xb0):
+	  extended ();
+	  cpu_clk -= 5;
+	  A = sub (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xb1):
+	  extended ();
+	  cpu_clk -= 5;
+	  cmp (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xb2):
+	  extended ();
+	  cpu_clk -= 5;
+	  A = sbc (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xb3):
+	  extended ();
+	  cpu_clk -= 5;
+	  subd (RDMEM16 (ea));
+	  cpu_clk--;
+	  NEXT;
+	OP (0, 0xb4):
+	  extended ();
+	  cpu_clk -= 5;
+	  A = and (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xb5):
+	  extended ();
+	  cpu_clk -= 5;
+	  bit (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xb6):
+	  extended ();
+	  cpu_clk -= 5;
+	  A = ld (RDMEM (ea));
+	  NEXT;
+	OP (0, 0xb7):
+	  extended ();
+	  cpu_clk -= 5;
+	  st (A);
+	  NEXT;
+	OP (0, 0xb8):
+	  extended ();
+	  cpu_clk -= 5;
+	  A = eor (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xb9):
+	  extended ();
+	  cpu_clk -= 5;
+	  A = adc (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xba):
+	  extended ();
+	  cpu_clk -= 5;
+	  A = or (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xbb):
+	  extended ();
+	  cpu_clk -= 5;
+	  A = add (A, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xbc):
+	  extended ();
+	  cpu_clk -= 5;
+	  cmp16 (X, RDMEM16 (ea));
+	  cpu_clk--;
+	  NEXT;
+	OP (0, 0xbd):
+	  extended ();
+	  cpu_clk -= 8;
+	  jsr ();
+	  NEXT;
+	OP (0, 0xbe):
+	  extended ();
+	  cpu_clk -= 5;
+	  X = ld16 (RDMEM16 (ea));
+	  NEXT;
+	OP (0, 0xbf):
+	  extended ();
+	  cpu_clk -= 5;
+	  st16 (X);
+	  NEXT;
+
+	OP (0, 0xc0):
+	  cpu_clk -= 2;
+	  B = sub (B, imm_byte ());
+	  NEXT;
+	OP (0, 0xc1):
+	  cpu_clk -= 2;
+	  cmp (B, imm_byte ());
+	  NEXT;
+	OP (0, 0xc2):
+	  cpu_clk -= 2;
+	  B = sbc (B, imm_byte ());
+	  NEXT;
+	OP (0, 0xc3):
+	  cpu_clk -= 4;
+	  addd (imm_word ());
+	  NEXT;
+	OP (0, 0xc4):
+	  cpu_clk -= 2;
+	  B = and (B, imm_byte ());
+	  NEXT;
+	OP (0, 0xc5):
+	  cpu_clk -= 2;
+	  bit (B, imm_byte ());
+	  NEXT;
+	OP (0, 0xc6):
+	  cpu_clk -= 2;
+	  B = ld (imm_byte ());
+	  NEXT;
+	OP (0, 0xc8):
+	  cpu_clk -= 2;
+	  B = eor (B, imm_byte ());
+	  NEXT;
+	OP (0, 0xc9):
+	  cpu_clk -= 2;
+	  B = adc (B, imm_byte ());
+	  NEXT;
+	OP (0, 0xca):
+	  cpu_clk -= 2;
+	  B = or (B, imm_byte ());
+	  NEXT;
+	OP (0, 0xcb):
+	  cpu_clk -= 2;
+	  B = add (B, imm_byte ());
+	  NEXT;
+	OP (0, 0xcc):
+	  cpu_clk -= 3;
+	  ldd (imm_word ());
+	  NEXT;
+#ifdef H6309
+	OP (0, 0xcd):		/* LDQ immed */
+	  NEXT;
+#endif
+	OP (0, 0xce):
+	  cpu_clk -= 3;
+	  U = ld16 (imm_word ());
+	  NEXT;
+
+	OP (0, 0xd0):
+	  direct ();
+	  cpu_clk -= 4;
+	  B = sub (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xd1):
+	  direct ();
+	  cpu_clk -= 4;
+	  cmp (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xd2):
+	  direct ();
+	  cpu_clk -= 4;
+	  B = sbc (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xd3):
+	  direct ();
+	  cpu_clk -= 4;
+	  addd (RDMEM16 (ea));
+	  cpu_clk--;
+	  NEXT;
+	OP (0, 0xd4):
+	  direct ();
+	  cpu_clk -= 4;
+	  B = and (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xd5):
+	  direct ();
+	  cpu_clk -= 4;
+	  bit (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xd6):
+	  direct ();
+	  cpu_clk -= 4;
+	  B = ld (RDMEM (ea));
+	  NEXT;
+	OP (0, 0xd7):
+	  direct ();
+	  cpu_clk -= 4;
+	  st (B);
+	  NEXT;
+	OP (0, 0xd8):
+	  direct ();
+	  cpu_clk -= 4;
+	  B = eor (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xd9):
+	  direct ();
+	  cpu_clk -= 4;
+	  B = adc (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xda):
+	  direct ();
+	  cpu_clk -= 4;
+	  B = or (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xdb):
+	  direct ();
+	  cpu_clk -= 4;
+	  B = add (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xdc):
+	  direct ();
+	  cpu_clk -= 4;
+	  ldd (RDMEM16 (ea));
+	  NEXT;
+	OP (0, 0xdd):
+	  direct ();
+	  cpu_clk -= 4;
+	  std ();
+	  NEXT;
+	OP (0, 0xde):
+	  direct ();
+	  cpu_clk -= 4;
+	  U = ld16 (RDMEM16 (ea));
+	  NEXT;
+	OP (0, 0xdf):
+	  direct ();
+	  cpu_clk -= 4;
+	  st16 (U);
+	  NEXT;
+
+	OP (0, 0xe0):
+	  indexed ();
+	  B = sub (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xe1):
+	  indexed ();
+	  cmp (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xe2):
+	  indexed ();
+	  B = sbc (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xe3):
+	  indexed ();
+	  addd (RDMEM16 (ea));
+	  cpu_clk--;
+	  NEXT;
+	OP (0, 0xe4):
+	  indexed ();
+	  B = and (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xe5):
+	  indexed ();
+	  bit (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xe6):
+	  indexed ();
+	  B = ld (RDMEM (ea));
+	  NEXT;
+	OP (0, 0xe7):
+	  indexed ();
+	  st (B);
+	  NEXT;
+	OP (0, 0xe8):
+	  indexed ();
+	  B = eor (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xe9):
+	  indexed ();
+	  B = adc (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xea):
+	  indexed ();
+	  B = or (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xeb):
+	  indexed ();
+	  B = add (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xec):
+	  indexed ();
+	  ldd (RDMEM16 (ea));
+	  NEXT;
+	OP (0, 0xed):
+	  indexed ();
+	  std ();
+	  NEXT;
+	OP (0, 0xee):
+	  indexed ();
+	  U = ld16 (RDMEM16 (ea));
+	  NEXT;
+	OP (0, 0xef):
+	  indexed ();
+	  st16 (U);
+	  NEXT;
+
+	OP (0, 0xf0):
+	  extended ();
+	  cpu_clk -= 5;
+	  B = sub (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xf1):
+	  extended ();
+	  cpu_clk -= 5;
+	  cmp (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xf2):
+	  extended ();
+	  cpu_clk -= 5;
+	  B = sbc (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xf3):
+	  extended ();
+	  cpu_clk -= 5;
+	  addd (RDMEM16 (ea));
+	  cpu_clk--;
+	  NEXT;
+	OP (0, 0xf4):
+	  extended ();
+	  cpu_clk -= 5;
+	  B = and (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xf5):
+	  extended ();
+	  cpu_clk -= 5;
+	  bit (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xf6):
+	  extended ();
+	  cpu_clk -= 5;
+	  B = ld (RDMEM (ea));
+	  NEXT;
+	OP (0, 0xf7):
+	  extended ();
+	  cpu_clk -= 5;
+	  st (B);
+	  NEXT;
+	OP (0, 0xf8):
+	  extended ();
+	  cpu_clk -= 5;
+	  B = eor (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xf9):
+	  extended ();
+	  cpu_clk -= 5;
+	  B = adc (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xfa):
+	  extended ();
+	  cpu_clk -= 5;
+	  B = or (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xfb):
+	  extended ();
+	  cpu_clk -= 5;
+	  B = add (B, RDMEM (ea));
+	  NEXT;
+	OP (0, 0xfc):
+	  extended ();
+	  cpu_clk -= 5;
+	  ldd (RDMEM16 (ea));
+	  NEXT;
+	OP (0, 0xfd):
+	  extended ();
+	  cpu_clk -= 5;
+	  std ();
+	  NEXT;
+	OP (0, 0xfe):
+	  extended ();
+	  cpu_clk -= 5;
+	  U = ld16 (RDMEM16 (ea));
+	  NEXT;
+	OP (0, 0xff):
+	  extended ();
+	  cpu_clk -= 5;
+	  st16 (U);
+	  NEXT;
+
+	OP_INVALID (0):
+	  cpu_clk -= 2;
+     sim_error ("invalid opcode '%02X'\n", opcode);
+     PC = iPC;
+	  NEXT;
+	}
+
+insn_done:
+      if (pd_timed)
+	{
+	  /* Keep the count only if nothing else moved the clock
+	  meanwhile (a slice change, an event or an interrupt);
+	  otherwise measure again on the next run */
+	  if (pd_adjusts == cpu_clk_adjusts)
+	    pd_timed->cycles = pd_clk - cpu_clk;
+	  pd_timed = NULL;
+	}
+	if (cc_changed)
+		cc_modified ();
+    }
+  while (cpu_clk > 0);
+
+#if DEBUG_HOOKS
+cpu_exit:
+#endif
+   if (PROFILING)
+     {
+       if (profile_enabled)
+	 profile_last->cycles += profile_clk - cpu_clk;
+       if (insnmix_enabled)
+	 insnmix_charge (profile_clk - cpu_clk);
+       if (tracefile_enabled)
+	 tracefile_pending += profile_clk - cpu_clk;
+       profile_clk = 0;
+     }
+   cpu_period -= cpu_clk;
+   cpu_clk = cpu_period;
+   return cpu_period;
+}
+
+#undef DISPATCH
+#undef OP
+#undef OP_INVALID
+#undef T
+#undef NEXT
+#undef MIX
+#undef PROFILING
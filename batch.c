@@ -0,0 +1,335 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Batch mode.  --batch=FILE runs every test listed in a manifest,
+each as a separate machine on a thread of its own (see INSTANCE),
+several at a time, and writes a single report.
+
+Each line of the manifest names a program, optionally followed by
+the exit code it must return (default 0) and a file holding the
+console output it must produce.  Blank lines and lines beginning with
+'#' are ignored.  All other options on the command line are given to
+every test.
+
+The report has one line per test, in manifest order, with the fields
+
+	program  PASS/FAIL  exit-code  cycles  host-ms  detail
+
+separated by tabs, then a summary line.  Lines that are not about a
+single test begin with '#'. */
+
+#include "6809.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/* The most options that are passed on to each test */
+#define MAX_BATCH_ARGS 64
+
+struct batch;
+
+struct batch_test
+{
+	struct batch *batch;
+
+	/* From the manifest */
+	char *program;
+	int expected_exit;
+	char *expected_file;
+
+	/* The results */
+	int passed;
+	int exit_code;
+	unsigned long cycles;
+	long ms;
+	char detail[128];
+};
+
+struct batch
+{
+	struct batch_test *tests;
+	unsigned int count;
+
+	/* The next test that no worker has taken yet */
+	unsigned int next;
+	pthread_mutex_t lock;
+
+	/* The options that every test is run with */
+	int argc;
+	char *argv[MAX_BATCH_ARGS];
+};
+
+/* Nonzero while running as one test of a batch */
+INSTANCE int batch_mode = 0;
+
+/* The options that start a batch */
+INSTANCE const char *batch_manifest = NULL;
+INSTANCE const char *batch_report = NULL;
+INSTANCE int batch_jobs = 0;
+
+
+/**
+ * Say whether a command-line argument is one of the batch options,
+ * which are not passed on to the tests.
+ */
+static int
+batch_option_p (const char *arg)
+{
+	static const char *const names[] = { "batch", "jobs", "report", NULL };
+	const char *const *name;
+	size_t len;
+
+	if (arg[0] != '-' || arg[1] != '-')
+		return 0;
+	for (name = names; *name; name++)
+	{
+		len = strlen (*name);
+		if (!strncmp (arg+2, *name, len) && (arg[len+2] == '\0' || arg[len+2] == '='))
+			return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Read the manifest.  Returns zero on success.
+ */
+static int
+batch_load (struct batch *batch, const char *filename)
+{
+	FILE *fp;
+	char line[1024];
+	char *program, *exit_code, *output, *save_ptr;
+	unsigned int size = 0;
+	struct batch_test *test;
+
+	fp = fopen (filename, "r");
+	if (!fp)
+	{
+		fprintf (stderr, "m6809-run: cannot open manifest %s\n", filename);
+		return -1;
+	}
+
+	while (fgets (line, sizeof (line), fp))
+	{
+		program = strtok_r (line, " \t\r\n", &save_ptr);
+		if (!program || *program == '#')
+			continue;
+		exit_code = strtok_r (NULL, " \t\r\n", &save_ptr);
+		output = strtok_r (NULL, " \t\r\n", &save_ptr);
+
+		if (batch->count == size)
+		{
+			size = size ? size * 2 : 64;
+			batch->tests = realloc (batch->tests, size * sizeof (struct batch_test));
+		}
+		test = &batch->tests[batch->count++];
+		memset (test, 0, sizeof (struct batch_test));
+		test->batch = batch;
+		test->program = strdup (program);
+		test->expected_exit = exit_code ? strtol (exit_code, NULL, 0) : 0;
+		test->expected_file = output ? strdup (output) : NULL;
+	}
+
+	fclose (fp);
+	return 0;
+}
+
+
+/**
+ * Decide whether a test passed, given the console output it produced.
+ */
+static void
+batch_check (struct batch_test *test, const char *output, size_t len)
+{
+	FILE *fp;
+	int c;
+	size_t n;
+
+	if (test->exit_code != test->expected_exit)
+	{
+		sprintf (test->detail, "exit code %d, expected %d",
+			test->exit_code, test->expected_exit);
+		return;
+	}
+
+	if (test->expected_file)
+	{
+		fp = fopen (test->expected_file, "r");
+		if (!fp)
+		{
+			snprintf (test->detail, sizeof (test->detail),
+				"cannot open %s", test->expected_file);
+			return;
+		}
+		for (n = 0; (c = getc (fp)) != EOF && n < len && c == (U8)output[n]; n++)
+			;
+		fclose (fp);
+		if (c != EOF || n != len)
+		{
+			sprintf (test->detail, "output differs at byte %lu", (unsigned long)n);
+			return;
+		}
+	}
+
+	test->passed = 1;
+}
+
+
+/**
+ * Run one test.  This is the entire life of a thread, since a thread
+ * can run only one machine.
+ */
+static void *
+batch_test_main (void *arg)
+{
+	struct batch_test *test = arg;
+	struct batch *batch = test->batch;
+	char *argv[MAX_BATCH_ARGS + 3];
+	int argc = 0;
+	int n;
+	char *output = NULL;
+	size_t len = 0;
+
+	if (access (test->program, R_OK))
+	{
+		snprintf (test->detail, sizeof (test->detail),
+			"cannot open %s", test->program);
+		return NULL;
+	}
+
+	/* The program goes first, so that it is the first plain argument
+	even if an option takes the next one. */
+	argv[argc++] = batch->argv[0];
+	argv[argc++] = test->program;
+	for (n = 1; n < batch->argc; n++)
+		argv[argc++] = batch->argv[n];
+	argv[argc] = NULL;
+
+	batch_mode = 1;
+	console_output = open_memstream (&output, &len);
+	test->exit_code = sim_main (argc, argv);
+	test->cycles = get_cycles ();
+	test->ms = get_elapsed_realtime ();
+	fclose (console_output);
+
+	batch_check (test, output, len);
+	free (output);
+	return NULL;
+}
+
+
+/**
+ * A worker takes the tests one at a time until none are left.
+ */
+static void *
+batch_worker (void *arg)
+{
+	struct batch *batch = arg;
+	struct batch_test *test;
+	pthread_t thread;
+
+	for (;;)
+	{
+		pthread_mutex_lock (&batch->lock);
+		test = batch->next < batch->count ? &batch->tests[batch->next++] : NULL;
+		pthread_mutex_unlock (&batch->lock);
+		if (!test)
+			return NULL;
+
+		if (pthread_create (&thread, NULL, batch_test_main, test))
+			strcpy (test->detail, "cannot create thread");
+		else
+			pthread_join (thread, NULL);
+	}
+}
+
+
+/**
+ * Run every test in the manifest given by --batch, passing on the
+ * other options in ARGV.  Returns the exit status for the batch: zero
+ * if every test passed.
+ */
+int
+batch_run (int argc, char *argv[])
+{
+	struct batch batch;
+	pthread_t *workers;
+	unsigned int jobs, n, passed;
+	unsigned long cycles;
+	long ms;
+	FILE *fp;
+	struct batch_test *test;
+
+	memset (&batch, 0, sizeof (batch));
+	pthread_mutex_init (&batch.lock, NULL);
+	for (n = 0; n < argc && batch.argc < MAX_BATCH_ARGS; n++)
+		if (!batch_option_p (argv[n]))
+			batch.argv[batch.argc++] = argv[n];
+
+	if (batch_load (&batch, batch_manifest))
+		return 1;
+
+	jobs = batch_jobs > 0 ? batch_jobs : sysconf (_SC_NPROCESSORS_ONLN);
+	if (jobs > batch.count)
+		jobs = batch.count;
+	if (jobs < 1)
+		jobs = 1;
+
+	workers = malloc (jobs * sizeof (pthread_t));
+	for (n = 0; n < jobs; n++)
+		pthread_create (&workers[n], NULL, batch_worker, &batch);
+	for (n = 0; n < jobs; n++)
+		pthread_join (workers[n], NULL);
+	free (workers);
+
+	fp = batch_report ? fopen (batch_report, "w") : stdout;
+	if (!fp)
+	{
+		fprintf (stderr, "m6809-run: cannot write %s\n", batch_report);
+		fp = stdout;
+	}
+
+	passed = 0;
+	cycles = 0;
+	ms = 0;
+	fprintf (fp, "# program\tresult\texit\tcycles\tms\tdetail\n");
+	for (n = 0; n < batch.count; n++)
+	{
+		test = &batch.tests[n];
+		fprintf (fp, "%s\t%s\t%d\t%lu\t%ld\t%s\n", test->program,
+			test->passed ? "PASS" : "FAIL", test->exit_code,
+			test->cycles, test->ms, test->detail);
+		passed += test->passed;
+		cycles += test->cycles;
+		ms += test->ms;
+		free (test->program);
+		free (test->expected_file);
+	}
+	fprintf (fp, "# %u tests, %u passed, %u failed, %lu cycles, "
+		"%ld ms in tests, %ld ms elapsed, %u at a time\n",
+		batch.count, passed, batch.count - passed, cycles,
+		ms, get_elapsed_realtime (), jobs);
+
+	if (fp != stdout)
+		fclose (fp);
+	free (batch.tests);
+	pthread_mutex_destroy (&batch.lock);
+	return passed == batch.count ? 0 : 1;
+}
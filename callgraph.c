@@ -0,0 +1,309 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The call graph profiler.  With --callgraph=FILE, every entry on the
+function call stack kept by monitor_call and monitor_return (see
+monitor.c) is timed.  When a call returns, its cycles are charged to
+the edge from the caller to the callee, and the cycles spent in the
+callee itself, not in the functions it called, to the callee.
+
+Time spent in interrupt handlers is not charged to the code that was
+interrupted: handlers are shown as called from a separate
+"<interrupts>" function.  A function reached by a tail call (a jump
+to a symbol) is counted as called by the function that jumped, and
+returns together with it.
+
+At the end of the run, the graph is written in the format of
+callgrind, so that it can be viewed with KCachegrind.  Functions are
+named after the program's symbols, or by device and address. */
+
+#include "6809.h"
+#include "monitor.h"
+
+extern absolute_address_t to_absolute (unsigned long cpuaddr);
+
+#define CG_HASH_SIZE 1024
+
+/* A function, identified by the absolute address of its entry */
+struct cg_function
+{
+	absolute_address_t addr;
+	const char *name;
+	unsigned long self_cycles;
+	unsigned int id;
+	int named;                      /* Nonzero once its name is written */
+	struct cg_function *hash_next;
+	struct cg_function *next;
+	struct cg_edge *edges;          /* The functions it called */
+};
+
+/* The calls from one function to another */
+struct cg_edge
+{
+	struct cg_function *callee;
+	unsigned long calls;
+	unsigned long cycles;
+	struct cg_edge *next;
+};
+
+/* The option that enables the call graph */
+INSTANCE const char *callgraph_file = NULL;
+
+/* Nonzero if calls are being timed */
+INSTANCE int callgraph_enabled = 0;
+
+static INSTANCE struct cg_function *cg_hash[CG_HASH_SIZE];
+
+/* All of the functions, last seen first */
+static INSTANCE struct cg_function *cg_functions = NULL;
+static INSTANCE unsigned int cg_function_count = 0;
+
+/* Where interrupt handlers are called from */
+static INSTANCE struct cg_function *cg_interrupts;
+
+
+static struct cg_function *
+cg_function_new (absolute_address_t addr)
+{
+	struct cg_function *fn = calloc (1, sizeof (struct cg_function));
+
+	fn->addr = addr;
+	fn->id = ++cg_function_count;
+	fn->next = cg_functions;
+	cg_functions = fn;
+	return fn;
+}
+
+
+/**
+ * Return the function that starts at ADDR.
+ */
+static struct cg_function *
+cg_function_at (absolute_address_t addr)
+{
+	struct cg_function **bucket = &cg_hash[addr % CG_HASH_SIZE];
+	struct cg_function *fn;
+
+	for (fn = *bucket; fn; fn = fn->hash_next)
+		if (fn->addr == addr)
+			return fn;
+
+	fn = cg_function_new (addr);
+	fn->hash_next = *bucket;
+	*bucket = fn;
+	return fn;
+}
+
+
+/**
+ * Return the edge for calls from CALLER to CALLEE.  The edge found is
+ * moved to the front of the list, as the same call is often repeated.
+ */
+static struct cg_edge *
+cg_edge_find (struct cg_function *caller, struct cg_function *callee)
+{
+	struct cg_edge **pe, *e;
+
+	for (pe = &caller->edges; (e = *pe) != NULL; pe = &e->next)
+		if (e->callee == callee)
+		{
+			*pe = e->next;
+			break;
+		}
+
+	if (!e)
+	{
+		e = calloc (1, sizeof (struct cg_edge));
+		e->callee = callee;
+	}
+	e->next = caller->edges;
+	caller->edges = e;
+	return e;
+}
+
+
+/**
+ * Start timing the call FC, which has just been pushed.
+ */
+void
+callgraph_enter (struct function_call *fc)
+{
+	struct cg_function *caller;
+
+	fc->entry_cycles = get_cycles ();
+	fc->child_cycles = fc->irq_cycles = 0;
+	fc->fn = cg_function_at (to_absolute (fc->entry_point));
+	caller = (fc->flags & FC_INTERRUPT) ? cg_interrupts : fc[-1].fn;
+	fc->edge = cg_edge_find (caller, fc->fn);
+}
+
+
+/**
+ * Charge the call FC, which is returning, to its function and to the
+ * edge it was called by.
+ */
+void
+callgraph_leave (struct function_call *fc)
+{
+	unsigned long elapsed = get_cycles () - fc->entry_cycles - fc->irq_cycles;
+	struct function_call *parent = fc - 1;
+
+	fc->fn->self_cycles += elapsed - fc->child_cycles;
+	fc->edge->calls++;
+	fc->edge->cycles += elapsed;
+
+	/* The caller was running all along, except for interrupts */
+	if (fc->flags & FC_INTERRUPT)
+		parent->irq_cycles += elapsed + fc->irq_cycles;
+	else
+	{
+		parent->child_cycles += elapsed;
+		parent->irq_cycles += fc->irq_cycles;
+	}
+}
+
+
+/**
+ * Start timing calls, if --callgraph was given.  The code running now
+ * is taken to be the function at the reset vector.  The JIT is turned
+ * off, as translated code does not report calls.
+ */
+void
+callgraph_init (void)
+{
+	struct function_call *root = &fctab[0];
+
+	if (!callgraph_file)
+		return;
+	callgraph_enabled = 1;
+	jit_enabled = 0;
+
+	cg_interrupts = cg_function_new (0);
+	cg_interrupts->name = "<interrupts>";
+
+	root->entry_cycles = get_cycles ();
+	root->child_cycles = root->irq_cycles = 0;
+	root->fn = cg_function_at (to_absolute (root->entry_point));
+	root->edge = NULL;
+}
+
+
+static void
+cg_write_name (FILE *fp, const char *key, struct cg_function *fn)
+{
+	const char *name;
+
+	fprintf (fp, "%s=(%u)", key, fn->id);
+	if (fn->named)
+	{
+		putc ('\n', fp);
+		return;
+	}
+	fn->named = 1;
+
+	if (fn->name)
+		fprintf (fp, " %s\n", fn->name);
+	else if ((name = sym_lookup (&program_symtab, fn->addr)) != NULL)
+		fprintf (fp, " %s\n", name);
+	else
+		fprintf (fp, " %02lX:%04lX\n", fn->addr >> 28, fn->addr & 0xFFFFFFF);
+}
+
+
+/**
+ * Write the call graph at the end of the run.  The calls that have
+ * not returned are ended first.
+ */
+void
+callgraph_report (void)
+{
+	struct function_call *root = &fctab[0];
+	struct cg_function *fn;
+	struct cg_edge *e;
+	unsigned long total;
+	FILE *fp;
+
+	if (!callgraph_enabled)
+		return;
+
+	while (current_function_call > root)
+		callgraph_leave (current_function_call--);
+	total = get_cycles () - root->entry_cycles;
+	root->fn->self_cycles += total - root->irq_cycles - root->child_cycles;
+	callgraph_enabled = 0;
+
+	if ((fp = fopen (callgraph_file, "w")) == NULL)
+	{
+		fprintf (stderr, "m6809-run: cannot write %s\n", callgraph_file);
+		return;
+	}
+
+	fprintf (fp, "# callgrind format\n");
+	fprintf (fp, "version: 1\n");
+	fprintf (fp, "creator: m6809-run\n");
+	if (prog_name)
+		fprintf (fp, "cmd: %s\n", prog_name);
+	fprintf (fp, "positions: instr\n");
+	fprintf (fp, "events: Cycles\n");
+	fprintf (fp, "summary: %lu\n", total);
+
+	for (fn = cg_functions; fn; fn = fn->next)
+	{
+		if (!fn->self_cycles && !fn->edges)
+			continue;
+		putc ('\n', fp);
+		cg_write_name (fp, "fn", fn);
+		fprintf (fp, "0x%lX %lu\n", fn->addr, fn->self_cycles);
+		for (e = fn->edges; e; e = e->next)
+		{
+			if (!e->calls)
+				continue;
+			cg_write_name (fp, "cfn", e->callee);
+			fprintf (fp, "calls=%lu 0x%lX\n", e->calls, e->callee->addr);
+			fprintf (fp, "0x%lX %lu\n", fn->addr, e->cycles);
+		}
+	}
+	fclose (fp);
+}
+
+
+/**
+ * Free the call graph at the end of the simulation.
+ */
+void
+callgraph_free (void)
+{
+	struct cg_function *fn;
+	struct cg_edge *e;
+
+	while ((fn = cg_functions) != NULL)
+	{
+		cg_functions = fn->next;
+		while ((e = fn->edges) != NULL)
+		{
+			fn->edges = e->next;
+			free (e);
+		}
+		free (fn);
+	}
+	memset (cg_hash, 0, sizeof (cg_hash));
+	cg_function_count = 0;
+	callgraph_enabled = 0;
+}
@@ -29,56 +29,81 @@ typedef enum
 /********************* Global Data ************************/
 /**********************************************************/
 
-unsigned int break_count = 0;
-breakpoint_t breaktab[MAX_BREAKS];
-unsigned int active_break_count = 0;
-
-unsigned int display_count = 0;
-display_t displaytab[MAX_DISPLAYS];
-
-unsigned int history_count = 0;
-unsigned long historytab[MAX_HISTORY];
-
-absolute_address_t examine_addr = 0;
-unsigned int examine_repeat = 1;
-datatype_t examine_type;
+/* The breakpoints and watchpoints, indexed by their IDs.  The table
+grows as needed. */
+INSTANCE unsigned int break_count = 0;
+INSTANCE breakpoint_t *breaktab;
+
+/* The number of enabled breakpoints, of enabled watchpoints, and of
+those that watch reads */
+INSTANCE unsigned int active_break_count = 0;
+INSTANCE unsigned int active_watch_count = 0;
+INSTANCE unsigned int read_watch_count = 0;
+
+/* The enabled breakpoints and watchpoints on a single address, hashed
+by address.  Each entry is the index of the first one in the chain
+plus 1, or 0 if there are none, so that most addresses are rejected
+with a single test.  Watchpoints on a range of addresses are kept in
+a chain of their own. */
+#define BREAK_HASH_SIZE 1024
+INSTANCE unsigned int break_hash[BREAK_HASH_SIZE];
+INSTANCE unsigned int break_ranges;
+
+/* The number of enabled watchpoints that cover each bus map sized page
+of each device.  The bus marks the maps of those pages as watched,
+and only calls the watchpoint hooks for them. */
+static INSTANCE unsigned short *watch_pages[MAX_BUS_DEVICES];
+static INSTANCE unsigned long watch_page_limit[MAX_BUS_DEVICES];
+
+INSTANCE unsigned int display_count = 0;
+INSTANCE display_t displaytab[MAX_DISPLAYS];
+
+INSTANCE unsigned int history_count = 0;
+INSTANCE unsigned long historytab[MAX_HISTORY];
+
+INSTANCE absolute_address_t examine_addr = 0;
+INSTANCE unsigned int examine_repeat = 1;
+INSTANCE datatype_t examine_type;
 
 /* Thread tracking. thread_current points to a location in
  * target memory where the current thread ID is kept.  thread_id
  * is the debugger's current cached value of that, to avoid
  * reading memory constantly.  The size allows for targets to
  * define the ID format differently. */
-unsigned int thread_id_size = 2;
-absolute_address_t thread_current;
-absolute_address_t thread_id = 0;
-thread_t threadtab[MAX_THREADS];
+INSTANCE unsigned int thread_id_size = 2;
+INSTANCE absolute_address_t thread_current;
+INSTANCE absolute_address_t thread_id = 0;
+INSTANCE thread_t threadtab[MAX_THREADS];
 
 #define MAX_CMD_QUEUES 8
-int command_stack_depth = -1;
-cmdqueue_t command_stack[MAX_CMD_QUEUES];
+INSTANCE int command_stack_depth = -1;
+INSTANCE cmdqueue_t command_stack[MAX_CMD_QUEUES];
 
 #define MAX_TRACE 256
-target_addr_t trace_buffer[MAX_TRACE];
-unsigned int trace_offset = 0;
+INSTANCE target_addr_t trace_buffer[MAX_TRACE];
+INSTANCE unsigned int trace_offset = 0;
 
-int stop_after_ms = 0;
+INSTANCE int stop_after_ms = 0;
 
-datatype_t print_type;
+INSTANCE datatype_t print_type;
 
-char *command_flags;
+INSTANCE char *command_flags;
 
-int exit_command_loop;
+INSTANCE int exit_command_loop;
 
 #define IRQ_CYCLE_COUNTS 128
-unsigned int irq_cycle_tab[IRQ_CYCLE_COUNTS] = { 0, };
-unsigned int irq_cycle_entry = 0;
-unsigned long irq_cycles = 0;
+INSTANCE unsigned int irq_cycle_tab[IRQ_CYCLE_COUNTS] = { 0, };
+INSTANCE unsigned int irq_cycle_entry = 0;
+INSTANCE unsigned long irq_cycles = 0;
 
 unsigned long eval (char *expr);
 unsigned long eval_mem (char *expr, eval_mode_t mode);
-extern int auto_break_insn_count;
+struct expr_node *expr_compile (const char *expr);
+unsigned long expr_eval (struct expr_node *e);
+void expr_free (struct expr_node *e);
+extern INSTANCE int auto_break_insn_count;
 
-FILE *command_input;
+INSTANCE FILE *command_input;
 
 /**********************************************************/
 /******************** 6809 Functions **********************/
@@ -149,6 +174,7 @@ assign_virtual (const char *name, unsigned long val)
       print_addr (val);
       putchar ('\n');
       thread_current = val;
+      bus_fast_update (0, NUM_BUS_MAPS);
    }
 }
 
@@ -179,21 +205,6 @@ eval_virtual (const char *name)
 }
 
 
-void
-eval_assign (char *expr, unsigned long val)
-{
-	if (*expr == '$')
-	{
-		assign_virtual (expr+1, val);
-	}
-   else
-   {
-      absolute_address_t dst = eval_mem (expr, LVALUE);
-      abs_write8 (dst, val);
-   }
-}
-
-
 unsigned long
 target_read (absolute_address_t addr, unsigned int size)
 {
@@ -246,6 +257,64 @@ parse_size_flag (const char *flags, unsigned int *sizep)
 }
 
 
+/* Expressions are compiled into a tree once, so that breakpoint
+conditions and display expressions do not have to be parsed again
+every time they are evaluated.  Symbols of the program and the
+handlers of the built-in variables are looked up when compiling;
+other variables, registers and memory are read when evaluating. */
+enum expr_op
+{
+   EXPR_CONST,       /* value */
+   EXPR_HISTORY,     /* history entry number value */
+   EXPR_HISTORY_BACK,/* history entry value before the last */
+   EXPR_VIRTUAL,     /* built-in variable, read by handler */
+   EXPR_INTERNAL,    /* user variable name */
+   EXPR_ASSIGN_VIRTUAL, /* name = right */
+   EXPR_ASSIGN_MEM,  /* [left] = right */
+   EXPR_EQ,
+   EXPR_NE,
+   EXPR_ADD,
+   EXPR_SUB,
+   EXPR_MUL,
+   EXPR_DIV,
+   EXPR_MAKE_ADDR,   /* device left, offset right */
+   EXPR_ABSOLUTE,    /* left as a CPU address */
+   EXPR_READ,        /* the byte at absolute address left */
+};
+
+struct expr_node
+{
+   enum expr_op op;
+   unsigned long value;
+   virtual_handler_t handler;
+   char *name;
+   struct expr_node *left, *right;
+};
+
+
+static struct expr_node *
+expr_node (enum expr_op op, struct expr_node *left, struct expr_node *right)
+{
+   struct expr_node *e = calloc (1, sizeof (struct expr_node));
+   e->op = op;
+   e->left = left;
+   e->right = right;
+   return e;
+}
+
+
+void
+expr_free (struct expr_node *e)
+{
+   if (!e)
+      return;
+   expr_free (e->left);
+   expr_free (e->right);
+   free (e->name);
+   free (e);
+}
+
+
 char *
 match_binary (char *expr, const char *op, char **secondp)
 {
@@ -260,176 +329,396 @@ match_binary (char *expr, const char *op, char **secondp)
 }
 
 
-int
-fold_comparisons (char *expr, unsigned long *value)
-{
-   char *p;
-   if (match_binary (expr, "==", &p))
-      *value = (eval (expr) == eval (p));
-   else if (match_binary (expr, "!=", &p))
-      *value = (eval (expr) != eval (p));
-   else
-      return 0;
-   return 1;
-}
+static struct expr_node *compile (char *expr);
 
 
-int
-fold_binary (char *expr, const char op, unsigned long *valp)
+static struct expr_node *
+compile_binary (char *expr, const char op)
 {
-	char *p;
-	unsigned long val1, val2;
+   char *p;
+   struct expr_node *left;
 
-	if ((p = strchr (expr, op)) == NULL)
-		return 0;
+   if ((p = strchr (expr, op)) == NULL)
+      return NULL;
 
    /* If the operator is the first character of the expression,
     * then it's really a unary and shouldn't match here. */
    if (p == expr)
-      return 0;
+      return NULL;
 
    *p++ = '\0';
-	val1 = eval (expr);
-	val2 = eval (p);
-
-	switch (op)
-	{
-		case '+': *valp = val1 + val2; break;
-		case '-': *valp = val1 - val2; break;
-		case '*': *valp = val1 * val2; break;
-		case '/': *valp = val1 / val2; break;
-	}
-	return 1;
+   left = compile (expr);
+   switch (op)
+   {
+      case '+': return expr_node (EXPR_ADD, left, compile (p));
+      case '-': return expr_node (EXPR_SUB, left, compile (p));
+      case '*': return expr_node (EXPR_MUL, left, compile (p));
+      default:  return expr_node (EXPR_DIV, left, compile (p));
+   }
 }
 
+
 /**
- * Evaluate a memory expression, as an lvalue or rvalue.
+ * Compile a memory expression, as an lvalue or rvalue.
  */
-unsigned long
-eval_mem (char *expr, eval_mode_t mode)
+static struct expr_node *
+compile_mem (char *expr, eval_mode_t mode)
 {
    char *p;
+   struct expr_node *e;
    unsigned long val;
 
    /* First evaluate the address */
    if ((p = strchr (expr, ':')) != NULL)
    {
       *p++ = '\0';
-      val = MAKE_ADDR (eval (expr), eval (p));
+      e = compile (expr);
+      e = expr_node (EXPR_MAKE_ADDR, e, compile (p));
    }
    else if (isalpha (*expr))
    {
       if (sym_find (&program_symtab, expr, &val, 0))
          val = 0;
+      e = expr_node (EXPR_CONST, NULL, NULL);
+      e->value = val;
    }
    else
    {
       /* TODO - if expr is already in absolute form,
       this explodes ! */
-      val = to_absolute (eval (expr));
+      e = expr_node (EXPR_ABSOLUTE, compile (expr), NULL);
    }
 
    /* If mode is RVALUE, then dereference it */
    if (mode == RVALUE)
-      val = target_read (val, 1);
-
-   return val;
+      e = expr_node (EXPR_READ, e, NULL);
+   return e;
 }
 
 
 /**
- * Evaluate an expression, given as a string.
- * The return is the value (rvalue) of the expression.
+ * Compile an expression.  The string is split up in place.
  *
  * TODO:
  * - Support typecasts ( {TYPE}ADDR )
  *
  */
-unsigned long
-eval (char *expr)
+static struct expr_node *
+compile (char *expr)
 {
    char *p;
+   struct expr_node *e;
    unsigned long val;
 
-   if (fold_comparisons (expr, &val));
+   if (match_binary (expr, "==", &p))
+   {
+      e = compile (expr);
+      return expr_node (EXPR_EQ, e, compile (p));
+   }
+   else if (match_binary (expr, "!=", &p))
+   {
+      e = compile (expr);
+      return expr_node (EXPR_NE, e, compile (p));
+   }
    else if ((p = strchr (expr, '=')) != NULL)
-	{
+   {
       *p++ = '\0';
-		val = eval (p);
-		eval_assign (expr, val);
-	}
-	else if (fold_binary (expr, '+', &val));
-	else if (fold_binary (expr, '-', &val));
-	else if (fold_binary (expr, '*', &val));
-	else if (fold_binary (expr, '/', &val));
+      if (*expr == '$')
+      {
+         e = expr_node (EXPR_ASSIGN_VIRTUAL, NULL, compile (p));
+         e->name = strdup (expr+1);
+      }
+      else
+      {
+         e = compile_mem (expr, LVALUE);
+         e = expr_node (EXPR_ASSIGN_MEM, e, compile (p));
+      }
+      return e;
+   }
+   else if ((e = compile_binary (expr, '+')) != NULL);
+   else if ((e = compile_binary (expr, '-')) != NULL);
+   else if ((e = compile_binary (expr, '*')) != NULL);
+   else if ((e = compile_binary (expr, '/')) != NULL);
    else if (*expr == '$')
    {
       if (expr[1] == '$')
-         val = eval_historical (history_count - strtoul (expr+2, NULL, 10));
-      else if (isdigit (expr[1]))
-         val = eval_historical (strtoul (expr+1, NULL, 10));
-      else if (!expr[1])
-         val = eval_historical (0);
+      {
+         e = expr_node (EXPR_HISTORY_BACK, NULL, NULL);
+         e->value = strtoul (expr+2, NULL, 10);
+      }
+      else if (isdigit (expr[1]) || !expr[1])
+      {
+         e = expr_node (EXPR_HISTORY, NULL, NULL);
+         e->value = strtoul (expr+1, NULL, 10);
+      }
+      else if (!sym_find (&auto_symtab, expr+1, &val, 0))
+      {
+         e = expr_node (EXPR_VIRTUAL, NULL, NULL);
+         e->handler = (virtual_handler_t)val;
+      }
       else
-         val = eval_virtual (expr+1);
+      {
+         e = expr_node (EXPR_INTERNAL, NULL, NULL);
+         e->name = strdup (expr+1);
+      }
    }
    else if (*expr == '&')
    {
-      val = eval_mem (expr+1, LVALUE);
+      e = compile_mem (expr+1, LVALUE);
    }
    else if (isalpha (*expr))
    {
-      val = eval_mem (expr, RVALUE);
+      e = compile_mem (expr, RVALUE);
    }
    else
    {
-      val = strtoul (expr, NULL, 0);
+      e = expr_node (EXPR_CONST, NULL, NULL);
+      e->value = strtoul (expr, NULL, 0);
+   }
+
+   return e;
+}
+
+
+/**
+ * Compile the expression EXPR, which is left alone.
+ */
+struct expr_node *
+expr_compile (const char *expr)
+{
+   char *copy = strdup (expr);
+   struct expr_node *e = compile (copy);
+   free (copy);
+   return e;
+}
+
+
+/**
+ * Evaluate a compiled expression.
+ */
+unsigned long
+expr_eval (struct expr_node *e)
+{
+   unsigned long val;
+
+   switch (e->op)
+   {
+      case EXPR_CONST:
+         return e->value;
+      case EXPR_HISTORY:
+         return eval_historical (e->value);
+      case EXPR_HISTORY_BACK:
+         return eval_historical (history_count - e->value);
+      case EXPR_VIRTUAL:
+         e->handler (&val, 0);
+         return val;
+      case EXPR_INTERNAL:
+         return eval_virtual (e->name);
+      case EXPR_ASSIGN_VIRTUAL:
+         val = expr_eval (e->right);
+         assign_virtual (e->name, val);
+         return val;
+      case EXPR_ASSIGN_MEM:
+         val = expr_eval (e->right);
+         abs_write8 (expr_eval (e->left), val);
+         return val;
+      case EXPR_EQ:
+         return expr_eval (e->left) == expr_eval (e->right);
+      case EXPR_NE:
+         return expr_eval (e->left) != expr_eval (e->right);
+      case EXPR_ADD:
+         return expr_eval (e->left) + expr_eval (e->right);
+      case EXPR_SUB:
+         return expr_eval (e->left) - expr_eval (e->right);
+      case EXPR_MUL:
+         return expr_eval (e->left) * expr_eval (e->right);
+      case EXPR_DIV:
+         val = expr_eval (e->right);
+         return expr_eval (e->left) / val;
+      case EXPR_MAKE_ADDR:
+         val = expr_eval (e->left);
+         return MAKE_ADDR (val, expr_eval (e->right));
+      case EXPR_ABSOLUTE:
+         return to_absolute (expr_eval (e->left));
+      case EXPR_READ:
+         return target_read (expr_eval (e->left), 1);
    }
+   return 0;
+}
+
+
+/**
+ * Evaluate a memory expression, as an lvalue or rvalue.
+ */
+unsigned long
+eval_mem (char *expr, eval_mode_t mode)
+{
+   struct expr_node *e = compile_mem (expr, mode);
+   unsigned long val = expr_eval (e);
 
+   expr_free (e);
    return val;
 }
 
 
+/**
+ * Evaluate an expression, given as a string.
+ * The return is the value (rvalue) of the expression.
+ */
+unsigned long
+eval (char *expr)
+{
+   struct expr_node *e = expr_compile (expr);
+   unsigned long val = expr_eval (e);
+
+   expr_free (e);
+   return val;
+}
+
+
+static inline unsigned int
+brkhash (absolute_address_t addr)
+{
+   return ((addr >> 28) * 61 + addr) % BREAK_HASH_SIZE;
+}
+
+
+/**
+ * Return the chain that BR belongs in.
+ */
+static unsigned int *
+brkchain (breakpoint_t *br)
+{
+   if (br->end != br->addr)
+      return &break_ranges;
+   return &break_hash[brkhash (br->addr)];
+}
+
+
+/**
+ * Add DELTA to the count of watchpoints for each page that BR covers.
+ */
+static void
+watch_pages_update (breakpoint_t *br, int delta)
+{
+   extern INSTANCE struct hw_device *device_table[];
+   extern INSTANCE unsigned int device_count;
+   unsigned int devid = br->addr >> 28;
+   unsigned long page, last;
+
+   if (devid >= device_count)
+      return;
+   if (!watch_pages[devid])
+   {
+      watch_page_limit[devid] =
+         (device_table[devid]->size + BUS_MAP_SIZE - 1) / BUS_MAP_SIZE;
+      watch_pages[devid] = calloc (watch_page_limit[devid],
+         sizeof (unsigned short));
+   }
+
+   last = (br->end >> 28) == devid ? (br->end & 0xFFFFFFF) / BUS_MAP_SIZE
+      : watch_page_limit[devid] - 1;
+   for (page = (br->addr & 0xFFFFFFF) / BUS_MAP_SIZE;
+        page <= last && page < watch_page_limit[devid]; page++)
+      watch_pages[devid][page] += delta;
+}
+
+
+/**
+ * Return nonzero if an enabled watchpoint covers part of the bus map
+ * sized page at OFFSET in device DEVID.
+ */
+int
+command_page_watched (unsigned int devid, unsigned long offset)
+{
+   unsigned long page = offset / BUS_MAP_SIZE;
+
+   return devid < MAX_BUS_DEVICES && page < watch_page_limit[devid]
+      && watch_pages[devid][page];
+}
+
+
+/**
+ * Enable or disable BR.  Only enabled breakpoints are linked into
+ * the hash, and counted for their pages.
+ */
 void brk_enable (breakpoint_t *br, int flag)
 {
-	if (br->enabled != flag)
-	{
-		br->enabled = flag;
-		if (flag)
-			active_break_count++;
-		else
-			active_break_count--;
-	}
+   unsigned int *chain;
+   int delta = flag ? 1 : -1;
+
+   if (br->enabled == flag)
+      return;
+   br->enabled = flag;
+
+   chain = brkchain (br);
+   if (flag)
+   {
+      br->hash_next = *chain;
+      *chain = br->id + 1;
+   }
+   else
+   {
+      for (; *chain; chain = &breaktab[*chain - 1].hash_next)
+         if (*chain - 1 == br->id)
+         {
+            *chain = br->hash_next;
+            break;
+         }
+   }
+
+   if (br->on_execute)
+      active_break_count += delta;
+   else
+   {
+      active_watch_count += delta;
+      if (br->on_read)
+         read_watch_count += delta;
+      watch_pages_update (br, delta);
+   }
+   bus_fast_update (0, NUM_BUS_MAPS);
 }
 
 
+/**
+ * Allocate a breakpoint at ADDR, growing the table if all of the
+ * entries are in use.  It is enabled with brk_enable once the caller
+ * has said what it is for.
+ */
 breakpoint_t *
-brkalloc (void)
+brkalloc (absolute_address_t addr)
 {
    unsigned int n;
-   for (n = 0; n < MAX_BREAKS; n++)
+   breakpoint_t *br;
+
+   for (n = 0; n < break_count; n++)
       if (!breaktab[n].used)
-      {
-         breakpoint_t *br = &breaktab[n];
-         br->used = 1;
-         br->id = n;
-         br->conditional = 0;
-         br->threaded = 0;
-         br->keep_running = 0;
-         br->ignore_count = 0;
-         br->temp = 0;
-         brk_enable (br, 1);
-         return br;
-      }
-	return NULL;
+         break;
+   if (n == break_count)
+   {
+      break_count = break_count ? break_count * 2 : 32;
+      breaktab = realloc (breaktab, break_count * sizeof (breakpoint_t));
+      memset (breaktab + n, 0, (break_count - n) * sizeof (breakpoint_t));
+   }
+
+   br = &breaktab[n];
+   memset (br, 0, sizeof (breakpoint_t));
+   br->used = 1;
+   br->id = n;
+   br->addr = br->end = addr;
+   return br;
 }
 
 
 void
 brkfree (breakpoint_t *br)
 {
+   if (!br->used)
+      return;
    brk_enable (br, 0);
    br->used = 0;
+   expr_free (br->cond);
+   br->cond = NULL;
 }
 
 
@@ -437,7 +726,7 @@ void
 brkfree_temps (void)
 {
    unsigned int n;
-   for (n = 0; n < MAX_BREAKS; n++)
+   for (n = 0; n < break_count; n++)
       if (breaktab[n].used && breaktab[n].temp)
       {
          brkfree (&breaktab[n]);
@@ -445,20 +734,57 @@ brkfree_temps (void)
 }
 
 
+/**
+ * Return the next enabled breakpoint after BR on the single address
+ * ADDR, or the first one if BR is NULL.
+ */
+static inline breakpoint_t *
+brkfind_next (absolute_address_t addr, breakpoint_t *br)
+{
+   unsigned int n = br ? br->hash_next : break_hash[brkhash (addr)];
+
+   for (; n; n = breaktab[n - 1].hash_next)
+      if (breaktab[n - 1].addr == addr)
+         return &breaktab[n - 1];
+   return NULL;
+}
+
 breakpoint_t *
 brkfind_by_addr (absolute_address_t addr)
+{
+   return brkfind_next (addr, NULL);
+}
+
+
+/**
+ * Return the next enabled breakpoint or watchpoint after BR that
+ * covers ADDR, or the first one if BR is NULL: those on ADDR alone
+ * come first, then the ranges.
+ */
+static breakpoint_t *
+watchfind_next (absolute_address_t addr, breakpoint_t *br)
 {
    unsigned int n;
-   for (n = 0; n < MAX_BREAKS; n++)
-		if (breaktab[n].addr == addr)
-			return &breaktab[n];
-	return NULL;
+
+   if (!br || br->end == br->addr)
+   {
+      if ((br = brkfind_next (addr, br)) != NULL)
+         return br;
+      n = break_ranges;
+   }
+   else
+      n = br->hash_next;
+
+   for (; n; n = breaktab[n - 1].hash_next)
+      if (addr >= breaktab[n - 1].addr && addr <= breaktab[n - 1].end)
+         return &breaktab[n - 1];
+   return NULL;
 }
 
 breakpoint_t *
 brkfind_by_id (unsigned int id)
 {
-	return &breaktab[id];
+   return id < break_count ? &breaktab[id] : NULL;
 }
 
 
@@ -479,6 +805,8 @@ brkprint (breakpoint_t *brkpt)
 
    printf (" %d at ", brkpt->id);
    print_addr (brkpt->addr);
+   if (brkpt->end != brkpt->addr)
+      printf (" len %lu", brkpt->end - brkpt->addr + 1);
    if (!brkpt->enabled)
       printf (" (disabled)");
    if (brkpt->conditional)
@@ -490,9 +818,11 @@ brkprint (breakpoint_t *brkpt)
    if (brkpt->temp)
       printf (", temp");
    if (brkpt->ignore_count)
-      printf (", ignore %d times\n", brkpt->ignore_count);
+      printf (", ignore %d times", brkpt->ignore_count);
+   if (brkpt->match_value)
+      printf (", value %02X", brkpt->value);
    if (brkpt->write_mask)
-      printf (", mask %02X\n", brkpt->write_mask);
+      printf (", mask %02X", brkpt->write_mask);
    putchar ('\n');
 }
 
@@ -574,10 +904,8 @@ display_print (void)
 		display_t *ds = &displaytab[n];
 		if (ds->used)
 		{
-         char expr[256];
-         strcpy (expr, ds->expr);
-         printf ("%c %s = ", comma, expr);
-         print_value (eval (expr), &ds->type);
+         printf ("%c %s = ", comma, ds->expr);
+         print_value (expr_eval (ds->code), &ds->type);
          comma = ',';
 		}
 	}
@@ -744,10 +1072,14 @@ command_stack_add (const char *cmd)
 }
 
 
+/* The rest of the command line, for getarg.  strtok's own state
+is shared by all threads. */
+INSTANCE char *command_args;
+
 char *
 getarg (void)
 {
-   return strtok (NULL, " \t\n");
+   return strtok_r (NULL, " \t\n", &command_args);
 }
 
 
@@ -791,8 +1123,7 @@ void cmd_break (void)
    if (!arg)
       return;
    unsigned long val = eval_mem (arg, LVALUE);
-   breakpoint_t *br = brkalloc ();
-   br->addr = val;
+   breakpoint_t *br = brkalloc (val);
    br->on_execute = 1;
 
    arg = getarg ();
@@ -802,12 +1133,14 @@ void cmd_break (void)
       br->conditional = 1;
       arg = getarg ();
       strcpy (br->condition, arg);
+      br->cond = expr_compile (arg);
    }
    else if (!strcmp (arg, "ignore"))
    {
       br->ignore_count = atoi (getarg ());
    }
 
+   brk_enable (br, 1);
    brkprint (br);
 }
 
@@ -820,32 +1153,42 @@ void cmd_watch1 (int on_read, int on_write)
    if (!arg)
       return;
    absolute_address_t addr = eval_mem (arg, LVALUE);
-   breakpoint_t *br = brkalloc ();
-   br->addr = addr;
+   breakpoint_t *br = brkalloc (addr);
    br->on_read = on_read;
    br->on_write = on_write;
 
-   for (;;)
+   while ((arg = getarg ()) != NULL)
    {
-      arg = getarg ();
-      if (!arg)
-         return;
-
       if (!strcmp (arg, "print"))
          br->keep_running = 1;
+      else if (!strcmp (arg, "len"))
+      {
+         arg = getarg ();
+         br->end = addr + strtoul (arg, NULL, 0) - 1;
+         if (br->end < addr)
+            br->end = addr;
+      }
       else if (!strcmp (arg, "mask"))
       {
          arg = getarg ();
          br->write_mask = strtoul (arg, NULL, 0);
       }
+      else if (!strcmp (arg, "value"))
+      {
+         arg = getarg ();
+         br->match_value = 1;
+         br->value = strtoul (arg, NULL, 0);
+      }
       else if (!strcmp (arg, "if"))
       {
          arg = getarg ();
          br->conditional = 1;
          strcpy (br->condition, arg);
+         br->cond = expr_compile (arg);
       }
    }
 
+   brk_enable (br, 1);
    brkprint (br);
 }
 
@@ -870,7 +1213,7 @@ void cmd_awatch (void)
 void cmd_break_list (void)
 {
    unsigned int n;
-   for (n = 0; n < MAX_BREAKS; n++)
+   for (n = 0; n < break_count; n++)
       brkprint (&breaktab[n]);
 }
 
@@ -888,10 +1231,10 @@ void cmd_next (void)
    unsigned long addr = to_absolute (get_pc ());
    addr += dasm (buf, addr);
 
-   br = brkalloc ();
-   br->addr = addr;
+   br = brkalloc (addr);
    br->on_execute = 1;
    br->temp = 1;
+   brk_enable (br, 1);
 
    /* TODO - for conditional branches, should also set a
    temp breakpoint at the branch target */
@@ -904,6 +1247,44 @@ void cmd_continue (void)
    exit_command_loop = 0;
 }
 
+void cmd_reverse_step (void)
+{
+   reverse_step ();
+   print_current_insn ();
+}
+
+void cmd_reverse_next (void)
+{
+   reverse_next ();
+   print_current_insn ();
+}
+
+void cmd_reverse_continue (void)
+{
+   reverse_continue ();
+   print_current_insn ();
+}
+
+void cmd_irqstat (void)
+{
+   char *arg = getarg ();
+
+   if (arg && !strcmp (arg, "on"))
+      irqstat_enabled = 1;
+   else if (arg && !strcmp (arg, "off"))
+      irqstat_enabled = 0;
+   else if (arg && !strcmp (arg, "reset"))
+      irqstat_reset ();
+   else if (arg)
+   {
+      syntax_error ("irqstat [on|off|reset]");
+      return;
+   }
+   if (!irqstat_enabled)
+      printf ("Interrupt statistics are off.\n");
+   irqstat_print (stdout);
+}
+
 void cmd_quit (void)
 {
    cpu_quit = 0;
@@ -919,17 +1300,14 @@ void cmd_delete (void)
    {
       int n;
       printf ("Deleting all breakpoints.\n");
-      for (id = 0; id < MAX_BREAKS; id++)
-      {
-         breakpoint_t *br = brkfind_by_id (id);
-         brkfree (br);
-      }
+      for (id = 0; id < break_count; id++)
+         brkfree (&breaktab[id]);
       return;
    }
 
    id = atoi (arg);
    breakpoint_t *br = brkfind_by_id (id);
-   if (br->used)
+   if (br && br->used)
    {
       printf ("Deleting breakpoint %d\n", id);
       brkfree (br);
@@ -939,8 +1317,8 @@ void cmd_delete (void)
 void cmd_list (void)
 {
    char *arg;
-   static absolute_address_t lastpc = 0;
-   static absolute_address_t lastaddr = 0;
+   static INSTANCE absolute_address_t lastpc = 0;
+   static INSTANCE absolute_address_t lastaddr = 0;
    absolute_address_t addr;
    int n;
 
@@ -984,6 +1362,7 @@ void cmd_display (void)
    {
       display_t *ds = display_alloc ();
       strcpy (ds->expr, arg);
+      ds->code = expr_compile (arg);
       ds->type = print_type;
       parse_format_flag (command_flags, &ds->type.format);
       parse_size_flag (command_flags, &ds->type.size);
@@ -1065,10 +1444,10 @@ void cmd_measure (void)
 
    /* Set a temp breakpoint at the current PC, so that
    the measurement will halt. */
-   br = brkalloc ();
-   br->addr = to_absolute (retaddr);
+   br = brkalloc (to_absolute (retaddr));
    br->on_execute = 1;
    br->temp = 1;
+   brk_enable (br, 1);
 
    /* Interrupts must be disabled for this to work ! */
    set_cc (get_cc () | 0x50);
@@ -1083,7 +1462,7 @@ void cmd_measure (void)
 
 void cmd_dump_insns (void)
 {
-   extern int dump_every_insn;
+   extern INSTANCE int dump_every_insn;
 
    char *arg = getarg ();
    if (arg)
@@ -1114,11 +1493,27 @@ cmd_trace_dump (void)
 
 void cmd_dump (void)
 {
+   char *arg = getarg ();
+   if (!arg)
+   {
+      syntax_error ("file name required");
+      return;
+   }
+   if (state_save (arg) == 0)
+      printf ("Saved machine state to %s\n", arg);
 }
 
 
 void cmd_restore (void)
 {
+   char *arg = getarg ();
+   if (!arg)
+   {
+      syntax_error ("file name required");
+      return;
+   }
+   if (state_load (arg) == 0)
+      printf ("Restored machine state from %s\n", arg);
 }
 
 /****************** Parser ************************/
@@ -1151,6 +1546,12 @@ struct command_name
    { "c", "continue", cmd_continue,
       "Continue the program" },
    { "fg", "foreground", cmd_continue, NULL },
+   { "rs", "rstep", cmd_reverse_step,
+      "Step back one instruction" },
+   { "rn", "rnext", cmd_reverse_next,
+      "Step back one instruction, over subroutine calls" },
+   { "rc", "rcontinue", cmd_reverse_continue,
+      "Run backwards to the previous breakpoint" },
    { "q", "quit", cmd_quit,
       "Quit the simulator" },
    { "re", "reset", cpu_reset,
@@ -1179,14 +1580,16 @@ struct command_name
       "Run for a certain amount of time" },
    { "me", "measure", cmd_measure,
       "Measure time that a function takes" },
+   { "irq", "irqstat", cmd_irqstat,
+      "Show interrupt latency and service times" },
    { "dumpi", "dumpi", cmd_dump_insns,
       "Set dump-instruction flag" },
    { "td", "tracedump", cmd_trace_dump,
       "Dump the trace buffer" },
    { "dump", "du", cmd_dump,
-      "Dump contents of memory to a file" },
+      "Save the machine state to a file" },
    { "restore", "res", cmd_restore,
-      "Restore contents of memory from a file" },
+      "Restore the machine state from a file" },
 #if 0
    { "cl", "clear", cmd_clear },
    { "i", "info", cmd_info },
@@ -1259,7 +1662,7 @@ int
 command_exec (FILE *infile)
 {
    char buffer[256];
-   static char prev_buffer[256];
+   static INSTANCE char prev_buffer[256];
    char *cmd;
    command_handler_t handler;
    int rc;
@@ -1297,7 +1700,7 @@ command_exec (FILE *infile)
    if (*buffer == '#')
       return 0;
 
-   cmd = strtok (buffer, " \t\n");
+   cmd = strtok_r (buffer, " \t\n", &command_args);
    if (!cmd)
       return 0;
 
@@ -1363,17 +1766,30 @@ restart:
 }
 
 
-void
-breakpoint_hit (breakpoint_t *br)
+/**
+ * Return nonzero if breakpoint BR applies: to this thread, and
+ * its condition is true.
+ */
+static int
+breakpoint_matches (breakpoint_t *br)
 {
    if (br->threaded && (thread_id != br->tid))
-      return;
+      return 0;
 
    if (br->conditional)
    {
-      if (eval (br->condition) == 0)
-         return;
+      if (expr_eval (br->cond) == 0)
+         return 0;
    }
+   return 1;
+}
+
+
+void
+breakpoint_hit (breakpoint_t *br)
+{
+   if (!breakpoint_matches (br))
+      return;
 
    if (br->ignore_count)
    {
@@ -1385,6 +1801,29 @@ breakpoint_hit (breakpoint_t *br)
 }
 
 
+/**
+ * Return nonzero if the program would stop at a breakpoint at PC.
+ * Used when execution is repeated for reverse-continue, so ignore
+ * counts are left alone and nothing is printed.
+ */
+int
+command_break_at (unsigned int pc)
+{
+   breakpoint_t *br;
+   absolute_address_t abspc;
+
+   if (active_break_count == 0)
+      return 0;
+
+   abspc = to_absolute (pc);
+   for (br = brkfind_by_addr (abspc); br; br = brkfind_next (abspc, br))
+      if (br->enabled && br->on_execute && !br->temp
+         && breakpoint_matches (br))
+         return 1;
+   return 0;
+}
+
+
 void
 command_trace_insn (target_addr_t addr)
 {
@@ -1398,44 +1837,55 @@ command_insn_hook (void)
 {
    target_addr_t pc;
    absolute_address_t abspc;
-	breakpoint_t *br;
+   breakpoint_t *br;
 
    pc = get_pc ();
    command_trace_insn (pc);
 
-	if (active_break_count == 0)
-		return;
+   if (active_break_count == 0)
+      return;
 
-	abspc = to_absolute (pc);
-	br = brkfind_by_addr (abspc);
-	if (br && br->enabled && br->on_execute)
-	{
-      breakpoint_hit (br);
-      if (monitor_on == 0)
+   abspc = to_absolute (pc);
+   for (br = brkfind_by_addr (abspc); br; br = brkfind_next (abspc, br))
+      if (br->enabled && br->on_execute)
+      {
+         breakpoint_hit (br);
+         if (monitor_on == 0)
+            continue;
+         if (br->temp)
+            brkfree (br);
+         else
+            printf ("Breakpoint %d reached.\n", br->id);
          return;
-      if (br->temp)
-         brkfree (br);
-      else
-		   printf ("Breakpoint %d reached.\n", br->id);
-	}
+      }
 }
 
 
 void
 command_read_hook (absolute_address_t addr)
 {
-	breakpoint_t *br;
+   breakpoint_t *br;
 
-   if (active_break_count == 0)
+   if (!active_watch_count
+       || !command_page_watched (addr >> 28, addr & 0xFFFFFFF))
       return;
 
-   br = brkfind_by_addr (addr);
-	if (br && br->enabled && br->on_read)
+   for (br = watchfind_next (addr, NULL); br; br = watchfind_next (addr, br))
    {
+      if (!br->on_read)
+         continue;
+      if (reverse_running)
+      {
+         if (breakpoint_matches (br))
+            reverse_watch_hit = 1;
+         continue;
+      }
       printf ("Watchpoint %d triggered. [", br->id);
       print_addr (addr);
       printf ("]\n");
       breakpoint_hit (br);
+      if (monitor_on)
+         cpu_end_slice ();
    }
 }
 
@@ -1443,31 +1893,51 @@ command_read_hook (absolute_address_t addr)
 void
 command_write_hook (absolute_address_t addr, U8 val)
 {
-	breakpoint_t *br;
+   breakpoint_t *br;
+   unsigned int mask;
+
+   br = NULL;
+   if (active_watch_count
+       && command_page_watched (addr >> 28, addr & 0xFFFFFFF))
+      br = watchfind_next (addr, NULL);
 
-   if (active_break_count != 0)
+   for (; br; br = watchfind_next (addr, br))
    {
-      br = brkfind_by_addr (addr);
-      if (br && br->enabled && br->on_write)
+      if (!br->on_write)
+         continue;
+      if (reverse_running)
       {
-         if (br->write_mask)
-         {
-            int mask_ok = ((br->last_write & br->write_mask) !=
-               (val & br->write_mask));
+         if (breakpoint_matches (br))
+            reverse_watch_hit = 1;
+         continue;
+      }
 
-            br->last_write = val;
-            if (!mask_ok)
-               return;
-         }
+      if (br->match_value)
+      {
+         /* Only when the bits under the mask are written with the
+         value given */
+         mask = br->write_mask ? br->write_mask : 0xFF;
+         if ((val ^ br->value) & mask)
+            continue;
+      }
+      else if (br->write_mask)
+      {
+         int mask_ok = ((br->last_write & br->write_mask) !=
+            (val & br->write_mask));
 
-         breakpoint_hit (br);
-         if (monitor_on == 0)
-            return;
-         printf ("Watchpoint %d triggered. [", br->id);
-         print_addr (addr);
-         printf (" = 0x%02X", val);
-         printf ("]\n");
+         br->last_write = val;
+         if (!mask_ok)
+            continue;
       }
+
+      breakpoint_hit (br);
+      if (monitor_on == 0)
+         continue;
+      printf ("Watchpoint %d triggered. [", br->id);
+      print_addr (addr);
+      printf (" = 0x%02X", val);
+      printf ("]\n");
+      cpu_end_slice ();
    }
 
    /* On any write, if threading is enabled then see if the
@@ -1540,7 +2010,7 @@ void cycles_virtual (unsigned long *val, int writep)
 
 void et_virtual (unsigned long *val, int writep)
 {
-   static unsigned long last_cycles = 0;
+   static INSTANCE unsigned long last_cycles = 0;
    if (!writep)
       *val = get_cycles () - last_cycles;
    last_cycles = get_cycles ();
@@ -1562,6 +2032,43 @@ command_exit_irq_hook (unsigned long cycles)
 }
 
 
+/**
+ * Free the breakpoint table, the watched page counts and the compiled
+ * display expressions, as the simulation ends.  The bus is not told,
+ * as the machine is going away too.
+ */
+void
+command_free (void)
+{
+   unsigned int n;
+
+   for (n = 0; n < break_count; n++)
+      if (breaktab[n].used)
+         expr_free (breaktab[n].cond);
+   free (breaktab);
+   breaktab = NULL;
+   break_count = 0;
+   active_break_count = active_watch_count = read_watch_count = 0;
+   memset (break_hash, 0, sizeof (break_hash));
+   break_ranges = 0;
+
+   for (n = 0; n < MAX_BUS_DEVICES; n++)
+   {
+      free (watch_pages[n]);
+      watch_pages[n] = NULL;
+      watch_page_limit[n] = 0;
+   }
+
+   for (n = 0; n < MAX_DISPLAYS; n++)
+      if (displaytab[n].used)
+      {
+         expr_free (displaytab[n].code);
+         displaytab[n].code = NULL;
+         displaytab[n].used = 0;
+      }
+}
+
+
 void
 command_init (void)
 {
@@ -0,0 +1,517 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Code coverage.  The execution engine built with PROFILE_HOOKS marks
+the absolute address of every instruction it runs in a table of flags,
+one byte per byte of each device, and the conditional branches also
+mark whether they were taken or not.
+
+With --coverage=FILE, the flags in FILE are read at startup and the
+merged flags are written back at the end, so that FILE accumulates the
+coverage of many runs of the same program.  --coverage-lcov=FILE and
+--coverage-json=FILE write a report, per symbol of the program's map
+file and per instruction.  The instructions that were not run are
+found by decoding each symbol from its start, up to its size. */
+
+#include "6809.h"
+#include "monitor.h"
+
+extern INSTANCE struct hw_device *device_table[];
+extern INSTANCE unsigned int device_count;
+extern absolute_address_t absolute_from_reladdr (unsigned int device,
+	unsigned long reladdr);
+
+/* The options that enable coverage */
+INSTANCE const char *coverage_file = NULL;
+INSTANCE const char *coverage_lcov_file = NULL;
+INSTANCE const char *coverage_json_file = NULL;
+
+/* Nonzero if instructions are being marked */
+INSTANCE int coverage_enabled = 0;
+
+/* The flags for each device, one per byte of it, and the number of
+bytes allocated, indexed by device ID up to INVALID_DEVID */
+INSTANCE U8 *coverage_flags[INVALID_DEVID + 1];
+INSTANCE unsigned long coverage_limit[INVALID_DEVID + 1];
+
+/* The flags of the instruction being run */
+INSTANCE U8 *coverage_last;
+
+/* Where the instructions that do not run from any device are marked */
+static INSTANCE U8 coverage_unmapped;
+
+/* The totals for one symbol, or for a whole report */
+struct coverage_total
+{
+	unsigned long insns, insns_hit;
+	unsigned long branches, branches_hit;
+};
+
+/* How the report is being written */
+struct coverage_output
+{
+	FILE *lcov;
+	FILE *json;
+	int json_first;
+};
+
+
+/**
+ * Return the flags of device DEVID, allocating them if needed.
+ */
+static U8 *
+coverage_table (unsigned int devid)
+{
+	unsigned long size;
+
+	if (!coverage_flags[devid])
+	{
+		size = (device_table[devid]->size + BUS_MAP_SIZE - 1)
+			/ BUS_MAP_SIZE * BUS_MAP_SIZE;
+		coverage_flags[devid] = calloc (size, 1);
+		coverage_limit[devid] = size;
+	}
+	return coverage_flags[devid];
+}
+
+
+/**
+ * Return the flags for CPU address PC, when its device has no table
+ * yet.  Called from coverage_at.
+ */
+U8 *
+coverage_lookup (unsigned int pc)
+{
+	struct bus_map *map = &busmaps[pc / BUS_MAP_SIZE];
+
+	if (map->devid >= device_count || coverage_flags[map->devid])
+		return &coverage_unmapped;
+	coverage_table (map->devid);
+	return coverage_at (pc);
+}
+
+
+/**
+ * Merge the flags saved in FILENAME, if it exists.
+ */
+static void
+coverage_load (const char *filename)
+{
+	FILE *fp;
+	char buf[128];
+	unsigned int devid, flags;
+	unsigned long size, offset;
+	U8 *table = NULL;
+
+	if ((fp = fopen (filename, "r")) == NULL)
+		return;
+
+	while (fgets (buf, sizeof (buf), fp))
+	{
+		if (buf[0] == '#')
+			continue;
+		if (sscanf (buf, "device %x size %lx", &devid, &size) == 2)
+		{
+			table = NULL;
+			if (devid < device_count && device_table[devid]->size == size)
+				table = coverage_table (devid);
+			else
+				fprintf (stderr, "m6809-run: %s: device %02X does not match, "
+					"ignored\n", filename, devid);
+		}
+		else if (table && sscanf (buf, "%lx %x", &offset, &flags) == 2
+			&& offset < coverage_limit[devid])
+			table[offset] |= flags;
+	}
+	fclose (fp);
+}
+
+
+/**
+ * Write all of the flags to FILENAME.
+ */
+static void
+coverage_save (const char *filename)
+{
+	FILE *fp;
+	unsigned int devid;
+	unsigned long offset;
+
+	if ((fp = fopen (filename, "w")) == NULL)
+	{
+		fprintf (stderr, "m6809-run: cannot write %s\n", filename);
+		return;
+	}
+
+	fprintf (fp, "# m6809-run coverage: offset, and 1 for run, 2 for taken, "
+		"4 for not taken\n");
+	for (devid = 0; devid < device_count; devid++)
+	{
+		if (!coverage_flags[devid])
+			continue;
+		fprintf (fp, "device %02X size %lX\n", devid, device_table[devid]->size);
+		for (offset = 0; offset < coverage_limit[devid]; offset++)
+			if (coverage_flags[devid][offset])
+				fprintf (fp, "%lX %X\n", offset, coverage_flags[devid][offset]);
+	}
+	fclose (fp);
+}
+
+
+/**
+ * Turn on coverage, if any of the coverage options was given.  The
+ * JIT is turned off, as translated code does not mark anything.
+ */
+void
+coverage_init (void)
+{
+	if (!coverage_file && !coverage_lcov_file && !coverage_json_file)
+		return;
+	coverage_enabled = 1;
+	coverage_last = &coverage_unmapped;
+	jit_enabled = 0;
+	if (coverage_file)
+		coverage_load (coverage_file);
+}
+
+
+/**
+ * Return nonzero if the instruction at ADDR is a conditional branch.
+ */
+static int
+coverage_is_branch (absolute_address_t addr)
+{
+	U8 op = abs_read8 (addr);
+
+	if (op == 0x10)
+		op = abs_read8 (addr + 1);
+	else if (op < 0x22)
+		return 0;
+	return op >= 0x22 && op <= 0x2f;
+}
+
+
+static void
+coverage_json_string (FILE *fp, const char *s)
+{
+	putc ('"', fp);
+	for (; *s; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			putc ('\\', fp);
+		putc (*s, fp);
+	}
+	putc ('"', fp);
+}
+
+
+/**
+ * Report the instructions of device DEVID from offset START up to END,
+ * all of which belong to the symbol NAME, or to none if NAME is NULL,
+ * and add them to TOTAL.
+ */
+static void
+coverage_walk (struct coverage_output *out, unsigned int devid,
+	unsigned long start, unsigned long end, const char *name,
+	struct coverage_total *total)
+{
+	U8 *table = coverage_flags[devid];
+	unsigned long offset, next, line;
+	unsigned int mode, k;
+	int jump, len;
+	absolute_address_t addr;
+	U8 flags;
+
+	for (offset = start; offset < end; offset = next)
+	{
+		addr = absolute_from_reladdr (devid, offset);
+		flags = table[offset];
+		len = insn_decode (addr, &mode, &jump);
+		next = offset + (len ? len : 1);
+
+		/* Code that was run is never inside another instruction:
+		if it is, this one was data */
+		for (k = 1; offset + k < next && offset + k < end; k++)
+			if (table[offset + k] & COV_EXECUTED)
+			{
+				next = offset + k;
+				if (!(flags & COV_EXECUTED))
+					len = 0;
+				break;
+			}
+		if (!len && !(flags & COV_EXECUTED))
+			continue;
+
+		line = offset + 1;
+		total->insns++;
+		if (flags & COV_EXECUTED)
+			total->insns_hit++;
+		if (out->lcov)
+			fprintf (out->lcov, "DA:%lu,%d\n", line, !!(flags & COV_EXECUTED));
+		if (out->json)
+		{
+			fprintf (out->json, "%s\n    { \"address\": \"%02X:%04lX\", ",
+				out->json_first ? "" : ",", devid, offset);
+			out->json_first = 0;
+			if (name)
+			{
+				fprintf (out->json, "\"symbol\": ");
+				coverage_json_string (out->json, name);
+				fprintf (out->json, ", ");
+			}
+			fprintf (out->json, "\"run\": %s",
+				flags & COV_EXECUTED ? "true" : "false");
+		}
+
+		if (coverage_is_branch (addr))
+		{
+			total->branches += 2;
+			total->branches_hit += !!(flags & COV_TAKEN)
+				+ !!(flags & COV_NOT_TAKEN);
+			if (out->lcov && (flags & COV_EXECUTED))
+				fprintf (out->lcov, "BRDA:%lu,0,0,%d\nBRDA:%lu,0,1,%d\n",
+					line, !!(flags & COV_TAKEN), line, !!(flags & COV_NOT_TAKEN));
+			else if (out->lcov)
+				fprintf (out->lcov, "BRDA:%lu,0,0,-\nBRDA:%lu,0,1,-\n", line, line);
+			if (out->json)
+				fprintf (out->json, ", \"taken\": %s, \"not_taken\": %s",
+					flags & COV_TAKEN ? "true" : "false",
+					flags & COV_NOT_TAKEN ? "true" : "false");
+		}
+		if (out->json)
+			fprintf (out->json, " }");
+	}
+}
+
+
+/**
+ * Report the instructions that were run on device DEVID from offset
+ * START up to END, where the code itself is not known.
+ */
+static void
+coverage_walk_run (struct coverage_output *out, unsigned int devid,
+	unsigned long start, unsigned long end, const char *name,
+	struct coverage_total *total)
+{
+	unsigned long offset;
+
+	for (offset = start; offset < end; offset++)
+		if (coverage_flags[devid][offset] & COV_EXECUTED)
+			coverage_walk (out, devid, offset, offset + 1, name, total);
+}
+
+
+/**
+ * Write the coverage reports at the end of the run.  Each device is a
+ * source file to lcov, with the byte at offset N on line N+1.
+ */
+void
+coverage_report (void)
+{
+	struct coverage_output out;
+	struct coverage_total sum, *totals;
+	struct symbol **syms, *sym;
+	unsigned int symcount, n, first;
+	unsigned int devid;
+	unsigned long offset, start, end, next, limit;
+
+	if (!coverage_enabled)
+		return;
+	coverage_enabled = 0;
+
+	if (coverage_file)
+		coverage_save (coverage_file);
+
+	memset (&out, 0, sizeof (out));
+	out.json_first = 1;
+	if (coverage_lcov_file && (out.lcov = fopen (coverage_lcov_file, "w")) == NULL)
+		fprintf (stderr, "m6809-run: cannot write %s\n", coverage_lcov_file);
+	if (coverage_json_file && (out.json = fopen (coverage_json_file, "w")) == NULL)
+		fprintf (stderr, "m6809-run: cannot write %s\n", coverage_json_file);
+	if (!out.lcov && !out.json)
+		return;
+
+	syms = sym_sorted (&program_symtab, &symcount);
+	totals = calloc (symcount + 1, sizeof (struct coverage_total));
+	memset (&sum, 0, sizeof (sum));
+
+	if (out.json)
+	{
+		fprintf (out.json, "{\n  \"program\": ");
+		coverage_json_string (out.json, prog_name ? prog_name : "");
+		fprintf (out.json, ",\n  \"addresses\": [");
+	}
+
+	/* Each device in turn: the symbols on it, and the code that was
+	run outside of them */
+	first = 0;
+	for (devid = 0; devid < device_count; devid++)
+	{
+		struct coverage_total devtotal, outside;
+
+		while (first < symcount && (syms[first]->value >> 28) < devid)
+			first++;
+		if (!coverage_flags[devid]
+			&& (first == symcount || (syms[first]->value >> 28) != devid))
+			continue;
+		coverage_table (devid);
+		memset (&outside, 0, sizeof (outside));
+
+		if (out.lcov)
+		{
+			fprintf (out.lcov, "TN:\nSF:%s@%02X\n", prog_name ? prog_name : "", devid);
+			for (n = first; n < symcount && (syms[n]->value >> 28) == devid; n++)
+			{
+				sym = syms[n];
+				fprintf (out.lcov, "FN:%lu,%s\n", (sym->value & 0xFFFFFFF) + 1,
+					sym->name);
+			}
+		}
+
+		/* The symbols are decoded as far as their size says; code that
+		is not in any symbol, or in one of unknown size, is only known
+		where it was run */
+		offset = 0;
+		n = first;
+		limit = coverage_limit[devid];
+		while (offset < limit)
+		{
+			if (n == symcount || (syms[n]->value >> 28) != devid)
+			{
+				coverage_walk_run (&out, devid, offset, limit, NULL,
+					&outside);
+				break;
+			}
+
+			start = syms[n]->value & 0xFFFFFFF;
+			if (start > offset)
+				coverage_walk_run (&out, devid, offset, start, NULL,
+					&outside);
+			else
+				start = offset;
+
+			next = limit;
+			if (n + 1 < symcount && (syms[n + 1]->value >> 28) == devid)
+				next = syms[n + 1]->value & 0xFFFFFFF;
+			end = syms[n]->ty.size ? (syms[n]->value & 0xFFFFFFF) + syms[n]->ty.size : 0;
+			if (end > next || end > limit)
+				end = next < limit ? next : limit;
+
+			if (end > start)
+			{
+				coverage_walk (&out, devid, start, end, syms[n]->name, &totals[n]);
+				offset = end;
+			}
+			else
+			{
+				coverage_walk_run (&out, devid, start, next, syms[n]->name,
+					&totals[n]);
+				offset = next > start ? next : start;
+			}
+			n++;
+		}
+
+		/* The code outside of the symbols is counted for the device,
+		and for the whole program in the last of the totals */
+		devtotal = outside;
+		for (n = first; n < symcount && (syms[n]->value >> 28) == devid; n++)
+		{
+			devtotal.insns += totals[n].insns;
+			devtotal.insns_hit += totals[n].insns_hit;
+			devtotal.branches += totals[n].branches;
+			devtotal.branches_hit += totals[n].branches_hit;
+		}
+		totals[symcount].insns += outside.insns;
+		totals[symcount].insns_hit += outside.insns_hit;
+		totals[symcount].branches += outside.branches;
+		totals[symcount].branches_hit += outside.branches_hit;
+
+		if (out.lcov)
+		{
+			unsigned int fnf = 0, fnh = 0;
+			for (n = first; n < symcount && (syms[n]->value >> 28) == devid; n++)
+			{
+				int hit = (coverage_flags[devid][syms[n]->value & 0xFFFFFFF]
+					& COV_EXECUTED) != 0;
+				fprintf (out.lcov, "FNDA:%d,%s\n", hit, syms[n]->name);
+				fnf++;
+				fnh += hit;
+			}
+			fprintf (out.lcov, "FNF:%u\nFNH:%u\n", fnf, fnh);
+			fprintf (out.lcov, "BRF:%lu\nBRH:%lu\n",
+				devtotal.branches, devtotal.branches_hit);
+			fprintf (out.lcov, "LF:%lu\nLH:%lu\nend_of_record\n",
+				devtotal.insns, devtotal.insns_hit);
+		}
+	}
+
+	for (n = 0; n <= symcount; n++)
+	{
+		sum.insns += totals[n].insns;
+		sum.insns_hit += totals[n].insns_hit;
+		sum.branches += totals[n].branches;
+		sum.branches_hit += totals[n].branches_hit;
+	}
+
+	if (out.json)
+	{
+		fprintf (out.json, "\n  ],\n  \"symbols\": [");
+		for (n = 0; n < symcount; n++)
+		{
+			fprintf (out.json, "%s\n    { \"name\": ", n ? "," : "");
+			coverage_json_string (out.json, syms[n]->name);
+			fprintf (out.json, ", \"address\": \"%02lX:%04lX\", \"size\": %lu, "
+				"\"instructions\": %lu, \"instructions_run\": %lu, "
+				"\"branches\": %lu, \"branches_covered\": %lu }",
+				syms[n]->value >> 28, syms[n]->value & 0xFFFFFFF,
+				(unsigned long)syms[n]->ty.size,
+				totals[n].insns, totals[n].insns_hit,
+				totals[n].branches, totals[n].branches_hit);
+		}
+		fprintf (out.json, "\n  ],\n  \"summary\": { \"instructions\": %lu, "
+			"\"instructions_run\": %lu, \"branches\": %lu, "
+			"\"branches_covered\": %lu }\n}\n",
+			sum.insns, sum.insns_hit, sum.branches, sum.branches_hit);
+		fclose (out.json);
+	}
+	if (out.lcov)
+		fclose (out.lcov);
+
+	free (totals);
+}
+
+
+/**
+ * Free the flags at the end of the simulation.
+ */
+void
+coverage_free (void)
+{
+	unsigned int devid;
+
+	for (devid = 0; devid <= INVALID_DEVID; devid++)
+	{
+		free (coverage_flags[devid]);
+		coverage_flags[devid] = NULL;
+		coverage_limit[devid] = 0;
+	}
+	coverage_unmapped = 0;
+	coverage_enabled = 0;
+}
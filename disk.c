@@ -19,7 +19,7 @@
  */
 
 #include <stdio.h>
-#include "machine.h"
+#include "6809.h"
 #include "eon.h"
 
 /* The disk drive is emulated as follows:
@@ -58,12 +58,6 @@ struct disk_priv
 };
 
 
-void disk_update (struct hw_device *dev)
-{
-	/* Simulate the way that an actual disk would work.
-	Induce some latency into the process. */
-}
-
 U8 disk_read (struct hw_device *dev, unsigned long addr)
 {
 	struct disk_priv *disk = (struct disk_priv *)dev->priv;
@@ -91,6 +85,8 @@ void disk_write (struct hw_device *dev, unsigned long addr, U8 val)
 			if (val & DSK_READ)
 			{
 				fread (disk->ram, SECTOR_SIZE, 1, disk->fp);
+				predecode_invalidate_range (disk->ramdev->devid,
+					disk->ram - (char *)disk->ramdev->priv, SECTOR_SIZE);
 			}
 			else if (val & DSK_WRITE)
 			{
@@ -134,13 +130,31 @@ void disk_format (struct hw_device *dev)
 	disk_write (dev, DSK_CTRL, DSK_FLUSH);
 }
 
+void disk_state (struct hw_device *dev)
+{
+	struct disk_priv *disk = (struct disk_priv *)dev->priv;
+	unsigned long ram;
+
+	/* The sector buffer is kept as an offset into the RAM device,
+	or all ones if none has been set. */
+	ram = disk->ram ? disk->ram - (char *)disk->ramdev->priv : ~0UL;
+	state_ulong (&disk->offset);
+	state_ulong (&ram);
+	state_uint (&disk->cycles_to_irq);
+	if (state_restoring ())
+	{
+		disk->ram = ram != ~0UL ? (char *)disk->ramdev->priv + ram : NULL;
+		fseek (disk->fp, disk->offset, SEEK_SET);
+	}
+}
+
 struct hw_class disk_class =
 {
 	.readonly = 0,
 	.reset = disk_reset,
 	.read = disk_read,
 	.write = disk_write,
-	.update = disk_update,
+	.state = disk_state,
 };
 
 struct hw_device *disk_create (const char *backing_file,
@@ -3,7 +3,7 @@
 #include "machine.h"
 #include "eon.h"
 
-extern int system_running;
+extern INSTANCE int system_running;
 
 
 void eon_fault (unsigned int addr, unsigned char type)
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The event scheduler.  Anything that has to happen at a particular
+CPU cycle -- a timer expiring, a periodic interrupt -- is registered
+as an event, and the main loop runs the CPU exactly up to the earliest
+one instead of polling every device after each time slice.
+
+The pending events are kept in a binary heap ordered by deadline.
+Deadlines are absolute cycle counts, as returned by get_cycles (). */
+
+#include "6809.h"
+
+#define MAX_EVENTS 64
+
+extern INSTANCE long cpu_clk, cpu_period;
+extern INSTANCE unsigned int cpu_clk_adjusts;
+
+/* The heap of scheduled events.  Entry 0 is unused, so that the
+children of entry N are 2N and 2N+1. */
+static INSTANCE struct event *event_heap[MAX_EVENTS + 1];
+
+static INSTANCE unsigned int event_count = 0;
+
+/* Nonzero while the CPU is running a slice returned by event_slice */
+static INSTANCE int event_in_slice = 0;
+
+
+static inline void
+event_place (struct event *ev, unsigned int slot)
+{
+	event_heap[slot] = ev;
+	ev->slot = slot;
+}
+
+
+static void
+event_sift_up (unsigned int slot)
+{
+	struct event *ev = event_heap[slot];
+
+	while (slot > 1 && event_heap[slot / 2]->when > ev->when)
+	{
+		event_place (event_heap[slot / 2], slot);
+		slot /= 2;
+	}
+	event_place (ev, slot);
+}
+
+
+static void
+event_sift_down (unsigned int slot)
+{
+	struct event *ev = event_heap[slot];
+	unsigned int child;
+
+	while ((child = slot * 2) <= event_count)
+	{
+		if (child < event_count
+			&& event_heap[child + 1]->when < event_heap[child]->when)
+			child++;
+		if (event_heap[child]->when >= ev->when)
+			break;
+		event_place (event_heap[child], slot);
+		slot = child;
+	}
+	event_place (ev, slot);
+}
+
+
+/**
+ * Initialize an event.  HANDLER is called with the event when its
+ * deadline is reached.
+ */
+void
+event_init (struct event *ev, void (*handler) (struct event *ev), void *data)
+{
+	ev->when = 0;
+	ev->slot = 0;
+	ev->handler = handler;
+	ev->data = data;
+}
+
+
+/**
+ * Remove an event from the queue, if it is there.
+ */
+void
+event_cancel (struct event *ev)
+{
+	unsigned int slot = ev->slot;
+	struct event *last;
+
+	if (!slot)
+		return;
+	ev->slot = 0;
+
+	last = event_heap[event_count--];
+	if (last == ev)
+		return;
+	event_place (last, slot);
+	event_sift_up (slot);
+	event_sift_down (last->slot);
+}
+
+
+/**
+ * Schedule an event for the absolute cycle count WHEN.  If the CPU is
+ * in the middle of a time slice that would run past it, the slice is
+ * cut short.
+ */
+static void
+event_schedule_at (struct event *ev, unsigned long when)
+{
+	unsigned long slice_end;
+
+	event_cancel (ev);
+	if (event_count == MAX_EVENTS)
+	{
+		fprintf (stderr, "m6809-run: too many events\n");
+		sim_stop (1);
+	}
+
+	ev->when = when;
+	event_heap[++event_count] = ev;
+	event_sift_up (event_count);
+
+	if (event_in_slice)
+	{
+		slice_end = total + cpu_period;
+		if (when < slice_end)
+		{
+			cpu_period -= slice_end - when;
+			cpu_clk -= slice_end - when;
+			cpu_clk_adjusts++;
+		}
+	}
+}
+
+
+/**
+ * Schedule an event DELAY cycles from now.  An event that is already
+ * scheduled is moved.
+ */
+void
+event_schedule (struct event *ev, unsigned long delay)
+{
+	event_schedule_at (ev, get_cycles () + delay);
+}
+
+
+/**
+ * Schedule an event again PERIOD cycles after its last deadline.
+ * Called from a handler, this gives a period that does not drift
+ * no matter how late the handler ran.
+ */
+void
+event_repeat (struct event *ev, unsigned long period)
+{
+	event_schedule_at (ev, ev->when + period);
+}
+
+
+/**
+ * Return how many cycles the CPU may run before the next event is
+ * due, but no more than LIMIT.  The result is always at least 1.
+ */
+unsigned long
+event_slice (unsigned long limit)
+{
+	unsigned long now = get_cycles ();
+
+	event_in_slice = 1;
+	if (event_count == 0 || event_heap[1]->when >= now + limit)
+		return limit;
+	if (event_heap[1]->when <= now)
+		return 1;
+	return event_heap[1]->when - now;
+}
+
+
+/**
+ * Run the handlers of all events that are due.  Each event is taken
+ * off the queue before its handler is called, so the handler may
+ * schedule it again.
+ */
+void
+event_dispatch (void)
+{
+	unsigned long now = get_cycles ();
+	struct event *ev;
+
+	event_in_slice = 0;
+	while (event_count > 0 && event_heap[1]->when <= now)
+	{
+		ev = event_heap[1];
+		event_cancel (ev);
+		ev->handler (ev);
+	}
+}
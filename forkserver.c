@@ -0,0 +1,286 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The fork server.  --fork-server=SOCKET sets the machine up once --
+loading the ROM and the symbols, and running it for a while if asked
+to -- and then listens on a UNIX socket.  Each connection is a request
+to run one test: the server forks, and the child continues from the
+warmed-up machine, which it shares with the server until either writes
+to memory.
+
+A request is a single line,
+
+	PROGRAM [INPUT [OUTPUT]]
+
+where '-' in any field means none.  PROGRAM is loaded over the
+machine's memory and started from its reset vector; without it, the
+child carries on from where the server stopped.  INPUT becomes the
+child's standard input, which is where the console and the WPC
+switch keys are read from, and the console output is written to
+OUTPUT.  When the test is over, the child replies with
+
+	EXIT-CODE CYCLES MS
+
+where CYCLES and MS are counted from the fork, and closes the
+connection.  If it crashes, the connection is closed without a
+reply.  The request 'quit' stops the server. */
+
+#include "6809.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+extern INSTANCE struct timeval time_started;
+extern INSTANCE unsigned long max_cycles;
+extern unsigned long eval (char *expr);
+extern void machine_update (void);
+extern void load_map_file (const char *name);
+
+/* The options that start the fork server */
+INSTANCE const char *fork_server_socket = NULL;
+INSTANCE unsigned long fork_cycles = 0;
+INSTANCE const char *fork_at = NULL;
+
+/* In a child, the connection that the reply goes to; else -1 */
+static INSTANCE int fork_client = -1;
+
+/* In a child, the cycle count when it was forked; else 0.  The
+child's --maxcycles and its reply count from here. */
+INSTANCE unsigned long fork_start_cycles = 0;
+
+
+/**
+ * Run the machine until it has been running for --fork-cycles, and
+ * then until it reaches the address given by --fork-at.  The server
+ * gives up if that takes more than --maxcycles.
+ */
+static void
+fork_server_warm_up (void)
+{
+	char expr[128];
+	unsigned int addr = 0;
+
+	if (fork_at)
+	{
+		strncpy (expr, fork_at, sizeof (expr) - 1);
+		expr[sizeof (expr) - 1] = '\0';
+		addr = eval (expr) & 0xFFFF;
+	}
+
+	while (get_cycles () < fork_cycles)
+	{
+		total += cpu_execute (event_slice (fork_cycles - get_cycles ()));
+		event_dispatch ();
+		machine_update ();
+	}
+
+	/* The address is checked after every instruction, except inside
+	code translated by --jit, which is only entered at the start of a
+	block. */
+	if (fork_at)
+	{
+		while (get_pc () != addr)
+		{
+			if ((max_cycles > 0) && (get_cycles () > max_cycles))
+			{
+				fprintf (stderr, "m6809-run: %s not reached in %lu cycles\n",
+					fork_at, max_cycles);
+				sim_stop (1);
+			}
+			total += cpu_execute (event_slice (1));
+			event_dispatch ();
+			machine_update ();
+		}
+	}
+}
+
+
+/**
+ * Read a request line from the client, into BUF.  Returns zero on
+ * success.
+ */
+static int
+fork_server_read (int fd, char *buf, unsigned int size)
+{
+	unsigned int len = 0;
+
+	while (len < size - 1)
+	{
+		if (read (fd, buf + len, 1) != 1)
+			return -1;
+		if (buf[len] == '\n')
+			break;
+		len++;
+	}
+	buf[len] = '\0';
+	if (len > 0 && buf[len-1] == '\r')
+		buf[len-1] = '\0';
+	return 0;
+}
+
+
+/**
+ * Make FD refer to FILENAME, opened with FLAGS.
+ */
+static int
+fork_server_redirect (int fd, const char *filename, int flags)
+{
+	int newfd = open (filename, flags, 0666);
+	if (newfd < 0)
+		return -1;
+	dup2 (newfd, fd);
+	close (newfd);
+	return 0;
+}
+
+
+/**
+ * Set up a child for the request in LINE.  Returns zero if the test
+ * can be run.
+ */
+static int
+fork_server_child (char *line)
+{
+	char *program, *input, *output, *save_ptr;
+
+	program = strtok_r (line, " \t", &save_ptr);
+	input = strtok_r (NULL, " \t", &save_ptr);
+	output = strtok_r (NULL, " \t", &save_ptr);
+
+	if (input && strcmp (input, "-")
+		&& fork_server_redirect (0, input, O_RDONLY))
+	{
+		dprintf (fork_client, "error: cannot open %s\n", input);
+		return -1;
+	}
+
+	if (output && strcmp (output, "-")
+		&& fork_server_redirect (1, output, O_WRONLY | O_CREAT | O_TRUNC))
+	{
+		dprintf (fork_client, "error: cannot write %s\n", output);
+		return -1;
+	}
+
+	if (program && strcmp (program, "-"))
+	{
+		if (load_s19 (program))
+		{
+			dprintf (fork_client, "error: cannot load %s\n", program);
+			return -1;
+		}
+		prog_name = strdup (program);
+		load_map_file (prog_name);
+		cpu_reset ();
+	}
+	return 0;
+}
+
+
+/**
+ * Become the fork server.  Returns only in a child, which then runs
+ * its test as any other simulation would.
+ */
+void
+fork_server (void)
+{
+	struct sockaddr_un addr;
+	int listener, fd;
+	char line[1024];
+
+	fork_server_warm_up ();
+
+	listener = socket (AF_UNIX, SOCK_STREAM, 0);
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strncpy (addr.sun_path, fork_server_socket, sizeof (addr.sun_path) - 1);
+	unlink (fork_server_socket);
+	if (listener < 0
+		|| bind (listener, (struct sockaddr *)&addr, sizeof (addr)) < 0
+		|| listen (listener, 16) < 0)
+	{
+		fprintf (stderr, "m6809-run: cannot listen on %s\n", fork_server_socket);
+		sim_stop (1);
+	}
+
+	/* Children are not waited for; they reply to their clients
+	themselves. */
+	signal (SIGCHLD, SIG_IGN);
+	fflush (stdout);
+
+	for (;;)
+	{
+		fd = accept (listener, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		if (fork_server_read (fd, line, sizeof (line)))
+		{
+			close (fd);
+			continue;
+		}
+
+		if (!strcmp (line, "quit"))
+		{
+			close (fd);
+			close (listener);
+			unlink (fork_server_socket);
+			sim_stop (0);
+		}
+
+		switch (fork ())
+		{
+			case 0:
+				close (listener);
+				signal (SIGCHLD, SIG_DFL);
+				fork_client = fd;
+				fork_start_cycles = get_cycles ();
+				if (fork_server_child (line))
+					_exit (1);
+				gettimeofday (&time_started, NULL);
+				return;
+
+			case -1:
+				dprintf (fd, "error: cannot fork\n");
+				break;
+		}
+		close (fd);
+	}
+}
+
+
+/**
+ * Called as the simulation ends with STATUS.  In a child, this sends
+ * the reply to the client.
+ */
+void
+fork_server_exit (int status)
+{
+	if (fork_client < 0)
+		return;
+
+	fflush (stdout);
+	dprintf (fork_client, "%d %lu %ld\n", status,
+		get_cycles () - fork_start_cycles, get_elapsed_realtime ());
+	close (fork_client);
+	fork_client = -1;
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The memory access heatmap.  With --heatmap=FILE, every read, write
+and instruction fetch that the CPU makes is counted for the bus map
+slot of its CPU address, and for the device it went to.  Ranges of
+CPU addresses given with --heatmap-range are also counted byte by
+byte.
+
+To see every access, the direct RAM/ROM pointers are not used (see
+bus_fast_update), and neither are the predecode cache and the JIT,
+so the CPU runs slower than usual.  Accesses made by the debugger are
+not counted. */
+
+#include "6809.h"
+
+extern INSTANCE struct hw_device *device_table[];
+extern INSTANCE unsigned int device_count;
+extern struct hw_class ram_class, rom_class;
+extern absolute_address_t to_absolute (unsigned long cpuaddr);
+
+#define MAX_HEAT_RANGES 8
+
+struct heat_count
+{
+	unsigned long count[3];
+};
+
+/* A range of CPU addresses counted byte by byte */
+struct heat_range
+{
+	unsigned int start, end;
+	struct heat_count *bytes;
+};
+
+/* The option that enables the heatmap */
+INSTANCE const char *heatmap_file = NULL;
+
+/* Nonzero if accesses are being counted */
+INSTANCE int heatmap_enabled = 0;
+
+/* The counts per bus map slot, and per device; accesses to no device
+are counted in the last entry */
+static INSTANCE struct heat_count heat_maps[NUM_BUS_MAPS];
+static INSTANCE struct heat_count heat_devices[MAX_BUS_DEVICES + 1];
+
+static INSTANCE struct heat_range heat_ranges[MAX_HEAT_RANGES];
+static INSTANCE unsigned int heat_range_count;
+
+static const char *heat_kind_names[] = { "reads", "writes", "fetches" };
+
+
+/**
+ * Handle --heatmap-range=START-END, with CPU addresses in hex.
+ */
+int
+heatmap_add_range (const char *arg)
+{
+	struct heat_range *r;
+	unsigned int start, end;
+
+	if (!arg)
+		return 0;
+	if (sscanf (arg, "%x-%x", &start, &end) != 2
+		|| start > end || end >= MAX_CPU_ADDR)
+	{
+		fprintf (stderr, "m6809-run: bad heatmap range '%s'\n", arg);
+		return -1;
+	}
+	if (heat_range_count == MAX_HEAT_RANGES)
+	{
+		fprintf (stderr, "m6809-run: too many heatmap ranges\n");
+		return -1;
+	}
+
+	r = &heat_ranges[heat_range_count++];
+	r->start = start;
+	r->end = end;
+	r->bytes = calloc (end - start + 1, sizeof (struct heat_count));
+	return 1;
+}
+
+
+/**
+ * Start counting, if --heatmap was given.  The direct pointers are
+ * recomputed so that every access goes through the bus.
+ */
+void
+heatmap_init (void)
+{
+	if (!heatmap_file)
+		return;
+	heatmap_enabled = 1;
+	predecode_enabled = 0;
+	jit_enabled = 0;
+	bus_fast_update (0, NUM_BUS_MAPS);
+}
+
+
+/**
+ * Count an access of type KIND (HEAT_READ, HEAT_WRITE or HEAT_FETCH)
+ * to CPU address ADDR, which is mapped to device DEVID.
+ */
+void
+heatmap_access (unsigned int addr, unsigned int devid, int kind)
+{
+	struct heat_range *r;
+
+	if (reverse_running)
+		return;
+
+	heat_maps[addr / BUS_MAP_SIZE].count[kind]++;
+	heat_devices[devid < device_count ? devid : MAX_BUS_DEVICES].count[kind]++;
+
+	for (r = heat_ranges; r < heat_ranges + heat_range_count; r++)
+		if (addr >= r->start && addr <= r->end)
+			r->bytes[addr - r->start].count[kind]++;
+}
+
+
+static unsigned long
+heat_total (const struct heat_count *c)
+{
+	return c->count[HEAT_READ] + c->count[HEAT_WRITE] + c->count[HEAT_FETCH];
+}
+
+
+static void
+heat_print_counts (FILE *fp, const struct heat_count *c, unsigned long most)
+{
+	unsigned long total = heat_total (c);
+
+	fprintf (fp, " %12lu %12lu %12lu %12lu ", c->count[HEAT_READ],
+		c->count[HEAT_WRITE], c->count[HEAT_FETCH], total);
+	if (most)
+		fprintf (fp, "%.*s", (int)((total * 40 + most - 1) / most),
+			"########################################");
+	putc ('\n', fp);
+}
+
+
+static void
+heat_print_header (FILE *fp, const char *title, int width)
+{
+	fprintf (fp, "%-*s %12s %12s %12s %12s\n", width, title,
+		"reads", "writes", "fetches", "total");
+}
+
+
+static const char *
+heat_device_type (unsigned int devid)
+{
+	if (devid >= device_count)
+		return "none";
+	if (device_table[devid]->class_ptr == &ram_class)
+		return "ram";
+	if (device_table[devid]->class_ptr == &rom_class)
+		return "rom";
+	return "i/o";
+}
+
+
+/**
+ * Write the heatmap at the end of the run.
+ */
+void
+heatmap_report (void)
+{
+	struct heat_count all;
+	struct heat_range *r;
+	struct bus_map *map;
+	unsigned int devid, mapno, addr, kind;
+	unsigned long most;
+	const char *name;
+	FILE *fp;
+
+	if (!heatmap_enabled)
+		return;
+	heatmap_enabled = 0;
+
+	if (!strcmp (heatmap_file, "-"))
+		fp = stdout;
+	else if ((fp = fopen (heatmap_file, "w")) == NULL)
+	{
+		fprintf (stderr, "m6809-run: cannot write %s\n", heatmap_file);
+		return;
+	}
+
+	memset (&all, 0, sizeof (all));
+	for (devid = 0; devid <= MAX_BUS_DEVICES; devid++)
+		for (kind = HEAT_READ; kind <= HEAT_FETCH; kind++)
+			all.count[kind] += heat_devices[devid].count[kind];
+	fprintf (fp, "Memory access heatmap: ");
+	for (kind = HEAT_READ; kind <= HEAT_FETCH; kind++)
+		fprintf (fp, "%s%lu %s", kind ? ", " : "", all.count[kind],
+			heat_kind_names[kind]);
+	fprintf (fp, " in %lu cycles\n", get_cycles ());
+
+	/* By device */
+	most = 0;
+	for (devid = 0; devid <= MAX_BUS_DEVICES; devid++)
+		if (heat_total (&heat_devices[devid]) > most)
+			most = heat_total (&heat_devices[devid]);
+	fprintf (fp, "\nBy device:\n");
+	heat_print_header (fp, "device", 7);
+	for (devid = 0; devid <= MAX_BUS_DEVICES; devid++)
+	{
+		if (!heat_total (&heat_devices[devid]))
+			continue;
+		if (devid < MAX_BUS_DEVICES)
+			fprintf (fp, "%02X %-4s", devid, heat_device_type (devid));
+		else
+			fprintf (fp, "(none) ");
+		heat_print_counts (fp, &heat_devices[devid], most);
+	}
+
+	/* By bus map slot, with the device mapped there at the end */
+	most = 0;
+	for (mapno = 0; mapno < NUM_BUS_MAPS; mapno++)
+		if (heat_total (&heat_maps[mapno]) > most)
+			most = heat_total (&heat_maps[mapno]);
+	fprintf (fp, "\nBy page (device and offset mapped at the end of the run):\n");
+	heat_print_header (fp, "address    device", 23);
+	for (mapno = 0; mapno < NUM_BUS_MAPS; mapno++)
+	{
+		if (!heat_total (&heat_maps[mapno]))
+			continue;
+		map = &busmaps[mapno];
+		fprintf (fp, "%04X-%04X  %02X:%04lX %-4s", mapno * BUS_MAP_SIZE,
+			(mapno + 1) * BUS_MAP_SIZE - 1, map->devid, map->offset,
+			heat_device_type (map->devid));
+		heat_print_counts (fp, &heat_maps[mapno], most);
+	}
+
+	/* The byte ranges */
+	for (r = heat_ranges; r < heat_ranges + heat_range_count; r++)
+	{
+		most = 0;
+		for (addr = r->start; addr <= r->end; addr++)
+			if (heat_total (&r->bytes[addr - r->start]) > most)
+				most = heat_total (&r->bytes[addr - r->start]);
+		fprintf (fp, "\nBytes %04X-%04X:\n", r->start, r->end);
+		heat_print_header (fp, "address symbol", 24);
+		for (addr = r->start; addr <= r->end; addr++)
+		{
+			if (!heat_total (&r->bytes[addr - r->start]))
+				continue;
+			name = sym_lookup (&program_symtab, to_absolute (addr));
+			fprintf (fp, "%04X    %-16.16s", addr, name ? name : "");
+			heat_print_counts (fp, &r->bytes[addr - r->start], most);
+		}
+	}
+
+	if (fp != stdout)
+		fclose (fp);
+}
+
+
+/**
+ * Free the byte counts at the end of the simulation.
+ */
+void
+heatmap_free (void)
+{
+	unsigned int n;
+
+	for (n = 0; n < heat_range_count; n++)
+		free (heat_ranges[n].bytes);
+	heat_range_count = 0;
+	memset (heat_maps, 0, sizeof (heat_maps));
+	memset (heat_devices, 0, sizeof (heat_devices));
+	heatmap_enabled = 0;
+}
@@ -117,12 +117,20 @@ void imux_assert (struct hw_device *dev, unsigned int sig)
 }
 
 
+void imux_state (struct hw_device *dev)
+{
+	struct imux *mux = (struct imux *)dev->priv;
+	state_uint (&mux->enabled);
+	state_uint (&mux->pending);
+}
+
 struct hw_class imux_class =
 {
 	.readonly = 0,
 	.reset = imux_reset,
 	.read = imux_read,
 	.write = imux_write,
+	.state = imux_state,
 };
 
 struct hw_device *imux_create (unsigned int cpu_line)
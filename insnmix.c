@@ -0,0 +1,238 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The instruction mix.  With --insnmix=FILE, every instruction run is
+counted, with its cycles, by opcode on each of the three opcode pages,
+and the instructions that use indexed addressing are also counted by
+the kind of postbyte they have.  Like the flat profile, the counting
+is done by the execution engine built with PROFILE_HOOKS: the opcode
+is noted when it is dispatched (see MIX in 6809exec.h), and the
+cycles are charged when the next instruction begins.
+
+At the end of the run, both tables are written to FILE ("-" for
+stdout), from the most to the least expensive. */
+
+#include "6809.h"
+#include "monitor.h"
+
+extern INSTANCE long cpu_clk;
+
+/* The option that enables the counting */
+INSTANCE const char *insnmix_file = NULL;
+
+/* Nonzero if instructions are being counted */
+INSTANCE int insnmix_enabled = 0;
+
+/* The counts per opcode page and opcode, and per indexed postbyte */
+INSTANCE struct profile_count insnmix_ops[3][256];
+INSTANCE struct profile_count insnmix_modes[INSNMIX_MODES];
+
+/* The counts the instruction being timed is charged to: its opcode,
+and its postbyte if it is indexed */
+INSTANCE struct profile_count *insnmix_last;
+INSTANCE struct profile_count *insnmix_mode;
+
+/* Where the time before the first instruction goes */
+static INSTANCE struct profile_count insnmix_none;
+
+/* A line of the report */
+struct insnmix_entry
+{
+	const struct profile_count *count;
+	unsigned int page, op;
+};
+
+static const char *insnmix_mode_names[] = {
+	"illegal", "inherent", "immediate", "immediate", "direct",
+	"extended", "indexed", "relative", "relative", "register",
+	"register", "register",
+};
+
+/* The indexed modes, by the low 5 bits of postbytes with bit 7 set */
+static const char *insnmix_index_names[] = {
+	",R+", ",R++", ",-R", ",--R", ",R", "B,R", "A,R", NULL,
+	"n8,R", "n16,R", NULL, "D,R", "n8,PCR", "n16,PCR", NULL, NULL,
+	"[,R+]", "[,R++]", "[,-R]", "[,--R]", "[,R]", "[B,R]", "[A,R]", NULL,
+	"[n8,R]", "[n16,R]", NULL, "[D,R]", "[n8,PCR]", "[n16,PCR]", NULL, "[n16]",
+};
+
+
+/**
+ * Turn on counting, if --insnmix was given.  The JIT is turned off,
+ * as translated code is not counted.
+ */
+void
+insnmix_init (void)
+{
+	if (!insnmix_file)
+		return;
+	insnmix_enabled = 1;
+	insnmix_last = &insnmix_none;
+	insnmix_mode = NULL;
+	jit_enabled = 0;
+}
+
+
+static int
+entry_compare (const void *a, const void *b)
+{
+	const struct profile_count *ca = ((const struct insnmix_entry *)a)->count;
+	const struct profile_count *cb = ((const struct insnmix_entry *)b)->count;
+
+	if (ca->cycles != cb->cycles)
+		return ca->cycles < cb->cycles ? 1 : -1;
+	if (ca->insns != cb->insns)
+		return ca->insns < cb->insns ? 1 : -1;
+	return 0;
+}
+
+
+static double
+insnmix_percent (unsigned long part, unsigned long total)
+{
+	return total ? part * 100.0 / total : 0.0;
+}
+
+
+/**
+ * Write the instruction mix at the end of the run.
+ */
+void
+insnmix_report (void)
+{
+	struct insnmix_entry entries[3 * 256 + INSNMIX_MODES];
+	const struct profile_count *c;
+	unsigned int nentries = 0, page, op, mode, n;
+	unsigned long total_cycles = 0, total_insns = 0;
+	unsigned long indexed_cycles = 0, indexed_insns = 0;
+	const char *name;
+	char buf[16];
+	FILE *fp;
+
+	if (!insnmix_enabled)
+		return;
+	insnmix_enabled = 0;
+
+	/* The program may have stopped in the middle of an instruction */
+	if (profile_clk > cpu_clk)
+	{
+		insnmix_last->cycles += profile_clk - cpu_clk;
+		if (insnmix_mode)
+			insnmix_mode->cycles += profile_clk - cpu_clk;
+	}
+
+	if (!strcmp (insnmix_file, "-"))
+		fp = stdout;
+	else if ((fp = fopen (insnmix_file, "w")) == NULL)
+	{
+		fprintf (stderr, "m6809-run: cannot write %s\n", insnmix_file);
+		return;
+	}
+
+	for (page = 0; page < 3; page++)
+		for (op = 0; op < 256; op++)
+		{
+			c = &insnmix_ops[page][op];
+			/* $10 and $11 on the base page are only prefixes; the
+			instructions are counted on their own pages */
+			if (page == 0 && (op == 0x10 || op == 0x11))
+				continue;
+			if (!c->insns && !c->cycles)
+				continue;
+			entries[nentries].count = c;
+			entries[nentries].page = page;
+			entries[nentries].op = op;
+			nentries++;
+			total_cycles += c->cycles;
+			total_insns += c->insns;
+		}
+	total_cycles += insnmix_none.cycles;
+	qsort (entries, nentries, sizeof (struct insnmix_entry), entry_compare);
+
+	fprintf (fp, "Instruction mix: %lu cycles, %lu instructions\n\n",
+		total_cycles, total_insns);
+	fprintf (fp, "%%cycles         cycles  instructions  cyc/insn  opcode  mnemonic\n");
+	for (n = 0; n < nentries; n++)
+	{
+		c = entries[n].count;
+		if (entries[n].page)
+			sprintf (buf, "%02X %02X", entries[n].page == 1 ? 0x10 : 0x11,
+				entries[n].op);
+		else
+			sprintf (buf, "%02X", entries[n].op);
+		name = opcode_name (entries[n].page, entries[n].op, &mode);
+		fprintf (fp, "%6.2f %14lu %13lu %9.2f  %-6s  %-6s %s\n",
+			insnmix_percent (c->cycles, total_cycles), c->cycles, c->insns,
+			c->insns ? (double)c->cycles / c->insns : 0.0, buf, name,
+			mode < sizeof (insnmix_mode_names) / sizeof (char *)
+				? insnmix_mode_names[mode] : "");
+	}
+
+	/* The indexed modes */
+	nentries = 0;
+	for (mode = 0; mode < INSNMIX_MODES; mode++)
+	{
+		c = &insnmix_modes[mode];
+		if (!c->insns)
+			continue;
+		entries[nentries].count = c;
+		entries[nentries].op = mode;
+		nentries++;
+		indexed_cycles += c->cycles;
+		indexed_insns += c->insns;
+	}
+	qsort (entries, nentries, sizeof (struct insnmix_entry), entry_compare);
+
+	fprintf (fp, "\nIndexed addressing: %lu cycles, %lu instructions\n\n",
+		indexed_cycles, indexed_insns);
+	fprintf (fp, "%%cycles         cycles  instructions  cyc/insn  postbyte\n");
+	for (n = 0; n < nentries; n++)
+	{
+		c = entries[n].count;
+		mode = entries[n].op;
+		if (mode == INSNMIX_OFFSET5)
+			name = "n5,R";
+		else if ((name = insnmix_index_names[mode]) == NULL)
+		{
+			sprintf (buf, "1xx%d%d%d%d%d", (mode >> 4) & 1, (mode >> 3) & 1,
+				(mode >> 2) & 1, (mode >> 1) & 1, mode & 1);
+			name = buf;
+		}
+		fprintf (fp, "%6.2f %14lu %13lu %9.2f  %s\n",
+			insnmix_percent (c->cycles, total_cycles), c->cycles, c->insns,
+			(double)c->cycles / c->insns, name);
+	}
+
+	if (fp != stdout)
+		fclose (fp);
+}
+
+
+/**
+ * Clear the counts at the end of the simulation.
+ */
+void
+insnmix_free (void)
+{
+	memset (insnmix_ops, 0, sizeof (insnmix_ops));
+	memset (insnmix_modes, 0, sizeof (insnmix_modes));
+	memset (&insnmix_none, 0, sizeof (insnmix_none));
+	insnmix_enabled = 0;
+}
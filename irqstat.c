@@ -0,0 +1,336 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Interrupt statistics.  With --irqstat, or after 'irqstat on' in the
+debugger, the simulator measures for IRQ and FIRQ:
+
+- the latency, from the first request_irq or request_firq for a
+source that was not already pending, to the entry of the handler,
+including any time that the interrupt was masked;
+
+- the service time, from the entry of the handler to its RTI,
+including any interrupt nested inside it;
+
+- the nesting depth at which each handler is entered, counting
+SWIs as well;
+
+- how many times each source was serviced, i.e. was pending when
+the handler was entered, and its worst latency.
+
+Times are kept in histograms with 8 buckets per power of two, so
+that the percentiles printed are within 1/8 of the true value.  The
+statistics are printed by the 'irqstat' command, and at exit. */
+
+#include "6809.h"
+
+#define HIST_LINEAR   16
+#define HIST_SUB      8
+#define HIST_BUCKETS  (HIST_LINEAR + (32 - 4) * HIST_SUB)
+
+#define MAX_SOURCES   32
+#define MAX_NESTING   16
+
+struct histogram
+{
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long min, max;
+	unsigned long bucket[HIST_BUCKETS];
+};
+
+/* The statistics for one interrupt line */
+struct irq_line
+{
+	const char *name;
+	struct histogram latency;
+	struct histogram service;
+	unsigned long source_count[MAX_SOURCES];
+	unsigned long source_worst[MAX_SOURCES];
+
+	/* When each source was requested, for those in requested */
+	unsigned long request_time[MAX_SOURCES];
+	unsigned int requested;
+};
+
+/* The option that enables the statistics */
+INSTANCE int irqstat_enabled = 0;
+
+static INSTANCE struct irq_line irq_lines[2];
+
+/* The handlers being run, innermost last */
+static INSTANCE struct
+{
+	int kind;
+	unsigned long start;
+} irq_nest[MAX_NESTING];
+static INSTANCE unsigned int irq_depth;
+static INSTANCE unsigned int irq_max_depth;
+static INSTANCE unsigned long irq_depth_count[MAX_NESTING + 1];
+
+
+static unsigned int
+hist_index (unsigned long v)
+{
+	unsigned int e;
+
+	if (v < HIST_LINEAR)
+		return v;
+	if (v > 0xFFFFFFFFUL)
+		v = 0xFFFFFFFFUL;
+	for (e = 4; (v >> (e + 1)) != 0; e++)
+		;
+	return HIST_LINEAR + (e - 4) * HIST_SUB + ((v >> (e - 3)) & (HIST_SUB - 1));
+}
+
+
+/**
+ * Return the largest value that falls in bucket N.
+ */
+static unsigned long
+hist_bucket_max (unsigned int n)
+{
+	unsigned int e;
+
+	if (n < HIST_LINEAR)
+		return n;
+	e = (n - HIST_LINEAR) / HIST_SUB + 4;
+	return ((unsigned long)(HIST_SUB + (n - HIST_LINEAR) % HIST_SUB + 1)
+		<< (e - 3)) - 1;
+}
+
+
+static void
+hist_add (struct histogram *h, unsigned long v)
+{
+	if (h->count == 0 || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->bucket[hist_index (v)]++;
+}
+
+
+/**
+ * Return the value below which PERMILLE thousandths of the samples
+ * fall, to the precision of the buckets.
+ */
+static unsigned long
+hist_percentile (const struct histogram *h, unsigned int permille)
+{
+	unsigned long long want = ((unsigned long long)h->count * permille + 999) / 1000;
+	unsigned long long seen = 0;
+	unsigned int n;
+
+	for (n = 0; n < HIST_BUCKETS; n++)
+	{
+		seen += h->bucket[n];
+		if (seen >= want && seen > 0)
+			return hist_bucket_max (n) < h->max ? hist_bucket_max (n) : h->max;
+	}
+	return h->max;
+}
+
+
+static void
+hist_print (FILE *fp, const char *title, const struct histogram *h)
+{
+	unsigned long rows[33];
+	unsigned long most = 0;
+	unsigned int n, row, first = 33, last = 0;
+
+	fprintf (fp, "  %s: %lu", title, h->count);
+	if (h->count == 0)
+	{
+		fprintf (fp, "\n");
+		return;
+	}
+	fprintf (fp, ", min %lu, avg %llu, max %lu cycles\n",
+		h->min, h->sum / h->count, h->max);
+	fprintf (fp, "    p50 %lu, p90 %lu, p99 %lu, p99.9 %lu\n",
+		hist_percentile (h, 500), hist_percentile (h, 900),
+		hist_percentile (h, 990), hist_percentile (h, 999));
+
+	/* Print the buckets one power of two to a row */
+	memset (rows, 0, sizeof (rows));
+	for (n = 0; n < HIST_BUCKETS; n++)
+	{
+		unsigned long v = hist_bucket_max (n);
+		for (row = 0; v >> row; row++)
+			;
+		rows[row] += h->bucket[n];
+	}
+	for (row = 0; row < 33; row++)
+		if (rows[row])
+		{
+			if (row < first)
+				first = row;
+			last = row;
+			if (rows[row] > most)
+				most = rows[row];
+		}
+	for (row = first; row <= last; row++)
+	{
+		unsigned long lo = row ? 1UL << (row - 1) : 0;
+		unsigned long hi = row ? (1UL << row) - 1 : 0;
+		fprintf (fp, "    %10lu-%-10lu %10lu %.*s\n", lo, hi, rows[row],
+			(int)((rows[row] * 40 + most - 1) / most),
+			"########################################");
+	}
+}
+
+
+/**
+ * Clear the statistics.  Interrupts that are pending or being
+ * serviced now are not counted.
+ */
+void
+irqstat_reset (void)
+{
+	memset (irq_lines, 0, sizeof (irq_lines));
+	irq_lines[IRQSTAT_IRQ].name = "IRQ";
+	irq_lines[IRQSTAT_FIRQ].name = "FIRQ";
+	irq_depth = irq_max_depth = 0;
+	memset (irq_depth_count, 0, sizeof (irq_depth_count));
+}
+
+
+/**
+ * Called when SOURCE requests an interrupt on line KIND, before it is
+ * added to PENDING.
+ */
+void
+irqstat_request (int kind, unsigned int source, unsigned int pending)
+{
+	struct irq_line *line = &irq_lines[kind];
+
+	if (reverse_running || source >= MAX_SOURCES || (pending & (1U << source)))
+		return;
+	line->request_time[source] = get_cycles ();
+	line->requested |= 1U << source;
+}
+
+
+/**
+ * Called when the CPU enters the handler for interrupt KIND, with the
+ * sources that were PENDING.
+ */
+void
+irqstat_enter (int kind, unsigned int pending)
+{
+	struct irq_line *line;
+	unsigned long now = get_cycles ();
+	unsigned long latency, first = now;
+	unsigned int source;
+
+	if (reverse_running)
+		return;
+
+	if (kind != IRQSTAT_SWI)
+	{
+		line = &irq_lines[kind];
+		for (source = 0; source < MAX_SOURCES; source++)
+			if (pending & (1U << source))
+			{
+				line->source_count[source]++;
+				if (!(line->requested & (1U << source)))
+					continue;
+				latency = now - line->request_time[source];
+				if (latency > line->source_worst[source])
+					line->source_worst[source] = latency;
+				if (line->request_time[source] < first)
+					first = line->request_time[source];
+			}
+		if (pending & line->requested)
+			hist_add (&line->latency, now - first);
+		line->requested &= ~pending;
+	}
+
+	irq_depth_count[irq_depth < MAX_NESTING ? irq_depth : MAX_NESTING]++;
+	if (irq_depth < MAX_NESTING)
+	{
+		irq_nest[irq_depth].kind = kind;
+		irq_nest[irq_depth].start = now;
+	}
+	irq_depth++;
+	if (irq_depth > irq_max_depth)
+		irq_max_depth = irq_depth;
+}
+
+
+/**
+ * Called by RTI, at the end of the innermost handler.
+ */
+void
+irqstat_return (void)
+{
+	if (reverse_running || irq_depth == 0)
+		return;
+	irq_depth--;
+	if (irq_depth < MAX_NESTING && irq_nest[irq_depth].kind != IRQSTAT_SWI)
+		hist_add (&irq_lines[irq_nest[irq_depth].kind].service,
+			get_cycles () - irq_nest[irq_depth].start);
+}
+
+
+/**
+ * Print the statistics to FP.
+ */
+void
+irqstat_print (FILE *fp)
+{
+	struct irq_line *line;
+	unsigned int kind, source, depth;
+
+	for (kind = IRQSTAT_IRQ; kind <= IRQSTAT_FIRQ; kind++)
+	{
+		line = &irq_lines[kind];
+		fprintf (fp, "%s:\n", line->name);
+		hist_print (fp, "latency", &line->latency);
+		hist_print (fp, "service", &line->service);
+		for (source = 0; source < MAX_SOURCES; source++)
+			if (line->source_count[source])
+				fprintf (fp, "  source %u: %lu, worst latency %lu cycles\n",
+					source, line->source_count[source],
+					line->source_worst[source]);
+	}
+
+	fprintf (fp, "Nesting: max depth %u\n", irq_max_depth);
+	for (depth = 0; depth <= MAX_NESTING; depth++)
+		if (irq_depth_count[depth])
+			fprintf (fp, "  entered at depth %u%s: %lu\n", depth,
+				depth == MAX_NESTING ? " or more" : "",
+				irq_depth_count[depth]);
+}
+
+
+/**
+ * Print the statistics at the end of the run.
+ */
+void
+irqstat_report (void)
+{
+	if (!irqstat_enabled)
+		return;
+	printf ("Interrupt statistics at %lu cycles:\n", get_cycles ());
+	irqstat_print (stdout);
+	irqstat_enabled = 0;
+}
@@ -0,0 +1,1434 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* A translator from 6809 code into x86-64 machine code.
+
+Predecoded blocks (see predecode.c) that are entered often enough
+are translated into a host function, which the CPU loop then calls
+instead of interpreting the block.  Only a subset of the instruction
+set is translated: loads, stores, ALU operations, unary operations,
+LEA and branches.  Translation stops at the first instruction outside
+the subset, and the interpreter picks up from there.
+
+The generated code keeps the CPU registers in their usual globals,
+addressed relative to r15.  It computes the condition codes eagerly,
+exactly as the C helpers in 6809.c define them: any lazy flags left
+pending by the interpreter are evaluated on entry, and none are left
+pending on exit.  Each instruction subtracts the number of cycles the
+interpreter measured for it, and the block stops as soon as cpu_clk
+runs out, just as the interpreter would.
+
+Memory is accessed directly through the host buffer of RAM and ROM
+devices.  The effective address is checked before the instruction
+changes anything; if it is not plain RAM/ROM (an I/O device, an
+unmapped page, a page that holds predecoded code, or a 16-bit access
+that straddles a page), the block exits and the interpreter executes
+that instruction instead.
+
+With --jit-compare, every translated block is run twice: once as
+native code, and again by the interpreter from the same starting
+state.  Registers, cycle counts and all bytes written are compared,
+and any difference is reported and the block is no longer translated. */
+
+#include "6809.h"
+#include "monitor.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_JIT
+#include <sys/mman.h>
+#endif
+
+extern INSTANCE unsigned X, Y, S, U, PC;
+extern INSTANCE unsigned A, B, DP;
+extern INSTANCE unsigned H, N, Z, OV, C;
+extern INSTANCE long cpu_clk;
+
+/* 0 = interpret only, JIT_ON = run translated blocks,
+JIT_COMPARE = run them and check them against the interpreter */
+INSTANCE int jit_enabled = 0;
+
+/* The number of times a block is entered before it is translated */
+#define JIT_THRESHOLD 16
+
+/* Marks a block that cannot be translated */
+#define JIT_NEVER 0xFFFFFFFFU
+
+INSTANCE unsigned long jit_blocks_translated = 0;
+INSTANCE unsigned long jit_compare_failures = 0;
+
+#ifdef HAVE_JIT
+
+/* The size of the code buffer.  When it fills up, everything is
+thrown away and translation starts over. */
+#define JIT_BUF_SIZE (8 * 1024 * 1024)
+
+/* The most code a single block can need */
+#define JIT_MAX_BLOCK_SIZE (PD_MAX_INSNS * 512)
+
+/* How a memory operand is going to be used */
+#define JIT_READ   0x1
+#define JIT_WRITE  0x2
+#define JIT_WORD   0x4
+
+static INSTANCE U8 *jit_buf;
+static INSTANCE U8 *jit_ptr;
+
+/* The base address that r15 holds; all CPU globals are addressed
+relative to it. */
+static INSTANCE char *jit_base;
+
+/* In compare mode, each byte written by translated code is recorded,
+so that the write can be undone before the interpreter runs. */
+struct jit_write
+{
+	U8 *ptr;
+	U8 old_val;
+	U8 new_val;
+	unsigned int addr;
+};
+
+static INSTANCE struct jit_write jit_log[PD_MAX_INSNS * 2];
+static INSTANCE unsigned int jit_log_count;
+static INSTANCE int jit_logging = 0;
+
+
+/**
+ * Return a host pointer to the memory at CPU address ADDR, or NULL
+ * if translated code may not access it directly.  Called from the
+ * generated code.
+ */
+static U8 *
+jit_mem_ptr (unsigned int addr, unsigned int how)
+{
+	unsigned int mapno = (addr & 0xFFFF) / BUS_MAP_SIZE;
+	U8 *ptr;
+
+	if ((how & JIT_WORD) && (addr % BUS_MAP_SIZE) == BUS_MAP_SIZE - 1)
+		return NULL;
+	if ((how & JIT_READ) && !bus_read_ptr[mapno])
+		return NULL;
+	if ((how & JIT_WRITE) && !bus_write_ptr[mapno])
+		return NULL;
+
+	/* Both pointers are the same whenever both are set */
+	ptr = ((how & JIT_WRITE) ? bus_write_ptr[mapno] : bus_read_ptr[mapno])
+		+ addr % BUS_MAP_SIZE;
+	if ((how & JIT_WRITE) && jit_logging)
+	{
+		jit_log[jit_log_count].ptr = ptr;
+		jit_log[jit_log_count].old_val = ptr[0];
+		jit_log[jit_log_count++].addr = addr;
+		if (how & JIT_WORD)
+		{
+			jit_log[jit_log_count].ptr = ptr + 1;
+			jit_log[jit_log_count].old_val = ptr[1];
+			jit_log[jit_log_count++].addr = addr + 1;
+		}
+	}
+	return ptr;
+}
+
+
+/* x86-64 code emission */
+
+#define EAX 0
+#define ECX 1
+#define EDX 2
+#define EBX 3
+#define ESI 6
+#define EDI 7
+
+/* ALU opcodes, reg/reg form */
+#define XOP_ADD 0x01
+#define XOP_OR  0x09
+#define XOP_AND 0x21
+#define XOP_SUB 0x29
+#define XOP_XOR 0x31
+#define XOP_MOV 0x89
+#define XOP_TEST 0x85
+
+/* ALU opcode extensions, reg/imm form */
+#define XEXT_ADD 0
+#define XEXT_OR  1
+#define XEXT_AND 4
+#define XEXT_SUB 5
+#define XEXT_XOR 6
+#define XEXT_CMP 7
+
+/* Condition codes for Jcc/SETcc */
+#define XCC_E  0x4
+#define XCC_NE 0x5
+#define XCC_LE 0xE
+
+static inline void
+emit1 (U8 b)
+{
+	*jit_ptr++ = b;
+}
+
+static void
+emit4 (unsigned int v)
+{
+	emit1 (v);
+	emit1 (v >> 8);
+	emit1 (v >> 16);
+	emit1 (v >> 24);
+}
+
+static void
+emit8 (unsigned long v)
+{
+	emit4 (v);
+	emit4 (v >> 32);
+}
+
+/* ModRM for [r15 + disp32] */
+static void
+x_modrm_g (int reg, void *g)
+{
+	emit1 (0x80 | (reg << 3) | 7);
+	emit4 ((char *)g - jit_base);
+}
+
+/* mov reg, dword [g] */
+static void
+x_ld (int reg, void *g)
+{
+	emit1 (0x41);
+	emit1 (0x8B);
+	x_modrm_g (reg, g);
+}
+
+/* mov dword [g], reg */
+static void
+x_st (void *g, int reg)
+{
+	emit1 (0x41);
+	emit1 (0x89);
+	x_modrm_g (reg, g);
+}
+
+/* mov dword [g], imm */
+static void
+x_sti (void *g, unsigned int imm)
+{
+	emit1 (0x41);
+	emit1 (0xC7);
+	x_modrm_g (0, g);
+	emit4 (imm);
+}
+
+/* cmp dword [g], 0 */
+static void
+x_cmp0 (void *g)
+{
+	emit1 (0x41);
+	emit1 (0x83);
+	x_modrm_g (7, g);
+	emit1 (0);
+}
+
+/* mov reg, imm */
+static void
+x_ldi (int reg, unsigned int imm)
+{
+	emit1 (0xB8 + reg);
+	emit4 (imm);
+}
+
+/* op dst, src */
+static void
+x_rr (int op, int dst, int src)
+{
+	emit1 (op);
+	emit1 (0xC0 | (src << 3) | dst);
+}
+
+/* op reg, imm */
+static void
+x_ri (int ext, int reg, unsigned int imm)
+{
+	emit1 (0x81);
+	emit1 (0xC0 | (ext << 3) | reg);
+	emit4 (imm);
+}
+
+static void
+x_shl (int reg, int n)
+{
+	emit1 (0xC1);
+	emit1 (0xE0 | reg);
+	emit1 (n);
+}
+
+static void
+x_shr (int reg, int n)
+{
+	emit1 (0xC1);
+	emit1 (0xE8 | reg);
+	emit1 (n);
+}
+
+static void
+x_not (int reg)
+{
+	emit1 (0xF7);
+	emit1 (0xD0 | reg);
+}
+
+static void
+x_neg (int reg)
+{
+	emit1 (0xF7);
+	emit1 (0xD8 | reg);
+}
+
+/* movsx dst, src8 */
+static void
+x_movsx8 (int dst, int src)
+{
+	emit1 (0x0F);
+	emit1 (0xBE);
+	emit1 (0xC0 | (dst << 3) | src);
+}
+
+/* setcc reg8; movzx reg, reg8 */
+static void
+x_setcc (int cc, int reg)
+{
+	emit1 (0x0F);
+	emit1 (0x90 | cc);
+	emit1 (0xC0 | reg);
+	emit1 (0x0F);
+	emit1 (0xB6);
+	emit1 (0xC0 | (reg << 3) | reg);
+}
+
+/* movzx reg, byte [rbx + disp] */
+static void
+x_ldb (int reg, int disp)
+{
+	emit1 (0x0F);
+	emit1 (0xB6);
+	emit1 (0x40 | (reg << 3) | EBX);
+	emit1 (disp);
+}
+
+/* mov byte [rbx + disp], reg8 */
+static void
+x_stb (int disp, int reg)
+{
+	emit1 (0x88);
+	emit1 (0x40 | (reg << 3) | EBX);
+	emit1 (disp);
+}
+
+/* sub qword [cpu_clk], n */
+static void
+x_sub_clk (unsigned int n)
+{
+	emit1 (0x49);
+	emit1 (0x81);
+	x_modrm_g (5, &cpu_clk);
+	emit4 (n);
+}
+
+/* jcc rel32; returns the location of the displacement */
+static U8 *
+x_jcc (int cc)
+{
+	emit1 (0x0F);
+	emit1 (0x80 | cc);
+	emit4 (0);
+	return jit_ptr - 4;
+}
+
+static void
+x_patch (U8 *where)
+{
+	int rel = jit_ptr - (where + 4);
+	memcpy (where, &rel, 4);
+}
+
+/* Call a C function with arguments already in edi/esi */
+static void
+x_call (void *fn)
+{
+	emit1 (0x48);
+	emit1 (0xB8);
+	emit8 ((unsigned long)fn);
+	emit1 (0xFF);
+	emit1 (0xD0);
+}
+
+static void
+x_prologue (void)
+{
+	emit1 (0x53);                    /* push rbx */
+	emit1 (0x41); emit1 (0x57);      /* push r15 */
+	emit1 (0x48); emit1 (0x83);      /* sub rsp, 8 */
+	emit1 (0xEC); emit1 (0x08);
+	emit1 (0x49); emit1 (0xBF);      /* mov r15, jit_base */
+	emit8 ((unsigned long)jit_base);
+}
+
+/* Set PC, return the instruction count */
+static void
+x_exit (unsigned int pc, unsigned int count)
+{
+	x_sti (&PC, pc);
+	x_ldi (EAX, count);
+	emit1 (0x48); emit1 (0x83);      /* add rsp, 8 */
+	emit1 (0xC4); emit1 (0x08);
+	emit1 (0x41); emit1 (0x5F);      /* pop r15 */
+	emit1 (0x5B);                    /* pop rbx */
+	emit1 (0xC3);                    /* ret */
+}
+
+
+/* Exits out of the middle of a block, whose code is emitted after
+the body. */
+struct jit_exit
+{
+	U8 *patch;
+	unsigned int pc;
+	unsigned int count;
+};
+
+static INSTANCE struct jit_exit jit_exits[PD_MAX_INSNS * 4];
+static INSTANCE unsigned int jit_exit_count;
+
+static void
+jit_add_exit (U8 *patch, unsigned int pc, unsigned int count)
+{
+	jit_exits[jit_exit_count].patch = patch;
+	jit_exits[jit_exit_count].pc = pc;
+	jit_exits[jit_exit_count++].count = count;
+}
+
+
+/* Decoding of the indexed postbyte.  Only the non-indirect modes
+are translated. */
+struct jit_ea
+{
+	unsigned *reg;      /* base register, or NULL if constant */
+	int offset;         /* constant offset */
+	unsigned *acc;      /* accumulator offset (A, B or JIT_ACC_D) */
+	int update;         /* autoincrement/decrement of reg */
+	int len;            /* postbyte plus offset bytes */
+};
+
+#define JIT_ACC_D ((unsigned *)&jit_base)
+
+static int
+jit_decode_indexed (const U8 *p, unsigned int next_pc, struct jit_ea *ea)
+{
+	unsigned *const regs[4] = { &X, &Y, &U, &S };
+	unsigned post = p[0];
+
+	ea->reg = regs[(post >> 5) & 3];
+	ea->offset = 0;
+	ea->acc = NULL;
+	ea->update = 0;
+	ea->len = 1;
+
+	if (!(post & 0x80))
+	{
+		ea->offset = (post & 0x10) ? (int)(post | ~0x1f) : (int)(post & 0x0f);
+		return 1;
+	}
+
+	switch (post & 0x1f)
+	{
+		case 0x00: ea->update = 1; break;
+		case 0x01: ea->update = 2; break;
+		case 0x02: ea->update = -1; ea->offset = -1; break;
+		case 0x03: ea->update = -2; ea->offset = -2; break;
+		case 0x04: break;
+		case 0x05: ea->acc = &B; break;
+		case 0x06: ea->acc = &A; break;
+		case 0x08: ea->offset = (INT8)p[1]; ea->len = 2; break;
+		case 0x09: ea->offset = (INT16)((p[1] << 8) | p[2]); ea->len = 3; break;
+		case 0x0b: ea->acc = JIT_ACC_D; break;
+		case 0x0c:
+			ea->reg = NULL;
+			ea->offset = (next_pc + (INT8)p[1]) & 0xffff;
+			ea->len = 2;
+			break;
+		case 0x0d:
+			ea->reg = NULL;
+			ea->offset = (next_pc + (INT16)((p[1] << 8) | p[2])) & 0xffff;
+			ea->len = 3;
+			break;
+		default:
+			return 0;
+	}
+	return 1;
+}
+
+
+/* Compute an effective address into EDI, without updating any
+registers. */
+static void
+jit_emit_ea (struct jit_ea *ea)
+{
+	if (!ea->reg)
+	{
+		x_ldi (EDI, ea->offset);
+		return;
+	}
+
+	x_ld (EDI, ea->reg);
+	if (ea->acc == JIT_ACC_D)
+	{
+		/* D,R */
+		x_ld (EAX, &A);
+		x_shl (EAX, 8);
+		x_ld (ECX, &B);
+		x_rr (XOP_OR, EAX, ECX);
+		x_rr (XOP_ADD, EDI, EAX);
+	}
+	else if (ea->acc)
+	{
+		x_ld (EAX, ea->acc);
+		x_movsx8 (EAX, EAX);
+		x_rr (XOP_ADD, EDI, EAX);
+	}
+	if (ea->offset)
+		x_ri (XEXT_ADD, EDI, ea->offset);
+	x_ri (XEXT_AND, EDI, 0xffff);
+}
+
+
+/* Apply the register update of an autoincrement/decrement mode */
+static void
+jit_emit_ea_update (struct jit_ea *ea)
+{
+	if (!ea->update)
+		return;
+	x_ld (EAX, ea->reg);
+	x_ri (XEXT_ADD, EAX, ea->update);
+	x_ri (XEXT_AND, EAX, 0xffff);
+	x_st (ea->reg, EAX);
+}
+
+
+/* Emit the check that the memory operand is plain RAM/ROM, leaving
+the host pointer in RBX, or exiting to the interpreter. */
+static void
+jit_emit_mem (unsigned int how, unsigned int pc, unsigned int count)
+{
+	x_ldi (ESI, how);
+	x_call (jit_mem_ptr);
+	emit1 (0x48); emit1 (0x85); emit1 (0xC0);   /* test rax, rax */
+	jit_add_exit (x_jcc (XCC_E), pc, count);
+	emit1 (0x48); emit1 (0x89); emit1 (0xC3);   /* mov rbx, rax */
+}
+
+
+/* Set N and Z from REG, and clear OV */
+static void
+jit_emit_nz8 (int reg)
+{
+	x_st (&N, reg);
+	x_st (&Z, reg);
+	x_sti (&OV, 0);
+}
+
+
+/* The operations of the 8-bit accumulator group, in the order of the
+low nibble of the opcode.  -1 means not translated here. */
+enum { J_SUB, J_CMP, J_AND, J_BIT, J_LD, J_ST, J_EOR, J_OR, J_ADD };
+
+static const int jit_acc_ops[16] = {
+	J_SUB, J_CMP, -1, -1, J_AND, J_BIT, J_LD, J_ST,
+	J_EOR, -1, J_OR, J_ADD, -1, -1, -1, -1,
+};
+
+
+/* 8-bit operation on accumulator ACC, with the operand in ECX */
+static void
+jit_emit_acc8 (int op, unsigned *acc)
+{
+	switch (op)
+	{
+		case J_LD:
+			x_st (acc, ECX);
+			jit_emit_nz8 (ECX);
+			break;
+
+		case J_AND:
+		case J_BIT:
+		case J_OR:
+		case J_EOR:
+			x_ld (EAX, acc);
+			x_rr (op == J_OR ? XOP_OR : op == J_EOR ? XOP_XOR : XOP_AND,
+				EAX, ECX);
+			if (op != J_BIT)
+				x_st (acc, EAX);
+			jit_emit_nz8 (EAX);
+			break;
+
+		case J_ADD:
+			/* C = (res >> 1) & 0x80; H = arg ^ val ^ res; OV = H ^ C */
+			x_ld (EAX, acc);
+			x_rr (XOP_MOV, EDX, EAX);
+			x_rr (XOP_ADD, EDX, ECX);
+			x_rr (XOP_MOV, ESI, EDX);
+			x_shr (ESI, 1);
+			x_ri (XEXT_AND, ESI, 0x80);
+			x_st (&C, ESI);
+			x_ri (XEXT_AND, EDX, 0xff);
+			x_st (&N, EDX);
+			x_st (&Z, EDX);
+			x_rr (XOP_XOR, EAX, ECX);
+			x_rr (XOP_XOR, EAX, EDX);
+			x_st (&H, EAX);
+			x_rr (XOP_XOR, EAX, ESI);
+			x_st (&OV, EAX);
+			x_st (acc, EDX);
+			break;
+
+		case J_SUB:
+		case J_CMP:
+			/* C = res & 0x100; OV = (arg ^ val) & (arg ^ res) */
+			x_ld (EAX, acc);
+			x_rr (XOP_MOV, EDX, EAX);
+			x_rr (XOP_SUB, EDX, ECX);
+			x_rr (XOP_MOV, ESI, EDX);
+			x_ri (XEXT_AND, ESI, 0x100);
+			x_st (&C, ESI);
+			x_ri (XEXT_AND, EDX, 0xff);
+			x_st (&N, EDX);
+			x_st (&Z, EDX);
+			x_rr (XOP_MOV, ESI, EAX);
+			x_rr (XOP_XOR, ESI, ECX);
+			x_rr (XOP_XOR, EAX, EDX);
+			x_rr (XOP_AND, EAX, ESI);
+			x_st (&OV, EAX);
+			if (op == J_SUB)
+				x_st (acc, EDX);
+			break;
+	}
+}
+
+
+/* Load the D register into REG */
+static void
+jit_emit_get_d (int reg)
+{
+	x_ld (reg, &A);
+	x_shl (reg, 8);
+	x_ld (EDX, &B);
+	x_rr (XOP_OR, reg, EDX);
+}
+
+
+/* 16-bit operations, with the operand in ECX.  REG is NULL for D. */
+enum { J16_LD, J16_CMP, J16_ADD, J16_SUB };
+
+static void
+jit_emit_acc16 (int op, unsigned *reg)
+{
+	switch (op)
+	{
+		case J16_LD:
+			x_st (&Z, ECX);
+			x_rr (XOP_MOV, EAX, ECX);
+			x_shr (EAX, 8);
+			x_st (&N, EAX);
+			x_sti (&OV, 0);
+			if (reg)
+				x_st (reg, ECX);
+			else
+			{
+				x_st (&A, EAX);
+				x_rr (XOP_MOV, EAX, ECX);
+				x_ri (XEXT_AND, EAX, 0xff);
+				x_st (&B, EAX);
+			}
+			break;
+
+		case J16_CMP:
+		case J16_SUB:
+		case J16_ADD:
+			if (reg)
+				x_ld (EAX, reg);
+			else
+				jit_emit_get_d (EAX);
+			x_rr (XOP_MOV, EDX, EAX);
+			x_rr (op == J16_ADD ? XOP_ADD : XOP_SUB, EDX, ECX);
+			x_rr (XOP_MOV, ESI, EDX);
+			x_ri (XEXT_AND, ESI, 0x10000);
+			x_st (&C, ESI);
+			x_ri (XEXT_AND, EDX, 0xffff);
+			x_st (&Z, EDX);
+			if (op == J16_ADD)
+			{
+				/* OV = ((arg ^ res) & (val ^ res)) >> 8 */
+				x_rr (XOP_XOR, EAX, EDX);
+				x_rr (XOP_XOR, ECX, EDX);
+				x_rr (XOP_AND, EAX, ECX);
+			}
+			else
+			{
+				/* OV = ((arg ^ val) & (arg ^ res)) >> 8 */
+				x_rr (XOP_MOV, ESI, EAX);
+				x_rr (XOP_XOR, ESI, ECX);
+				x_rr (XOP_XOR, EAX, EDX);
+				x_rr (XOP_AND, EAX, ESI);
+			}
+			x_shr (EAX, 8);
+			x_st (&OV, EAX);
+			x_rr (XOP_MOV, EAX, EDX);
+			x_shr (EAX, 8);
+			x_st (&N, EAX);
+			if (op != J16_CMP)
+			{
+				x_st (&A, EAX);
+				x_ri (XEXT_AND, EDX, 0xff);
+				x_st (&B, EDX);
+			}
+			break;
+	}
+}
+
+
+/* 16-bit store of REG (NULL for D) to [rbx] */
+static void
+jit_emit_st16 (unsigned *reg)
+{
+	if (reg)
+		x_ld (ECX, reg);
+	else
+		jit_emit_get_d (ECX);
+	x_st (&Z, ECX);
+	x_rr (XOP_MOV, EAX, ECX);
+	x_shr (EAX, 8);
+	x_st (&N, EAX);
+	x_sti (&OV, 0);
+	x_stb (0, EAX);
+	x_stb (1, ECX);
+}
+
+
+/* Unary operations, on the value in EAX, leaving the result in EDX.
+Returns zero if the result is not written back (TST). */
+static int
+jit_emit_unary (int op)
+{
+	switch (op)
+	{
+		case 0x0: /* NEG */
+			x_rr (XOP_MOV, EDX, EAX);
+			x_neg (EDX);
+			x_ri (XEXT_AND, EDX, 0xff);
+			x_st (&C, EDX);
+			x_st (&N, EDX);
+			x_st (&Z, EDX);
+			x_rr (XOP_MOV, ECX, EDX);
+			x_rr (XOP_AND, ECX, EAX);
+			x_st (&OV, ECX);
+			return 1;
+
+		case 0x3: /* COM */
+			x_rr (XOP_MOV, EDX, EAX);
+			x_ri (XEXT_XOR, EDX, 0xff);
+			jit_emit_nz8 (EDX);
+			x_sti (&C, 1);
+			return 1;
+
+		case 0x4: /* LSR */
+			x_rr (XOP_MOV, EDX, EAX);
+			x_shr (EDX, 1);
+			x_sti (&N, 0);
+			x_st (&Z, EDX);
+			x_ri (XEXT_AND, EAX, 1);
+			x_st (&C, EAX);
+			return 1;
+
+		case 0x6: /* ROR */
+			x_rr (XOP_MOV, EDX, EAX);
+			x_cmp0 (&C);
+			x_setcc (XCC_NE, ECX);
+			x_shl (ECX, 8);
+			x_rr (XOP_OR, EDX, ECX);
+			x_rr (XOP_MOV, ECX, EDX);
+			x_ri (XEXT_AND, ECX, 1);
+			x_st (&C, ECX);
+			x_shr (EDX, 1);
+			x_st (&N, EDX);
+			x_st (&Z, EDX);
+			return 1;
+
+		case 0x7: /* ASR */
+			x_movsx8 (EDX, EAX);
+			x_rr (XOP_MOV, ECX, EDX);
+			x_ri (XEXT_AND, ECX, 1);
+			x_st (&C, ECX);
+			x_shr (EDX, 1);
+			x_ri (XEXT_AND, EDX, 0xff);
+			x_st (&N, EDX);
+			x_st (&Z, EDX);
+			return 1;
+
+		case 0x8: /* ASL */
+		case 0x9: /* ROL */
+			x_rr (XOP_MOV, EDX, EAX);
+			x_shl (EDX, 1);
+			if (op == 0x9)
+			{
+				x_cmp0 (&C);
+				x_setcc (XCC_NE, ECX);
+				x_rr (XOP_ADD, EDX, ECX);
+			}
+			x_rr (XOP_MOV, ECX, EDX);
+			x_ri (XEXT_AND, ECX, 0x100);
+			x_st (&C, ECX);
+			x_ri (XEXT_AND, EDX, 0xff);
+			x_st (&N, EDX);
+			x_st (&Z, EDX);
+			x_rr (XOP_XOR, EAX, EDX);
+			x_st (&OV, EAX);
+			return 1;
+
+		case 0xA: /* DEC */
+		case 0xC: /* INC */
+			x_rr (XOP_MOV, EDX, EAX);
+			x_ri (op == 0xA ? XEXT_SUB : XEXT_ADD, EDX, 1);
+			x_ri (XEXT_AND, EDX, 0xff);
+			x_st (&N, EDX);
+			x_st (&Z, EDX);
+			if (op == 0xA)
+			{
+				/* OV = arg & ~res */
+				x_rr (XOP_MOV, ECX, EDX);
+				x_not (ECX);
+				x_rr (XOP_AND, ECX, EAX);
+			}
+			else
+			{
+				/* OV = ~arg & res */
+				x_rr (XOP_MOV, ECX, EAX);
+				x_not (ECX);
+				x_rr (XOP_AND, ECX, EDX);
+			}
+			x_st (&OV, ECX);
+			return 1;
+
+		case 0xD: /* TST */
+			jit_emit_nz8 (EAX);
+			return 0;
+
+		case 0xF: /* CLR */
+			x_sti (&C, 0);
+			x_sti (&N, 0);
+			x_sti (&Z, 0);
+			x_sti (&OV, 0);
+			x_ldi (EDX, 0);
+			return 1;
+	}
+	return -1;
+}
+
+static int
+jit_unary_ok (int op)
+{
+	switch (op)
+	{
+		case 0x0: case 0x3: case 0x4: case 0x6: case 0x7:
+		case 0x8: case 0x9: case 0xA: case 0xC: case 0xD: case 0xF:
+			return 1;
+	}
+	return 0;
+}
+
+
+/* Leave in EAX nonzero if branch condition COND (the low nibble of
+the opcode, 2-F) is true.  Mirrors the cond_XX macros in 6809.c. */
+static void
+jit_emit_cond (int cond)
+{
+	switch (cond & ~1)
+	{
+		case 0x2: /* HI: Z != 0 && C == 0 */
+			x_cmp0 (&Z);
+			x_setcc (XCC_NE, EAX);
+			x_cmp0 (&C);
+			x_setcc (XCC_E, ECX);
+			x_rr (XOP_AND, EAX, ECX);
+			break;
+		case 0x4: /* HS: C == 0 */
+			x_cmp0 (&C);
+			x_setcc (XCC_E, EAX);
+			break;
+		case 0x6: /* NE: Z != 0 */
+			x_cmp0 (&Z);
+			x_setcc (XCC_NE, EAX);
+			break;
+		case 0x8: /* VC: (OV & 0x80) == 0 */
+			x_ld (EAX, &OV);
+			x_shr (EAX, 7);
+			x_ri (XEXT_AND, EAX, 1);
+			x_ri (XEXT_XOR, EAX, 1);
+			break;
+		case 0xA: /* PL: (N & 0x80) == 0 */
+			x_ld (EAX, &N);
+			x_shr (EAX, 7);
+			x_ri (XEXT_AND, EAX, 1);
+			x_ri (XEXT_XOR, EAX, 1);
+			break;
+		case 0xC: /* GE: ((N ^ OV) & 0x80) == 0 */
+		case 0xE: /* GT: GE && Z != 0 */
+			x_ld (EAX, &N);
+			x_ld (ECX, &OV);
+			x_rr (XOP_XOR, EAX, ECX);
+			x_shr (EAX, 7);
+			x_ri (XEXT_AND, EAX, 1);
+			x_ri (XEXT_XOR, EAX, 1);
+			if (cond >= 0xE)
+			{
+				x_cmp0 (&Z);
+				x_setcc (XCC_NE, ECX);
+				x_rr (XOP_AND, EAX, ECX);
+			}
+			break;
+	}
+
+	/* The odd conditions are the inverse of the even ones */
+	if (cond & 1)
+		x_ri (XEXT_XOR, EAX, 1);
+}
+
+
+/**
+ * Translate the instruction INSN at CPU address PC, the COUNT'th in
+ * its block.  Returns 1 if it was translated and the block continues,
+ * 2 if it was translated and ended the block, or 0 if it cannot be
+ * translated.
+ */
+static int
+jit_translate_insn (struct pd_insn *insn, unsigned int pc, unsigned int count)
+{
+	const U8 *p = insn->bytes;
+	unsigned int next_pc = pc + insn->len;
+	unsigned int op = p[0];
+	unsigned int cycles = insn->cycles;
+	struct jit_ea ea;
+	unsigned *acc;
+	unsigned *reg16;
+	int mode, alu;
+	U8 *patch;
+
+	if (cycles == 0)
+		return 0;
+
+	/* Short and long branches end the block */
+	if ((op >= 0x20 && op <= 0x2F) || op == 0x16
+		|| (op == 0x10 && p[1] >= 0x21 && p[1] <= 0x2F))
+	{
+		int cond;
+		unsigned int target;
+
+		if (op == 0x16)
+		{
+			cond = 0;
+			target = next_pc + (INT16)((p[1] << 8) | p[2]);
+		}
+		else if (op == 0x10)
+		{
+			cond = p[1] & 0x0F;
+			target = next_pc + (INT16)((p[2] << 8) | p[3]);
+		}
+		else
+		{
+			cond = op & 0x0F;
+			target = next_pc + (INT8)p[1];
+		}
+
+		if (cond == 0)
+		{
+			/* BRA/LBRA */
+			x_sub_clk (cycles);
+			x_exit (target, count + 1);
+		}
+		else if (cond == 1)
+		{
+			/* BRN/LBRN */
+			x_sub_clk (cycles);
+			x_exit (next_pc, count + 1);
+		}
+		else if (op == 0x10)
+		{
+			/* Long branches take one more cycle when taken; see
+			long_branch () */
+			jit_emit_cond (cond);
+			x_rr (XOP_TEST, EAX, EAX);
+			patch = x_jcc (XCC_NE);
+			x_sub_clk (5);
+			x_exit (next_pc, count + 1);
+			x_patch (patch);
+			x_sub_clk (6);
+			x_exit (target, count + 1);
+		}
+		else
+		{
+			x_sub_clk (cycles);
+			jit_emit_cond (cond);
+			x_rr (XOP_TEST, EAX, EAX);
+			patch = x_jcc (XCC_NE);
+			x_exit (next_pc, count + 1);
+			x_patch (patch);
+			x_exit (target, count + 1);
+		}
+		return 2;
+	}
+
+	/* Inherent instructions */
+	switch (op)
+	{
+		case 0x12: /* NOP */
+			x_sub_clk (cycles);
+			return 1;
+
+		case 0x1D: /* SEX */
+			x_sub_clk (cycles);
+			x_ld (EDX, &B);
+			x_st (&Z, EDX);
+			x_ri (XEXT_AND, EDX, 0x80);
+			x_st (&N, EDX);
+			x_shr (EDX, 7);
+			x_neg (EDX);
+			x_ri (XEXT_AND, EDX, 0xff);
+			x_st (&A, EDX);
+			return 1;
+
+		case 0x3A: /* ABX */
+			x_sub_clk (cycles);
+			x_ld (EAX, &X);
+			x_ld (ECX, &B);
+			x_rr (XOP_ADD, EAX, ECX);
+			x_ri (XEXT_AND, EAX, 0xffff);
+			x_st (&X, EAX);
+			return 1;
+
+		case 0x30: case 0x31: case 0x32: case 0x33: /* LEA */
+		{
+			unsigned *const lea_regs[4] = { &X, &Y, &S, &U };
+			if (!jit_decode_indexed (p + 1, next_pc, &ea))
+				return 0;
+			x_sub_clk (cycles);
+			jit_emit_ea (&ea);
+			jit_emit_ea_update (&ea);
+			x_st (lea_regs[op & 3], EDI);
+			if (op <= 0x31)
+				x_st (&Z, EDI);
+			return 1;
+		}
+	}
+
+	/* Unary operations on A and B */
+	if ((op & 0xE0) == 0x40 && jit_unary_ok (op & 0x0F))
+	{
+		acc = (op & 0x10) ? &B : &A;
+		x_sub_clk (cycles);
+		x_ld (EAX, acc);
+		if (jit_emit_unary (op & 0x0F))
+			x_st (acc, EDX);
+		return 1;
+	}
+
+	/* Unary operations on memory */
+	if ((op < 0x10 || (op & 0xE0) == 0x60) && jit_unary_ok (op & 0x0F))
+	{
+		unsigned int how = JIT_READ;
+		if ((op & 0x0F) != 0xD)
+			how |= JIT_WRITE;
+
+		if (op < 0x10)
+		{
+			x_ld (EDI, &DP);
+			x_ri (XEXT_OR, EDI, p[1]);
+		}
+		else if (op >= 0x70)
+			x_ldi (EDI, (p[1] << 8) | p[2]);
+		else
+		{
+			if (!jit_decode_indexed (p + 1, next_pc, &ea))
+				return 0;
+			jit_emit_ea (&ea);
+		}
+		jit_emit_mem (how, pc, count);
+		if ((op & 0xF0) == 0x60)
+			jit_emit_ea_update (&ea);
+		x_sub_clk (cycles);
+		x_ldb (EAX, 0);
+		if (jit_emit_unary (op & 0x0F))
+			x_stb (0, EDX);
+		return 1;
+	}
+
+	/* The register/memory groups.  Work out the operation, the
+	register, the addressing mode and where the operand starts. */
+	{
+		int page = 0;
+		int wide = 0;
+		int store = 0;
+		int op16 = -1;
+		const U8 *operand;
+
+		if (op == 0x10 || op == 0x11)
+		{
+			page = (op == 0x10) ? 1 : 2;
+			op = p[1];
+			operand = p + 2;
+		}
+		else
+			operand = p + 1;
+
+		if (op < 0x80)
+			return 0;
+		mode = (op >> 4) & 3;
+		acc = NULL;
+		reg16 = NULL;
+		alu = -1;
+
+		if (page == 0)
+		{
+			switch (op & 0x4F)
+			{
+				case 0x03: op16 = J16_SUB; break;                /* SUBD */
+				case 0x43: op16 = J16_ADD; break;                /* ADDD */
+				case 0x0C: op16 = J16_CMP; reg16 = &X; break;    /* CMPX */
+				case 0x4C: op16 = J16_LD; break;                 /* LDD */
+				case 0x4D: store = 1; break;                     /* STD */
+				case 0x0E: op16 = J16_LD; reg16 = &X; break;     /* LDX */
+				case 0x4E: op16 = J16_LD; reg16 = &U; break;     /* LDU */
+				case 0x0F: store = 1; reg16 = &X; break;         /* STX */
+				case 0x4F: store = 1; reg16 = &U; break;         /* STU */
+				case 0x0D:                                       /* BSR/JSR */
+					return 0;
+				default:
+					alu = jit_acc_ops[op & 0x0F];
+					if (alu < 0)
+						return 0;
+					acc = (op & 0x40) ? &B : &A;
+					if (alu == J_ST)
+					{
+						alu = -1;
+						store = 1;
+					}
+					break;
+			}
+		}
+		else if (page == 1)
+		{
+			switch (op & 0x4F)
+			{
+				case 0x03: op16 = J16_CMP; break;                /* CMPD */
+				case 0x0C: op16 = J16_CMP; reg16 = &Y; break;    /* CMPY */
+				case 0x0E: op16 = J16_LD; reg16 = &Y; break;     /* LDY */
+				case 0x0F: store = 1; reg16 = &Y; break;         /* STY */
+				case 0x4E: op16 = J16_LD; reg16 = &S; break;     /* LDS */
+				case 0x4F: store = 1; reg16 = &S; break;         /* STS */
+				default:
+					return 0;
+			}
+		}
+		else
+		{
+			switch (op & 0x4F)
+			{
+				case 0x03: op16 = J16_CMP; reg16 = &U; break;    /* CMPU */
+				case 0x0C: op16 = J16_CMP; reg16 = &S; break;    /* CMPS */
+				default:
+					return 0;
+			}
+		}
+		wide = (op16 >= 0) || (store && !acc);
+
+		/* LDS changes the stack, which the interpreter tracks */
+		if (reg16 == &S && op16 == J16_LD)
+			return 0;
+
+		if (mode == 0)
+		{
+			/* Immediate */
+			if (store)
+				return 0;
+			x_sub_clk (cycles);
+			if (wide)
+				x_ldi (ECX, (operand[0] << 8) | operand[1]);
+			else
+				x_ldi (ECX, operand[0]);
+		}
+		else
+		{
+			if (mode == 1)
+			{
+				x_ld (EDI, &DP);
+				x_ri (XEXT_OR, EDI, operand[0]);
+			}
+			else if (mode == 3)
+				x_ldi (EDI, (operand[0] << 8) | operand[1]);
+			else
+			{
+				if (!jit_decode_indexed (operand, next_pc, &ea))
+					return 0;
+				jit_emit_ea (&ea);
+			}
+			jit_emit_mem ((store ? JIT_WRITE : JIT_READ) | (wide ? JIT_WORD : 0),
+				pc, count);
+			if (mode == 2)
+				jit_emit_ea_update (&ea);
+			x_sub_clk (cycles);
+
+			if (store)
+			{
+				if (wide)
+					jit_emit_st16 (reg16);
+				else
+				{
+					x_ld (EAX, acc);
+					jit_emit_nz8 (EAX);
+					x_stb (0, EAX);
+				}
+				return 1;
+			}
+
+			x_ldb (ECX, 0);
+			if (wide)
+			{
+				x_shl (ECX, 8);
+				x_ldb (EAX, 1);
+				x_rr (XOP_OR, ECX, EAX);
+			}
+		}
+
+		if (wide)
+			jit_emit_acc16 (op16, reg16);
+		else
+			jit_emit_acc8 (alu, acc);
+		return 1;
+	}
+}
+
+
+/**
+ * Translate a block.  Returns nonzero if at least one instruction
+ * was translated.
+ */
+static int
+jit_translate (struct pd_block *blk, unsigned int pc)
+{
+	U8 *start;
+	unsigned int count, n;
+	int rc = 1;
+
+	if (!jit_buf)
+	{
+		jit_buf = mmap (NULL, JIT_BUF_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (jit_buf == MAP_FAILED)
+		{
+			fprintf (stderr, "m6809-run: cannot allocate JIT buffer, JIT disabled\n");
+			jit_buf = NULL;
+			jit_enabled = 0;
+			return 0;
+		}
+		jit_ptr = jit_buf;
+		jit_base = (char *)&cpu_clk;
+	}
+
+	/* Out of space: start over.  This throws away every block,
+	including this one, so do not translate it now. */
+	if (jit_ptr + JIT_MAX_BLOCK_SIZE > jit_buf + JIT_BUF_SIZE)
+	{
+		jit_ptr = jit_buf;
+		predecode_flush ();
+		return 0;
+	}
+
+	start = jit_ptr;
+	jit_exit_count = 0;
+	x_prologue ();
+
+	for (count = 0; count < blk->count && rc == 1; count++)
+	{
+		U8 *insn_start = jit_ptr;
+		unsigned int exits = jit_exit_count;
+
+		rc = jit_translate_insn (&blk->insn[count], pc, count);
+		if (rc == 0)
+		{
+			jit_ptr = insn_start;
+			jit_exit_count = exits;
+			break;
+		}
+		pc += blk->insn[count].len;
+
+		/* Stop when the time slice is used up, as the interpreter would */
+		if (rc == 1 && count + 1 < blk->count)
+		{
+			emit1 (0x49); emit1 (0x83);   /* cmp qword [cpu_clk], 0 */
+			x_modrm_g (7, &cpu_clk);
+			emit1 (0);
+			jit_add_exit (x_jcc (XCC_LE), pc, count + 1);
+		}
+	}
+
+	if (count == 0)
+	{
+		jit_ptr = start;
+		return 0;
+	}
+
+	if (rc != 2)
+		x_exit (pc, count);
+
+	for (n = 0; n < jit_exit_count; n++)
+	{
+		x_patch (jit_exits[n].patch);
+		x_exit (jit_exits[n].pc, jit_exits[n].count);
+	}
+
+	blk->jit = (int (*) (void))start;
+	jit_blocks_translated++;
+	return 1;
+}
+
+
+/**
+ * Run a translated block, and then rerun it with the interpreter
+ * from the same state and compare the results.
+ */
+static int
+jit_compare_block (struct pd_block *blk, unsigned int pc)
+{
+	struct cpu_regs before, after;
+	long clk_before = cpu_clk, clk_after;
+	unsigned int count, n, i;
+	int ok;
+
+	cpu_get_regs (&before);
+	jit_log_count = 0;
+	jit_logging = 1;
+	count = blk->jit ();
+	jit_logging = 0;
+	cpu_get_regs (&after);
+	clk_after = cpu_clk;
+	if (count == 0)
+		return 0;
+
+	/* Undo the writes, newest first */
+	for (n = jit_log_count; n-- > 0; )
+	{
+		jit_log[n].new_val = *jit_log[n].ptr;
+		*jit_log[n].ptr = jit_log[n].old_val;
+	}
+
+	cpu_set_regs (&before);
+	cpu_clk = clk_before;
+	jit_enabled = 0;
+	for (i = 0; i < count; i++)
+		cpu_interpret_one ();
+	jit_enabled = JIT_COMPARE;
+
+	cpu_get_regs (&before);
+	ok = !memcmp (&before, &after, sizeof (struct cpu_regs))
+		&& cpu_clk == clk_after;
+	for (n = 0; n < jit_log_count; n++)
+		if (*jit_log[n].ptr != jit_log[n].new_val)
+			ok = 0;
+
+	if (!ok)
+	{
+		fprintf (stderr, "m6809-run: JIT mismatch in block at %s (%d instructions)\n",
+			monitor_addr_name (pc), count);
+		fprintf (stderr, "  jit:    PC=%04X A=%02X B=%02X X=%04X Y=%04X U=%04X S=%04X "
+			"H=%X N=%X Z=%X OV=%X C=%X clk=%ld\n",
+			after.PC, after.A, after.B, after.X, after.Y, after.U, after.S,
+			after.H, after.N, after.Z, after.OV, after.C, clk_after);
+		fprintf (stderr, "  interp: PC=%04X A=%02X B=%02X X=%04X Y=%04X U=%04X S=%04X "
+			"H=%X N=%X Z=%X OV=%X C=%X clk=%ld\n",
+			before.PC, before.A, before.B, before.X, before.Y, before.U, before.S,
+			before.H, before.N, before.Z, before.OV, before.C, cpu_clk);
+		for (n = 0; n < jit_log_count; n++)
+			if (*jit_log[n].ptr != jit_log[n].new_val)
+				fprintf (stderr, "  write %04X: jit=%02X interp=%02X\n",
+					jit_log[n].addr, jit_log[n].new_val, *jit_log[n].ptr);
+		jit_compare_failures++;
+		blk->jit = NULL;
+		blk->hits = JIT_NEVER;
+	}
+	return count;
+}
+
+#endif /* HAVE_JIT */
+
+
+/**
+ * Called when the CPU enters block BLK at CPU address PC.  Runs the
+ * translation of the block if there is one, translating it first if
+ * it has become hot.  Returns the number of instructions executed,
+ * or zero if the interpreter should run the block.
+ */
+int
+jit_execute (struct pd_block *blk, unsigned int pc)
+{
+#ifdef HAVE_JIT
+	if (!blk->jit)
+	{
+		if (blk->hits == JIT_NEVER || ++blk->hits < JIT_THRESHOLD)
+			return 0;
+		if (!jit_translate (blk, pc))
+		{
+			blk->hits = JIT_NEVER;
+			return 0;
+		}
+	}
+
+	/* Translated code computes flags eagerly, so any that the
+	interpreter left pending must be evaluated first. */
+	flags_valid ();
+	if (jit_enabled == JIT_COMPARE)
+		return jit_compare_block (blk, pc);
+	return blk->jit ();
+#else
+	fprintf (stderr, "m6809-run: JIT not supported on this host\n");
+	jit_enabled = 0;
+	return 0;
+#endif
+}
+
+
+
+/**
+ * Release the code buffer when a machine finishes.
+ */
+void
+jit_free (void)
+{
+#ifdef HAVE_JIT
+	if (jit_buf)
+		munmap (jit_buf, JIT_BUF_SIZE);
+	jit_buf = NULL;
+#endif
+}
@@ -32,23 +32,34 @@
 
 extern void eon_init (const char *);
 extern void wpc_init (const char *);
+extern struct hw_class ram_class, rom_class;
 
-struct machine *machine;
+INSTANCE struct machine *machine;
 
-unsigned int device_count = 0;
-struct hw_device *device_table[MAX_BUS_DEVICES];
+INSTANCE unsigned int device_count = 0;
+INSTANCE struct hw_device *device_table[MAX_BUS_DEVICES];
 
-struct hw_device *null_device;
+INSTANCE struct hw_device *null_device;
 
-struct bus_map busmaps[NUM_BUS_MAPS];
+INSTANCE struct bus_map busmaps[NUM_BUS_MAPS];
 
-struct bus_map default_busmaps[NUM_BUS_MAPS];
+INSTANCE struct bus_map default_busmaps[NUM_BUS_MAPS];
 
-U16 fault_addr;
+/* For each bus map, a host pointer to the start of the RAM/ROM it
+maps, if the CPU is allowed to read or write it directly without
+calling the device.  NULL means the access must go through
+cpu_read8/cpu_write8. */
+INSTANCE U8 *bus_read_ptr[NUM_BUS_MAPS];
+INSTANCE U8 *bus_write_ptr[NUM_BUS_MAPS];
 
-U8 fault_type;
+INSTANCE U16 fault_addr;
 
-int system_running = 0;
+INSTANCE U8 fault_type;
+
+INSTANCE int system_running = 0;
+
+/* Where the console's output goes, if not to stdout */
+INSTANCE FILE *console_output;
 
 
 void cpu_is_running (void)
@@ -67,7 +78,7 @@ void exit_fault (unsigned int addr, unsigned int type)
 {
 	monitor_on = debug_enabled;
 	sim_error ("Fault: addr=%04X type=%02X\n", addr, type);
-	exit (1);
+	sim_stop (1);
 }
 
 
@@ -89,6 +100,76 @@ struct hw_device *device_attach (struct hw_class *class_ptr, unsigned int size,
 };
 
 
+/**
+ * Recompute the direct access pointers for COUNT bus maps, starting
+ * with map number START.  Only plain RAM and ROM are accessed
+ * directly.  Writes also have to go through the bus if the page holds
+ * predecoded code, or the thread ID that the debugger is tracking.
+ * Everything goes through the bus in pages that a watchpoint covers
+ * (see command_page_watched), which are marked as watched, or while
+ * accesses are being counted for the heatmap, and writes do while
+ * they are being recorded in the trace file.
+ */
+void bus_fast_update (unsigned int start, unsigned int count)
+{
+	extern INSTANCE absolute_address_t thread_current;
+	extern INSTANCE unsigned int thread_id_size;
+	struct bus_map *map;
+	struct hw_device *dev;
+	unsigned int mapno;
+	U8 *ptr;
+
+	for (mapno = start; mapno < start + count && mapno < NUM_BUS_MAPS; mapno++)
+	{
+		map = &busmaps[mapno];
+		bus_read_ptr[mapno] = bus_write_ptr[mapno] = NULL;
+		map->watched = 0;
+
+		if (map->devid >= device_count)
+			continue;
+		map->watched = active_watch_count
+			&& command_page_watched (map->devid, map->offset);
+		if (map->watched || heatmap_enabled)
+			continue;
+		dev = device_table[map->devid];
+		if (dev->class_ptr != &ram_class && dev->class_ptr != &rom_class)
+			continue;
+		if (map->offset + BUS_MAP_SIZE > dev->size)
+			continue;
+
+		ptr = (U8 *)dev->priv + map->offset;
+		if (map->flags & MAP_READABLE)
+			bus_read_ptr[mapno] = ptr;
+
+		if (!(map->flags & MAP_WRITABLE) || tracefile_writes)
+			continue;
+		if (predecode_pages[map->devid]
+			&& predecode_pages[map->devid][map->offset / BUS_MAP_SIZE])
+			continue;
+		if (thread_id_size
+			&& (map->devid * 0x10000000L + map->offset) / BUS_MAP_SIZE
+				== (thread_current + thread_id_size - 1) / BUS_MAP_SIZE)
+			continue;
+		bus_write_ptr[mapno] = ptr;
+	}
+}
+
+
+/**
+ * Recompute the direct access pointers for every bus map that
+ * maps page PAGE of device DEVID.
+ */
+void bus_fast_update_page (unsigned int devid, unsigned long page)
+{
+	unsigned int mapno;
+
+	for (mapno = 0; mapno < NUM_BUS_MAPS; mapno++)
+		if (busmaps[mapno].devid == devid
+			&& busmaps[mapno].offset / BUS_MAP_SIZE == page)
+			bus_fast_update (mapno, 1);
+}
+
+
 /**
  * Map a portion of a device into the CPU's address space.
  */
@@ -131,6 +212,11 @@ void bus_map (unsigned int addr,
 		map++;
 		offset += BUS_MAP_SIZE;
 	}
+	bus_fast_update (start, len / BUS_MAP_SIZE);
+
+	/* The CPU may be in the middle of a block that was just
+	mapped out */
+	predecode_generation++;
 }
 
 void device_define (struct hw_device *dev,
@@ -160,6 +246,8 @@ void bus_unmap (unsigned int addr, unsigned int len)
 	/* Set the maps to their defaults. */
 	memcpy (&busmaps[start], &default_busmaps[start],
 		sizeof (struct bus_map) * count);
+	bus_fast_update (start, count);
+	predecode_generation++;
 }
 
 
@@ -211,14 +299,15 @@ U8 abs_read8 (absolute_address_t addr)
 
 
 /**
- * Called by the CPU to read a byte.
+ * Read a byte for the CPU.  KIND says whether it is an instruction
+ * byte or data, for the heatmap.
  * This is the bottleneck in terms of performance.  Consider
  * a caching scheme that cuts down on some of this.
  * There is also a 16-bit version that is more efficient when
  * a full word is needed, but it implies that no reads will ever
  * occur across a device boundary.
  */
-U8 cpu_read8 (unsigned int addr)
+static inline U8 bus_read8 (unsigned int addr, int kind)
 {
 	struct bus_map *map = find_map (addr);
 	struct hw_device *dev = find_device (addr, map->devid);
@@ -227,11 +316,14 @@ U8 cpu_read8 (unsigned int addr)
 
 	if (system_running && !(map->flags & MAP_READABLE))
 		machine->fault (addr, FAULT_NOT_READABLE);
-	command_read_hook (absolute_from_reladdr (map->devid, phy_addr));
+	if (map->watched)
+		command_read_hook (absolute_from_reladdr (map->devid, phy_addr));
+	if (heatmap_enabled)
+		heatmap_access (addr, map->devid, kind);
 	return (*class_ptr->read) (dev, phy_addr);
 }
 
-U16 cpu_read16 (unsigned int addr)
+static inline U16 bus_read16 (unsigned int addr, int kind)
 {
 	struct bus_map *map = find_map (addr);
 	struct hw_device *dev = find_device (addr, map->devid);
@@ -240,11 +332,40 @@ U16 cpu_read16 (unsigned int addr)
 
 	if (system_running && !(map->flags & MAP_READABLE))
 		do_fault (addr, FAULT_NOT_READABLE);
-	command_read_hook (absolute_from_reladdr (map->devid, phy_addr));
+	if (map->watched)
+	{
+		command_read_hook (absolute_from_reladdr (map->devid, phy_addr));
+		command_read_hook (absolute_from_reladdr (map->devid, phy_addr + 1));
+	}
+	if (heatmap_enabled)
+	{
+		heatmap_access (addr, map->devid, kind);
+		heatmap_access ((addr + 1) & 0xFFFF, map->devid, kind);
+	}
 	return ((*class_ptr->read) (dev, phy_addr) << 8)
 			| (*class_ptr->read) (dev, phy_addr+1);
 }
 
+U8 cpu_read8 (unsigned int addr)
+{
+	return bus_read8 (addr, HEAT_READ);
+}
+
+U16 cpu_read16 (unsigned int addr)
+{
+	return bus_read16 (addr, HEAT_READ);
+}
+
+U8 cpu_fetch8 (unsigned int addr)
+{
+	return bus_read8 (addr, HEAT_FETCH);
+}
+
+U16 cpu_fetch16 (unsigned int addr)
+{
+	return bus_read16 (addr, HEAT_FETCH);
+}
+
 
 /**
  * Called by the CPU to write a byte.
@@ -258,7 +379,12 @@ void cpu_write8 (unsigned int addr, U8 val)
 
 	if (system_running && !(map->flags & MAP_WRITABLE))
 		do_fault (addr, FAULT_NOT_WRITABLE);
+	if (heatmap_enabled)
+		heatmap_access (addr, map->devid, HEAT_WRITE);
 	(*class_ptr->write) (dev, phy_addr, val);
+	predecode_write (map->devid, phy_addr);
+	if (tracefile_writes)
+		tracefile_write (absolute_from_reladdr (map->devid, phy_addr), val);
 	command_write_hook (absolute_from_reladdr (map->devid, phy_addr), val);
 }
 
@@ -269,6 +395,7 @@ void abs_write8 (absolute_address_t addr, U8 val)
 	struct hw_device *dev = device_table[id];
 	struct hw_class *class_ptr = dev->class_ptr;
 	class_ptr->write (dev, phy_addr, val);
+	predecode_write (id, phy_addr);
 }
 
 
@@ -352,12 +479,18 @@ void ram_write (struct hw_device *dev, unsigned long addr, U8 val)
 	buf[addr] = val;
 }
 
+void ram_state (struct hw_device *dev)
+{
+	state_data (dev->priv, dev->size);
+}
+
 struct hw_class ram_class =
 {
 	.readonly = 0,
 	.reset = ram_reset,
 	.read = ram_read,
 	.write = ram_write,
+	.state = ram_state,
 };
 
 struct hw_device *ram_create (unsigned long size)
@@ -417,7 +550,7 @@ U8 console_read (struct hw_device *dev, unsigned long addr)
 	switch (addr)
 	{
 		case CON_IN:
-			return getchar ();
+			return input_getc ();
 		default:
 			return MISSING;
 	}
@@ -428,7 +561,12 @@ void console_write (struct hw_device *dev, unsigned long addr, U8 val)
 	switch (addr)
 	{
 		case CON_OUT:
-			putchar (val);
+			if (reverse_running)
+				break;
+			if (console_output)
+				putc (val, console_output);
+			else
+				putchar (val);
 			break;
 		case CON_EXIT:
 			sim_exit (val);
@@ -454,7 +592,7 @@ struct hw_device *console_create (void)
 /**********************************************************/
 
 
-U8 mmu_regs[MMU_PAGECOUNT][MMU_PAGEREGS];
+INSTANCE U8 mmu_regs[MMU_PAGECOUNT][MMU_PAGEREGS];
 
 U8 mmu_read (struct hw_device *dev, unsigned long addr)
 {
@@ -521,12 +659,26 @@ void mmu_reset_complete (struct hw_device *dev)
 }
 
 
+void mmu_state (struct hw_device *dev)
+{
+	unsigned int addr = fault_addr;
+	unsigned int type = fault_type;
+
+	state_data (mmu_regs, sizeof (mmu_regs));
+	state_uint (&addr);
+	state_uint (&type);
+	fault_addr = addr;
+	fault_type = type;
+}
+
+
 struct hw_class mmu_class =
 {
 	.readonly = 0,
 	.reset = mmu_reset,
 	.read = mmu_read,
 	.write = mmu_write,
+	.state = mmu_state,
 };
 
 struct hw_device *mmu_create (void)
@@ -579,7 +731,7 @@ void machine_init (const char *machine_name, const char *boot_rom_file)
 	else if (machine_match (machine_name, boot_rom_file, &eon_machine));
 	else if (machine_match (machine_name, boot_rom_file, &eon2_machine));
 	else if (machine_match (machine_name, boot_rom_file, &wpc_machine));
-	else exit (1);
+	else sim_stop (1);
 
 	/* Save the default busmap configuration, before the
 	CPU begins to run, so that it can be restored if
@@ -590,3 +742,25 @@ void machine_init (const char *machine_name, const char *boot_rom_file)
 		mmu_reset_complete (mmu_device);
 }
 
+
+
+/**
+ * Release the devices when the machine finishes.  The memory behind
+ * RAM and ROM is freed as well; other devices' private data is not
+ * always dynamically allocated, so it is left alone.
+ */
+void machine_free (void)
+{
+	unsigned int devid;
+	struct hw_device *dev;
+
+	for (devid = 0; devid < device_count; devid++)
+	{
+		dev = device_table[devid];
+		if (dev->class_ptr == &ram_class || dev->class_ptr == &rom_class)
+			free (dev->priv);
+		free (dev);
+		device_table[devid] = NULL;
+	}
+	device_count = 0;
+}
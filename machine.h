@@ -28,6 +28,12 @@ typedef unsigned short U16;
 
 typedef unsigned long absolute_address_t;
 
+/* Everything that belongs to one simulated machine -- the CPU
+registers, the bus, the devices, the debugger's tables -- is declared
+INSTANCE, which makes it thread-local.  Each thread that calls
+sim_main () therefore runs a machine of its own. */
+#define INSTANCE __thread
+
 #define MAX_CPU_ADDR 65536
 
 /* The generic bus architecture. */
@@ -71,6 +77,7 @@ struct bus_map
 	unsigned int devid; /* The devid mapped here */
 	unsigned long offset; /* The offset within the device */
 	unsigned char flags;
+	unsigned char watched; /* Nonzero if a watchpoint covers part of it */
 };
 
 #define NUM_BUS_MAPS (MAX_CPU_ADDR / BUS_MAP_SIZE)
@@ -104,6 +111,11 @@ struct hw_class
 	whatever purpose.  The minimum update interval is once per 1ms.  Leave
 	NULL if not required */
 	void (*update) (struct hw_device *dev);
+
+	/* Saves or restores the device's state in a snapshot, by calling
+	the state_ functions on each of its variables.  Leave NULL if the
+	device has nothing to save. */
+	void (*state) (struct hw_device *dev);
 };
 
 
@@ -129,7 +141,7 @@ struct hw_device
 /* The machine structure collects everything about the abstract machine.
 The pointer 'machine' points to the machine that is being run. */
 
-extern struct machine *machine;
+extern INSTANCE struct machine *machine;
 
 struct machine
 {
@@ -141,7 +153,58 @@ struct machine
 	unsigned long cycles_per_sec;
 };
 
+/* An event is something that must happen at a particular CPU cycle,
+like a timer expiring.  Devices embed one in their private data and
+schedule it instead of polling from an update procedure; the CPU is
+then run exactly up to the earliest event. */
+
+struct event
+{
+	/* The cycle count (see get_cycles) at which the event fires */
+	unsigned long when;
+
+	/* Position in the event queue, or zero if not scheduled */
+	unsigned int slot;
+
+	/* Called when the deadline is reached.  The event has already
+	been taken off the queue, so the handler may schedule it again. */
+	void (*handler) (struct event *ev);
+
+	/* Private data for the handler */
+	void *data;
+};
+
+#define event_pending(ev) ((ev)->slot != 0)
+
+unsigned long get_cycles (void);
+
+void event_init (struct event *ev, void (*handler) (struct event *ev), void *data);
+void event_schedule (struct event *ev, unsigned long delay);
+void event_repeat (struct event *ev, unsigned long period);
+void event_cancel (struct event *ev);
+unsigned long event_slice (unsigned long limit);
+void event_dispatch (void);
+
+int state_restoring (void);
+void state_data (void *ptr, unsigned long len);
+void state_uint (unsigned int *val);
+void state_ulong (unsigned long *val);
+void state_event (struct event *ev);
+
+int input_deterministic (void);
+int input_poll (void);
+int input_getc (void);
+
+/* Nonzero while execution is being repeated for reverse debugging
+(see reverse.c).  Devices do not send output then, since it has been
+sent already. */
+extern INSTANCE int reverse_running;
+
 struct hw_device *device_attach (struct hw_class *class_ptr, unsigned int size, void *priv);
+void machine_free (void);
+
+/* Read a byte at an absolute address, bypassing the CPU's bus map */
+U8 abs_read8 (absolute_address_t addr);
 
 struct hw_device *ram_create (unsigned long size);
 struct hw_device *rom_create (const char *filename, unsigned int maxsize);
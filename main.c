@@ -21,59 +21,61 @@
 
 
 #include <sys/time.h>
+#include <setjmp.h>
 #include "6809.h"
+#include "monitor.h"
 
 enum
 { HEX, S19, BIN };
 
 
 /* The total number of cycles that have executed */
-unsigned long total = 0;
+INSTANCE unsigned long total = 0;
 
 /* The frequency of the emulated CPU, in megahertz */
-unsigned int mhz = 1;
+INSTANCE unsigned int mhz = 1;
 
 /* When nonzero, indicates that the IRQ should be triggered periodically,
 every so many cycles.  By default no periodic IRQ is generated. */
-unsigned int cycles_per_irq = 0;
+INSTANCE unsigned int cycles_per_irq = 0;
 
 /* When nonzero, indicates that the FIRQ should be triggered periodically,
 every so many cycles.  By default no periodic FIRQ is generated. */
-unsigned int cycles_per_firq = 0;
+INSTANCE unsigned int cycles_per_firq = 0;
 
 /* Nonzero if debugging support is turned on */
-int debug_enabled = 0;
+INSTANCE int debug_enabled = 0;
 
 /* Nonzero if tracing is enabled */
-int trace_enabled = 0;
+INSTANCE int trace_enabled = 0;
 
 /* When nonzero, causes the program to print the total number of cycles
 on a successful exit. */
-int dump_cycles_on_success = 0;
+INSTANCE int dump_cycles_on_success = 0;
 
 /* When nonzero, indicates the total number of cycles before an automated
 exit.  This is to help speed through test cases that never finish. */
-unsigned long max_cycles = 500000000UL;
+INSTANCE unsigned long max_cycles = 500000000UL;
 
 /* When nonzero, says that the state of the machine is persistent
 across runs of the simulator. */
-int machine_persistent = 0;
+INSTANCE int machine_persistent = 0;
 
 /* When nonzero, says that the simulator is slowed down to match what a real
 processor would run like. */
-int machine_realtime = 0;
+INSTANCE int machine_realtime = 0;
 
-static int type = S19;
+static INSTANCE int type = S19;
 
-char *exename;
+INSTANCE char *exename;
 
-const char *machine_name = "simple";
+INSTANCE const char *machine_name = "simple";
 
-const char *prog_name = NULL;
+INSTANCE const char *prog_name = NULL;
 
-FILE *stat_file = NULL;
+INSTANCE FILE *stat_file = NULL;
 
-struct timeval time_started;
+INSTANCE struct timeval time_started;
 
 
 /**
@@ -97,27 +99,37 @@ get_elapsed_realtime (void)
 }
 
 
+/* How often idle_loop runs: about 30ms of simulated time */
+#define IDLE_CYCLES (30 * 1024 * mhz)
+
+/* The events that are scheduled here rather than by a device */
+static INSTANCE struct event idle_ev, irq_ev, firq_ev;
+
+/* The simulated time that idle_loop has seen: the cycle count at its
+last run, and the milliseconds since machine->periodic was called */
+static INSTANCE unsigned long idle_last_cycles = 0;
+static INSTANCE unsigned int idle_ms_elapsed = 0;
+
+/* The IRQs since the last FIRQ, when only -I is given */
+static INSTANCE unsigned int firq_freq = 0;
+
 /*
- * Check if the CPU should idle.
+ * Check if the CPU should idle.  This is a scheduled event that
+ * repeats every IDLE_CYCLES.
  */
 void
-idle_loop (void)
+idle_loop (struct event *ev)
 {
 	struct timeval now;
-	static struct timeval last = { 0, 0 };
+	static INSTANCE struct timeval last = { 0, 0 };
 	int real_ms;
-	static unsigned long last_cycles = 0;
 	unsigned long cycles;
 	int sim_ms;
 	const int cycles_per_ms = 2000;
-	static int period = 30;
-	static int count = 30;
 	int delay;
-	static int total_ms_elapsed = 0;
-	static int cumulative_delay = 0;
+	static INSTANCE int cumulative_delay = 0;
 
-	if (--count > 0)
-		return;
+	event_repeat (ev, IDLE_CYCLES);
 
 	if (last.tv_sec == 0 && last.tv_usec == 0)
 		gettimeofday (&last, NULL);
@@ -127,20 +139,27 @@ idle_loop (void)
 	last = now;
 
 	cycles = get_cycles ();
-	sim_ms = (cycles - last_cycles) / cycles_per_ms;
+	sim_ms = (cycles - idle_last_cycles) / cycles_per_ms;
 	if (sim_ms < 0)
 		sim_ms += cycles_per_ms;
-	last_cycles = cycles;
+	idle_last_cycles = cycles;
 
-	total_ms_elapsed += sim_ms;
-	if (total_ms_elapsed > 100)
+	idle_ms_elapsed += sim_ms;
+	if (idle_ms_elapsed > 100)
 	{
-		total_ms_elapsed -= 100;
+		idle_ms_elapsed -= 100;
 		if (machine->periodic)
 			machine->periodic ();
-		command_periodic ();
+		if (!reverse_running)
+			command_periodic ();
 	}
 
+	/* Keep the simulation from running ahead of real time.  A run
+	whose input is recorded or replayed does not wait, so that it
+	takes the same time either way. */
+	if (input_deterministic ())
+		return;
+
 	delay = sim_ms - real_ms;
 	cumulative_delay += delay;
 	if (cumulative_delay > 0)
@@ -148,8 +167,55 @@ idle_loop (void)
 		usleep (50 * 1000UL);
 		cumulative_delay -= 50;
 	}
+}
+
+
+/*
+ * The periodic interrupts requested with -I and -F.  When only an
+ * IRQ frequency is given, an FIRQ is also generated on every 8th IRQ,
+ * as on WPC.
+ */
+void
+irq_event (struct event *ev)
+{
+	event_repeat (ev, cycles_per_irq);
+	request_irq (0);
+	if (cycles_per_firq == 0 && ++firq_freq == 8)
+	{
+		request_firq (0);
+		firq_freq = 0;
+	}
+}
+
+void
+firq_event (struct event *ev)
+{
+	event_repeat (ev, cycles_per_firq);
+	request_firq (0);
+}
 
-	count = period;
+
+/*
+ * Save or restore the periodic events in a snapshot.  The periods
+ * come from the command line, so an interrupt that is not requested
+ * this time is not restored either.
+ */
+void
+sim_events_state (void)
+{
+	state_event (&idle_ev);
+	state_event (&irq_ev);
+	state_event (&firq_ev);
+	state_ulong (&idle_last_cycles);
+	state_uint (&idle_ms_elapsed);
+	state_uint (&firq_freq);
+	if (state_restoring ())
+	{
+		if (!cycles_per_irq)
+			event_cancel (&irq_ev);
+		if (!cycles_per_firq)
+			event_cancel (&firq_ev);
+	}
 }
 
 
@@ -173,36 +239,36 @@ struct option
 	int default_value;
 	const char **string_value;
 	int (*handler) (const char *arg);
-} option_table[] = {
-	{ 'd', "debug", "Enter the monitor immediately",
-		HAS_NEG, NO_ARG, &debug_enabled, 1, NULL, NULL },
-	{ 'h', "help", NULL,
-		NO_NEG, NO_ARG, NULL, 0, 0, do_help },
-	{ 'b', "binary", "",
-		NO_NEG, NO_ARG, &type, BIN, NULL, NULL },
-	{ 'M', "mhz", "", NO_NEG, HAS_ARG },
-	{ '-', "68a09", "Emulate the 68A09 variation (1.5Mhz)" },
-	{ '-', "68b09", "Emulate the 68B09 variation (2Mhz)" },
-	{ 'R', "realtime", "Limit simulation speed to match realtime",
-		HAS_NEG, NO_ARG, &machine_realtime, 0, NULL, NULL },
-	{ 'I', "irqfreq", "Asserts an IRQ every so many cycles automatically",
-		NO_NEG, HAS_ARG, &cycles_per_irq, 0, NULL, NULL },
-	{ 'F', "firqfreq", "Asserts an FIRQ every so many cycles automatically",
-		NO_NEG, HAS_ARG, &cycles_per_firq, 0, NULL, NULL },
-	{ 'C', "cycledump", "",
-		HAS_NEG, NO_ARG, &dump_cycles_on_success, 1, NULL, NULL},
-	{ 't', "loadmap", "" },
-	{ 'T', "trace", "",
-		NO_NEG, NO_ARG, &trace_enabled, 1, NULL, NULL },
-	{ 'm', "maxcycles", "Sets maximum number of cycles to run",
-		NO_NEG, HAS_ARG, &max_cycles, 0, NULL, NULL },
-	{ 's', "machine", "Specify the machine (exact hardware) to emulate",
-		NO_NEG, HAS_ARG, NULL, 0, &machine_name, NULL },
-	{ 'p', "persistent", "Use persistent machine state",
-		NO_NEG, NO_ARG, &machine_persistent, 1, NULL, NULL },
-	{ '\0', NULL },
 };
 
+/* The options of the machine being run.  The table itself is built
+by sim_main, since the variables it points to are per-instance and
+so have no fixed address. */
+static INSTANCE struct option *option_table;
+
+
+/**
+ * Handlers for the options that take a cycle count, which can be more
+ * than the int that the option table stores.
+ */
+static int
+set_fork_cycles (const char *arg)
+{
+	if (!arg)
+		return 0;
+	fork_cycles = strtoul (arg, NULL, 0);
+	return 1;
+}
+
+static int
+set_checkpoint_cycles (const char *arg)
+{
+	if (!arg)
+		return 0;
+	checkpoint_cycles = strtoul (arg, NULL, 0);
+	return 1;
+}
+
 
 int
 do_help (const char *arg __attribute__((unused)))
@@ -223,7 +289,7 @@ do_help (const char *arg __attribute__((unused)))
 		}
 		opt++;
 	}
-	exit (0);
+	sim_stop (0);
 }
 
 
@@ -267,9 +333,6 @@ process_option (struct option *opt, const char *arg)
 	}
 	else
 	{
-		if (arg)
-			//printf ("  Takes no argument but one given, ignored.\n");
-
 		if (opt->int_value)
 		{
 			*(opt->int_value) = opt->default_value;
@@ -313,14 +376,17 @@ next_arg:
 		{
 			if (arg[1] == '-')
 			{
+				/* argv is left intact, since --batch passes it on */
 				char *rest = strchr (arg+2, '=');
+				size_t len = rest ? rest - (arg+2) : strlen (arg+2);
 				if (rest)
-					*rest++ = '\0';
+					rest++;
 
 				opt = option_table;
 				while (opt->o_long != NULL)
 				{
-					if (!strcmp (opt->o_long, arg+2))
+					if (strlen (opt->o_long) == len
+						&& !strncmp (opt->o_long, arg+2, len))
 					{
 						argn++;
 						(void)process_option (opt, rest);
@@ -328,7 +394,7 @@ next_arg:
 					}
 					opt++;
 				}
-				printf ("long option '%s' not recognized.\n", arg+2);
+				printf ("long option '%.*s' not recognized.\n", (int)len, arg+2);
 			}
 			else
 			{
@@ -357,14 +423,151 @@ next_arg:
 
 
 
+/* Where sim_main returns to when the simulation ends, and the exit
+status it returns */
+static INSTANCE jmp_buf sim_done;
+static INSTANCE int sim_status;
+
+
+/**
+ * End the simulation of this machine: sim_main returns STATUS.
+ */
+void
+sim_stop (int status)
+{
+	sim_status = status;
+	longjmp (sim_done, 1);
+}
+
+
+/**
+ * Run one machine, given the same arguments as the m6809-run command,
+ * and return its exit status.  Each thread may run one machine; all
+ * of its state is thread-local (see INSTANCE).  Console output of
+ * concurrent machines goes to the same stdout.
+ */
 int
-main (int argc, char *argv[])
+sim_main (int argc, char *argv[])
 {
   int off = 0;
   int i, j, n;
   int argn = 1;
   unsigned int loops = 0;
+	struct option options[] = {
+		{ 'd', "debug", "Enter the monitor immediately",
+			HAS_NEG, NO_ARG, &debug_enabled, 1, NULL, NULL },
+		{ 'h', "help", NULL,
+			NO_NEG, NO_ARG, NULL, 0, 0, do_help },
+		{ 'b', "binary", "",
+			NO_NEG, NO_ARG, &type, BIN, NULL, NULL },
+		{ 'M', "mhz", "", NO_NEG, HAS_ARG },
+		{ '-', "68a09", "Emulate the 68A09 variation (1.5Mhz)" },
+		{ '-', "68b09", "Emulate the 68B09 variation (2Mhz)" },
+		{ '-', "switch", "Decode instructions with a switch, not threaded code",
+			NO_NEG, NO_ARG, &switch_dispatch, 1, NULL, NULL },
+		{ '-', "no-predecode", "Fetch every instruction from the bus, without caching",
+			NO_NEG, NO_ARG, &predecode_enabled, 0, NULL, NULL },
+		{ '-', "jit", "Translate frequently run code into native code",
+			NO_NEG, NO_ARG, &jit_enabled, JIT_ON, NULL, NULL },
+		{ '-', "jit-compare", "Check all translated code against the interpreter",
+			NO_NEG, NO_ARG, &jit_enabled, JIT_COMPARE, NULL, NULL },
+		{ 'R', "realtime", "Limit simulation speed to match realtime",
+			HAS_NEG, NO_ARG, &machine_realtime, 0, NULL, NULL },
+		{ 'I', "irqfreq", "Asserts an IRQ every so many cycles automatically",
+			NO_NEG, HAS_ARG, &cycles_per_irq, 0, NULL, NULL },
+		{ 'F', "firqfreq", "Asserts an FIRQ every so many cycles automatically",
+			NO_NEG, HAS_ARG, &cycles_per_firq, 0, NULL, NULL },
+		{ 'C', "cycledump", "",
+			HAS_NEG, NO_ARG, &dump_cycles_on_success, 1, NULL, NULL},
+		{ 't', "loadmap", "" },
+		{ 'T', "trace", "Keep the instruction trace for 'td'",
+			NO_NEG, NO_ARG, &trace_enabled, 1, NULL, NULL },
+		{ 'm', "maxcycles", "Sets maximum number of cycles to run",
+			NO_NEG, HAS_ARG, &max_cycles, 0, NULL, NULL },
+		{ 's', "machine", "Specify the machine (exact hardware) to emulate",
+			NO_NEG, HAS_ARG, NULL, 0, &machine_name, NULL },
+		{ 'p', "persistent", "Use persistent machine state",
+			NO_NEG, NO_ARG, &machine_persistent, 1, NULL, NULL },
+		{ '-', "batch", "Run the tests listed in a manifest (--batch=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &batch_manifest, NULL },
+		{ '-', "jobs", "Tests run at once by --batch (default: one per CPU)",
+			NO_NEG, HAS_ARG, &batch_jobs, 0, NULL, NULL },
+		{ '-', "report", "Write the --batch report to a file, not stdout",
+			NO_NEG, HAS_ARG, NULL, 0, &batch_report, NULL },
+		{ '-', "fork-server", "Serve test requests on a UNIX socket (--fork-server=SOCKET)",
+			NO_NEG, HAS_ARG, NULL, 0, &fork_server_socket, NULL },
+		{ '-', "fork-cycles", "Run this many cycles before serving requests",
+			NO_NEG, HAS_ARG, NULL, 0, NULL, set_fork_cycles },
+		{ '-', "fork-at", "Run to this address or symbol before serving requests",
+			NO_NEG, HAS_ARG, NULL, 0, &fork_at, NULL },
+		{ '-', "record", "Log all input, with its timing (--record=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &record_file, NULL },
+		{ '-', "replay", "Take input from a --record log, not stdin (--replay=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &replay_file, NULL },
+		{ '-', "checkpoint", "Keep a checkpoint every so many cycles, for reverse execution",
+			NO_NEG, HAS_ARG, NULL, 0, NULL, set_checkpoint_cycles },
+		{ '-', "checkpoints", "How many checkpoints to keep (default 16)",
+			NO_NEG, HAS_ARG, &checkpoint_count, 0, NULL, NULL },
+		{ '-', "profile", "Write a flat profile of where the cycles went (--profile=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &profile_file, NULL },
+		{ '-', "callgraph", "Write a call graph for KCachegrind (--callgraph=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &callgraph_file, NULL },
+		{ '-', "insnmix", "Count instructions and cycles per opcode (--insnmix=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &insnmix_file, NULL },
+		{ '-', "coverage", "Merge the code run into a coverage file (--coverage=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &coverage_file, NULL },
+		{ '-', "coverage-lcov", "Write a coverage report for lcov (--coverage-lcov=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &coverage_lcov_file, NULL },
+		{ '-', "coverage-json", "Write a coverage report in JSON (--coverage-json=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &coverage_json_file, NULL },
+		{ '-', "irqstat", "Measure interrupt latency and service times",
+			NO_NEG, NO_ARG, &irqstat_enabled, 1, NULL, NULL },
+		{ '-', "heatmap", "Count memory accesses per page and device (--heatmap=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &heatmap_file, NULL },
+		{ '-', "heatmap-range", "Also count each byte in a range (--heatmap-range=START-END)",
+			NO_NEG, HAS_ARG, NULL, 0, NULL, heatmap_add_range },
+		{ '-', "trace-file", "Record every instruction run in a binary trace (--trace-file=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &tracefile_name, NULL },
+		{ '-', "trace-regs", "Also record the registers in the --trace-file",
+			NO_NEG, NO_ARG, &tracefile_regs, 1, NULL, NULL },
+		{ '-', "trace-writes", "Also record memory writes in the --trace-file",
+			NO_NEG, NO_ARG, &tracefile_writes, 1, NULL, NULL },
+		{ '-', "trace-decode", "Print a --trace-file, instead of running (--trace-decode=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &tracefile_decode_name, NULL },
+		{ '-', "save-state", "Save a snapshot when the program stops (--save-state=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &state_save_file, NULL },
+		{ '-', "load-state", "Resume from a snapshot (--load-state=FILE)",
+			NO_NEG, HAS_ARG, NULL, 0, &state_load_file, NULL },
+		{ '\0', NULL },
+	};
+
+	/* Everything that ends the simulation comes back here */
+	if (setjmp (sim_done))
+	{
+		profile_report ();
+		callgraph_report ();
+		insnmix_report ();
+		coverage_report ();
+		irqstat_report ();
+		heatmap_report ();
+		tracefile_close ();
+		fork_server_exit (sim_status);
+		reverse_free ();
+		replay_close ();
+		command_free ();
+		machine_free ();
+		predecode_free ();
+		jit_free ();
+		profile_free ();
+		callgraph_free ();
+		heatmap_free ();
+		insnmix_free ();
+		coverage_free ();
+		sym_free ();
+		return sim_status;
+	}
 
+	option_table = options;
 	gettimeofday (&time_started, NULL);
 
   exename = argv[0];
@@ -373,6 +576,11 @@ main (int argc, char *argv[])
 
 	parse_args (argc, argv);
 
+	/* In batch mode, this machine does not run; it only starts one
+	for each test. */
+	if (batch_manifest)
+		sim_stop (batch_run (argc, argv));
+
 	sym_init ();
 
 	switch (type)
@@ -400,8 +608,12 @@ main (int argc, char *argv[])
 	if (prog_name)
 		load_map_file (prog_name);
 
+	/* Print a trace file, using the program's symbols */
+	if (tracefile_decode_name)
+		sim_stop (tracefile_decode (tracefile_decode_name));
+
 	/* Enable debugging if no executable given yet. */
-	if (!prog_name)
+	if (!prog_name && !state_load_file)
 		debug_enabled = 1;
 	else
 		/* OK, ready to run.  Reset the CPU first. */
@@ -411,42 +623,54 @@ main (int argc, char *argv[])
 	command_init ();
    keybuffering (0);
 
-	/* Now, iterate through the instructions.
-	 * If no IRQs or FIRQs are enabled, we can just call cpu_execute()
-	 * and let it run for a long time; otherwise, we need to come back
-	 * here periodically and do the interrupt handling. */
+	/* Schedule the periodic events */
+	event_init (&idle_ev, idle_loop, NULL);
+	event_init (&irq_ev, irq_event, NULL);
+	event_init (&firq_ev, firq_event, NULL);
+	event_schedule (&idle_ev, IDLE_CYCLES);
+	if (cycles_per_irq)
+		event_schedule (&irq_ev, cycles_per_irq);
+	if (cycles_per_firq)
+		event_schedule (&firq_ev, cycles_per_firq);
+
+	/* Pick up where a snapshot left off.  This replaces the reset
+	state, and the events just scheduled. */
+	if (state_load_file && state_load (state_load_file))
+		sim_stop (1);
+
+	if (replay_init ())
+		sim_stop (1);
+	reverse_init ();
+	profile_init ();
+	callgraph_init ();
+	insnmix_init ();
+	coverage_init ();
+	irqstat_reset ();
+	heatmap_init ();
+	tracefile_init ();
+
+	/* In a fork server, only the children go on from here. */
+	if (fork_server_socket)
+		fork_server ();
+
+	/* Now, iterate through the instructions.  The CPU runs until the
+	next scheduled event is due, but no more than 1ms at a time so that
+	devices with an update procedure are still called regularly. */
 	for (cpu_quit = 1; cpu_quit != 0;)
 	{
-   	if ((cycles_per_irq == 0) && (cycles_per_firq == 0))
-		{
-			/* Simulate some CPU time, either 1ms worth or up to the
-			next possible IRQ */
-			total += cpu_execute (mhz * 1024);
-
-			/* Call each device that needs periodic processing. */
-			machine_update ();
-		}
-		else
-		{
-			total += cpu_execute (cycles_per_irq);
-			/* TODO - this assumes periodic interrupts (WPC) */
-			request_irq (0);
-			{
-			/* TODO - FIRQ frequency not handled yet */
-				static int firq_freq = 0;
-				if (++firq_freq == 8)
-				{
-					request_firq (0);
-					firq_freq = 0;
-				}
-			}
-		}
+		total += cpu_execute (event_slice (mhz * 1024));
+		event_dispatch ();
 
-		idle_loop ();
+		/* Call each device that needs periodic processing. */
+		machine_update ();
 
-		/* Check for a rogue program that won't end */
-		if ((max_cycles > 0) && (total > max_cycles))
+		/* Check for a rogue program that won't end.  A fork server's
+		child does not count the cycles spent warming up. */
+		if ((max_cycles > 0) && (total - fork_start_cycles > max_cycles))
 		{
+			/* When a snapshot is wanted, this is a normal stop. */
+			if (state_save_file)
+				sim_exit (0);
 			sim_error ("maximum cycle count exceeded at %s\n",
 				monitor_addr_name (get_pc ()));
 		}
@@ -455,3 +679,10 @@ main (int argc, char *argv[])
 	sim_exit (0);
 	return 0;
 }
+
+
+int
+main (int argc, char *argv[])
+{
+	return sim_main (argc, argv);
+}
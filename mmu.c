@@ -92,12 +92,20 @@ void small_mmu_reset (struct hw_device *dev)
 	}
 }
 
+void small_mmu_state (struct hw_device *dev)
+{
+	struct small_mmu *mmu = (struct small_mmu *)dev->priv;
+	state_data (mmu->global_regs, sizeof (mmu->global_regs));
+	state_data (mmu->slot_regs, sizeof (mmu->slot_regs));
+}
+
 struct hw_class small_mmu_class =
 {
 	.readonly = 0,
 	.reset = small_mmu_reset,
 	.read = small_mmu_read,
 	.write = small_mmu_write,
+	.state = small_mmu_state,
 };
 
 struct hw_device *small_mmu_create (struct hw_device *realdev)
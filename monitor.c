@@ -27,24 +27,22 @@
 
 
 /* The function call stack */
-struct function_call fctab[MAX_FUNCTION_CALLS];
+INSTANCE struct function_call fctab[MAX_FUNCTION_CALLS];
 
 /* The top of the function call stack */
-struct function_call *current_function_call;
+INSTANCE struct function_call *current_function_call;
 
 /* Automatically break after executing this many instructions */
-int auto_break_insn_count = 0;
+INSTANCE int auto_break_insn_count = 0;
 
-int monitor_on = 0;
+INSTANCE int monitor_on = 0;
 
-int dump_every_insn = 0;
+INSTANCE int dump_every_insn = 0;
 
+/* When not NULL, the bytes of the instruction being decoded, to be used
+in place of the ones in memory (see tracefile.c) */
+INSTANCE const U8 *dasm_bytes = NULL;
 
-enum addr_mode
-{
-  _illegal, _implied, _imm_byte, _imm_word, _direct, _extended,
-  _indexed, _rel_byte, _rel_word, _reg_post, _sys_post, _usr_post
-};
 
 enum opcode
 {
@@ -889,6 +887,127 @@ char *off4[] = {
 };
 
 
+/* Read the byte at ADDR, which is part of the instruction at OPC */
+U8
+dasm_read8 (absolute_address_t opc, absolute_address_t addr)
+{
+  if (dasm_bytes && addr - opc < 5)
+    return dasm_bytes[addr - opc];
+  return abs_read8 (addr);
+}
+
+
+/* Return the mnemonic of opcode OP on opcode page PAGE (0 for the
+base page, 1 for $10 and 2 for $11), and store its addressing mode in
+*MODEP. */
+const char *
+opcode_name (unsigned int page, unsigned int op, unsigned int *modep)
+{
+  opcode_t *table = page == 1 ? codes10 : page == 2 ? codes11 : codes;
+
+  *modep = table[op & 0xff].mode;
+  return mne[table[op & 0xff].code];
+}
+
+
+/* Decode the instruction at OPC without disassembling it.  Returns the
+number of bytes that compose it, or zero if the opcode is not valid.
+The addressing mode is stored in *MODEP.  *JUMPP is set nonzero if the
+instruction may transfer control somewhere other than the next
+instruction. */
+int
+insn_decode (absolute_address_t opc, unsigned int *modep, int *jumpp)
+{
+  UINT8 op, am, post;
+  absolute_address_t pc = opc;
+
+  op = fetch8 ();
+  if (op == 0x10)
+    {
+      op = fetch8 ();
+      am = codes10[op].mode;
+      op = codes10[op].code;
+    }
+  else if (op == 0x11)
+    {
+      op = fetch8 ();
+      am = codes11[op].mode;
+      op = codes11[op].code;
+    }
+  else
+    {
+      am = codes[op].mode;
+      op = codes[op].code;
+    }
+
+  *modep = am;
+  *jumpp = 0;
+
+  switch (op)
+    {
+    case _undoc:
+    case _reset:
+      return 0;
+
+    case _jmp: case _jsr: case _rts: case _rti:
+    case _swi: case _swi2: case _swi3: case _cwai: case _sync:
+      *jumpp = 1;
+      break;
+    }
+
+  switch (am)
+    {
+    case _illegal:
+      return 0;
+    case _implied:
+      break;
+    case _imm_byte:
+    case _direct:
+      pc++;
+      break;
+    case _imm_word:
+    case _extended:
+      pc += 2;
+      break;
+    case _indexed:
+      post = fetch8 ();
+      if (post & 0x80)
+	switch (post & 0x1f)
+	  {
+	  case 0x08: case 0x0C: case 0x18: case 0x1C:
+	    pc++;
+	    break;
+	  case 0x09: case 0x0D: case 0x19: case 0x1D: case 0x1F:
+	    pc += 2;
+	    break;
+	  }
+      break;
+    case _rel_byte:
+      pc++;
+      *jumpp = 1;
+      break;
+    case _rel_word:
+      pc += 2;
+      *jumpp = 1;
+      break;
+    case _reg_post:
+      /* TFR/EXG into the PC is a jump */
+      post = fetch8 ();
+      if ((post & 0x0F) == 5 || (op == _exg && (post >> 4) == 5))
+	*jumpp = 1;
+      break;
+    case _sys_post:
+    case _usr_post:
+      /* PULS/PULU of the PC is a return */
+      post = fetch8 ();
+      if ((op == _puls || op == _pulu) && (post & 0x80))
+	*jumpp = 1;
+      break;
+    }
+  return pc - opc;
+}
+
+
 /* Disassemble the current instruction.  Returns the number of bytes that
 compose it. */
 int
@@ -1098,6 +1217,7 @@ load_map_file (const char *name)
 	char *value_ptr, *id_ptr;
 	target_addr_t value;
 	char *file_ptr;
+	char *save_ptr;
 	struct symbol *sym = NULL;
 
 	/* Try appending the suffix 'map' to the name of the program. */
@@ -1116,7 +1236,8 @@ load_map_file (const char *name)
 
 		if (!fp)
 		{
-			fprintf (stderr, "warning: no symbols for %s\n", name);
+			if (!batch_mode)
+				fprintf (stderr, "warning: no symbols for %s\n", name);
 			return -1;
 		}
 	}
@@ -1151,12 +1272,12 @@ load_map_file (const char *name)
 		while (*id_ptr == ' ')
 			id_ptr++;
 
-		id_ptr = strtok (id_ptr, " \t\n");
+		id_ptr = strtok_r (id_ptr, " \t\n", &save_ptr);
 		if (((*id_ptr == 'l') || (*id_ptr == 's')) && (id_ptr[1] == '_'))
 			continue;
 		++id_ptr;
 
-		file_ptr = strtok (NULL, " \t\n");
+		file_ptr = strtok_r (NULL, " \t\n", &save_ptr);
 
 		if (sym)
 			sym->ty.size = to_absolute (value) - sym->value;
@@ -1164,6 +1285,7 @@ load_map_file (const char *name)
 	}
 
 	fclose (fp);
+	sym_index (&program_symtab);
 	return 0;
 }
 
@@ -1306,62 +1428,147 @@ load_s19 (const char *name)
 
 
 
+/**
+ * Return from the call FC and from every call made since.
+ */
+static void
+monitor_pop (struct function_call *fc)
+{
+	while (current_function_call >= fc)
+	{
+		if (callgraph_enabled)
+			callgraph_leave (current_function_call);
+		current_function_call--;
+	}
+}
+
+
+/**
+ * Called after the CPU has entered a function, with the PC at its
+ * first instruction and the return address stacked.  A jump (with
+ * FC_TAIL_CALL) only counts if it goes to a symbol other than the
+ * current function; jumping back to a function that tail-called its
+ * way here returns to it.
+ */
 void
 monitor_call (unsigned int flags)
 {
-#ifdef CALL_STACK
-	if (current_function_call <= &fctab[MAX_FUNCTION_CALLS-1])
+	struct function_call *fc;
+	unsigned int s;
+
+#ifndef CALL_STACK
+	if (!callgraph_enabled)
+		return;
+#endif
+
+	if (flags & FC_TAIL_CALL)
 	{
-		current_function_call++;
-		current_function_call->entry_point = get_pc ();
-		current_function_call->flags = flags;
+		if (!sym_lookup (&program_symtab, to_absolute (get_pc ())))
+			return;
+		for (fc = current_function_call; ; fc--)
+		{
+			if (fc->entry_point == get_pc ())
+			{
+				monitor_pop (fc + 1);
+				return;
+			}
+			if (!(fc->flags & FC_TAIL_CALL) || fc == fctab)
+				break;
+		}
+		s = current_function_call->entry_s;
 	}
-#endif
-#if 0
-	const char *id = sym_lookup (&program_symtab, to_absolute (get_pc ()));
-	if (id)
+	else
 	{
-		// printf ("In %s now\n", id);
+		/* Like a return address, the PC stacked by an interrupt is
+		where it returns with */
+		s = get_s ();
+		if (flags & (FC_INTERRUPT | FC_SWI))
+			s += (get_cc () & E_FLAG) ? 10 : 1;
+
+		/* The stack only grows with a call, so calls made further up
+		it have been left without returning, e.g. by switching
+		stacks. */
+		while (current_function_call > fctab
+			&& (INT16)(current_function_call->entry_s - s) <= 0)
+			monitor_pop (current_function_call);
 	}
-#endif
+
+	/* When the stack is full, the call is not recorded, and neither
+	is its return, which will not match any entry */
+	if (current_function_call == &fctab[MAX_FUNCTION_CALLS-1])
+		return;
+
+	fc = ++current_function_call;
+	fc->entry_point = get_pc ();
+	fc->flags = flags;
+	fc->entry_s = s;
+	if (callgraph_enabled)
+		callgraph_enter (fc);
 }
 
 
+/**
+ * Called by RTS, RTI and PULS PC just before they pull the PC.
+ * The call returned from is the one that was made with the stack
+ * pointer where it is now, along with the tail calls it made.  If
+ * there is none, the return is ignored.
+ */
 void
 monitor_return (void)
 {
-#ifdef CALL_STACK
-	if (current_function_call > &fctab[MAX_FUNCTION_CALLS-1])
-	{
-		current_function_call--;
+	struct function_call *fc;
+	unsigned int s;
+
+#ifndef CALL_STACK
+	if (!callgraph_enabled)
 		return;
-	}
+#endif
 
-	while ((current_function_call->flags & FC_TAIL_CALL) &&
-		(current_function_call > fctab))
-	{
-		current_function_call--;
-	}
+	s = get_s ();
+	for (fc = current_function_call; fc > fctab; fc--)
+		if (fc->entry_s == s)
+			break;
+	if (fc == fctab)
+		return;
 
-	if (current_function_call > fctab)
-		current_function_call--;
-#endif
+	while (fc - 1 > fctab && (fc->flags & FC_TAIL_CALL))
+		fc--;
+	monitor_pop (fc);
+}
+
+
+/**
+ * Write NAME to BUF, followed by +OFFSET if the address is inside
+ * the symbol rather than at its start.
+ */
+static void
+sym_format (char *buf, const char *name, unsigned long offset)
+{
+	if (offset)
+		snprintf (buf, 64, "%s+%lu", name, offset);
+	else
+		snprintf (buf, 64, "%s", name);
 }
 
 
 const char *
 absolute_addr_name (absolute_address_t addr)
 {
-	static char buf[256], *bufptr;
+	static INSTANCE char buf[256], *bufptr;
+	char sym[64];
 	const char *name;
+	unsigned long offset;
 
 	bufptr = buf;
 
    bufptr += sprintf (bufptr, "%02X:0x%04X", addr >> 28, addr & 0xFFFFFF);
 
-   name = sym_lookup (&program_symtab, addr);
+   name = sym_lookup_offset (&program_symtab, addr, &offset);
    if (name)
-      bufptr += sprintf (bufptr, "  <%-16.16s>", name);
+   {
+      sym_format (sym, name, offset);
+      bufptr += sprintf (bufptr, "  <%-16.16s>", sym);
+   }
 
 	return buf;
 
@@ -1371,17 +1578,22 @@ absolute_addr_name (absolute_address_t addr)
 const char *
 monitor_addr_name (target_addr_t target_addr)
 {
-	static char buf[256], *bufptr;
+	static INSTANCE char buf[256], *bufptr;
+	char sym[64];
 	const char *name;
+	unsigned long offset;
 	absolute_address_t addr = to_absolute (target_addr);
 
 	bufptr = buf;
 
    bufptr += sprintf (bufptr, "0x%04X", target_addr);
 
-   name = sym_lookup (&program_symtab, addr);
+   name = sym_lookup_offset (&program_symtab, addr, &offset);
    if (name)
-      bufptr += sprintf (bufptr, "  <%s>", name);
+   {
+      sym_format (sym, name, offset);
+      bufptr += sprintf (bufptr, "  <%s>", sym);
+   }
 
 	return buf;
 }
@@ -1400,11 +1612,13 @@ void
 monitor_init (void)
 {
 	int tmp;
-	extern int debug_enabled;
+	extern INSTANCE int debug_enabled;
 	target_addr_t a;
 
 	fctab[0].entry_point = read16 (0xfffe);
 	memset (&fctab[0].entry_regs, 0, sizeof (struct cpu_regs));
+	fctab[0].flags = 0;
+	fctab[0].entry_s = 0;
 	current_function_call = &fctab[0];
 
   auto_break_insn_count = 0;
@@ -12,6 +12,12 @@
 #define BP_USED 0x1
 #define BP_TEMP 0x2
 
+enum addr_mode
+{
+  _illegal, _implied, _imm_byte, _imm_word, _direct, _extended,
+  _indexed, _rel_byte, _rel_word, _reg_post, _sys_post, _usr_post
+};
+
 #define PROMPT_REGS 0x1
 #define PROMPT_CYCLES 0x2
 #define PROMPT_INSN 0x4
@@ -27,6 +33,9 @@ struct cpu_regs {
 #endif
 };
 
+extern void cpu_get_regs (struct cpu_regs *regs);
+extern void cpu_set_regs (const struct cpu_regs *regs);
+
 
 struct x_symbol {
 	int flags;
@@ -62,21 +71,43 @@ struct breakpoint {
 };
 
 
-#define FC_TAIL_CALL 0x1
+#define FC_TAIL_CALL 0x1  /* Entered by a jump to the start of a function */
+#define FC_INTERRUPT 0x2  /* Entered by an interrupt */
+#define FC_SWI       0x4  /* Entered by SWI, SWI2 or SWI3 */
+
+struct cg_function;
+struct cg_edge;
 
 struct function_call {
 	target_addr_t entry_point;
 	struct cpu_regs entry_regs;
 	int flags;
+
+	/* Where the return address is stacked */
+	unsigned int entry_s;
+
+	/* For the call graph profiler (see callgraph.c) */
+	unsigned long entry_cycles;
+	unsigned long child_cycles;
+	unsigned long irq_cycles;
+	struct cg_function *fn;
+	struct cg_edge *edge;
 };
 
+extern INSTANCE struct function_call fctab[];
+extern INSTANCE struct function_call *current_function_call;
+
 void add_named_symbol (const char *id, target_addr_t value, const char *filename);
 struct x_symbol * find_symbol (target_addr_t value);
 void monitor_branch (void);
 void monitor_call (unsigned int flags);
 void monitor_return (void);
+void callgraph_enter (struct function_call *fc);
+void callgraph_leave (struct function_call *fc);
 const char * monitor_addr_name (target_addr_t addr);
 const char * absolute_addr_name (unsigned long addr);
+int insn_decode (absolute_address_t opc, unsigned int *modep, int *jumpp);
+const char * opcode_name (unsigned int page, unsigned int op, unsigned int *modep);
 
 
 
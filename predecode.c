@@ -0,0 +1,302 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The predecode cache.  Straight-line runs of instructions (basic
+blocks) are decoded once and kept in a hash table keyed by their
+absolute address, so that the CPU does not have to go through the
+bus for every opcode and operand byte it fetches.
+
+Only RAM and ROM devices are cached; I/O devices may have side
+effects on read.  A block never crosses a bus map boundary, so each
+block belongs to exactly one page of one device.  A write to a page
+that holds cached code throws away all of the blocks in that page. */
+
+#include "6809.h"
+#include "monitor.h"
+
+extern INSTANCE struct bus_map busmaps[];
+extern INSTANCE struct hw_device *device_table[];
+extern struct hw_class ram_class, rom_class;
+
+/* Nonzero if the predecode cache is used */
+INSTANCE int predecode_enabled = 1;
+
+/* Incremented whenever blocks are thrown away, or the bus maps change.
+The CPU must look up its block again when this changes. */
+INSTANCE unsigned long predecode_generation = 0;
+
+/* For each device, a list of the blocks in each page.  NULL if
+nothing has been cached for that device yet. */
+INSTANCE struct pd_block **predecode_pages[MAX_BUS_DEVICES];
+
+static INSTANCE struct pd_block *pd_hash[PD_HASH_SIZE];
+
+/* The blocks, allocated on the first flush; too large to be
+thread-local itself */
+static INSTANCE struct pd_block *pd_pool;
+
+static INSTANCE struct pd_block *pd_free;
+
+static INSTANCE int pd_initialized = 0;
+
+
+static inline unsigned int
+pd_hash_index (absolute_address_t addr)
+{
+	return (addr ^ (addr >> 28) ^ (addr >> 12)) % PD_HASH_SIZE;
+}
+
+
+/**
+ * Throw away every cached block.
+ */
+void
+predecode_flush (void)
+{
+	unsigned int n;
+
+	memset (pd_hash, 0, sizeof (pd_hash));
+	for (n = 0; n < MAX_BUS_DEVICES; n++)
+		if (predecode_pages[n])
+			memset (predecode_pages[n], 0,
+				(device_table[n]->size / BUS_MAP_SIZE + 1) * sizeof (struct pd_block *));
+
+	if (!pd_pool)
+		pd_pool = malloc (PD_MAX_BLOCKS * sizeof (struct pd_block));
+	pd_free = NULL;
+	for (n = 0; n < PD_MAX_BLOCKS; n++)
+	{
+		pd_pool[n].hash_next = pd_free;
+		pd_free = &pd_pool[n];
+	}
+	pd_initialized = 1;
+	predecode_generation++;
+	bus_fast_update (0, NUM_BUS_MAPS);
+}
+
+
+/**
+ * Forget the handler of every cached instruction.  The handlers are
+ * label addresses in one copy of the threaded engine, and must not be
+ * used by another.
+ */
+void
+predecode_clear_handlers (void)
+{
+	unsigned int n, i;
+
+	if (!pd_pool)
+		return;
+	for (n = 0; n < PD_MAX_BLOCKS; n++)
+		for (i = 0; i < PD_MAX_INSNS; i++)
+			pd_pool[n].insn[i].handler = NULL;
+}
+
+
+/**
+ * Release the cache when a machine finishes.
+ */
+void
+predecode_free (void)
+{
+	unsigned int n;
+
+	for (n = 0; n < MAX_BUS_DEVICES; n++)
+	{
+		free (predecode_pages[n]);
+		predecode_pages[n] = NULL;
+	}
+	free (pd_pool);
+	pd_pool = NULL;
+	pd_initialized = 0;
+}
+
+
+/**
+ * Throw away all blocks in one page of a device.
+ */
+void
+predecode_invalidate (unsigned int devid, unsigned long page)
+{
+	struct pd_block *blk, *next, **prevp;
+
+	for (blk = predecode_pages[devid][page]; blk; blk = next)
+	{
+		next = blk->page_next;
+
+		prevp = &pd_hash[pd_hash_index (blk->addr)];
+		while (*prevp != blk)
+			prevp = &(*prevp)->hash_next;
+		*prevp = blk->hash_next;
+
+		blk->hash_next = pd_free;
+		pd_free = blk;
+	}
+	predecode_pages[devid][page] = NULL;
+	predecode_generation++;
+	bus_fast_update_page (devid, page);
+}
+
+
+/**
+ * Throw away all blocks that overlap a range of a device, after
+ * it has been modified without going through the bus.
+ */
+void
+predecode_invalidate_range (unsigned int devid, unsigned long offset,
+	unsigned long len)
+{
+	unsigned long page;
+
+	if (!predecode_pages[devid] || len == 0)
+		return;
+	for (page = offset / BUS_MAP_SIZE;
+		page <= (offset + len - 1) / BUS_MAP_SIZE; page++)
+		if (predecode_pages[devid][page])
+			predecode_invalidate (devid, page);
+}
+
+
+/**
+ * If a block is an idle loop -- it does nothing but branch back to
+ * its own start -- return the number of cycles one pass takes.
+ * Otherwise return zero.  Only NOPs may come before the BRA or LBRA;
+ * any other branch would have ended the block.
+ */
+static unsigned int
+predecode_idle_cycles (struct pd_block *blk)
+{
+	struct pd_insn *insn;
+	unsigned int n, len = 0, cycles = 0;
+
+	for (n = 0; n < blk->count; n++)
+	{
+		insn = &blk->insn[n];
+		len += insn->len;
+		switch (insn->bytes[0])
+		{
+			case 0x12: /* NOP */
+				cycles += 2;
+				break;
+			case 0x20: /* BRA */
+				if ((INT8)insn->bytes[1] == -(int)len)
+					return cycles + 3;
+				return 0;
+			case 0x16: /* LBRA */
+				if ((INT16)((insn->bytes[1] << 8) | insn->bytes[2]) == -(int)len)
+					return cycles + 5;
+				return 0;
+			default:
+				return 0;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Decode a new block starting at absolute address ADDR.
+ */
+static struct pd_block *
+predecode_build (absolute_address_t addr)
+{
+	struct hw_device *dev = device_table[addr >> 28];
+	unsigned long phy_addr = addr & 0xFFFFFFF;
+	unsigned long page = phy_addr / BUS_MAP_SIZE;
+	unsigned long limit = (page + 1) * BUS_MAP_SIZE;
+	struct pd_block *blk;
+	struct pd_insn *insn;
+	unsigned int mode, len, n;
+	int jump;
+
+	if (limit > dev->size)
+		limit = dev->size;
+	if (!predecode_pages[dev->devid])
+		predecode_pages[dev->devid] =
+			calloc (dev->size / BUS_MAP_SIZE + 1, sizeof (struct pd_block *));
+
+	if (!pd_free)
+		predecode_flush ();
+	blk = pd_free;
+	pd_free = blk->hash_next;
+
+	blk->addr = addr;
+	blk->link_gen = 0;
+	blk->count = 0;
+	blk->jit = NULL;
+	blk->hits = 0;
+	do {
+		len = insn_decode (addr, &mode, &jump);
+		if (len == 0 || phy_addr + len > limit)
+			break;
+
+		insn = &blk->insn[blk->count++];
+		insn->handler = NULL;
+		insn->len = len;
+		insn->cycles = 0;
+		for (n = 0; n < len; n++)
+			insn->bytes[n] = abs_read8 (addr + n);
+		addr += len;
+		phy_addr += len;
+	} while (!jump && blk->count < PD_MAX_INSNS);
+	blk->idle = predecode_idle_cycles (blk);
+
+	/* Link the block even if it is empty, so that the next lookup
+	for an undecodable address is still a single hash probe. */
+	blk->hash_next = pd_hash[pd_hash_index (blk->addr)];
+	pd_hash[pd_hash_index (blk->addr)] = blk;
+	blk->page_next = predecode_pages[dev->devid][page];
+	predecode_pages[dev->devid][page] = blk;
+
+	/* Writes to this page must now go through the bus */
+	if (!blk->page_next)
+		bus_fast_update_page (dev->devid, page);
+	return blk;
+}
+
+
+/**
+ * Return the predecoded block that begins at CPU address PC,
+ * decoding it if necessary.  Returns NULL if the code there cannot
+ * be cached.
+ */
+struct pd_block *
+predecode_lookup (unsigned int pc)
+{
+	struct bus_map *map = &busmaps[pc / BUS_MAP_SIZE];
+	struct hw_device *dev;
+	absolute_address_t addr;
+	struct pd_block *blk;
+
+	if (map->devid >= MAX_BUS_DEVICES || !(map->flags & MAP_READABLE))
+		return NULL;
+	dev = device_table[map->devid];
+	if (!dev || (dev->class_ptr != &ram_class && dev->class_ptr != &rom_class))
+		return NULL;
+
+	if (!pd_initialized)
+		predecode_flush ();
+
+	addr = (map->devid * 0x10000000L) + map->offset + pc % BUS_MAP_SIZE;
+	for (blk = pd_hash[pd_hash_index (addr)]; blk; blk = blk->hash_next)
+		if (blk->addr == addr)
+			return blk;
+	return predecode_build (addr);
+}
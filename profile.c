@@ -0,0 +1,237 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The flat profiler.  With --profile=FILE, the cycles taken by every
+instruction are charged to its absolute address (see to_absolute), so
+that code in different ROM banks is counted apart even though it runs
+at the same CPU address.  The counting is done by a copy of the
+execution engine built with PROFILE_HOOKS (see 6809exec.h), which is
+used only when profiling, so plain runs do not pay for it.
+
+At the end of the run, the counts are added up for each symbol of
+the program, by the nearest symbol at or below the address, and
+written to FILE ("-" for stdout) from the most to the least
+expensive.  The cycles that pass while the CPU waits in SYNC or CWAI
+are charged to that instruction. */
+
+#include "6809.h"
+
+extern INSTANCE long cpu_clk;
+extern INSTANCE struct hw_device *device_table[];
+extern INSTANCE unsigned int device_count;
+extern absolute_address_t absolute_from_reladdr (unsigned int device,
+	unsigned long reladdr);
+
+/* The option that enables profiling */
+INSTANCE const char *profile_file = NULL;
+
+/* Nonzero if the profiling engine is to be used */
+INSTANCE int profile_enabled = 0;
+
+/* The counts for each device, one per byte of it, allocated when code
+first runs from it, and the number of bytes allocated.  The tables are
+indexed by device ID, up to INVALID_DEVID. */
+INSTANCE struct profile_count *profile_counts[INVALID_DEVID + 1];
+INSTANCE unsigned long profile_limit[INVALID_DEVID + 1];
+
+/* Where the instructions that do not run from any device are counted */
+INSTANCE struct profile_count profile_unmapped;
+
+/* The instruction being timed, and the value of cpu_clk when it
+started (see 6809exec.h), or zero between time slices */
+INSTANCE struct profile_count *profile_last;
+INSTANCE long profile_clk;
+
+/* A line of the report */
+struct profile_entry
+{
+	const char *name;
+	absolute_address_t addr;
+	unsigned long cycles;
+	unsigned long insns;
+};
+
+
+/**
+ * Turn on profiling, if --profile was given.  The JIT is turned off,
+ * as translated code is not counted.
+ */
+void
+profile_init (void)
+{
+	if (!profile_file)
+		return;
+	profile_enabled = 1;
+	profile_last = &profile_unmapped;
+	jit_enabled = 0;
+}
+
+
+/**
+ * Return the counts for CPU address PC, when its device has no table
+ * yet.  Called from profile_at.
+ */
+struct profile_count *
+profile_lookup (unsigned int pc)
+{
+	struct bus_map *map = &busmaps[pc / BUS_MAP_SIZE];
+	unsigned int devid = map->devid;
+	unsigned long size;
+
+	if (devid >= device_count || profile_counts[devid])
+		return &profile_unmapped;
+
+	size = (device_table[devid]->size + BUS_MAP_SIZE - 1)
+		/ BUS_MAP_SIZE * BUS_MAP_SIZE;
+	profile_counts[devid] = calloc (size, sizeof (struct profile_count));
+	profile_limit[devid] = size;
+	return profile_at (pc);
+}
+
+
+static int
+entry_compare (const void *a, const void *b)
+{
+	const struct profile_entry *ea = a;
+	const struct profile_entry *eb = b;
+
+	if (ea->cycles != eb->cycles)
+		return ea->cycles < eb->cycles ? 1 : -1;
+	if (ea->insns != eb->insns)
+		return ea->insns < eb->insns ? 1 : -1;
+	return ea->addr < eb->addr ? -1 : ea->addr > eb->addr;
+}
+
+
+/**
+ * Write the flat profile at the end of the run.
+ */
+void
+profile_report (void)
+{
+	struct symbol **syms;
+	struct profile_entry *entries, *e;
+	struct profile_count *c;
+	unsigned int symcount, nentries, n;
+	unsigned int devid;
+	unsigned long phy;
+	unsigned long total_cycles = 0, total_insns = 0;
+	int i;
+	FILE *fp;
+
+	if (!profile_enabled)
+		return;
+	profile_enabled = 0;
+
+	/* The program may have stopped in the middle of an instruction */
+	if (profile_clk > cpu_clk)
+		profile_last->cycles += profile_clk - cpu_clk;
+
+	/* One entry per symbol, then one per device for the code that is
+	not in any symbol, then one for no device at all */
+	syms = sym_sorted (&program_symtab, &symcount);
+	nentries = symcount + device_count + 1;
+	entries = calloc (nentries, sizeof (struct profile_entry));
+	for (n = 0; n < symcount; n++)
+	{
+		entries[n].name = syms[n]->name;
+		entries[n].addr = syms[n]->value;
+	}
+	for (devid = 0; devid < device_count; devid++)
+	{
+		entries[symcount + devid].name = NULL;
+		entries[symcount + devid].addr = absolute_from_reladdr (devid, 0);
+	}
+	e = &entries[nentries - 1];
+	e->name = "(unmapped)";
+	e->cycles = profile_unmapped.cycles;
+	e->insns = profile_unmapped.insns;
+	total_cycles += e->cycles;
+	total_insns += e->insns;
+
+	for (devid = 0; devid < device_count; devid++)
+	{
+		if (!profile_counts[devid])
+			continue;
+		for (phy = 0; phy < profile_limit[devid]; phy++)
+		{
+			c = &profile_counts[devid][phy];
+			if (!c->insns && !c->cycles)
+				continue;
+			i = sym_nearest (&program_symtab,
+				absolute_from_reladdr (devid, phy));
+			e = &entries[i >= 0 ? i : symcount + devid];
+			e->cycles += c->cycles;
+			e->insns += c->insns;
+			total_cycles += c->cycles;
+			total_insns += c->insns;
+		}
+	}
+
+	if (!strcmp (profile_file, "-"))
+		fp = stdout;
+	else if ((fp = fopen (profile_file, "w")) == NULL)
+	{
+		fprintf (stderr, "m6809-run: cannot write %s\n", profile_file);
+		goto done;
+	}
+
+	qsort (entries, nentries, sizeof (struct profile_entry), entry_compare);
+	fprintf (fp, "Flat profile: %lu cycles, %lu instructions\n\n",
+		total_cycles, total_insns);
+	fprintf (fp, "%%cycles   self cycles  instructions  address   symbol\n");
+	for (n = 0; n < nentries; n++)
+	{
+		e = &entries[n];
+		if (!e->insns && !e->cycles)
+			break;
+		fprintf (fp, "%6.2f %14lu %13lu  %08lX  ",
+			total_cycles ? e->cycles * 100.0 / total_cycles : 0.0,
+			e->cycles, e->insns, e->addr);
+		if (e->name)
+			fprintf (fp, "%s\n", e->name);
+		else
+			fprintf (fp, "(device %02lX)\n", e->addr >> 28);
+	}
+
+	if (fp != stdout)
+		fclose (fp);
+done:
+	free (entries);
+}
+
+
+/**
+ * Free the counts at the end of the simulation.
+ */
+void
+profile_free (void)
+{
+	unsigned int devid;
+
+	for (devid = 0; devid <= INVALID_DEVID; devid++)
+	{
+		free (profile_counts[devid]);
+		profile_counts[devid] = NULL;
+		profile_limit[devid] = 0;
+	}
+	profile_unmapped.cycles = profile_unmapped.insns = 0;
+	profile_enabled = 0;
+}
@@ -0,0 +1,399 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Input recording and replay.  Everything the simulated program reads
+from the host -- the console, a serial port on stdin, the WPC switch
+keys -- comes through input_poll and input_getc, so that a run can be
+repeated exactly.
+
+With --record=FILE, each byte of input is logged together with the
+cycle count at which the program first saw it.  With --replay=FILE,
+stdin is not read at all: a byte becomes available to the program
+at the cycle it was logged at, and so does the end of the input, if
+it was reached.  As the simulation is otherwise deterministic, a
+replayed run takes exactly the same number of cycles as the recorded
+one, however fast or slow the host is.
+
+The file holds "6809RPL" and the format version, followed by one
+record per byte.  A record is the number of cycles since the
+previous one, shifted left by one and with the low bit set at end of
+file, stored 7 bits at a time, low bits first, with the top bit set
+in all but the last byte.  Except at end of file, the input byte
+follows.
+
+For reverse debugging, the input is also logged in memory, so that
+when the machine is put back to an earlier checkpoint, what arrived
+after it can be delivered again at the same cycles. */
+
+#include "6809.h"
+#include <limits.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define REPLAY_VERSION 1
+
+/* The options that record and replay input */
+INSTANCE const char *record_file = NULL;
+INSTANCE const char *replay_file = NULL;
+
+static INSTANCE FILE *record_fp = NULL;
+static INSTANCE FILE *replay_fp = NULL;
+
+/* The cycle count of the last record read */
+static INSTANCE unsigned long replay_last;
+
+/* The next record to replay: its cycle count and byte, or EOF */
+static INSTANCE unsigned long replay_next_when;
+static INSTANCE int replay_next_c;
+
+/* The cycle count of the last record written */
+static INSTANCE unsigned long record_last;
+
+/* A byte that has been seen by input_poll but not yet read, or -1 */
+static INSTANCE int input_pending = -1;
+
+/* Nonzero once the end of the input has been reached */
+static INSTANCE int input_eof = 0;
+
+/* Nonzero if input is logged in memory, so that it can be delivered
+again after the machine is rewound (see reverse.c) */
+INSTANCE int input_logging = 0;
+
+struct input_event
+{
+	unsigned long when;
+	int c;
+};
+
+/* The logged input.  Entries are numbered from the start of the run;
+the first one still in the log is number input_log_base. */
+static INSTANCE struct input_event *input_log = NULL;
+static INSTANCE unsigned long input_log_base = 0;
+static INSTANCE unsigned long input_log_count = 0;
+static INSTANCE unsigned long input_log_size = 0;
+
+/* The number of the next logged entry to deliver again */
+static INSTANCE unsigned long input_log_next = 0;
+
+
+static void
+record_event (int c)
+{
+	unsigned long now = get_cycles ();
+	unsigned long val = ((now - record_last) << 1) | (c == EOF);
+
+	record_last = now;
+	while (val >= 0x80)
+	{
+		putc ((val & 0x7F) | 0x80, record_fp);
+		val >>= 7;
+	}
+	putc (val, record_fp);
+	if (c != EOF)
+		putc (c, record_fp);
+}
+
+
+/**
+ * Read the next record to replay.  At the end of the file, no more
+ * input ever becomes available, as in the recorded run.
+ */
+static void
+replay_advance (void)
+{
+	unsigned long val = 0;
+	unsigned int shift = 0;
+	int b;
+
+	do {
+		if ((b = getc (replay_fp)) == EOF)
+			goto end;
+		val |= (unsigned long)(b & 0x7F) << shift;
+		shift += 7;
+	} while (b & 0x80);
+
+	replay_last += val >> 1;
+	replay_next_when = replay_last;
+	if (val & 1)
+		replay_next_c = EOF;
+	else if ((replay_next_c = getc (replay_fp)) == EOF)
+		goto end;
+	return;
+
+end:
+	replay_next_when = ULONG_MAX;
+	replay_next_c = EOF;
+}
+
+
+/**
+ * Open the files given by --record and --replay.  Returns zero on
+ * success.
+ */
+int
+replay_init (void)
+{
+	char magic[8];
+
+	replay_last = record_last = 0;
+	if (replay_file)
+	{
+		replay_fp = fopen (replay_file, "rb");
+		if (!replay_fp
+			|| fread (magic, sizeof (magic), 1, replay_fp) != 1
+			|| memcmp (magic, "6809RPL", 7)
+			|| magic[7] != REPLAY_VERSION)
+		{
+			fprintf (stderr, "m6809-run: cannot replay %s\n", replay_file);
+			return -1;
+		}
+		replay_advance ();
+	}
+
+	if (record_file)
+	{
+		record_fp = fopen (record_file, "wb");
+		if (!record_fp)
+		{
+			fprintf (stderr, "m6809-run: cannot write %s\n", record_file);
+			return -1;
+		}
+		fwrite ("6809RPL", 7, 1, record_fp);
+		putc (REPLAY_VERSION, record_fp);
+	}
+	return 0;
+}
+
+
+/**
+ * Close the files at the end of the simulation.
+ */
+void
+replay_close (void)
+{
+	if (replay_fp)
+		fclose (replay_fp);
+	if (record_fp)
+		fclose (record_fp);
+	replay_fp = record_fp = NULL;
+	free (input_log);
+	input_log = NULL;
+}
+
+
+/**
+ * Return nonzero if host timing must not affect the simulation,
+ * because input is being recorded or replayed, or execution is being
+ * repeated for reverse debugging.
+ */
+int
+input_deterministic (void)
+{
+	return record_fp || replay_fp || reverse_running;
+}
+
+
+/**
+ * Called when a byte of input, or the end of it, arrives from stdin
+ * or the --replay file.
+ */
+static void
+input_arrived (int c)
+{
+	struct input_event *ev;
+
+	if (record_fp)
+		record_event (c);
+
+	if (input_logging)
+	{
+		if (input_log_count == input_log_size)
+		{
+			input_log_size = input_log_size ? input_log_size * 2 : 256;
+			input_log = realloc (input_log,
+				input_log_size * sizeof (struct input_event));
+		}
+		ev = &input_log[input_log_count++];
+		ev->when = get_cycles ();
+		ev->c = c;
+		input_log_next = input_log_base + input_log_count;
+	}
+}
+
+
+/**
+ * Return the next logged event to deliver again after input_rewind,
+ * or NULL if all of them have been.
+ */
+static struct input_event *
+input_relog (void)
+{
+	if (input_log_next >= input_log_base + input_log_count)
+		return NULL;
+	return &input_log[input_log_next - input_log_base];
+}
+
+
+/**
+ * Take the next replayed byte as the input.
+ */
+static int
+replay_take (void)
+{
+	int c = replay_next_c;
+
+	if (c != EOF)
+		replay_advance ();
+	input_arrived (c);
+	return c;
+}
+
+
+/**
+ * Return nonzero if input_getc would not block: a byte is waiting,
+ * or the input is at end of file.
+ */
+int
+input_poll (void)
+{
+	fd_set fds;
+	struct timeval timeout;
+	struct input_event *ev;
+	unsigned char byte;
+	int c;
+
+	if (input_pending >= 0 || input_eof)
+		return 1;
+
+	if ((ev = input_relog ()) != NULL)
+	{
+		if (ev->when > get_cycles ())
+			return 0;
+		input_log_next++;
+		c = ev->c;
+	}
+	else if (replay_fp)
+	{
+		if (replay_next_when > get_cycles ())
+			return 0;
+		c = replay_take ();
+	}
+	else
+	{
+		FD_ZERO (&fds);
+		FD_SET (0, &fds);
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 0;
+		if (select (1, &fds, NULL, NULL, &timeout) <= 0)
+			return 0;
+		c = (read (0, &byte, 1) == 1) ? byte : EOF;
+		input_arrived (c);
+	}
+
+	if (c == EOF)
+		input_eof = 1;
+	else
+		input_pending = c;
+	return 1;
+}
+
+
+/**
+ * Read the next byte of input, waiting for it if necessary.  Returns
+ * EOF at the end.  When replaying, the next byte is returned whatever
+ * the cycle count, as the recorded run would have waited for it.
+ */
+int
+input_getc (void)
+{
+	struct input_event *ev;
+	int c;
+
+	if (input_pending >= 0)
+	{
+		c = input_pending;
+		input_pending = -1;
+		return c;
+	}
+	if (input_eof)
+		return EOF;
+
+	if ((ev = input_relog ()) != NULL)
+	{
+		input_log_next++;
+		c = ev->c;
+	}
+	else if (replay_fp)
+		c = replay_take ();
+	else
+	{
+		c = getchar ();
+		input_arrived (c);
+	}
+
+	if (c == EOF)
+		input_eof = 1;
+	return c;
+}
+
+
+/**
+ * Remember where the input is now, for input_rewind.
+ */
+void
+input_mark (struct input_mark *mark)
+{
+	mark->pos = input_log_base + input_log_count;
+	mark->pending = input_pending;
+	mark->eof = input_eof;
+}
+
+
+/**
+ * Go back to the input as it was at MARK.  The machine must have been
+ * put back to the same point: the input that has arrived since then is
+ * delivered again at the same cycles, before any new input is read.
+ */
+void
+input_rewind (const struct input_mark *mark)
+{
+	input_log_next = mark->pos;
+	input_pending = mark->pending;
+	input_eof = mark->eof;
+}
+
+
+/**
+ * Forget the logged input from before MARK, which will not be
+ * rewound to any more.
+ */
+void
+input_log_trim (const struct input_mark *mark)
+{
+	unsigned long n = mark->pos - input_log_base;
+
+	if (n == 0 || n > input_log_count)
+		return;
+	memmove (input_log, input_log + n,
+		(input_log_count - n) * sizeof (struct input_event));
+	input_log_count -= n;
+	input_log_base = mark->pos;
+}
@@ -0,0 +1,419 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Reverse execution.  With --checkpoint=CYCLES, a snapshot of the
+machine is kept in memory every so many cycles; only the last
+--checkpoints=N of them are kept, so the memory used is bounded by N
+times the size of a snapshot.  The input is logged as well (see
+replay.c).
+
+To go backwards, the machine is put back to the last checkpoint
+before the point wanted and run forward again, one instruction at a
+time with the interpreter, which gives the same result as the run
+that got here, as long as nothing was changed from the debugger in
+between.  Console and serial output are not repeated.  Finding the
+point means running forward once to see where it is, and then again
+to stop there.
+
+The checkpoints taken after the point that is reached are dropped,
+and taken again when the machine gets there. */
+
+#include "6809.h"
+#include "monitor.h"
+
+extern INSTANCE long cpu_clk, cpu_period;
+extern absolute_address_t to_absolute (unsigned long cpuaddr);
+
+/* The options that enable checkpoints */
+INSTANCE unsigned long checkpoint_cycles = 0;
+INSTANCE int checkpoint_count = 16;
+
+/* Nonzero while execution is being repeated */
+INSTANCE int reverse_running = 0;
+
+/* Set by the read and write hooks when a watchpoint is hit while
+execution is being repeated */
+INSTANCE int reverse_watch_hit = 0;
+
+struct checkpoint
+{
+	unsigned long cycles;
+	char *data;
+	size_t len;
+	struct input_mark input;
+};
+
+/* The checkpoints, oldest first, in a ring of checkpoint_count */
+static INSTANCE struct checkpoint *checkpoints = NULL;
+static INSTANCE unsigned int checkpoint_first;
+static INSTANCE unsigned int checkpoint_used;
+
+static INSTANCE struct event checkpoint_ev;
+
+/* The jit_enabled option, while it is turned off */
+static INSTANCE int reverse_saved_jit;
+
+/* What reverse_scan looks for */
+#define SCAN_INSN   0  /* Any instruction */
+#define SCAN_OUTER  1  /* An instruction with the stack no deeper than scan_s */
+#define SCAN_BREAK  2  /* A stop at a breakpoint or watchpoint */
+
+static INSTANCE unsigned int scan_s;
+
+/* The first byte and the postbyte of the instruction found */
+static INSTANCE U8 scan_op[2];
+
+
+#define checkpoint_nth(n) \
+	(&checkpoints[(checkpoint_first + (n)) % checkpoint_count])
+
+
+/**
+ * Take a checkpoint now, dropping the oldest one if there is no room.
+ */
+static void
+checkpoint_take (void)
+{
+	struct checkpoint *ck;
+
+	if (checkpoint_used == checkpoint_count)
+	{
+		free (checkpoint_nth (0)->data);
+		checkpoint_first = (checkpoint_first + 1) % checkpoint_count;
+		checkpoint_used--;
+		input_log_trim (&checkpoint_nth (0)->input);
+	}
+
+	ck = checkpoint_nth (checkpoint_used);
+	if (state_save_mem (&ck->data, &ck->len))
+		return;
+	ck->cycles = get_cycles ();
+	input_mark (&ck->input);
+	checkpoint_used++;
+}
+
+
+static void
+checkpoint_event (struct event *ev)
+{
+	checkpoint_take ();
+	event_repeat (ev, checkpoint_cycles);
+}
+
+
+/**
+ * Start taking checkpoints, if --checkpoint was given.
+ */
+void
+reverse_init (void)
+{
+	if (!checkpoint_cycles)
+		return;
+	if (checkpoint_count < 1)
+		checkpoint_count = 1;
+
+	checkpoints = calloc (checkpoint_count, sizeof (struct checkpoint));
+	checkpoint_first = checkpoint_used = 0;
+	input_logging = 1;
+
+	checkpoint_take ();
+	event_init (&checkpoint_ev, checkpoint_event, NULL);
+	event_schedule (&checkpoint_ev, checkpoint_cycles);
+}
+
+
+/**
+ * Free the checkpoints at the end of the simulation.
+ */
+void
+reverse_free (void)
+{
+	while (checkpoint_used > 0)
+	{
+		free (checkpoint_nth (0)->data);
+		checkpoint_first = (checkpoint_first + 1) % checkpoint_count;
+		checkpoint_used--;
+	}
+	free (checkpoints);
+	checkpoints = NULL;
+}
+
+
+/**
+ * Return the last checkpoint taken before CYCLES, or NULL.
+ */
+static struct checkpoint *
+checkpoint_before (unsigned long cycles)
+{
+	unsigned int n = checkpoint_used;
+
+	while (n-- > 0)
+		if (checkpoint_nth (n)->cycles < cycles)
+			return checkpoint_nth (n);
+	return NULL;
+}
+
+
+/**
+ * Get ready to repeat execution.  This is called from the debugger,
+ * in the middle of a time slice, which is ended here.
+ */
+static void
+reverse_begin (void)
+{
+	total = get_cycles ();
+	cpu_period = cpu_clk = 0;
+
+	event_cancel (&checkpoint_ev);
+	reverse_saved_jit = jit_enabled;
+	jit_enabled = 0;
+	reverse_running = 1;
+}
+
+
+/**
+ * Go back to the debugger at the point reached.  The rest of the time
+ * slice is a single instruction, so that events are looked at again.
+ */
+static void
+reverse_end (void)
+{
+	unsigned long now = get_cycles ();
+	struct checkpoint *ck;
+
+	reverse_running = 0;
+	reverse_watch_hit = 0;
+	jit_enabled = reverse_saved_jit;
+
+	while (checkpoint_used > 1 && checkpoint_nth (checkpoint_used - 1)->cycles > now)
+	{
+		checkpoint_used--;
+		free (checkpoint_nth (checkpoint_used)->data);
+	}
+	ck = checkpoint_nth (checkpoint_used - 1);
+	if (ck->cycles + checkpoint_cycles > now)
+		event_schedule (&checkpoint_ev, ck->cycles + checkpoint_cycles - now);
+	else
+		event_schedule (&checkpoint_ev, 0);
+
+	cpu_period = cpu_clk = 1;
+}
+
+
+/**
+ * Put the machine back to checkpoint CK.  Events that were due at
+ * that cycle but had not run yet are run now.
+ */
+static void
+reverse_restore (struct checkpoint *ck)
+{
+	state_load_mem (ck->data, ck->len);
+	input_rewind (&ck->input);
+	event_dispatch ();
+}
+
+
+/**
+ * Run one instruction, or if the CPU is waiting for an interrupt,
+ * let time pass up to the next event but not past LIMIT.
+ */
+static void
+reverse_step_insn (unsigned long limit)
+{
+	unsigned long slice;
+
+	slice = event_slice (cpu_waiting ? limit - get_cycles () : 1);
+	total += cpu_step (slice);
+	event_dispatch ();
+}
+
+
+/**
+ * Return nonzero if the instruction at the PC returns from a
+ * subroutine or an interrupt.
+ */
+static int
+insn_is_return (const U8 *op)
+{
+	return op[0] == 0x39 || op[0] == 0x3B
+		|| (op[0] == 0x35 && (op[1] & 0x80));
+}
+
+
+/**
+ * Run from checkpoint CK up to cycle END, looking for what MODE says.
+ * If it is found, returns nonzero and the cycle count of the last
+ * place it was found in *FOUND.
+ */
+static int
+reverse_scan (struct checkpoint *ck, unsigned long end, int mode,
+	unsigned long *found)
+{
+	unsigned long now;
+	absolute_address_t pc;
+	int hit = 0;
+
+	reverse_restore (ck);
+	reverse_watch_hit = 0;
+	while ((now = get_cycles ()) < end)
+	{
+		if (mode == SCAN_INSN
+			|| (mode == SCAN_OUTER && (INT16)(get_s () - scan_s) >= 0)
+			|| (mode == SCAN_BREAK && command_break_at (get_pc ())))
+		{
+			hit = 1;
+			*found = now;
+			pc = to_absolute (get_pc ());
+			scan_op[0] = abs_read8 (pc);
+			scan_op[1] = abs_read8 (pc + 1);
+		}
+
+		reverse_step_insn (end);
+
+		if (mode == SCAN_BREAK && reverse_watch_hit)
+		{
+			reverse_watch_hit = 0;
+			if (get_cycles () < end)
+			{
+				hit = 1;
+				*found = get_cycles ();
+			}
+		}
+	}
+	return hit;
+}
+
+
+/**
+ * Look backwards from END, one checkpoint interval at a time, for
+ * what MODE says.
+ */
+static int
+reverse_search (unsigned long end, int mode, unsigned long *found)
+{
+	struct checkpoint *ck;
+
+	while ((ck = checkpoint_before (end)) != NULL)
+	{
+		if (reverse_scan (ck, end, mode, found))
+			return 1;
+		end = ck->cycles;
+	}
+	return 0;
+}
+
+
+/**
+ * Put the machine at cycle count CYCLES, which must be the start of an
+ * instruction found by reverse_scan.
+ */
+static void
+reverse_goto (unsigned long cycles)
+{
+	struct checkpoint *ck = checkpoint_before (cycles + 1);
+
+	reverse_restore (ck);
+	while (get_cycles () < cycles)
+		reverse_step_insn (cycles);
+}
+
+
+/**
+ * Check that reverse execution can go back from here.
+ */
+static int
+reverse_ready (void)
+{
+	if (!checkpoints)
+	{
+		printf ("Reverse execution needs --checkpoint.\n");
+		return 0;
+	}
+	if (!checkpoint_before (get_cycles ()))
+	{
+		printf ("No checkpoint before this point.\n");
+		return 0;
+	}
+	return 1;
+}
+
+
+/**
+ * Go back one instruction.
+ */
+void
+reverse_step (void)
+{
+	unsigned long found;
+
+	if (!reverse_ready ())
+		return;
+	reverse_begin ();
+	if (reverse_search (get_cycles (), SCAN_INSN, &found))
+		reverse_goto (found);
+	reverse_end ();
+}
+
+
+/**
+ * Go back one instruction, but over a whole subroutine or interrupt
+ * handler if that instruction returned from one.
+ */
+void
+reverse_next (void)
+{
+	unsigned long now = get_cycles ();
+	unsigned long found;
+
+	if (!reverse_ready ())
+		return;
+	reverse_begin ();
+	scan_s = get_s ();
+	if (reverse_search (now, SCAN_INSN, &found))
+	{
+		if (insn_is_return (scan_op))
+			reverse_search (found, SCAN_OUTER, &found);
+		reverse_goto (found);
+	}
+	reverse_end ();
+}
+
+
+/**
+ * Go back to the last place where the program stopped, or would have
+ * stopped, at a breakpoint or watchpoint.  Without one, go back as far
+ * as the checkpoints go.
+ */
+void
+reverse_continue (void)
+{
+	unsigned long found;
+
+	if (!reverse_ready ())
+		return;
+	reverse_begin ();
+	if (!reverse_search (get_cycles (), SCAN_BREAK, &found))
+	{
+		printf ("No breakpoint reached since the oldest checkpoint.\n");
+		found = checkpoint_nth (0)->cycles;
+	}
+	reverse_goto (found);
+	reverse_end ();
+}
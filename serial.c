@@ -50,6 +50,22 @@ void serial_update (struct serial_port *port)
 	struct timeval timeout;
 	int rc;
 
+	/* Input from stdin may be recorded or replayed, in which case
+	the output is always ready, so that the host cannot change the
+	course of the program. */
+	if (port->fin == STDIN_FILENO)
+	{
+		if (input_poll ())
+			port->status |= SER_STAT_READOK;
+		else
+			port->status &= ~SER_STAT_READOK;
+		if (input_deterministic ())
+		{
+			port->status |= SER_STAT_WRITEOK;
+			return;
+		}
+	}
+
 	FD_ZERO (&infds);
 	FD_SET (port->fin, &infds);
 	FD_ZERO (&outfds);
@@ -57,10 +73,13 @@ void serial_update (struct serial_port *port)
 	timeout.tv_sec = 0;
 	timeout.tv_usec = 0;
 	rc = select (2, &infds, &outfds, NULL, &timeout);
-	if (FD_ISSET (port->fin, &infds))
-		port->status |= SER_STAT_READOK;
-	else
-		port->status &= ~SER_STAT_READOK;
+	if (port->fin != STDIN_FILENO)
+	{
+		if (FD_ISSET (port->fin, &infds))
+			port->status |= SER_STAT_READOK;
+		else
+			port->status &= ~SER_STAT_READOK;
+	}
 	if (FD_ISSET (port->fout, &outfds))
 		port->status |= SER_STAT_WRITEOK;
 	else
@@ -78,6 +97,8 @@ U8 serial_read (struct hw_device *dev, unsigned long addr)
 			U8 val;
 			if (!(port->status & SER_STAT_READOK))
 				return 0xFF;
+			if (port->fin == STDIN_FILENO)
+				return input_getc ();
 			read (port->fin, &val, 1);
 			return val;
 		}
@@ -94,7 +115,8 @@ void serial_write (struct hw_device *dev, unsigned long addr, U8 val)
 		case SER_DATA:
 		{
 			U8 v = val;
-			write (port->fout, &v, 1);
+			if (!reverse_running)
+				write (port->fout, &v, 1);
 			break;
 		}
 		case SER_CTL_STATUS:
@@ -110,12 +132,20 @@ void serial_reset (struct hw_device *dev)
 	port->status = 0;
 }
 
+void serial_state (struct hw_device *dev)
+{
+	struct serial_port *port = (struct serial_port *)dev->priv;
+	state_uint (&port->ctrl);
+	state_uint (&port->status);
+}
+
 struct hw_class serial_class =
 {
 	.readonly = 0,
 	.reset = serial_reset,
 	.read = serial_read,
 	.write = serial_write,
+	.state = serial_state,
 };
 
 extern U8 null_read (struct hw_device *dev, unsigned long addr);
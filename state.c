@@ -0,0 +1,404 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Snapshots.  A snapshot holds everything about a running machine --
+the CPU registers, the cycle count, the bus maps, the state of each
+device and the pending events -- so that the run can be resumed from
+that point later, for example to start every test from a machine that
+has already booted.
+
+The same code saves and restores: each part of the machine calls the
+state_ functions below on its variables, and they either write the
+value to the file or read it back, depending on the direction.  A
+device class provides a state hook for its private data.
+
+The file holds, in order:
+
+	"6809SNAP", the format version and the flags (STATE_H6309)
+	the machine name, in 32 bytes
+	the number of devices, and the size of each
+	the CPU registers and the cycle count
+	the bus maps
+	the state of each device
+	the simulator's own periodic events, and its idle_loop counters
+
+Numbers are stored little-endian, in 4 bytes, or 8 for cycle counts
+and device offsets, or 1 for the bus map flags.  A snapshot can only
+be loaded into the same kind of machine built with the same options.
+ROM is not saved, so the same ROM image must be given when loading. */
+
+#include "6809.h"
+
+#define STATE_VERSION 2
+
+#define STATE_H6309 0x1
+
+#ifdef H6309
+#define STATE_FLAGS STATE_H6309
+#else
+#define STATE_FLAGS 0
+#endif
+
+extern INSTANCE struct bus_map busmaps[];
+extern INSTANCE struct hw_device *device_table[];
+extern INSTANCE unsigned int device_count;
+
+/* The snapshot being written or read */
+static INSTANCE FILE *state_fp;
+
+/* Nonzero if it is being read */
+static INSTANCE int state_loading;
+
+/* Why the snapshot could not be read or written, or NULL */
+static INSTANCE const char *state_error;
+
+/* The options that save and load snapshots */
+INSTANCE const char *state_save_file = NULL;
+INSTANCE const char *state_load_file = NULL;
+
+
+/**
+ * Return nonzero if a snapshot is being restored rather than saved.
+ * Device state hooks use this to redo whatever follows from the
+ * values they have read.
+ */
+int
+state_restoring (void)
+{
+	return state_loading;
+}
+
+
+/**
+ * Save or restore LEN bytes at PTR.
+ */
+void
+state_data (void *ptr, unsigned long len)
+{
+	if (state_error)
+		return;
+	if (state_loading)
+	{
+		if (fread (ptr, len, 1, state_fp) != 1)
+			state_error = "file is truncated";
+	}
+	else
+	{
+		if (fwrite (ptr, len, 1, state_fp) != 1)
+			state_error = "write failed";
+	}
+}
+
+
+static void
+state_number (unsigned long *val, unsigned int size)
+{
+	U8 buf[8];
+	unsigned int n;
+
+	for (n = 0; n < size; n++)
+		buf[n] = *val >> (n * 8);
+	state_data (buf, size);
+	if (state_loading)
+	{
+		*val = 0;
+		for (n = 0; n < size; n++)
+			*val |= (unsigned long)buf[n] << (n * 8);
+	}
+}
+
+
+/**
+ * Save or restore a 32-bit value.
+ */
+void
+state_uint (unsigned int *val)
+{
+	unsigned long v = *val;
+	state_number (&v, 4);
+	*val = v;
+}
+
+
+/**
+ * Save or restore a 64-bit value.
+ */
+void
+state_ulong (unsigned long *val)
+{
+	state_number (val, 8);
+}
+
+
+/**
+ * Save or restore an event: whether it is scheduled, and for when.
+ * A restored event is rescheduled for the same cycle, so the cycle
+ * count must have been restored first.
+ */
+void
+state_event (struct event *ev)
+{
+	unsigned int pending = event_pending (ev);
+	unsigned long when = ev->when;
+	unsigned long now;
+
+	state_uint (&pending);
+	state_ulong (&when);
+	if (state_loading && !state_error)
+	{
+		event_cancel (ev);
+		now = get_cycles ();
+		if (pending)
+			event_schedule (ev, when > now ? when - now : 0);
+	}
+}
+
+
+/**
+ * Save or check the header, which says what kind of machine the
+ * snapshot is for.
+ */
+static void
+state_header (void)
+{
+	char magic[8], name[32];
+	unsigned int version = STATE_VERSION;
+	unsigned int flags = STATE_FLAGS;
+	unsigned int count = device_count;
+	unsigned int n, size;
+
+	memcpy (magic, "6809SNAP", sizeof (magic));
+	memset (name, 0, sizeof (name));
+	if (machine)
+		strncpy (name, machine->name, sizeof (name) - 1);
+
+	state_data (magic, sizeof (magic));
+	state_uint (&version);
+	state_uint (&flags);
+	if (state_loading && !state_error)
+	{
+		if (memcmp (magic, "6809SNAP", sizeof (magic)))
+			state_error = "not a snapshot";
+		else if (version != STATE_VERSION)
+			state_error = "unsupported snapshot version";
+		else if (flags != STATE_FLAGS)
+			state_error = "snapshot is for a different CPU";
+	}
+
+	state_data (name, sizeof (name));
+	state_uint (&count);
+	if (state_loading && !state_error)
+	{
+		if (!machine || strncmp (name, machine->name, sizeof (name)))
+			state_error = "snapshot is of a different machine";
+		else if (count != device_count)
+			state_error = "snapshot has different devices";
+	}
+
+	for (n = 0; n < device_count && !state_error; n++)
+	{
+		size = device_table[n]->size;
+		state_uint (&size);
+		if (state_loading && size != device_table[n]->size)
+			state_error = "snapshot has different devices";
+	}
+}
+
+
+/**
+ * Save or restore everything after the header.
+ */
+static void
+state_machine (void)
+{
+	unsigned long cycles = get_cycles ();
+	unsigned long flags;
+	struct hw_device *dev;
+	unsigned int n;
+
+	cpu_state ();
+	state_ulong (&cycles);
+	if (state_loading)
+		total += cycles - get_cycles ();
+
+	for (n = 0; n < NUM_BUS_MAPS; n++)
+	{
+		state_uint (&busmaps[n].devid);
+		state_ulong (&busmaps[n].offset);
+		flags = busmaps[n].flags;
+		state_number (&flags, 1);
+		busmaps[n].flags = flags;
+	}
+
+	for (n = 0; n < device_count; n++)
+	{
+		dev = device_table[n];
+		if (dev->class_ptr->state)
+			dev->class_ptr->state (dev);
+	}
+
+	sim_events_state ();
+}
+
+
+/**
+ * Write a snapshot to FP, which is closed.  NAME is used in the error
+ * message.  Returns zero on success.
+ */
+static int
+state_write (FILE *fp, const char *name)
+{
+	state_fp = fp;
+	state_loading = 0;
+	state_error = NULL;
+	state_header ();
+	state_machine ();
+	if (fclose (state_fp) && !state_error)
+		state_error = "write failed";
+
+	if (state_error)
+	{
+		fprintf (stderr, "m6809-run: %s: %s\n", name, state_error);
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Restore the machine from the snapshot in FP, which is closed.
+ * Returns zero on success, -1 if the header did not match and nothing
+ * was changed, or -2 if the machine was partly restored.
+ */
+static int
+state_read (FILE *fp, const char *name)
+{
+	int rc = 0;
+
+	state_fp = fp;
+	state_loading = 1;
+	state_error = NULL;
+	state_header ();
+	if (state_error)
+		rc = -1;
+	else
+	{
+		state_machine ();
+		if (state_error)
+			rc = -2;
+
+		/* Memory and the bus maps have changed behind the cache's
+		back; this also recomputes the direct access pointers. */
+		predecode_flush ();
+	}
+	fclose (state_fp);
+	state_loading = 0;
+
+	if (state_error)
+		fprintf (stderr, "m6809-run: %s: %s\n", name, state_error);
+	return rc;
+}
+
+
+/**
+ * Write a snapshot of the machine to FILENAME.  Returns zero on
+ * success; otherwise an error has been printed.
+ */
+int
+state_save (const char *filename)
+{
+	FILE *fp = fopen (filename, "wb");
+	if (!fp)
+	{
+		fprintf (stderr, "m6809-run: cannot write %s\n", filename);
+		return -1;
+	}
+	return state_write (fp, filename);
+}
+
+
+/**
+ * Restore the machine from the snapshot in FILENAME.  Returns zero
+ * on success; otherwise an error has been printed, and the machine is
+ * left as it was.  A snapshot that is cut short or does not fit is
+ * only found out part way through, so the machine is saved in memory
+ * first and put back from there.
+ */
+int
+state_load (const char *filename)
+{
+	FILE *fp;
+	char *undo;
+	size_t undo_len;
+	int rc;
+
+	fp = fopen (filename, "rb");
+	if (!fp)
+	{
+		fprintf (stderr, "m6809-run: cannot open %s\n", filename);
+		return -1;
+	}
+	if (state_save_mem (&undo, &undo_len))
+	{
+		fclose (fp);
+		fprintf (stderr, "m6809-run: %s: cannot save the current state\n",
+			filename);
+		return -1;
+	}
+
+	rc = state_read (fp, filename);
+	if (rc == -2 && state_load_mem (undo, undo_len))
+		fprintf (stderr, "m6809-run: %s: the machine could not be put back\n",
+			filename);
+	free (undo);
+	return rc ? -1 : 0;
+}
+
+
+/**
+ * Take a snapshot in memory.  On success, *BUFP is a buffer of *LENP
+ * bytes that the caller must free.
+ */
+int
+state_save_mem (char **bufp, size_t *lenp)
+{
+	FILE *fp = open_memstream (bufp, lenp);
+	if (!fp)
+		return -1;
+	if (state_write (fp, "checkpoint"))
+	{
+		free (*bufp);
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Restore the machine from a snapshot taken by state_save_mem.
+ */
+int
+state_load_mem (char *buf, size_t len)
+{
+	FILE *fp = fmemopen (buf, len, "rb");
+	if (!fp)
+		return -1;
+	return state_read (fp, "checkpoint");
+}
@@ -21,19 +21,19 @@
 #include "6809.h"
 
 /* A pointer to the current stringspace */
-struct stringspace *current_stringspace;
+INSTANCE struct stringspace *current_stringspace;
 
 /* Symbol table for program variables (taken from symbol file) */
-struct symtab program_symtab;
+INSTANCE struct symtab program_symtab;
 
 /* Symbol table for internal variables.  Works identically to the
 above but in a different namespace */
-struct symtab internal_symtab;
+INSTANCE struct symtab internal_symtab;
 
 /* Symbol table for the 'autocomputed virtuals'.  The values
 kept in the table are pointers to functions that compute the
 values, allowing for dynamic variables. */
-struct symtab auto_symtab;
+INSTANCE struct symtab auto_symtab;
 
 
 /**
@@ -44,6 +44,7 @@ struct stringspace *stringspace_create (void)
 {
 	struct stringspace *ss = malloc (sizeof (struct stringspace));
 	ss->used = 0;
+	ss->prev = NULL;
 	return ss;
 }
 
@@ -59,7 +60,11 @@ char *stringspace_copy (const char *string)
 	char *result;
 
 	if (current_stringspace->used + len > MAX_STRINGSPACE)
-		current_stringspace = stringspace_create ();
+	{
+		struct stringspace *ss = stringspace_create ();
+		ss->prev = current_stringspace;
+		current_stringspace = ss;
+	}
 
 	result = current_stringspace->space + current_stringspace->used;
 	strcpy (result, string);
@@ -181,6 +186,8 @@ struct symbol *sym_add (struct symtab *symtab,
 	s->value_chain = chain;
 	symtab->syms_by_value[hash] = s;
 
+	/* A new symbol is not in the sorted index yet */
+	symtab->by_addr_valid = 0;
 	return s;
 }
 
@@ -190,28 +197,144 @@ void sym_set (struct symtab *symtab,
 {
 	struct symbol * s = sym_find1 (symtab, name, NULL, type);
 	if (s)
+	{
+		/* The value chains are not rehashed; only the sorted index
+		is affected */
 		s->value = value;
+		symtab->by_addr_valid = 0;
+	}
 	else
 		sym_add (symtab, name, value, type);
 }
 
 
+static int
+sym_value_compare (const void *a, const void *b)
+{
+	const struct symbol *sa = *(const struct symbol **)a;
+	const struct symbol *sb = *(const struct symbol **)b;
+
+	if (sa->value < sb->value)
+		return -1;
+	return sa->value > sb->value;
+}
+
+
+/**
+ * Build the index of the symbols in SYMTAB sorted by value, for the
+ * lookups by nearest address.  Called after a map file is loaded;
+ * sym_sorted rebuilds it if symbols were added since.
+ */
+void sym_index (struct symtab *symtab)
+{
+	struct symbol *sym;
+	unsigned int count = 0, hash;
+
+	for (hash = 0; hash < MAX_SYMBOL_HASH; hash++)
+		for (sym = symtab->syms_by_value[hash]; sym; sym = sym->value_chain)
+			count++;
+
+	free (symtab->by_addr);
+	symtab->by_addr = malloc ((count ? count : 1) * sizeof (struct symbol *));
+	count = 0;
+	for (hash = 0; hash < MAX_SYMBOL_HASH; hash++)
+		for (sym = symtab->syms_by_value[hash]; sym; sym = sym->value_chain)
+			symtab->by_addr[count++] = sym;
+
+	if (count)
+		qsort (symtab->by_addr, count, sizeof (struct symbol *),
+			sym_value_compare);
+	symtab->by_addr_count = count;
+	symtab->by_addr_valid = 1;
+}
+
+
+/**
+ * Return the symbols in SYMTAB sorted by value, and their number in
+ * *COUNTP.  The array belongs to the symbol table.
+ */
+struct symbol **sym_sorted (struct symtab *symtab, unsigned int *countp)
+{
+	if (!symtab->by_addr_valid)
+		sym_index (symtab);
+	*countp = symtab->by_addr_count;
+	return symtab->by_addr;
+}
+
+
+/**
+ * Return the index in the sorted symbols (see sym_sorted) of the one
+ * that VALUE belongs to, or -1 if there is none: the last one at or
+ * below it on the same device, if VALUE is within its size.  A symbol
+ * whose size is not known extends to the next one.
+ */
+int sym_nearest (struct symtab *symtab, unsigned long value)
+{
+	struct symbol **syms;
+	unsigned int count, lo = 0, hi, mid;
+
+	syms = sym_sorted (symtab, &count);
+	hi = count;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (syms[mid]->value <= value)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return -1;
+	lo--;
+	if ((syms[lo]->value >> 28) != (value >> 28))
+		return -1;
+	if (syms[lo]->ty.size && value - syms[lo]->value >= syms[lo]->ty.size)
+		return -1;
+	return lo;
+}
+
+
+/**
+ * Return the name of the symbol at VALUE, or else of the symbol of
+ * known size that contains it, with the distance from its start in
+ * *OFFSETP.  Returns NULL if there is neither.
+ */
+const char *sym_lookup_offset (struct symtab *symtab, unsigned long value,
+	unsigned long *offsetp)
+{
+	const char *name;
+	struct symbol *sym;
+	int n;
+
+	*offsetp = 0;
+	if ((name = sym_lookup (symtab, value)) != NULL)
+		return name;
+	if ((n = sym_nearest (symtab, value)) < 0)
+		return NULL;
+	sym = symtab->by_addr[n];
+	if (!sym->ty.size)
+		return NULL;
+	*offsetp = value - sym->value;
+	return sym->name;
+}
+
+
 void for_each_var (void (*cb) (struct symbol *, unsigned int size))
 {
 	struct symtab *symtab = &program_symtab;
-	absolute_address_t addr;
-	const char *id;
-	struct symbol *sym;
+	struct symbol **syms;
+	unsigned int count, n;
 	unsigned int devid = 1; /* TODO */
 
-	for (addr = devid << 28; addr < (devid << 28) + 0x2000; addr++)
+	syms = sym_sorted (symtab, &count);
+	for (n = 0; n < count; n++)
 	{
-		id = sym_lookup (symtab, addr);
-		if (id)
-		{
-			sym = sym_find1 (symtab, id, NULL, 0);
-			printf ("%-20.20s  %8lX  %d\n", id, addr, sym->ty.size);
-		}
+		if (syms[n]->value < ((unsigned long)devid << 28))
+			continue;
+		if (syms[n]->value >= ((unsigned long)devid << 28) + 0x2000)
+			break;
+		printf ("%-20.20s  %8lX  %d\n", syms[n]->name, syms[n]->value,
+			syms[n]->ty.size);
 	}
 }
 
@@ -221,9 +344,26 @@ void symtab_init (struct symtab *symtab)
 }
 
 
+/**
+ * Remove all of the symbols from SYMTAB.  Their names stay in the
+ * stringspace.
+ */
 void symtab_reset (struct symtab *symtab)
 {
-	/* TODO */
+	unsigned int hash;
+
+	/* Every symbol is on exactly one of the name chains */
+	for (hash = 0; hash < MAX_SYMBOL_HASH; hash++)
+	{
+		struct symbol *s = symtab->syms_by_name[hash];
+		while (s)
+		{
+			struct symbol *next = s->name_chain;
+			free (s);
+			s = next;
+		}
+	}
+	free (symtab->by_addr);
 	symtab_init (symtab);
 }
 
@@ -241,3 +381,22 @@ void sym_init (void)
 	symtab_init (&auto_symtab);
 }
 
+
+/**
+ * Free the symbol tables and the strings of their names, as the
+ * simulation ends.
+ */
+void sym_free (void)
+{
+	symtab_reset (&program_symtab);
+	symtab_reset (&internal_symtab);
+	symtab_reset (&auto_symtab);
+
+	while (current_stringspace)
+	{
+		struct stringspace *prev = current_stringspace->prev;
+		free (current_stringspace);
+		current_stringspace = prev;
+	}
+}
+
@@ -21,14 +21,17 @@
 #include <stdio.h>
 #include "machine.h"
 
-/* A hardware timer counts CPU cycles and can generate interrupts periodically. */
+/* A hardware timer counts CPU cycles and can generate interrupts periodically.
+While it is running, the time at which it next reaches zero is kept as
+a scheduled event, so the count does not have to be updated as time
+passes. */
 struct hwtimer
 {
-	int count;            /* The current value of the timer */
+	int count;            /* The value of the timer, when it is stopped */
 	unsigned int reload;  /* Value to reload into the timer when it reaches zero */
 	unsigned int resolution; /* Resolution of CPU registers (cycles/tick) */
 	unsigned int flags;
-	unsigned long prev_cycles;
+	struct event expire;  /* Scheduled when the count will reach zero */
 	struct hw_device *int_dev;  /* Which interrupt mux we use */
 	unsigned int int_line;  /* Which interrupt to signal */
 };
@@ -41,54 +44,57 @@ struct hwtimer
 
 
 /*
- * Called by the system to indicate that some number of CPU cycles have passed.
+ * (Re)start the timer from its current count.  If either the counter
+ * or the reload register is nonzero, the timer is considered running.
+ * Otherwise, nothing to do.
  */
-void hwtimer_decrement (struct hwtimer *timer, unsigned int cycles)
+void hwtimer_start (struct hwtimer *timer)
 {
-	/* If either the counter or the reload register is nonzero, the timer
-	is considered running.  Otherwise, nothing to do */
 	if (!timer->count && !timer->reload)
-		return;
+		event_cancel (&timer->expire);
+	else
+		event_schedule (&timer->expire, timer->count);
+}
+
+
+/*
+ * Called by the scheduler when the count reaches zero.
+ */
+void hwtimer_expire (struct event *ev)
+{
+	struct hwtimer *timer = (struct hwtimer *)ev->data;
 
-	/* Decrement the counter.  Is it zero/negative? */
-	timer->count -= cycles;
-	if (timer->count <= 0)
+	/* If interrupt is configured and enabled, generate one now */
+	if (timer->int_dev && timer->flags & HWTF_INT)
+	{
+		imux_assert (timer->int_dev, timer->int_line);
+	}
+
+	/* If reload is nonzero, start over from that, to simulate the
+	timer "wrapping".  Otherwise, stop at zero. */
+	if (timer->reload > 0)
+	{
+		timer->count = timer->reload;
+		event_repeat (ev, timer->reload);
+	}
+	else
 	{
-		/* If interrupt is configured and enabled, generate one now */
-		if (timer->int_dev && timer->flags & HWTF_INT)
-		{
-			imux_assert (timer->int_dev, timer->int_line);
-		}
-
-		/* If it is negative, we need to make it positive again.
-		If reload is nonzero, add that, to simulate the timer "wrapping".
-		Otherwise, fix it at zero. */
-		if (timer->count < 0)
-		{
-			if (timer->reload > 0)
-			{
-				timer->count += timer->reload;
-				/* Note: if timer->count is still negative, the reload value
-				is lower than the frequency at which the system is updating the
-				timers, and we would need to simulate two interrupts here
-				perhaps.  For later. */
-				if (timer->count < 0)
-					sim_error ("timer count = %d, reload = %d\n", timer->count, timer->reload);
-			}
-			else
-			{
-				timer->count = 0;
-			}
-		}
+		timer->count = 0;
 	}
 }
 
-void hwtimer_update (struct hw_device *dev)
+
+/*
+ * Return the current value of the counter, in cycles.
+ */
+int hwtimer_count (struct hwtimer *timer)
 {
-	struct hwtimer *timer = (struct hwtimer *)dev->priv;
-	unsigned long cycles = get_cycles ();
-	hwtimer_decrement (timer, cycles - timer->prev_cycles);
-	timer->prev_cycles = cycles;
+	unsigned long now;
+
+	if (!event_pending (&timer->expire))
+		return timer->count;
+	now = get_cycles ();
+	return timer->expire.when > now ? timer->expire.when - now : 0;
 }
 
 
@@ -98,7 +104,7 @@ U8 hwtimer_read (struct hw_device *dev, unsigned long addr)
 	switch (addr)
 	{
 		case HWT_COUNT:
-			return timer->count / timer->resolution;
+			return hwtimer_count (timer) / timer->resolution;
 		case HWT_RELOAD:
 			return timer->reload / timer->resolution;
 		case HWT_FLAGS:
@@ -113,9 +119,12 @@ void hwtimer_write (struct hw_device *dev, unsigned long addr, U8 val)
 	{
 		case HWT_COUNT:
 			timer->count = val * timer->resolution;
+			hwtimer_start (timer);
 			break;
 		case HWT_RELOAD:
 			timer->reload = val * timer->resolution;
+			if (!event_pending (&timer->expire))
+				hwtimer_start (timer);
 			break;
 		case HWT_FLAGS:
 			timer->flags = val;
@@ -129,7 +138,7 @@ void hwtimer_reset (struct hw_device *dev)
 	timer->count = 0;
 	timer->flags = 0;
 	timer->resolution = 128;
-	timer->prev_cycles = get_cycles ();
+	event_cancel (&timer->expire);
 }
 
 void oscillator_reset (struct hw_device *dev)
@@ -139,6 +148,17 @@ void oscillator_reset (struct hw_device *dev)
 	timer->count = timer->reload;
 	if (timer->int_dev)
 		timer->flags |= HWTF_INT;
+	hwtimer_start (timer);
+}
+
+void hwtimer_state (struct hw_device *dev)
+{
+	struct hwtimer *timer = (struct hwtimer *)dev->priv;
+	state_uint ((unsigned int *)&timer->count);
+	state_uint (&timer->reload);
+	state_uint (&timer->resolution);
+	state_uint (&timer->flags);
+	state_event (&timer->expire);
 }
 
 struct hw_class hwtimer_class =
@@ -147,7 +167,7 @@ struct hw_class hwtimer_class =
 	.reset = hwtimer_reset,
 	.read = hwtimer_read,
 	.write = hwtimer_write,
-	.update = hwtimer_update,
+	.state = hwtimer_state,
 };
 
 struct hw_device *hwtimer_create (struct hw_device *int_dev, unsigned int int_line)
@@ -156,6 +176,7 @@ struct hw_device *hwtimer_create (struct hw_device *int_dev, unsigned int int_li
 	timer->reload = 0;
 	timer->int_dev = int_dev;
 	timer->int_line = int_line;
+	event_init (&timer->expire, hwtimer_expire, timer);
 	return device_attach (&hwtimer_class, 16, timer); /* 16 = sizeof I/O window */
 }
 
@@ -165,7 +186,7 @@ struct hw_class oscillator_class =
 	.reset = oscillator_reset,
 	.read = NULL,
 	.write = NULL,
-	.update = hwtimer_update,
+	.state = hwtimer_state,
 };
 
 struct hw_device *oscillator_create (struct hw_device *int_dev, unsigned int int_line)
@@ -174,5 +195,6 @@ struct hw_device *oscillator_create (struct hw_device *int_dev, unsigned int int
 	timer->reload = 2048; /* cycles per pulse */
 	timer->int_dev = int_dev;
 	timer->int_line = int_line;
+	event_init (&timer->expire, hwtimer_expire, timer);
 	return device_attach (&oscillator_class, 0, timer);
 }
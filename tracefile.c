@@ -0,0 +1,515 @@
+/*
+ * Copyright 2009 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of GCC6809.
+ *
+ * GCC6809 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GCC6809 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GCC6809; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The execution trace file.  With --trace-file=FILE, the execution
+engine built with PROFILE_HOOKS records every instruction it runs: its
+absolute address, its bytes and the cycles since the one before, and
+with --trace-regs the registers that changed, and with --trace-writes
+the bytes written to memory.
+
+The records are packed into a ring buffer, which a thread of its own
+copies to FILE, so that the CPU does not wait for the disk unless the
+ring is full.  The ring has a single producer and a single consumer,
+each of which only moves its own index, so no lock is needed.
+
+To keep the file small, each record only holds what cannot be
+guessed: an instruction's address is left out when it follows the one
+before, and cycle counts and address differences are stored in as few
+bytes as they need (7 bits per byte, the high bit set on all but the
+last).  A typical instruction takes 4 or 5 bytes.
+
+--trace-decode=FILE reads a trace back and prints it, disassembled
+with the program's symbols, instead of running the program. */
+
+#include "6809.h"
+#include "monitor.h"
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+extern INSTANCE struct hw_device *device_table[];
+extern INSTANCE unsigned int device_count;
+extern struct hw_class ram_class, rom_class;
+extern absolute_address_t absolute_from_reladdr (unsigned int device,
+	unsigned long reladdr);
+extern void print_addr (absolute_address_t addr);
+extern int print_insn (absolute_address_t addr);
+
+#define TRACE_RING_SIZE  (1UL << 20)
+#define TRACE_MAGIC      "M6809TRC"
+#define TRACE_VERSION    1
+
+/* The flags in the header */
+#define TRACE_HAS_REGS   0x1
+#define TRACE_HAS_WRITES 0x2
+
+/* The tag of an instruction record is below TRACE_WRITE: the number of
+its bytes in the low 3 bits, and these flags */
+#define TRACE_LEN        0x07
+#define TRACE_JUMP       0x08   /* The distance from the expected address follows */
+#define TRACE_REGS       0x10   /* The mask of changed registers and their values follow */
+
+/* The tags of the other records */
+#define TRACE_WRITE      0x80   /* The distance from the last write, and the value */
+#define TRACE_END        0x81
+
+/* The registers recorded, in the order of the bits in the mask */
+#define TRACE_NREGS      8
+static const char *trace_reg_names[TRACE_NREGS] = {
+	"A", "B", "DP", "CC", "X", "Y", "U", "S",
+};
+
+struct trace_ring
+{
+	U8 buf[TRACE_RING_SIZE];
+	unsigned long head;           /* Moved only by the CPU */
+	unsigned long tail;           /* Moved only by the writer */
+	int done;
+	FILE *fp;
+	pthread_t thread;
+};
+
+/* The options */
+INSTANCE const char *tracefile_name = NULL;
+INSTANCE const char *tracefile_decode_name = NULL;
+INSTANCE int tracefile_regs = 0;
+INSTANCE int tracefile_writes = 0;
+
+/* Nonzero if instructions are being recorded */
+INSTANCE int tracefile_enabled = 0;
+
+/* Cycles that passed at the end of a time slice, to be added to the
+next record */
+INSTANCE long tracefile_pending;
+
+static INSTANCE struct trace_ring *tracefile_ring;
+
+/* How far the CPU can fill the ring before it has to look at the
+writer's index again */
+static INSTANCE unsigned long tracefile_limit;
+
+/* What the next record is compared against */
+static INSTANCE absolute_address_t tracefile_next_pc;
+static INSTANCE absolute_address_t tracefile_last_write;
+static INSTANCE unsigned int tracefile_last_regs[TRACE_NREGS];
+
+
+/**
+ * The thread that copies the ring to the file, until the CPU says it
+ * is done and the ring is empty.
+ */
+static void *
+tracefile_writer (void *arg)
+{
+	struct trace_ring *ring = arg;
+	unsigned long head, tail, start, len;
+	int done;
+
+	for (;;)
+	{
+		/* Look at done first: once it is set, head is final */
+		done = __atomic_load_n (&ring->done, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+		tail = ring->tail;
+		if (head == tail)
+		{
+			if (done)
+				break;
+			usleep (1000);
+			continue;
+		}
+
+		start = tail % TRACE_RING_SIZE;
+		len = head - tail;
+		if (start + len > TRACE_RING_SIZE)
+			len = TRACE_RING_SIZE - start;
+		fwrite (ring->buf + start, 1, len, ring->fp);
+		__atomic_store_n (&ring->tail, tail + len, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+
+/**
+ * Add the LEN bytes of a record to the ring, waiting for the writer if
+ * there is no room.
+ */
+static void
+tracefile_put (const U8 *rec, unsigned int len)
+{
+	struct trace_ring *ring = tracefile_ring;
+	unsigned long head = ring->head;
+	unsigned int n;
+
+	while (head + len > tracefile_limit)
+	{
+		tracefile_limit = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE)
+			+ TRACE_RING_SIZE;
+		if (head + len > tracefile_limit)
+			sched_yield ();
+	}
+
+	for (n = 0; n < len; n++)
+		ring->buf[(head + n) % TRACE_RING_SIZE] = rec[n];
+	__atomic_store_n (&ring->head, head + len, __ATOMIC_RELEASE);
+}
+
+
+static unsigned int
+trace_put_number (U8 *p, unsigned long long v)
+{
+	unsigned int n = 0;
+
+	while (v >= 0x80)
+	{
+		p[n++] = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+
+/* Signed numbers are stored with the sign in the low bit */
+static unsigned int
+trace_put_signed (U8 *p, long v)
+{
+	return trace_put_number (p, v < 0 ? ((unsigned long)~v << 1) | 1
+		: (unsigned long)v << 1);
+}
+
+
+/**
+ * Return the byte at CPU address ADDR, if it is in RAM or ROM.  Other
+ * devices are not read, as reading them may change their state.
+ */
+static U8
+tracefile_peek (unsigned int addr)
+{
+	struct bus_map *map = &busmaps[(addr & 0xFFFF) / BUS_MAP_SIZE];
+	struct hw_device *dev;
+	unsigned long phy = map->offset + addr % BUS_MAP_SIZE;
+
+	if (map->devid >= device_count)
+		return 0;
+	dev = device_table[map->devid];
+	if ((dev->class_ptr != &ram_class && dev->class_ptr != &rom_class)
+		|| phy >= dev->size)
+		return 0;
+	return ((U8 *)dev->priv)[phy];
+}
+
+
+/**
+ * Record the instruction that begins at CPU address PC.  CYCLES is
+ * the number of cycles since the last one began.
+ */
+void
+tracefile_insn (unsigned int pc, long cycles)
+{
+	struct bus_map *map = &busmaps[pc / BUS_MAP_SIZE];
+	absolute_address_t addr =
+		absolute_from_reladdr (map->devid, map->offset + pc % BUS_MAP_SIZE);
+	U8 rec[48], bytes[5];
+	unsigned int regs[TRACE_NREGS];
+	unsigned int n, k, len, mask = 0, mode;
+	int jump;
+
+	for (k = 0; k < 5; k++)
+		bytes[k] = tracefile_peek (pc + k);
+	dasm_bytes = bytes;
+	len = insn_decode (addr, &mode, &jump);
+	dasm_bytes = NULL;
+	if (len == 0)
+		len = 1;
+
+	rec[0] = len;
+	n = 1;
+	if (addr != tracefile_next_pc)
+	{
+		rec[0] |= TRACE_JUMP;
+		n += trace_put_signed (rec + n, (long)(addr - tracefile_next_pc));
+	}
+	n += trace_put_number (rec + n, cycles + tracefile_pending);
+	tracefile_pending = 0;
+	for (k = 0; k < len; k++)
+		rec[n++] = bytes[k];
+
+	if (tracefile_regs)
+	{
+		regs[0] = get_a ();
+		regs[1] = get_b ();
+		regs[2] = get_dp ();
+		regs[3] = get_cc ();
+		regs[4] = get_x ();
+		regs[5] = get_y ();
+		regs[6] = get_u ();
+		regs[7] = get_s ();
+		for (k = 0; k < TRACE_NREGS; k++)
+			if (regs[k] != tracefile_last_regs[k])
+				mask |= 1 << k;
+		if (mask)
+		{
+			rec[0] |= TRACE_REGS;
+			rec[n++] = mask;
+			for (k = 0; k < TRACE_NREGS; k++)
+				if (mask & (1 << k))
+				{
+					if (k >= 4)
+						rec[n++] = regs[k] >> 8;
+					rec[n++] = regs[k];
+					tracefile_last_regs[k] = regs[k];
+				}
+		}
+	}
+
+	tracefile_put (rec, n);
+	tracefile_next_pc = addr + len;
+}
+
+
+/**
+ * Record a write of VAL to the absolute address ADDR.
+ */
+void
+tracefile_write (absolute_address_t addr, U8 val)
+{
+	U8 rec[16];
+	unsigned int n = 1;
+
+	if (!tracefile_enabled)
+		return;
+	rec[0] = TRACE_WRITE;
+	n += trace_put_signed (rec + n, (long)(addr - tracefile_last_write));
+	rec[n++] = val;
+	tracefile_put (rec, n);
+	tracefile_last_write = addr;
+}
+
+
+/**
+ * Start recording, if --trace-file was given.  The JIT is turned off,
+ * as translated code is not recorded.  For --trace-writes, the direct
+ * write pointers are recomputed so that every write goes through
+ * cpu_write8.
+ */
+void
+tracefile_init (void)
+{
+	struct trace_ring *ring;
+	unsigned long long start = get_cycles ();
+	U8 header[16];
+	unsigned int k;
+
+	if (!tracefile_name)
+		return;
+
+	ring = calloc (1, sizeof (struct trace_ring));
+	if ((ring->fp = fopen (tracefile_name, "wb")) == NULL)
+	{
+		fprintf (stderr, "m6809-run: cannot write %s\n", tracefile_name);
+		free (ring);
+		return;
+	}
+
+	memcpy (header, TRACE_MAGIC, 8);
+	header[8] = TRACE_VERSION;
+	header[9] = (tracefile_regs ? TRACE_HAS_REGS : 0)
+		| (tracefile_writes ? TRACE_HAS_WRITES : 0);
+	fwrite (header, 1, 10, ring->fp);
+	for (k = 0; k < 8; k++)
+		putc ((start >> (k * 8)) & 0xFF, ring->fp);
+
+	if (pthread_create (&ring->thread, NULL, tracefile_writer, ring))
+	{
+		fprintf (stderr, "m6809-run: cannot start the trace writer\n");
+		fclose (ring->fp);
+		free (ring);
+		return;
+	}
+
+	tracefile_ring = ring;
+	tracefile_limit = TRACE_RING_SIZE;
+	tracefile_pending = 0;
+	tracefile_next_pc = 0;
+	tracefile_last_write = 0;
+	for (k = 0; k < TRACE_NREGS; k++)
+		tracefile_last_regs[k] = ~0U;
+	tracefile_enabled = 1;
+	jit_enabled = 0;
+	if (tracefile_writes)
+		bus_fast_update (0, NUM_BUS_MAPS);
+}
+
+
+/**
+ * Stop recording at the end of the simulation, and wait for the
+ * writer to finish the file.
+ */
+void
+tracefile_close (void)
+{
+	struct trace_ring *ring = tracefile_ring;
+	U8 end = TRACE_END;
+
+	if (!ring)
+		return;
+	tracefile_put (&end, 1);
+	tracefile_enabled = 0;
+	__atomic_store_n (&ring->done, 1, __ATOMIC_RELEASE);
+	pthread_join (ring->thread, NULL);
+	fclose (ring->fp);
+	free (ring);
+	tracefile_ring = NULL;
+	if (tracefile_writes)
+		bus_fast_update (0, NUM_BUS_MAPS);
+}
+
+
+static int
+trace_get_number (FILE *fp, unsigned long long *vp)
+{
+	unsigned long long v = 0;
+	unsigned int shift = 0;
+	int c;
+
+	do {
+		if ((c = getc (fp)) == EOF)
+			return -1;
+		v |= (unsigned long long)(c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	*vp = v;
+	return 0;
+}
+
+
+static int
+trace_get_signed (FILE *fp, long *vp)
+{
+	unsigned long long v;
+
+	if (trace_get_number (fp, &v))
+		return -1;
+	*vp = (v & 1) ? ~(long)(v >> 1) : (long)(v >> 1);
+	return 0;
+}
+
+
+/**
+ * Print the trace in FILENAME.  Returns the exit status.
+ */
+int
+tracefile_decode (const char *filename)
+{
+	FILE *fp;
+	U8 header[10], bytes[5];
+	unsigned long long cycles = 0, delta, insns = 0;
+	absolute_address_t pc = 0, write_addr = 0;
+	unsigned int regs[TRACE_NREGS];
+	unsigned int k, len, mask;
+	long distance;
+	unsigned long offset;
+	int tag, c;
+	const char *name;
+
+	if ((fp = fopen (filename, "rb")) == NULL)
+	{
+		fprintf (stderr, "m6809-run: cannot read %s\n", filename);
+		return 1;
+	}
+	if (fread (header, 1, 10, fp) != 10 || memcmp (header, TRACE_MAGIC, 8)
+		|| header[8] != TRACE_VERSION)
+	{
+		fprintf (stderr, "m6809-run: %s is not a trace file\n", filename);
+		fclose (fp);
+		return 1;
+	}
+	for (k = 0; k < 8; k++)
+		cycles |= (unsigned long long)(getc (fp) & 0xFF) << (k * 8);
+	memset (regs, 0, sizeof (regs));
+
+	while ((tag = getc (fp)) != EOF && tag != TRACE_END)
+	{
+		if (tag == TRACE_WRITE)
+		{
+			if (trace_get_signed (fp, &distance) || (c = getc (fp)) == EOF)
+				break;
+			write_addr += distance;
+			printf ("%34s%02lX:0x%04lX = %02X", "", write_addr >> 28,
+				write_addr & 0xFFFFFF, c);
+			name = sym_lookup_offset (&program_symtab, write_addr, &offset);
+			if (name && offset)
+				printf ("  <%s+%lu>", name, offset);
+			else if (name)
+				printf ("  <%s>", name);
+			putchar ('\n');
+			continue;
+		}
+		if (tag > TRACE_WRITE)
+			break;
+
+		len = tag & TRACE_LEN;
+		if (tag & TRACE_JUMP)
+		{
+			if (trace_get_signed (fp, &distance))
+				break;
+			pc += distance;
+		}
+		if (trace_get_number (fp, &delta) || fread (bytes, 1, len, fp) != len)
+			break;
+		cycles += delta;
+
+		if (tag & TRACE_REGS)
+		{
+			mask = getc (fp);
+			for (k = 0; k < TRACE_NREGS; k++)
+				if (mask & (1 << k))
+				{
+					regs[k] = getc (fp);
+					if (k >= 4)
+						regs[k] = (regs[k] << 8) | getc (fp);
+				}
+		}
+
+		printf ("%12llu  ", cycles);
+		print_addr (pc);
+		printf (" : ");
+		dasm_bytes = bytes;
+		print_insn (pc);
+		dasm_bytes = NULL;
+		if (header[9] & TRACE_HAS_REGS)
+		{
+			printf ("\t");
+			for (k = 0; k < TRACE_NREGS; k++)
+				printf (k >= 4 ? " %s=%04X" : " %s=%02X",
+					trace_reg_names[k], regs[k]);
+		}
+		putchar ('\n');
+		pc += len;
+		insns++;
+	}
+
+	if (tag != TRACE_END)
+		fprintf (stderr, "m6809-run: %s is truncated\n", filename);
+	printf ("%llu instructions\n", insns);
+	fclose (fp);
+	return 0;
+}
@@ -154,15 +154,17 @@ struct wpc_asic
 	int curr_sw;
 	int curr_sw_time;
 	int wdog_timer;
-} the_wpc;
+};
+
+INSTANCE struct wpc_asic the_wpc;
 
 
-struct wpc_asic *wpc = NULL;
+INSTANCE struct wpc_asic *wpc = NULL;
 
-int wpc_sock;
+INSTANCE int wpc_sock;
 
 
-static int wpc_console_inited = 0;
+static INSTANCE int wpc_console_inited = 0;
 
 static U8 wpc_get_console_state (void)
 {
@@ -191,22 +193,20 @@ static U8 wpc_get_console_state (void)
 
 static U8 wpc_console_read (void)
 {
-	int rc;
-	U8 c = 0;
-
 	if (!wpc_console_inited)
 	{
 		wpc_console_inited = 1;
 		return 0;
 	}
 
-	rc = read (0, &c, 1);
-	return c;
+	return input_getc ();
 }
 
 
 static void wpc_console_write (U8 val)
 {
+	if (reverse_running)
+		return;
 	putchar (val);
 	fflush (stdout);
 }
@@ -288,9 +288,9 @@ void wpc_dmd_set_visible (U8 val)
 	struct wpc_message msg;
 	int rc;
 	int i, n;
-	static unsigned long last_firq_time = 0;
+	static INSTANCE unsigned long last_firq_time = 0;
 	unsigned long now;
-	static int no_change_count = 0;
+	static INSTANCE int no_change_count = 0;
 
 	now = get_cycles ();
 	if (now - last_firq_time <= 1850 * 8)
@@ -351,19 +351,10 @@ void wpc_dmd_set_visible (U8 val)
 
 void wpc_keypoll (void)
 {
-	fd_set fds;
-	struct timeval timeout;
-	int rc;
-	unsigned char c;
+	int c;
 
-	FD_ZERO (&fds);
-	FD_SET (0, &fds);
-
-	timeout.tv_sec = 0;
-	timeout.tv_usec = 0;
-	if (select (1, &fds, NULL, NULL, &timeout))
+	if (input_poll () && (c = input_getc ()) != EOF)
 	{
-		rc = read (0, &c, 1);
 
 #define BUTTON_DURATION 200
 		switch (c)
@@ -625,11 +616,40 @@ void wpc_asic_reset (struct hw_device *dev)
 }
 
 
+void wpc_asic_state (struct hw_device *dev)
+{
+	unsigned int shiftaddr = wpc->shiftaddr;
+	unsigned int shiftbit = wpc->shiftbit;
+
+	state_data (&wpc->led, 1);
+	state_data (&wpc->rombank, 1);
+	state_data (&wpc->ram_unlocked, 1);
+	state_data (&wpc->ram_lock_size, 1);
+	state_uint (&shiftaddr);
+	state_uint (&shiftbit);
+	wpc->shiftaddr = shiftaddr;
+	wpc->shiftbit = shiftbit;
+	state_data (&wpc->lamp_strobe, 1);
+	state_data (wpc->lamp_mx, sizeof (wpc->lamp_mx));
+	state_data (wpc->sols, sizeof (wpc->sols));
+	state_data (&wpc->switch_strobe, 1);
+	state_data (wpc->switch_mx, sizeof (wpc->switch_mx));
+	state_data (wpc->opto_mx, sizeof (wpc->opto_mx));
+	state_data (wpc->dmd_maps, sizeof (wpc->dmd_maps));
+	state_uint (&wpc->dmd_phase);
+	state_data (wpc->dmd_visibles, sizeof (wpc->dmd_visibles));
+	state_data (wpc->dmd_last_visibles, sizeof (wpc->dmd_last_visibles));
+	state_uint ((unsigned int *)&wpc->curr_sw);
+	state_uint ((unsigned int *)&wpc->curr_sw_time);
+	state_uint ((unsigned int *)&wpc->wdog_timer);
+}
+
 struct hw_class wpc_asic_class =
 {
 	.reset = wpc_asic_reset,
 	.read = wpc_asic_read,
 	.write = wpc_asic_write,
+	.state = wpc_asic_state,
 };
 
 struct hw_device *wpc_asic_create (void)